@@ -59,6 +59,9 @@ QString SettingsNames::imapStartOffline = QLatin1String("imap.offline");
 QString SettingsNames::imapEnableId = QLatin1String("imap.enableId");
 QString SettingsNames::imapSslPemCertificate = QLatin1String("imap.ssl.pemCertificate");
 QString SettingsNames::imapBlacklistedCapabilities = QLatin1String("imap.capabilities.blacklist");
+QString SettingsNames::imapBackgroundSyncConnections = QLatin1String("imap.backgroundSync.connections");
+QString SettingsNames::imapFlagsSyncWindow = QLatin1String("imap.flagsSyncWindow");
+QString SettingsNames::imapReconnectDelay = QLatin1String("imap.reconnectDelay");
 QString SettingsNames::composerSaveToImapKey = QLatin1String("composer/saveToImapEnabled");
 QString SettingsNames::composerImapSentKey = QLatin1String("composer/imapSentName");
 QString SettingsNames::cacheMetadataKey = QLatin1String("offline.metadataCache");
@@ -68,12 +71,14 @@ QString SettingsNames::cacheOfflineNone = QLatin1String("memory");
 QString SettingsNames::cacheOfflineXDays = QLatin1String("days");
 QString SettingsNames::cacheOfflineAll = QLatin1String("all");
 QString SettingsNames::cacheOfflineNumberDaysKey = QLatin1String("offline.cache.numDays");
+QString SettingsNames::cacheOfflineSizeLimitKey = QLatin1String("offline.cache.sizeLimit");
 QString SettingsNames::xtConnectCacheDirectory = QLatin1String("xtconnect.cachedir");
 QString SettingsNames::xtSyncMailboxList = QLatin1String("xtconnect.listOfMailboxes");
 QString SettingsNames::xtDbHost = QLatin1String("xtconnect.db.hostname");
 QString SettingsNames::xtDbPort = QLatin1String("xtconnect.db.port");
 QString SettingsNames::xtDbDbName = QLatin1String("xtconnect.db.dbname");
 QString SettingsNames::xtDbUser = QLatin1String("xtconnect.db.username");
+QString SettingsNames::xtMemoryCacheLimit = QLatin1String("xtconnect.memoryCacheLimit");
 QString SettingsNames::guiMsgListShowThreading = QLatin1String("gui/msgList.showThreading");
 QString SettingsNames::guiMsgListHideRead = QLatin1String("gui/msgList.hideRead");
 QString SettingsNames::guiMailboxListShowOnlySubscribed = QLatin1String("gui/mailboxList.showOnlySubscribed");
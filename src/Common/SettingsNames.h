@@ -34,12 +34,14 @@ struct SettingsNames {
            sendmailKey, sendmailDefaultCmd;
     static QString imapMethodKey, methodTCP, methodSSL, methodProcess, imapHostKey,
            imapPortKey, imapStartTlsKey, imapUserKey, imapPassKey, imapProcessKey,
-           imapStartOffline, imapEnableId, imapSslPemCertificate, imapBlacklistedCapabilities;
+           imapStartOffline, imapEnableId, imapSslPemCertificate, imapBlacklistedCapabilities,
+           imapBackgroundSyncConnections, imapFlagsSyncWindow, imapReconnectDelay;
     static QString composerSaveToImapKey, composerImapSentKey, smtpUseBurlKey;
     static QString cacheMetadataKey, cacheMetadataMemory,
-           cacheOfflineKey, cacheOfflineNone, cacheOfflineXDays, cacheOfflineAll, cacheOfflineNumberDaysKey;
+           cacheOfflineKey, cacheOfflineNone, cacheOfflineXDays, cacheOfflineAll, cacheOfflineNumberDaysKey,
+           cacheOfflineSizeLimitKey;
     static QString xtConnectCacheDirectory, xtSyncMailboxList, xtDbHost, xtDbPort,
-           xtDbDbName, xtDbUser;
+           xtDbDbName, xtDbUser, xtMemoryCacheLimit;
     static QString guiMsgListShowThreading;
     static QString guiMsgListHideRead;
     static QString guiMailboxListShowOnlySubscribed;
@@ -25,6 +25,7 @@
 #include <QApplication>
 #include <QCheckBox>
 #include <QFrame>
+#include <QLabel>
 #include <QMenu>
 #include <QTimer>
 #include <QToolButton>
@@ -37,7 +38,7 @@
 namespace Gui {
 
 MessageListWidget::MessageListWidget(QWidget *parent) :
-    QWidget(parent), m_supportsFuzzySearch(false)
+    QWidget(parent), m_supportsFuzzySearch(false), m_firstResultLatency(-1), m_searchPending(false)
 {
     tree = new MsgListView(this);
 
@@ -48,7 +49,7 @@ MessageListWidget::MessageListWidget(QWidget *parent) :
     m_queryPlaceholder = tr("<query>");
 
     connect(m_quickSearchText, SIGNAL(returnPressed()), this, SLOT(slotApplySearch()));
-    connect(m_quickSearchText, SIGNAL(textChanged(QString)), this, SLOT(slotConditionalSearchReset()));
+    connect(m_quickSearchText, SIGNAL(textChanged(QString)), this, SLOT(slotSearchTextChanged()));
     connect(m_quickSearchText, SIGNAL(cursorPositionChanged(int, int)), this, SLOT(slotUpdateSearchCursor()));
 
     m_searchOptions = new QToolButton(this);
@@ -99,6 +100,12 @@ MessageListWidget::MessageListWidget(QWidget *parent) :
     hlayout->setContentsMargins(0, 0, 0, 0);
     hlayout->addWidget(m_searchOptions);
     hlayout->addStretch();
+    m_searchLatency = new QLabel(m_quickSearchText);
+    //: a debugging aid in the quick search field measuring the time since the last keystroke
+    m_searchLatency->setToolTip(tr("Time till the first result was shown / till the complete result was shown"));
+    m_searchLatency->setEnabled(false);
+    m_searchLatency->hide();
+    hlayout->addWidget(m_searchLatency);
     hlayout->addWidget(m_quickSearchText->clearButton());
     hlayout->activate(); // this processes the layout and ensures the toolbutton has it's final dimensions
 #if QT_VERSION >= QT_VERSION_CHECK(5, 0, 0)
@@ -116,16 +123,31 @@ MessageListWidget::MessageListWidget(QWidget *parent) :
     layout->addWidget(m_quickSearchText);
     layout->addWidget(tree);
 
-    m_searchResetTimer = new QTimer(this);
-    m_searchResetTimer->setSingleShot(true);
-    connect(m_searchResetTimer, SIGNAL(timeout()), SLOT(slotApplySearch()));
+    m_searchDelayTimer = new QTimer(this);
+    m_searchDelayTimer->setSingleShot(true);
+    connect(m_searchDelayTimer, SIGNAL(timeout()), SLOT(slotDelayedSearch()));
 
     slotAutoEnableDisableSearch();
 }
 
 void MessageListWidget::slotApplySearch()
 {
-    emit requestingSearch(searchConditions());
+    m_searchDelayTimer->stop();
+    if (m_searchStarted.isNull())
+        m_searchStarted.start();
+    m_firstResultLatency = -1;
+    m_searchPending = true;
+    m_lastSearchConditions = searchConditions();
+    emit requestingSearch(m_lastSearchConditions);
+}
+
+void MessageListWidget::slotDelayedSearch()
+{
+    // Typing something and deleting it again shall not result in asking the server once again
+    if (searchConditions() != m_lastSearchConditions)
+        slotApplySearch();
+    else
+        m_searchStarted = QTime();
 }
 
 void MessageListWidget::slotAutoEnableDisableSearch()
@@ -146,6 +168,12 @@ void MessageListWidget::slotAutoEnableDisableSearch()
 
 void MessageListWidget::slotSortingFailed()
 {
+    if (m_searchPending) {
+        m_searchPending = false;
+        m_searchStarted = QTime();
+        m_searchLatency->setText(tr("failed"));
+    }
+
     QPalette pal = m_quickSearchText->palette();
     pal.setColor(m_quickSearchText->backgroundRole(), Qt::red);
     pal.setColor(m_quickSearchText->foregroundRole(), Qt::white);
@@ -158,12 +186,40 @@ void MessageListWidget::slotResetSortingFailed()
     m_quickSearchText->setPalette(QPalette());
 }
 
-void MessageListWidget::slotConditionalSearchReset()
+void MessageListWidget::slotSortingApplied(const bool isFinal)
 {
-    if (m_quickSearchText->text().isEmpty())
-        m_searchResetTimer->start(250);
-    else
-        m_searchResetTimer->stop();
+    if (!m_searchPending)
+        return;
+
+    const int elapsed = m_searchStarted.elapsed();
+    if (!isFinal) {
+        m_firstResultLatency = elapsed;
+        m_searchLatency->setText(tr("%1 ms / ...").arg(elapsed));
+        return;
+    }
+
+    m_searchLatency->setText(tr("%1 ms / %2 ms").arg(m_firstResultLatency == -1 ? elapsed : m_firstResultLatency).arg(elapsed));
+    m_searchPending = false;
+    m_searchStarted = QTime();
+}
+
+void MessageListWidget::setSearchLatencyVisible(bool visible)
+{
+    m_searchLatency->setVisible(visible);
+}
+
+void MessageListWidget::slotSearchTextChanged()
+{
+    m_searchStarted.start();
+    if (m_quickSearchText->text().isEmpty()) {
+        m_searchDelayTimer->start(250);
+    } else if (!m_quickSearchText->text().startsWith(QLatin1String(":="))) {
+        // Search as you type, but only after a pause, so that each keystroke doesn't result in a new search.  The raw IMAP
+        // queries are only sent after the user confirms them, as they are likely invalid while still being written.
+        m_searchDelayTimer->start(400);
+    } else {
+        m_searchDelayTimer->stop();
+    }
 }
 
 void MessageListWidget::slotUpdateSearchCursor()
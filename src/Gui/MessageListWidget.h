@@ -23,9 +23,11 @@
 #ifndef MESSAGELISTWIDGET_H
 #define MESSAGELISTWIDGET_H
 
+#include <QTime>
 #include <QWidget>
 
 class LineEdit;
+class QLabel;
 class QTimer;
 class QToolButton;
 
@@ -50,14 +52,20 @@ public:
 signals:
     void requestingSearch(const QStringList &conditions);
 
+public slots:
+    /** @short Show how long it took from the last keystroke till the search result was displayed */
+    void setSearchLatencyVisible(bool visible);
+
 protected slots:
     void slotApplySearch();
     void slotAutoEnableDisableSearch();
     void slotSortingFailed();
+    void slotSortingApplied(const bool isFinal);
 
 private slots:
     void slotComplexSearchInput(QAction*);
-    void slotConditionalSearchReset();
+    void slotSearchTextChanged();
+    void slotDelayedSearch();
     void slotDeActivateSimpleSearch();
     void slotResetSortingFailed();
     void slotUpdateSearchCursor();
@@ -71,8 +79,18 @@ private:
     QAction *m_searchInRecipients;
     QAction *m_searchFuzzy;
     bool m_supportsFuzzySearch;
-    QTimer *m_searchResetTimer;
+    /** @short Starts the search once the user stops typing for a while */
+    QTimer *m_searchDelayTimer;
     QString m_queryPlaceholder;
+    /** @short Conditions of the last search which was requested */
+    QStringList m_lastSearchConditions;
+    QLabel *m_searchLatency;
+    /** @short Time of the last change of the search text */
+    QTime m_searchStarted;
+    /** @short Time till the first, possibly incomplete, result was shown, or -1 */
+    int m_firstResultLatency;
+    /** @short Is the result of a search requested by us being waited for? */
+    bool m_searchPending;
 };
 
 }
@@ -437,6 +437,7 @@ CachePage::CachePage(QWidget *parent, QSettings &s): QScrollArea(parent), Ui_Cac
     }
 
     offlineNumberOfDays->setValue(s.value(SettingsNames::cacheOfflineNumberDaysKey, QVariant(30)).toInt());
+    offlineSizeLimit->setValue(s.value(SettingsNames::cacheOfflineSizeLimitKey, QVariant(0)).toInt());
 
     updateWidgets();
     connect(offlineNope, SIGNAL(clicked()), this, SLOT(updateWidgets()));
@@ -454,6 +455,7 @@ void CachePage::resizeEvent(QResizeEvent *event)
 void CachePage::updateWidgets()
 {
     offlineNumberOfDays->setEnabled(offlineXDays->isChecked());
+    offlineSizeLimit->setEnabled(!offlineNope->isChecked());
 }
 
 void CachePage::save(QSettings &s)
@@ -468,6 +470,7 @@ void CachePage::save(QSettings &s)
         s.setValue(SettingsNames::cacheOfflineKey, SettingsNames::cacheOfflineNone);
 
     s.setValue(SettingsNames::cacheOfflineNumberDaysKey, offlineNumberOfDays->value());
+    s.setValue(SettingsNames::cacheOfflineSizeLimitKey, offlineSizeLimit->value());
 }
 
 OutgoingPage::OutgoingPage(QWidget *parent, QSettings &s): QScrollArea(parent), Ui_OutgoingPage()
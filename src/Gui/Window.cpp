@@ -45,7 +45,6 @@
 #include "Common/PortNumbers.h"
 #include "Common/SettingsNames.h"
 #include "Composer/SenderIdentitiesModel.h"
-#include "Imap/Model/CombinedCache.h"
 #include "Imap/Model/MailboxModel.h"
 #include "Imap/Model/MailboxTree.h"
 #include "Imap/Model/MemoryCache.h"
@@ -54,6 +53,7 @@
 #include "Imap/Model/MsgListModel.h"
 #include "Imap/Model/PrettyMailboxModel.h"
 #include "Imap/Model/PrettyMsgListModel.h"
+#include "Imap/Model/ThreadedCache.h"
 #include "Imap/Model/ThreadingMsgListModel.h"
 #include "Imap/Model/Utils.h"
 #include "Imap/Network/FileDownloadManager.h"
@@ -215,6 +215,11 @@ void MainWindow::createActions()
     connect(showImapLogger, SIGNAL(toggled(bool)), imapLoggerDock, SLOT(setVisible(bool)));
     connect(imapLoggerDock, SIGNAL(visibilityChanged(bool)), showImapLogger, SLOT(setChecked(bool)));
 
+    //: a debugging tool measuring the time from typing into the quick search till the result is shown
+    showSearchLatency = new QAction(tr("Show &search latency"), this);
+    showSearchLatency->setCheckable(true);
+    connect(showSearchLatency, SIGNAL(toggled(bool)), msgListWidget, SLOT(setSearchLatencyVisible(bool)));
+
     //: file to save the debug log into
     logPersistent = new QAction(tr("Log &into %1").arg(Imap::Mailbox::persistentLogFileName()), this);
     logPersistent->setCheckable(true);
@@ -438,6 +443,7 @@ void MainWindow::createMenus()
     debugMenu->addAction(showFullView);
     debugMenu->addAction(showTaskView);
     debugMenu->addAction(showImapLogger);
+    debugMenu->addAction(showSearchLatency);
     debugMenu->addAction(logPersistent);
     debugMenu->addAction(showImapCapabilities);
     imapMenu->addSeparator();
@@ -616,22 +622,30 @@ void MainWindow::setupModels()
     if (! shouldUsePersistentCache) {
         cache = new Imap::Mailbox::MemoryCache(this);
     } else {
-        cache = new Imap::Mailbox::CombinedCache(this, QLatin1String("trojita-imap-cache"), cacheDir);
+        cache = new Imap::Mailbox::ThreadedCache(this, QLatin1String("trojita-imap-cache"), cacheDir);
         connect(cache, SIGNAL(error(QString)), this, SLOT(cacheError(QString)));
-        if (! static_cast<Imap::Mailbox::CombinedCache *>(cache)->open()) {
+        if (! static_cast<Imap::Mailbox::ThreadedCache *>(cache)->open()) {
             // Error message was already shown by the cacheError() slot
             cache->deleteLater();
             cache = new Imap::Mailbox::MemoryCache(this);
         } else {
-            if (s.value(SettingsNames::cacheOfflineKey).toString() == SettingsNames::cacheOfflineAll) {
-                cache->setRenewalThreshold(0);
-            } else {
+            int days = 0;
+            if (s.value(SettingsNames::cacheOfflineKey).toString() != SettingsNames::cacheOfflineAll) {
                 bool ok;
-                int num = s.value(SettingsNames::cacheOfflineNumberDaysKey, 30).toInt(&ok);
+                days = s.value(SettingsNames::cacheOfflineNumberDaysKey, 30).toInt(&ok);
                 if (!ok)
-                    num = 30;
-                cache->setRenewalThreshold(num);
+                    days = 30;
             }
+            // The size limit is in megabytes
+            const qint64 maxBytes = s.value(SettingsNames::cacheOfflineSizeLimitKey, 0).toLongLong() * 1024 * 1024;
+            // The date of the last access is only as precise as the renewal threshold, so it has to be much shorter than
+            // the period after which the messages expire
+            if (days)
+                cache->setRenewalThreshold(qMax(1, days / 10));
+            else
+                cache->setRenewalThreshold(maxBytes ? 1 : 0);
+            cache->setCacheBudget(maxBytes, days);
+            connect(cache, SIGNAL(evicted(qint64)), this, SLOT(cacheEvicted(qint64)));
         }
     }
     model = new Imap::Mailbox::Model(this, cache, factory, taskFactory, s.value(SettingsNames::imapStartOffline).toBool());
@@ -640,6 +654,14 @@ void MainWindow::setupModels()
     if (s.value(SettingsNames::imapEnableId, true).toBool()) {
         model->setProperty("trojita-imap-enable-id", true);
     }
+    model->setProperty("trojita-imap-flags-sync-window", s.value(SettingsNames::imapFlagsSyncWindow, 1000).toInt());
+    if (s.contains(SettingsNames::imapReconnectDelay)) {
+        // Reconnecting silently after a lost connection is opt-in
+        model->setProperty("trojita-imap-reconnect-delay", s.value(SettingsNames::imapReconnectDelay).toInt());
+    }
+    if (s.contains(SettingsNames::imapBackgroundSyncConnections)) {
+        model->setProperty("trojita-imap-background-sync-connections", s.value(SettingsNames::imapBackgroundSyncConnections).toInt());
+    }
     mboxModel = new Imap::Mailbox::MailboxModel(this, model);
     mboxModel->setObjectName(QLatin1String("mboxModel"));
     prettyMboxModel = new Imap::Mailbox::PrettyMailboxModel(this, mboxModel);
@@ -650,6 +672,7 @@ void MainWindow::setupModels()
     threadingMsgListModel->setObjectName(QLatin1String("threadingMsgListModel"));
     threadingMsgListModel->setSourceModel(msgListModel);
     connect(threadingMsgListModel, SIGNAL(sortingFailed()), msgListWidget, SLOT(slotSortingFailed()));
+    connect(threadingMsgListModel, SIGNAL(sortingApplied(bool)), msgListWidget, SLOT(slotSortingApplied(bool)));
     prettyMsgListModel = new Imap::Mailbox::PrettyMsgListModel(this);
     prettyMsgListModel->setSourceModel(threadingMsgListModel);
     prettyMsgListModel->setObjectName(QLatin1String("prettyMsgListModel"));
@@ -980,6 +1003,14 @@ void MainWindow::cacheError(const QString &message)
         model->setCache(new Imap::Mailbox::MemoryCache(model));
 }
 
+void MainWindow::cacheEvicted(const qint64 bytes)
+{
+    const uint shownBytes = static_cast<uint>(qMin<qint64>(bytes, 0xffffffff));
+    statusBar()->showMessage(tr("Removed %1 of old data from the offline cache")
+                             .arg(Imap::Mailbox::PrettySize::prettySize(shownBytes, Imap::Mailbox::PrettySize::WITH_BYTES_SUFFIX)),
+                             10000);
+}
+
 void MainWindow::networkPolicyOffline()
 {
     netOffline->setChecked(true);
@@ -1883,12 +1914,6 @@ void MainWindow::slotHideRead()
 
 void MainWindow::slotCapabilitiesUpdated(const QStringList &capabilities)
 {
-    if (capabilities.contains(QLatin1String("SORT"))) {
-        m_actionSortByDate->actionGroup()->setEnabled(true);
-    } else {
-        m_actionSortByDate->actionGroup()->setEnabled(false);
-    }
-
     msgListWidget->setFuzzySearchSupported(capabilities.contains(QLatin1String("SEARCH=FUZZY")));
 
     m_actionShowOnlySubscribed->setEnabled(capabilities.contains(QLatin1String("LIST-EXTENDED")));
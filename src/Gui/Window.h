@@ -106,6 +106,7 @@ private slots:
     void slotExpunge();
     void connectionError(const QString &message);
     void cacheError(const QString &message);
+    void cacheEvicted(const qint64 bytes);
     void authenticationRequested();
     void authenticationFailed(const QString &message);
     void sslErrors(const QList<QSslCertificate> &certificateChain, const QList<QSslError> &errors);
@@ -219,6 +220,7 @@ private:
     QAction *showFullView;
     QAction *showTaskView;
     QAction *showImapLogger;
+    QAction *showSearchLatency;
     QAction *logPersistent;
     QAction *showImapCapabilities;
     QAction *showMenuBar;
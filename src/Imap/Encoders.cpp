@@ -395,6 +395,14 @@ QByteArray quotedPrintableEncode(const QByteArray &raw)
     return KCodecs::quotedPrintableEncode(raw);
 }
 
+QString decodeTextPartForIndex(const QByteArray &data, const QString &charset, const QString &mimeType)
+{
+    QString text = decodeByteArray(data, charset);
+    if (mimeType == QLatin1String("text/html"))
+        text.replace(QRegExp(QLatin1String("<[^>]*>")), QLatin1String(" "));
+    return text;
+}
+
 
 QByteArray quotedString( const QByteArray& unquoted, QuotedStringStyle style )
 {
@@ -52,6 +52,12 @@ QString decodeImapFolderName(const QByteArray &raw);
 QByteArray quotedPrintableDecode(const QByteArray &raw);
 QByteArray quotedPrintableEncode(const QByteArray &raw);
 
+/** @short Convert a text/plain or text/html message part to the plain text which goes to the full-text index
+
+The transfer encoding of the @arg data shall be undone already.  The HTML markup is replaced by spaces.
+*/
+QString decodeTextPartForIndex(const QByteArray &data, const QString &charset, const QString &mimeType);
+
 QString extractRfc2231Param(const QMap<QByteArray, QByteArray> &parameters, const QByteArray &key);
 QByteArray encodeRfc2231Parameter(const QByteArray &key, const QString &value);
 
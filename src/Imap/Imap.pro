@@ -35,16 +35,20 @@ SOURCES += Parser/Parser.cpp \
     Model/PrettyMailboxModel.cpp \
     Model/MsgListModel.cpp \
     Model/ThreadingMsgListModel.cpp \
+    Model/LocalThreading.cpp \
+    Model/LocalSorting.cpp \
     Model/PrettyMsgListModel.cpp \
     Model/MailboxTree.cpp \
     Model/MemoryCache.cpp \
     Model/SQLCache.cpp \
-    Model/DiskPartCache.cpp \
+    Model/PackPartCache.cpp \
     Model/CombinedCache.cpp \
+    Model/ThreadedCache.cpp \
     Model/Utils.cpp \
     Model/TaskFactory.cpp \
     Model/DelayedPopulation.cpp \
     Model/ParserState.cpp \
+    Model/BackgroundSyncScheduler.cpp \
     Tasks/ImapTask.cpp \
     Tasks/FetchMsgPartTask.cpp \
     Tasks/FetchMsgMetadataTask.cpp \
@@ -107,12 +111,15 @@ HEADERS += Parser/Parser.h \
     Model/PrettyMailboxModel.h \
     Model/MsgListModel.h \
     Model/ThreadingMsgListModel.h \
+    Model/LocalThreading.h \
+    Model/LocalSorting.h \
     Model/PrettyMsgListModel.h \
     Model/MailboxTree.h \
     Model/MemoryCache.h \
     Model/SQLCache.h \
-    Model/DiskPartCache.h \
+    Model/PackPartCache.h \
     Model/CombinedCache.h \
+    Model/ThreadedCache.h \
     Model/Cache.h \
     Model/Utils.h \
     Model/TaskFactory.h \
@@ -122,6 +129,7 @@ HEADERS += Parser/Parser.h \
     Model/SubscribeUnSubscribeOperation.h \
     Model/ItemRoles.h \
     Model/ParserState.h \
+    Model/BackgroundSyncScheduler.h \
     Tasks/ImapTask.h \
     Tasks/FetchMsgPartTask.h \
     Tasks/FetchMsgMetadataTask.h \
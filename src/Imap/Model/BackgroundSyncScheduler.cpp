@@ -0,0 +1,231 @@
+/* Copyright (C) 2006 - 2013 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "BackgroundSyncScheduler.h"
+#include <QTimer>
+#include "MailboxTree.h"
+#include "Model.h"
+#include "KeepMailboxOpenTask.h"
+#include "ObtainSynchronizedMailboxTask.h"
+
+namespace Imap
+{
+namespace Mailbox
+{
+
+BackgroundSyncScheduler::BackgroundSyncScheduler(Model *model):
+    QObject(model), m_model(model), m_remainingBudget(0), m_running(false)
+{
+    m_roundTimer = new QTimer(this);
+    m_roundTimer->setSingleShot(true);
+    connect(m_roundTimer, SIGNAL(timeout()), this, SLOT(slotStartRound()));
+}
+
+int BackgroundSyncScheduler::intProperty(const char *name, const int defaultValue) const
+{
+    bool ok;
+    int res = m_model->property(name).toInt(&ok);
+    return ok ? res : defaultValue;
+}
+
+void BackgroundSyncScheduler::start()
+{
+    if (intProperty("trojita-imap-background-sync-connections", 0) <= 0)
+        return;
+
+    m_running = true;
+    if (!m_roundTimer->isActive())
+        m_roundTimer->start(intProperty("trojita-imap-background-sync-delay", 30 * 1000));
+}
+
+void BackgroundSyncScheduler::stop()
+{
+    m_running = false;
+    m_roundTimer->stop();
+    m_queue.clear();
+    m_done.clear();
+    Q_FOREACH(const Slot &slot, m_slots) {
+        if (!slot.parser)
+            continue;
+        if (slot.mailbox == m_activeMailbox && m_model->m_parsers.contains(slot.parser)) {
+            // The user is looking at this mailbox, so the connection is simply handed over to the Model
+            continue;
+        }
+        // Nobody else would ever close this connection and its tasks would keep running
+        m_model->logoutParser(slot.parser);
+    }
+    m_slots.clear();
+}
+
+void BackgroundSyncScheduler::mailboxActivated(const QString &mailbox)
+{
+    m_recentlyUsed.removeAll(mailbox);
+    m_recentlyUsed.prepend(mailbox);
+    while (m_recentlyUsed.size() > 20)
+        m_recentlyUsed.removeLast();
+
+    // The previously active mailbox no longer pins its connection
+    m_activeMailbox = mailbox;
+    if (m_running)
+        QTimer::singleShot(0, this, SLOT(slotScheduleMore()));
+}
+
+bool BackgroundSyncScheduler::ownsParser(const Parser *parser) const
+{
+    Q_FOREACH(const Slot &slot, m_slots) {
+        if (slot.parser && slot.parser == parser)
+            return true;
+    }
+    return false;
+}
+
+void BackgroundSyncScheduler::slotStartRound()
+{
+    if (!m_running)
+        return;
+
+    if (m_model->isNetworkOnline()) {
+        // Mailboxes which were left over from the previous round go right after the recently used ones; the recently used
+        // mailboxes are always re-checked because they are the most likely ones to be opened again.
+        QStringList queue = m_recentlyUsed;
+        if (m_queue.isEmpty())
+            collectSubscribedMailboxes(m_model->m_mailboxes, m_queue);
+        Q_FOREACH(const QString &mailbox, m_queue) {
+            if (!queue.contains(mailbox))
+                queue << mailbox;
+        }
+        m_queue = queue;
+        m_done.clear();
+        m_remainingBudget = intProperty("trojita-imap-background-sync-budget", 10000);
+        slotScheduleMore();
+    }
+
+    m_roundTimer->start(intProperty("trojita-imap-background-sync-period", 15 * 60 * 1000));
+}
+
+void BackgroundSyncScheduler::slotScheduleMore()
+{
+    if (!m_running || !m_model->isNetworkOnline())
+        return;
+
+    const int connections = intProperty("trojita-imap-background-sync-connections", 0);
+    while (m_slots.size() < connections)
+        m_slots << Slot();
+    for (int i = m_slots.size() - 1; i >= connections; --i) {
+        if (!m_slots[i].task)
+            m_slots.removeAt(i);
+    }
+
+    for (QList<Slot>::iterator slot = m_slots.begin(); slot != m_slots.end(); ++slot) {
+        if (slot->task && !slot->task->isFinished()) {
+            // Still busy with some other mailbox
+            continue;
+        }
+
+        if (slot->parser && (!m_model->m_parsers.contains(slot->parser) ||
+                             m_model->accessParser(slot->parser).connState == CONN_STATE_LOGOUT)) {
+            // The connection went away, a new one will have to be established
+            slot->parser = 0;
+        }
+
+        if (slot->parser && slot->mailbox == m_activeMailbox) {
+            // The user is looking at this mailbox right now, so we shall not steal the connection from them
+            continue;
+        }
+
+        TreeItemMailbox *mailbox = pickNextMailbox();
+        if (!mailbox)
+            break;
+
+        KeepMailboxOpenTask *keepTask = m_model->m_taskFactory->createKeepMailboxOpenTask(
+                    m_model, mailbox->toIndex(m_model), slot->parser);
+        Q_ASSERT(keepTask->synchronizeConn);
+        slot->parser = keepTask->parser;
+        slot->mailbox = mailbox->mailbox();
+        slot->task = keepTask->synchronizeConn;
+        connect(slot->task, SIGNAL(completed(Imap::Mailbox::ImapTask*)), this, SLOT(slotSyncFinished()));
+        connect(slot->task, SIGNAL(failed(QString)), this, SLOT(slotSyncFinished()));
+    }
+}
+
+void BackgroundSyncScheduler::slotSyncFinished()
+{
+    // Give the Model a chance to clean up after the finished task before the connection gets reused
+    QTimer::singleShot(0, this, SLOT(slotScheduleMore()));
+}
+
+TreeItemMailbox *BackgroundSyncScheduler::pickNextMailbox()
+{
+    const int fullBudget = intProperty("trojita-imap-background-sync-budget", 10000);
+    while (!m_queue.isEmpty()) {
+        const QString name = m_queue.front();
+        if (m_done.contains(name)) {
+            m_queue.removeFirst();
+            continue;
+        }
+
+        TreeItemMailbox *mailbox = m_model->findMailboxByName(name);
+        if (!mailbox || !isEligible(mailbox)) {
+            m_queue.removeFirst();
+            m_done.insert(name);
+            continue;
+        }
+
+        // The cached EXISTS is a reasonable estimate of the amount of data which the synchronization will have to transfer.
+        // A single mailbox which is larger than the whole budget is only allowed as the first one within a round.
+        int cost = qMax(1u, m_model->cache()->mailboxSyncState(name).exists());
+        if (cost > m_remainingBudget && m_remainingBudget != fullBudget) {
+            // Out of budget; the rest will have to wait for the next round
+            return 0;
+        }
+
+        m_queue.removeFirst();
+        m_done.insert(name);
+        m_remainingBudget -= cost;
+        return mailbox;
+    }
+    return 0;
+}
+
+void BackgroundSyncScheduler::collectSubscribedMailboxes(TreeItemMailbox *root, QStringList &out) const
+{
+    Q_FOREACH(TreeItem *item, root->m_children) {
+        TreeItemMailbox *mailbox = dynamic_cast<TreeItemMailbox *>(item);
+        if (!mailbox)
+            continue;
+        if (mailbox->mailboxMetadata().flags.contains(QLatin1String("\\SUBSCRIBED")))
+            out << mailbox->mailbox();
+        collectSubscribedMailboxes(mailbox, out);
+    }
+}
+
+bool BackgroundSyncScheduler::isEligible(TreeItemMailbox *mailbox) const
+{
+    if (mailbox->mailbox().isEmpty() || !mailbox->isSelectable())
+        return false;
+
+    // A mailbox which is already kept open by some connection is up-to-date anyway
+    return !mailbox->maintainingTask;
+}
+
+}
+}
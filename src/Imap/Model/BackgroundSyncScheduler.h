@@ -0,0 +1,133 @@
+/* Copyright (C) 2006 - 2013 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef IMAP_MODEL_BACKGROUNDSYNCSCHEDULER_H
+#define IMAP_MODEL_BACKGROUNDSYNCSCHEDULER_H
+
+#include <QPointer>
+#include <QSet>
+#include <QStringList>
+
+class QTimer;
+
+namespace Imap
+{
+
+class Parser;
+
+namespace Mailbox
+{
+
+class ImapTask;
+class Model;
+class TreeItemMailbox;
+
+/** @short Keep the cache of the subscribed mailboxes warm by synchronizing them on extra connections
+
+Without this helper, only the mailbox which is currently shown in the GUI gets synchronized; all other mailboxes are only
+polled through STATUS.  Switching to another mailbox therefore has to pay the full price of a SELECT, UID SEARCH and a complete
+FETCH FLAGS.
+
+The BackgroundSyncScheduler maintains a configurable number of additional connections to the IMAP server and uses them for
+opening the subscribed mailboxes one after another.  Each of them is synchronized through the usual KeepMailboxOpenTask and
+ObtainSynchronizedMailboxTask machinery, so the cached UID map, flags and the SyncState get updated.  When the user opens one
+of these mailboxes later, only the QRESYNC/CONDSTORE delta has to be transferred.
+
+The mailboxes are visited in the order of priority -- the recently used ones go first, followed by the rest of the subscribed
+mailboxes which are already known in the tree.  Each round of synchronization is limited by a "budget" which is expressed as
+the total number of messages in the mailboxes which we're allowed to synchronize.  When the budget gets exhausted, we wait for
+the next round.
+
+The following properties of the Model are used for configuration:
+
+- trojita-imap-background-sync-connections: number of extra connections; zero (the default) disables this feature
+- trojita-imap-background-sync-budget: maximal number of messages to synchronize per round, 10000 by default
+- trojita-imap-background-sync-period: delay between two rounds of synchronization in milliseconds, 15 minutes by default
+- trojita-imap-background-sync-delay: delay before the first round starts in milliseconds, 30 seconds by default
+*/
+class BackgroundSyncScheduler : public QObject
+{
+    Q_OBJECT
+public:
+    explicit BackgroundSyncScheduler(Model *model);
+
+    /** @short Start the periodic synchronization, unless disabled */
+    void start();
+    /** @short Stop scheduling any further synchronization and close the extra connections */
+    void stop();
+
+    /** @short The user has opened the specified mailbox
+
+    The mailbox is moved to the top of the list of recently used mailboxes. If one of our connections is currently keeping this
+    mailbox open, it will not be reused for other mailboxes until the user switches away.
+    */
+    void mailboxActivated(const QString &mailbox);
+
+    /** @short Return true if the passed parser is one of the connections used for background synchronization */
+    bool ownsParser(const Parser *parser) const;
+
+private slots:
+    /** @short Start a new round of synchronization */
+    void slotStartRound();
+    /** @short Assign pending mailboxes to all idle connections */
+    void slotScheduleMore();
+    /** @short One of the synchronizing tasks has finished */
+    void slotSyncFinished();
+
+private:
+    /** @short One of the extra connections */
+    struct Slot {
+        QPointer<Parser> parser;
+        QPointer<ImapTask> task;
+        QString mailbox;
+    };
+
+    /** @short Find the next mailbox which shall be synchronized and which fits into the remaining budget */
+    TreeItemMailbox *pickNextMailbox();
+    /** @short Walk the already known part of the mailbox tree and collect the subscribed mailboxes */
+    void collectSubscribedMailboxes(TreeItemMailbox *root, QStringList &out) const;
+    /** @short Is the mailbox a sensible candidate for background synchronization? */
+    bool isEligible(TreeItemMailbox *mailbox) const;
+
+    int intProperty(const char *name, const int defaultValue) const;
+
+    Model *m_model;
+    QList<Slot> m_slots;
+    QTimer *m_roundTimer;
+
+    /** @short Mailboxes in the order in which they were opened, the most recent one first */
+    QStringList m_recentlyUsed;
+    /** @short The mailbox which is currently open in the GUI */
+    QString m_activeMailbox;
+    /** @short Mailboxes which still wait for their turn during the current round */
+    QStringList m_queue;
+    /** @short Mailboxes which were already handled in the current round */
+    QSet<QString> m_done;
+    /** @short Number of messages which we are still allowed to synchronize during this round */
+    int m_remainingBudget;
+    bool m_running;
+};
+
+}
+}
+
+#endif // IMAP_MODEL_BACKGROUNDSYNCSCHEDULER_H
@@ -94,6 +94,16 @@ public:
     /** @short Set current syncing state */
     virtual void setMailboxSyncState(const QString &mailbox, const SyncState &state) = 0;
 
+    /** @short Return the message counts from the last known STATUS response for a mailbox
+
+    Unlike the mailboxSyncState(), this record is not tied to the cached UID map and is only meant for displaying the
+    number of messages before the server gets a chance to answer.  Only the EXISTS, RECENT and the count of unseen
+    messages are filled in.
+    */
+    virtual SyncState mailboxStatus(const QString &mailbox) const = 0;
+    /** @short Remember the message counts as reported by the STATUS command */
+    virtual void setMailboxStatus(const QString &mailbox, const SyncState &state) = 0;
+
     /** @short Store the mapping of sequence numbers to UIDs */
     virtual void setUidMapping(const QString &mailbox, const QList<uint> &seqToUid) = 0;
     /** @short Forget the cached seq->UID mapping for given mailbox */
@@ -109,17 +119,73 @@ public:
     /** @short Returns all known data for a message in the given mailbox (except real parts data) */
     virtual MessageDataBundle messageMetadata(const QString &mailbox, uint uid) const = 0;
     virtual void setMessageMetadata(const QString &mailbox, uint uid, const MessageDataBundle &metadata) = 0;
+    /** @short Return the metadata of those of the @arg uids which are known to the cache, indexed by their UID
+
+    This is meant for processing many messages at once, like when threading or sorting a whole mailbox locally.  Unlike
+    the messageMetadata(), it does not count as an access to the messages.
+    */
+    virtual QHash<uint, MessageDataBundle> metadataOfMessages(const QString &mailbox, const QList<uint> &uids) const = 0;
+    /** @short Start reading the metadata and flags of the @arg uids without blocking the caller
+
+    If this returns true, the messageMetadataLoaded() will be emitted once the messageMetadata() and msgFlags() of these
+    messages can be answered right away.  The default implementation returns false, which means that the caller shall
+    simply ask for them directly.
+    */
+    virtual bool loadMessageMetadata(const QString &mailbox, const QList<uint> &uids) const
+    {
+        Q_UNUSED(mailbox);
+        Q_UNUSED(uids);
+        return false;
+    }
 
     /** @short Retrieve flags for one message in a mailbox */
     virtual QStringList msgFlags(const QString &mailbox, uint uid) const = 0;
     /** @short Save flags for one message in mailbox */
     virtual void setMsgFlags(const QString &mailbox, uint uid, const QStringList &flags) = 0;
 
+    /** @short Return UIDs of the messages which have the @arg flag set, or which do not have it if @arg present is false
+
+    Only messages which are in the UID map of the mailbox and whose flags are stored in the cache are considered.  The flags
+    are compared case-insensitively.
+    */
+    virtual QList<uint> uidsWithFlag(const QString &mailbox, const QString &flag, const bool present) const = 0;
+    /** @short Return the number of messages which would be returned by uidsWithFlag() */
+    virtual uint countWithFlag(const QString &mailbox, const QString &flag, const bool present) const = 0;
+
     /** @short Return part data or a null QByteArray if none available */
     virtual QByteArray messagePart(const QString &mailbox, uint uid, const QString &partId) const = 0;
+    /** @short Start reading the part data without blocking the caller
+
+    If this returns true, the data are passed to the messagePartLoaded() later on.  The default implementation returns false,
+    which means that the caller shall use messagePart() instead.
+    */
+    virtual bool loadMessagePart(const QString &mailbox, uint uid, const QString &partId) const
+    {
+        Q_UNUSED(mailbox);
+        Q_UNUSED(uid);
+        Q_UNUSED(partId);
+        return false;
+    }
     /** @short Save data for one message part */
     virtual void setMsgPart(const QString &mailbox, uint uid, const QString &partId, const QByteArray &data) = 0;
 
+    /** @short Add the text of a message part to the full-text index
+
+    The envelope is indexed automatically by setMessageMetadata(), but the cache has no way of telling which of the parts
+    contain text, so the caller has to point them out.  The @arg data are the contents of the part with the transfer encoding
+    already undone; the conversion from the @arg charset and the stripping of HTML according to the @arg mimeType are left to
+    the cache, which might do them in the background.
+    */
+    virtual void setMsgPartText(const QString &mailbox, uint uid, const QString &partId, const QByteArray &data,
+                                const QString &charset, const QString &mimeType) = 0;
+    /** @short Return UIDs of the cached messages whose @arg field contains all words of the @arg text
+
+    The @arg field is named after the IMAP SEARCH key, i.e. one of SUBJECT, FROM, TO, CC, BCC, BODY or TEXT.  The words are
+    matched as prefixes and case-insensitively.  Messages which have not been indexed yet are never returned, which is why the
+    result shall be treated as a subset of what the IMAP server would find.  The UIDs are sorted in the ascending order.
+    */
+    virtual QList<uint> fullTextSearch(const QString &mailbox, const QString &field, const QString &text) const = 0;
+
     /** @short Return cached threading info for a given mailbox */
     virtual QVector<Imap::Responses::ThreadingNode> messageThreading(const QString &mailbox) = 0;
     /** @short Save information about how messages are threaded */
@@ -128,9 +194,35 @@ public:
     /** @short How many days is it OK not to mark entries as accessed? */
     virtual void setRenewalThreshold(const int days) = 0;
 
+    /** @short Start grouping the following modifications into a batch
+
+    The cache is free to defer the writes till the matching commitBatch(), so that the results of hundreds of FETCH responses
+    can be stored at once.  The reads which happen in between still see all previous writes.  The batches can be nested, in
+    which case only the outermost commitBatch() has an effect.
+    */
+    virtual void beginBatch() = 0;
+    /** @short Write all modifications made since the matching beginBatch(); unbalanced calls are ignored */
+    virtual void commitBatch() = 0;
+
+    /** @short Limit the amount of data kept in the cache
+
+    Messages which have not been accessed for more than @arg maxDays days are removed, and so are the least recently used
+    messages when the cache grows above @arg maxBytes bytes.  The data of the message parts go first, the metadata of the
+    messages are removed only when that is not enough.  The UID mappings and the synchronization state of the mailboxes are
+    never expired.  Zero means no limit.  The work is done incrementally in the background; the caches which do not support
+    expiration simply ignore this.
+    */
+    virtual void setCacheBudget(const qint64 maxBytes, const int maxDays) = 0;
+
 signals:
     /** @short Some cache error has occurred */
     void error(const QString &error) const;
+    /** @short The background expiration has removed approximately @arg bytes bytes of data */
+    void evicted(const qint64 bytes) const;
+    /** @short The data requested through loadMessageMetadata() are available now */
+    void messageMetadataLoaded(const QString &mailbox, const QList<uint> &uids) const;
+    /** @short The result of loadMessagePart(); a null @arg data means that the part is not cached */
+    void messagePartLoaded(const QString &mailbox, const uint uid, const QString &partId, const QByteArray &data) const;
 };
 
 }
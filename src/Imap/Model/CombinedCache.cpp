@@ -21,8 +21,24 @@
 */
 
 #include "CombinedCache.h"
-#include "DiskPartCache.h"
-#include "SQLCache.h"
+#include <climits>
+#include <QTimer>
+#include "PackPartCache.h"
+
+namespace
+{
+/** @short How long to wait after the startup before the cache expiration kicks in */
+const int expirationStartDelay = 30 * 1000;
+
+/** @short Delay between two batches of the cache expiration */
+const int expirationBatchDelay = 200;
+
+/** @short Number of messages processed in one batch of the cache expiration */
+const int expirationBatchSize = 100;
+
+/** @short How often to check whether the cache has outgrown its budget */
+const int expirationPeriod = 60 * 60 * 1000;
+}
 
 namespace Imap
 {
@@ -30,12 +46,16 @@ namespace Mailbox
 {
 
 CombinedCache::CombinedCache(QObject *parent, const QString &name, const QString &cacheDir):
-    AbstractCache(parent), name(name), cacheDir(cacheDir)
+    AbstractCache(parent), name(name), cacheDir(cacheDir), m_budgetBytes(0), m_budgetDays(0),
+    m_expirationPhase(EXPIRE_IDLE), m_expirationSize(0), m_expirationFreed(0)
 {
     sqlCache = new SQLCache(this);
     connect(sqlCache, SIGNAL(error(QString)), this, SIGNAL(error(QString)));
-    diskPartCache = new DiskPartCache(this, cacheDir);
-    connect(diskPartCache, SIGNAL(error(QString)), this, SIGNAL(error(QString)));
+    packPartCache = new PackPartCache(this, name, cacheDir);
+    connect(packPartCache, SIGNAL(error(QString)), this, SIGNAL(error(QString)));
+    m_expirationTimer = new QTimer(this);
+    m_expirationTimer->setSingleShot(true);
+    connect(m_expirationTimer, SIGNAL(timeout()), this, SLOT(expireSomeMessages()));
 }
 
 CombinedCache::~CombinedCache()
@@ -44,7 +64,7 @@ CombinedCache::~CombinedCache()
 
 bool CombinedCache::open()
 {
-    return sqlCache->open(name, cacheDir + QLatin1String("/imap.cache.sqlite"));
+    return sqlCache->open(name, cacheDir + QLatin1String("/imap.cache.sqlite")) && packPartCache->open();
 }
 
 QList<MailboxMetadata> CombinedCache::childMailboxes(const QString &mailbox) const
@@ -72,6 +92,16 @@ void CombinedCache::setMailboxSyncState(const QString &mailbox, const SyncState
     sqlCache->setMailboxSyncState(mailbox, state);
 }
 
+SyncState CombinedCache::mailboxStatus(const QString &mailbox) const
+{
+    return sqlCache->mailboxStatus(mailbox);
+}
+
+void CombinedCache::setMailboxStatus(const QString &mailbox, const SyncState &state)
+{
+    sqlCache->setMailboxStatus(mailbox, state);
+}
+
 QList<uint> CombinedCache::uidMapping(const QString &mailbox) const
 {
     return sqlCache->uidMapping(mailbox);
@@ -90,13 +120,13 @@ void CombinedCache::clearUidMapping(const QString &mailbox)
 void CombinedCache::clearAllMessages(const QString &mailbox)
 {
     sqlCache->clearAllMessages(mailbox);
-    diskPartCache->clearAllMessages(mailbox);
+    packPartCache->clearAllMessages(mailbox);
 }
 
 void CombinedCache::clearMessage(const QString mailbox, uint uid)
 {
     sqlCache->clearMessage(mailbox, uid);
-    diskPartCache->clearMessage(mailbox, uid);
+    packPartCache->clearMessage(mailbox, uid);
 }
 
 QStringList CombinedCache::msgFlags(const QString &mailbox, uint uid) const
@@ -109,6 +139,16 @@ void CombinedCache::setMsgFlags(const QString &mailbox, uint uid, const QStringL
     sqlCache->setMsgFlags(mailbox, uid, flags);
 }
 
+QList<uint> CombinedCache::uidsWithFlag(const QString &mailbox, const QString &flag, const bool present) const
+{
+    return sqlCache->uidsWithFlag(mailbox, flag, present);
+}
+
+uint CombinedCache::countWithFlag(const QString &mailbox, const QString &flag, const bool present) const
+{
+    return sqlCache->countWithFlag(mailbox, flag, present);
+}
+
 AbstractCache::MessageDataBundle CombinedCache::messageMetadata(const QString &mailbox, uint uid) const
 {
     return sqlCache->messageMetadata(mailbox, uid);
@@ -119,13 +159,18 @@ void CombinedCache::setMessageMetadata(const QString &mailbox, uint uid, const M
     sqlCache->setMessageMetadata(mailbox, uid, metadata);
 }
 
+QHash<uint, AbstractCache::MessageDataBundle> CombinedCache::metadataOfMessages(const QString &mailbox,
+                                                                                const QList<uint> &uids) const
+{
+    return sqlCache->metadataOfMessages(mailbox, uids);
+}
+
 QByteArray CombinedCache::messagePart(const QString &mailbox, uint uid, const QString &partId) const
 {
-    QByteArray res = sqlCache->messagePart(mailbox, uid, partId);
-    if (res.isEmpty()) {
-        res = diskPartCache->messagePart(mailbox, uid, partId);
-    }
-    return res;
+    // The pack cache knows which parts it has, so there's no need to try both of them
+    if (packPartCache->contains(mailbox, uid, partId))
+        return packPartCache->messagePart(mailbox, uid, partId);
+    return sqlCache->messagePart(mailbox, uid, partId);
 }
 
 void CombinedCache::setMsgPart(const QString &mailbox, uint uid, const QString &partId, const QByteArray &data)
@@ -133,10 +178,21 @@ void CombinedCache::setMsgPart(const QString &mailbox, uint uid, const QString &
     if (data.size() < 1024 * 1024) {
         sqlCache->setMsgPart(mailbox, uid, partId, data);
     } else {
-        diskPartCache->setMsgPart(mailbox, uid, partId, data);
+        packPartCache->setMsgPart(mailbox, uid, partId, data);
     }
 }
 
+void CombinedCache::setMsgPartText(const QString &mailbox, uint uid, const QString &partId, const QByteArray &data,
+                                   const QString &charset, const QString &mimeType)
+{
+    sqlCache->setMsgPartText(mailbox, uid, partId, data, charset, mimeType);
+}
+
+QList<uint> CombinedCache::fullTextSearch(const QString &mailbox, const QString &field, const QString &text) const
+{
+    return sqlCache->fullTextSearch(mailbox, field, text);
+}
+
 QVector<Imap::Responses::ThreadingNode> CombinedCache::messageThreading(const QString &mailbox)
 {
     return sqlCache->messageThreading(mailbox);
@@ -152,5 +208,83 @@ void CombinedCache::setRenewalThreshold(const int days)
     sqlCache->setRenewalThreshold(days);
 }
 
+void CombinedCache::beginBatch()
+{
+    // The big parts are written right away; they are few and there's nothing to gain by grouping them
+    sqlCache->beginBatch();
+}
+
+void CombinedCache::commitBatch()
+{
+    sqlCache->commitBatch();
+}
+
+void CombinedCache::setCacheBudget(const qint64 maxBytes, const int maxDays)
+{
+    m_budgetBytes = maxBytes;
+    m_budgetDays = maxDays;
+    if (!m_budgetBytes && !m_budgetDays) {
+        m_expirationTimer->stop();
+        m_expirationPhase = EXPIRE_IDLE;
+    } else if (m_expirationPhase == EXPIRE_IDLE) {
+        m_expirationTimer->start(expirationStartDelay);
+    }
+}
+
+void CombinedCache::expireSomeMessages()
+{
+    if (!m_budgetBytes && !m_budgetDays)
+        return;
+
+    if (m_expirationPhase == EXPIRE_IDLE) {
+        m_expirationPhase = EXPIRE_PARTS;
+        m_expirationCursor = SQLCache::AccessRecord();
+        m_expirationSize = sqlCache->storedSize() + packPartCache->storedSize();
+        m_expirationFreed = 0;
+    }
+
+    const int oldestAllowed = m_budgetDays ? SQLCache::currentAccessDate() - m_budgetDays : INT_MIN;
+    const QList<SQLCache::AccessRecord> batch = sqlCache->leastRecentlyAccessed(m_expirationCursor, expirationBatchSize);
+    bool passFinished = batch.size() < expirationBatchSize;
+    Q_FOREACH(const SQLCache::AccessRecord &record, batch) {
+        if (record.lastAccess >= oldestAllowed && (!m_budgetBytes || m_expirationSize <= m_budgetBytes)) {
+            // All of the remaining messages have been accessed more recently than this one
+            passFinished = true;
+            break;
+        }
+        qint64 freed;
+        if (m_expirationPhase == EXPIRE_PARTS) {
+            freed = record.partsSize + packPartCache->messageSize(record.mailbox, record.uid);
+            if (record.partsSize)
+                sqlCache->expireMessageParts(record.mailbox, record.uid);
+            packPartCache->clearMessage(record.mailbox, record.uid);
+        } else {
+            freed = record.metadataSize;
+            sqlCache->expireMessageMetadata(record.mailbox, record.uid);
+        }
+        m_expirationSize -= freed;
+        m_expirationFreed += freed;
+        m_expirationCursor = record;
+    }
+
+    if (!passFinished) {
+        m_expirationTimer->start(expirationBatchDelay);
+        return;
+    }
+
+    if (m_expirationPhase == EXPIRE_PARTS && (m_budgetDays || m_expirationSize > m_budgetBytes)) {
+        // Removing the parts was not enough, or there are some expired messages whose metadata have to go, too
+        m_expirationPhase = EXPIRE_METADATA;
+        m_expirationCursor = SQLCache::AccessRecord();
+        m_expirationTimer->start(expirationBatchDelay);
+        return;
+    }
+
+    m_expirationPhase = EXPIRE_IDLE;
+    if (m_expirationFreed)
+        emit evicted(m_expirationFreed);
+    m_expirationTimer->start(expirationPeriod);
+}
+
 }
 }
@@ -24,6 +24,9 @@
 #define IMAP_MODEL_COMBINEDCACHE_H
 
 #include "Cache.h"
+#include "SQLCache.h"
+
+class QTimer;
 
 namespace Imap
 {
@@ -31,15 +34,19 @@ namespace Imap
 namespace Mailbox
 {
 
-class SQLCache;
-class DiskPartCache;
+class PackPartCache;
 
 
 /** @short A hybrid cache, using both SQLite and on-disk format
 
 This cache servers as a thin wrapper around the SQLCache. It uses
-the SQL facilities for most of the actual caching, but changes to
-a file-based cache when items are bigger than a certain threshold.
+the SQL facilities for most of the actual caching, but message parts
+which are bigger than a certain threshold go to the PackPartCache.
+
+The size of the cache is kept within the limits set by setCacheBudget().  Once in a while, the messages are walked through
+in the order of their last access in small batches, so that neither the GUI nor the other users of the cache have to wait
+for long.  The first pass removes the message parts and the second one, which is only needed when that was not enough,
+removes the message metadata.
 
 In future, this should be extended with an in-memory cache (but
 only after the MemoryCache rework) which should only speed-up certain
@@ -67,6 +74,9 @@ public:
     virtual SyncState mailboxSyncState(const QString &mailbox) const;
     virtual void setMailboxSyncState(const QString &mailbox, const SyncState &state);
 
+    virtual SyncState mailboxStatus(const QString &mailbox) const;
+    virtual void setMailboxStatus(const QString &mailbox, const SyncState &state);
+
     virtual void setUidMapping(const QString &mailbox, const QList<uint> &seqToUid);
     virtual void clearUidMapping(const QString &mailbox);
     virtual QList<uint> uidMapping(const QString &mailbox) const;
@@ -76,30 +86,65 @@ public:
 
     virtual MessageDataBundle messageMetadata(const QString &mailbox, uint uid) const;
     virtual void setMessageMetadata(const QString &mailbox, uint uid, const MessageDataBundle &metadata);
+    virtual QHash<uint, MessageDataBundle> metadataOfMessages(const QString &mailbox, const QList<uint> &uids) const;
 
     virtual QStringList msgFlags(const QString &mailbox, uint uid) const;
     virtual void setMsgFlags(const QString &mailbox, uint uid, const QStringList &flags);
+    virtual QList<uint> uidsWithFlag(const QString &mailbox, const QString &flag, const bool present) const;
+    virtual uint countWithFlag(const QString &mailbox, const QString &flag, const bool present) const;
 
     virtual QByteArray messagePart(const QString &mailbox, uint uid, const QString &partId) const;
     virtual void setMsgPart(const QString &mailbox, uint uid, const QString &partId, const QByteArray &data);
+    virtual void setMsgPartText(const QString &mailbox, uint uid, const QString &partId, const QByteArray &data,
+                                const QString &charset, const QString &mimeType);
+    virtual QList<uint> fullTextSearch(const QString &mailbox, const QString &field, const QString &text) const;
 
     virtual QVector<Imap::Responses::ThreadingNode> messageThreading(const QString &mailbox);
     virtual void setMessageThreading(const QString &mailbox, const QVector<Imap::Responses::ThreadingNode> &threading);
 
     virtual void setRenewalThreshold(const int days);
+    virtual void beginBatch();
+    virtual void commitBatch();
+    virtual void setCacheBudget(const qint64 maxBytes, const int maxDays);
 
     /** @short Open a connection to the cache */
     bool open();
 
+private slots:
+    /** @short Process the next batch of the cache expiration */
+    void expireSomeMessages();
+
 private:
+    typedef enum {
+        /** @short Waiting for the next run */
+        EXPIRE_IDLE,
+        /** @short Removing the message parts */
+        EXPIRE_PARTS,
+        /** @short Removing the message metadata */
+        EXPIRE_METADATA
+    } ExpirationPhase;
+
     /** @short The SQL-based cache */
     SQLCache *sqlCache;
     /** @short Cache for bigger message parts */
-    DiskPartCache *diskPartCache;
+    PackPartCache *packPartCache;
     /** @short Name of the DB connection */
     QString name;
     /** @short Directory to serve as a cache root */
     QString cacheDir;
+
+    /** @short Maximal size of the cache in bytes, or zero for no limit */
+    qint64 m_budgetBytes;
+    /** @short Number of days after which the messages which have not been accessed expire, or zero for no limit */
+    int m_budgetDays;
+    QTimer *m_expirationTimer;
+    ExpirationPhase m_expirationPhase;
+    /** @short The last message processed by the current pass of the expiration */
+    SQLCache::AccessRecord m_expirationCursor;
+    /** @short Estimated size of the cache during the current run */
+    qint64 m_expirationSize;
+    /** @short Number of bytes reclaimed so far by the current run */
+    qint64 m_expirationFreed;
 };
 
 }
@@ -0,0 +1,288 @@
+/* Copyright (C) 2006 - 2013 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "LocalSorting.h"
+#include <algorithm>
+#include "LocalThreading.h"
+
+namespace Imap
+{
+namespace Mailbox
+{
+
+namespace
+{
+
+/** @short One message in the full sort, with the key already reduced to a number */
+struct SortItem
+{
+    qint64 key;
+    uint uid;
+    int row;
+
+    bool operator<(const SortItem &other) const
+    {
+        return key < other.key || (key == other.key && uid < other.uid);
+    }
+};
+
+qint64 timestamp(const QDateTime &dateTime)
+{
+    return dateTime.isValid() ? static_cast<qint64>(dateTime.toTime_t()) : 0;
+}
+
+/** @short Replace strings by their position among all distinct values so that the full sort can compare numbers only */
+void assignRanks(const QVector<QString> &keys, QVector<SortItem> &items)
+{
+    QHash<QString, qint64> ranks;
+    ranks.reserve(keys.size() / 4);
+    for (int i = 0; i < keys.size(); ++i)
+        ranks.insert(keys[i], 0);
+
+    QVector<QString> distinct;
+    distinct.reserve(ranks.size());
+    for (QHash<QString, qint64>::const_iterator it = ranks.constBegin(); it != ranks.constEnd(); ++it)
+        distinct.append(it.key());
+    std::sort(distinct.begin(), distinct.end());
+    for (int i = 0; i < distinct.size(); ++i)
+        ranks[distinct[i]] = i;
+
+    for (int i = 0; i < keys.size(); ++i)
+        items[i].key = ranks[keys[i]];
+}
+
+}
+
+LocalSorting::LocalSorting()
+{
+}
+
+void LocalSorting::clear()
+{
+    m_uids.clear();
+    m_arrivals.clear();
+    m_dates.clear();
+    m_sizes.clear();
+    m_subjects.clear();
+    m_from.clear();
+    m_to.clear();
+    m_cc.clear();
+    m_rows.clear();
+    for (int i = 0; i < KEY_COUNT; ++i)
+        m_orders[i] = Order();
+}
+
+void LocalSorting::setMessage(const LocalSortingMessage &message)
+{
+    const qint64 arrival = timestamp(message.internalDate);
+    // RFC 5256: the INTERNALDATE is used when the Date header is missing or unparsable
+    const qint64 date = message.envelope.date.isValid() ? timestamp(message.envelope.date) : arrival;
+
+    QHash<uint, int>::const_iterator it = m_rows.constFind(message.uid);
+    const bool update = it != m_rows.constEnd();
+    int row;
+    if (update) {
+        row = *it;
+        m_arrivals[row] = arrival;
+        m_dates[row] = date;
+        m_sizes[row] = message.size;
+        m_subjects[row] = subjectKey(message.envelope.subject);
+        m_from[row] = addressKey(message.envelope.from);
+        m_to[row] = addressKey(message.envelope.to);
+        m_cc[row] = addressKey(message.envelope.cc);
+    } else {
+        row = m_uids.size();
+        m_uids.append(message.uid);
+        m_arrivals.append(arrival);
+        m_dates.append(date);
+        m_sizes.append(message.size);
+        m_subjects.append(subjectKey(message.envelope.subject));
+        m_from.append(addressKey(message.envelope.from));
+        m_to.append(addressKey(message.envelope.to));
+        m_cc.append(addressKey(message.envelope.cc));
+        m_rows.insert(message.uid, row);
+    }
+
+    for (int i = 0; i < KEY_COUNT; ++i) {
+        Order &order = m_orders[i];
+        if (!order.built)
+            continue;
+        order.pending.append(row);
+        if (update)
+            order.pendingUpdates = true;
+    }
+}
+
+QList<uint> LocalSorting::sortedUids(const Key key)
+{
+    Q_ASSERT(key >= 0 && key < KEY_COUNT);
+    Order &order = m_orders[key];
+    if (!order.built || order.pending.size() > order.rows.size() / 4) {
+        fullSort(key);
+    } else if (!order.pending.isEmpty()) {
+        mergePending(key);
+    }
+
+    QList<uint> res;
+    res.reserve(order.rows.size());
+    Q_FOREACH(const int row, order.rows) {
+        res.append(m_uids[row]);
+    }
+    return res;
+}
+
+QString LocalSorting::subjectKey(const QString &subject)
+{
+    return LocalThreading::baseSubject(subject).toLower();
+}
+
+QString LocalSorting::addressKey(const QList<Imap::Message::MailAddress> &addresses)
+{
+    if (addresses.isEmpty())
+        return QString();
+    // This is the DISPLAYFROM/DISPLAYTO of RFC 5957 because it matches what the user sees
+    const Imap::Message::MailAddress &address = addresses.front();
+    if (!address.name.isEmpty())
+        return address.name.toLower();
+    return (address.mailbox + QLatin1Char('@') + address.host).toLower();
+}
+
+bool LocalSorting::lessThan(const Key key, const int a, const int b) const
+{
+    switch (key) {
+    case KEY_ARRIVAL:
+        if (m_arrivals[a] != m_arrivals[b])
+            return m_arrivals[a] < m_arrivals[b];
+        break;
+    case KEY_DATE:
+        if (m_dates[a] != m_dates[b])
+            return m_dates[a] < m_dates[b];
+        break;
+    case KEY_SIZE:
+        if (m_sizes[a] != m_sizes[b])
+            return m_sizes[a] < m_sizes[b];
+        break;
+    case KEY_SUBJECT:
+        if (m_subjects[a] != m_subjects[b])
+            return m_subjects[a] < m_subjects[b];
+        break;
+    case KEY_FROM:
+        if (m_from[a] != m_from[b])
+            return m_from[a] < m_from[b];
+        break;
+    case KEY_TO:
+        if (m_to[a] != m_to[b])
+            return m_to[a] < m_to[b];
+        break;
+    case KEY_CC:
+        if (m_cc[a] != m_cc[b])
+            return m_cc[a] < m_cc[b];
+        break;
+    case KEY_COUNT:
+        Q_ASSERT(false);
+        break;
+    }
+    return m_uids[a] < m_uids[b];
+}
+
+void LocalSorting::fullSort(const Key key)
+{
+    QVector<SortItem> items(m_uids.size());
+    for (int i = 0; i < items.size(); ++i) {
+        items[i].uid = m_uids[i];
+        items[i].row = i;
+    }
+
+    switch (key) {
+    case KEY_ARRIVAL:
+        for (int i = 0; i < items.size(); ++i)
+            items[i].key = m_arrivals[i];
+        break;
+    case KEY_DATE:
+        for (int i = 0; i < items.size(); ++i)
+            items[i].key = m_dates[i];
+        break;
+    case KEY_SIZE:
+        for (int i = 0; i < items.size(); ++i)
+            items[i].key = m_sizes[i];
+        break;
+    case KEY_SUBJECT:
+        assignRanks(m_subjects, items);
+        break;
+    case KEY_FROM:
+        assignRanks(m_from, items);
+        break;
+    case KEY_TO:
+        assignRanks(m_to, items);
+        break;
+    case KEY_CC:
+        assignRanks(m_cc, items);
+        break;
+    case KEY_COUNT:
+        Q_ASSERT(false);
+        break;
+    }
+
+    std::sort(items.begin(), items.end());
+
+    Order &order = m_orders[key];
+    order.rows.resize(items.size());
+    for (int i = 0; i < items.size(); ++i)
+        order.rows[i] = items[i].row;
+    order.pending.clear();
+    order.pendingUpdates = false;
+    order.built = true;
+}
+
+void LocalSorting::mergePending(const Key key)
+{
+    Order &order = m_orders[key];
+
+    std::sort(order.pending.begin(), order.pending.end());
+    order.pending.erase(std::unique(order.pending.begin(), order.pending.end()), order.pending.end());
+
+    if (order.pendingUpdates) {
+        // The changed rows might have moved, so they have to be taken out of the order first
+        QVector<bool> changed(m_uids.size(), false);
+        Q_FOREACH(const int row, order.pending) {
+            changed[row] = true;
+        }
+        int target = 0;
+        for (int i = 0; i < order.rows.size(); ++i) {
+            if (!changed[order.rows[i]])
+                order.rows[target++] = order.rows[i];
+        }
+        order.rows.resize(target);
+    }
+
+    RowLessThan compare(this, key);
+    std::sort(order.pending.begin(), order.pending.end(), compare);
+    const int oldSize = order.rows.size();
+    order.rows += order.pending;
+    std::inplace_merge(order.rows.begin(), order.rows.begin() + oldSize, order.rows.end(), compare);
+
+    order.pending.clear();
+    order.pendingUpdates = false;
+}
+
+}
+}
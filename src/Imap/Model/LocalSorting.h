@@ -0,0 +1,142 @@
+/* Copyright (C) 2006 - 2013 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef IMAP_MODEL_LOCALSORTING_H
+#define IMAP_MODEL_LOCALSORTING_H
+
+#include <QHash>
+#include <QVector>
+#include "Imap/Parser/Message.h"
+
+/** @short Namespace for IMAP interaction */
+namespace Imap
+{
+
+/** @short Classes for handling of mailboxes and connections */
+namespace Mailbox
+{
+
+/** @short Data of a message which can be used for sorting */
+struct LocalSortingMessage
+{
+    uint uid;
+    Imap::Message::Envelope envelope;
+    QDateTime internalDate;
+    uint size;
+
+    LocalSortingMessage(): uid(0), size(0) {}
+};
+
+/** @short Client-side sorting of messages for servers without SORT and for the offline mode
+
+The sort keys of all messages are computed once, when the messages are added, and kept in one array per key.  The semantics
+follow RFC 5256 (with the DISPLAY extension from RFC 5957 for addresses) and the UIDs are used to break the ties.
+
+The complete ordering by each criterium is remembered after it has been computed for the first time.  Messages which are added
+or updated afterwards are sorted on their own and merged into that ordering, so that a few new arrivals in a huge mailbox do
+not require a full sort.
+*/
+class LocalSorting
+{
+public:
+    /** @short Available sort keys, see ThreadingMsgListModel::SortCriterium for their meaning */
+    typedef enum {
+        KEY_ARRIVAL,
+        KEY_CC,
+        KEY_DATE,
+        KEY_FROM,
+        KEY_SIZE,
+        KEY_SUBJECT,
+        KEY_TO,
+        KEY_COUNT /**< @short Not a real key, just the number of them */
+    } Key;
+
+    LocalSorting();
+
+    /** @short Forget about all messages */
+    void clear();
+
+    /** @short Add a message or replace the data of a message with the same UID */
+    void setMessage(const LocalSortingMessage &message);
+
+    /** @short Return UIDs of all known messages in ascending order according to the @arg key */
+    QList<uint> sortedUids(const Key key);
+
+    int size() const { return m_uids.size(); }
+    bool contains(const uint uid) const { return m_rows.contains(uid); }
+
+    static QString subjectKey(const QString &subject);
+    static QString addressKey(const QList<Imap::Message::MailAddress> &addresses);
+
+private:
+    class RowLessThan;
+    friend class RowLessThan;
+
+    /** @short Is the @arg a sorted before the @arg b? */
+    bool lessThan(const Key key, const int a, const int b) const;
+    /** @short Sort all messages from scratch */
+    void fullSort(const Key key);
+    /** @short Merge the messages which have changed since the last sort into the existing order */
+    void mergePending(const Key key);
+
+    /** @short Comparison of two rows according to a key, to be used by the STL algorithms */
+    class RowLessThan
+    {
+    public:
+        RowLessThan(const LocalSorting *sorting, const Key key): m_sorting(sorting), m_key(key) {}
+        bool operator()(const int a, const int b) const { return m_sorting->lessThan(m_key, a, b); }
+    private:
+        const LocalSorting *m_sorting;
+        Key m_key;
+    };
+
+    /** @short Precomputed ordering according to one of the keys */
+    struct Order
+    {
+        /** @short Indexes of rows in the right order; only valid if the @arg built is set */
+        QVector<int> rows;
+        /** @short Rows which were added or changed after the ordering was built */
+        QVector<int> pending;
+        /** @short Do the pending rows include some which are already present in the rows? */
+        bool pendingUpdates;
+        bool built;
+
+        Order(): pendingUpdates(false), built(false) {}
+    };
+
+    QVector<uint> m_uids;
+    QVector<qint64> m_arrivals;
+    QVector<qint64> m_dates;
+    QVector<uint> m_sizes;
+    QVector<QString> m_subjects;
+    QVector<QString> m_from;
+    QVector<QString> m_to;
+    QVector<QString> m_cc;
+    /** @short Mapping from UIDs to indexes in the arrays above */
+    QHash<uint, int> m_rows;
+    Order m_orders[KEY_COUNT];
+};
+
+}
+}
+
+#endif // IMAP_MODEL_LOCALSORTING_H
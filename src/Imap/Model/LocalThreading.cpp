@@ -0,0 +1,357 @@
+/* Copyright (C) 2006 - 2013 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "LocalThreading.h"
+#include <algorithm>
+
+namespace Imap
+{
+namespace Mailbox
+{
+
+namespace
+{
+
+/** @short Skip a "[blob]" starting at @arg pos, returning the position just after it or @arg pos if there is none */
+int skipBlob(const QString &subject, int pos)
+{
+    if (pos >= subject.size() || subject[pos] != QLatin1Char('['))
+        return pos;
+    const int end = subject.indexOf(QLatin1Char(']'), pos);
+    return end == -1 ? pos : end + 1;
+}
+
+int skipSpaces(const QString &subject, int pos)
+{
+    while (pos < subject.size() && subject[pos].isSpace())
+        ++pos;
+    return pos;
+}
+
+/** @short Return the position after a "Re:", "Fw:" or "Fwd:" prefix (with an optional blob before the colon), or zero */
+int replyPrefixLength(const QString &subject)
+{
+    int pos = 0;
+    while (pos < subject.size() && subject[pos].isLetter())
+        ++pos;
+    const QString word = subject.left(pos).toLower();
+    if (word != QLatin1String("re") && word != QLatin1String("fw") && word != QLatin1String("fwd"))
+        return 0;
+    pos = skipSpaces(subject, skipBlob(subject, skipSpaces(subject, pos)));
+    if (pos >= subject.size() || subject[pos] != QLatin1Char(':'))
+        return 0;
+    return pos + 1;
+}
+
+}
+
+LocalThreading::LocalThreading()
+{
+}
+
+void LocalThreading::clear()
+{
+    m_containers.clear();
+    m_idTable.clear();
+    m_uidTable.clear();
+}
+
+void LocalThreading::addMessages(const QList<LocalThreadingMessage> &messages)
+{
+    m_containers.reserve(m_containers.size() + messages.size() * 2);
+    m_uidTable.reserve(m_uidTable.size() + messages.size());
+    Q_FOREACH(const LocalThreadingMessage &message, messages) {
+        addMessage(message);
+    }
+}
+
+void LocalThreading::addMessage(const LocalThreadingMessage &message)
+{
+    QHash<uint, int>::iterator known = m_uidTable.find(message.uid);
+    if (known != m_uidTable.end()) {
+        Container &old = m_containers[*known];
+        if (!old.anonymous) {
+            // The headers of a message never change
+            return;
+        }
+        // Nothing could have referred to a message without a Message-Id, so it can be simply discarded
+        setParent(*known, -1);
+        old.uid = 0;
+        m_uidTable.erase(known);
+    }
+
+    int node = -1;
+    bool anonymous = true;
+    if (!message.messageId.isEmpty()) {
+        QHash<QByteArray, int>::const_iterator it = m_idTable.constFind(message.messageId);
+        if (it == m_idTable.constEnd()) {
+            node = containerForId(message.messageId);
+            anonymous = false;
+        } else if (!m_containers[*it].uid) {
+            node = *it;
+            anonymous = false;
+        }
+        // Otherwise this is a duplicate Message-Id, and the message gets a container of its own
+    }
+    if (node == -1) {
+        node = m_containers.size();
+        m_containers.append(Container());
+    }
+
+    Container &container = m_containers[node];
+    container.uid = message.uid;
+    container.anonymous = anonymous;
+    container.baseSubject = baseSubject(message.subject, &container.isReply).toLower();
+    container.date = message.date.isValid() ? message.date.toTime_t() : 0;
+    m_uidTable.insert(message.uid, node);
+
+    // Link the referenced messages into a chain, unless they are linked already
+    int previous = -1;
+    Q_FOREACH(const QByteArray &reference, message.references) {
+        if (reference.isEmpty())
+            continue;
+        const int current = containerForId(reference);
+        if (previous != -1 && m_containers[current].parent == -1 && !isAncestor(current, previous))
+            setParent(current, previous);
+        previous = current;
+    }
+
+    // The message's own references are authoritative, so they override what the other messages have suggested
+    if (previous == -1 || !isAncestor(node, previous))
+        setParent(node, previous);
+}
+
+int LocalThreading::containerForId(const QByteArray &messageId)
+{
+    QHash<QByteArray, int>::const_iterator it = m_idTable.constFind(messageId);
+    if (it != m_idTable.constEnd())
+        return *it;
+    const int res = m_containers.size();
+    m_containers.append(Container());
+    m_containers.back().anonymous = false;
+    m_idTable.insert(messageId, res);
+    return res;
+}
+
+bool LocalThreading::isAncestor(const int ancestor, int node) const
+{
+    for (; node != -1; node = m_containers[node].parent) {
+        if (node == ancestor)
+            return true;
+    }
+    return false;
+}
+
+void LocalThreading::setParent(const int node, const int parent)
+{
+    Container &container = m_containers[node];
+    if (container.parent == parent)
+        return;
+    if (container.parent != -1) {
+        QVector<int> &siblings = m_containers[container.parent].children;
+        siblings.remove(siblings.indexOf(node));
+    }
+    container.parent = parent;
+    if (parent != -1)
+        m_containers[parent].children.append(node);
+}
+
+QVector<Imap::Responses::ThreadingNode> LocalThreading::threading() const
+{
+    QVector<TreeNode> roots;
+    for (int i = 0; i < m_containers.size(); ++i) {
+        if (m_containers[i].parent != -1)
+            continue;
+        QVector<TreeNode> nodes;
+        prune(i, nodes);
+        if (!m_containers[i].uid && nodes.size() > 1) {
+            // An empty root with several children holds a thread together, so it stays
+            TreeNode dummy;
+            dummy.children = nodes;
+            roots.append(dummy);
+        } else {
+            roots += nodes;
+        }
+    }
+    sortTree(roots);
+    groupBySubject(roots);
+    sortTree(roots);
+    return toThreadingNodes(roots);
+}
+
+void LocalThreading::prune(const int index, QVector<TreeNode> &output) const
+{
+    const Container &container = m_containers[index];
+    if (!container.uid) {
+        // Empty containers are replaced by their children
+        Q_FOREACH(const int child, container.children) {
+            prune(child, output);
+        }
+        return;
+    }
+
+    TreeNode node;
+    node.uid = container.uid;
+    node.date = container.date;
+    node.isReply = container.isReply;
+    node.baseSubject = container.baseSubject;
+    Q_FOREACH(const int child, container.children) {
+        prune(child, node.children);
+    }
+    output.append(node);
+}
+
+bool LocalThreading::sentEarlier(const TreeNode &a, const TreeNode &b)
+{
+    return a.date < b.date || (a.date == b.date && a.uid < b.uid);
+}
+
+void LocalThreading::sortTree(QVector<TreeNode> &nodes)
+{
+    for (QVector<TreeNode>::iterator it = nodes.begin(); it != nodes.end(); ++it) {
+        sortTree(it->children);
+        if (!it->uid && !it->children.isEmpty()) {
+            it->date = it->children.front().date;
+            if (it->baseSubject.isEmpty())
+                it->baseSubject = it->children.front().baseSubject;
+        }
+    }
+    std::stable_sort(nodes.begin(), nodes.end(), sentEarlier);
+}
+
+QVector<Imap::Responses::ThreadingNode> LocalThreading::toThreadingNodes(const QVector<TreeNode> &nodes)
+{
+    QVector<Imap::Responses::ThreadingNode> res;
+    res.reserve(nodes.size());
+    for (QVector<TreeNode>::const_iterator it = nodes.constBegin(); it != nodes.constEnd(); ++it) {
+        res.append(Imap::Responses::ThreadingNode(it->uid, toThreadingNodes(it->children)));
+    }
+    return res;
+}
+
+void LocalThreading::groupBySubject(QVector<TreeNode> &roots)
+{
+    // This is step 5 of the JWZ algorithm
+    QHash<QString, int> subjects;
+    for (int i = 0; i < roots.size(); ++i) {
+        const TreeNode &node = roots[i];
+        if (node.baseSubject.isEmpty())
+            continue;
+        QHash<QString, int>::iterator it = subjects.find(node.baseSubject);
+        if (it == subjects.end()) {
+            subjects.insert(node.baseSubject, i);
+            continue;
+        }
+        // An empty container is the best candidate, followed by a message which is not a reply
+        const TreeNode &current = roots[*it];
+        if ((!node.uid && current.uid) || (current.uid && node.uid && current.isReply && !node.isReply))
+            *it = i;
+    }
+
+    QVector<bool> merged(roots.size(), false);
+    for (int i = 0; i < roots.size(); ++i) {
+        if (roots[i].baseSubject.isEmpty())
+            continue;
+        const int target = subjects[roots[i].baseSubject];
+        if (target == i)
+            continue;
+
+        TreeNode &into = roots[target];
+        const TreeNode &node = roots[i];
+        if (!into.uid && !node.uid) {
+            into.children += node.children;
+        } else if (!into.uid) {
+            into.children.append(node);
+        } else if (!into.isReply && node.isReply) {
+            into.children.append(node);
+        } else {
+            TreeNode dummy;
+            dummy.baseSubject = into.baseSubject;
+            dummy.children.append(into);
+            dummy.children.append(node);
+            into = dummy;
+        }
+        merged[i] = true;
+    }
+
+    QVector<TreeNode> res;
+    res.reserve(roots.size());
+    for (int i = 0; i < roots.size(); ++i) {
+        if (!merged[i])
+            res.append(roots[i]);
+    }
+    roots = res;
+}
+
+QString LocalThreading::baseSubject(const QString &subject, bool *isReply)
+{
+    QString res = subject.simplified();
+    bool reply = false;
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        while (res.endsWith(QLatin1String("(fwd)"), Qt::CaseInsensitive)) {
+            res = res.left(res.size() - 5).trimmed();
+            reply = true;
+            changed = true;
+        }
+        if (int length = replyPrefixLength(res)) {
+            res = res.mid(length).trimmed();
+            reply = true;
+            changed = true;
+            continue;
+        }
+        const int afterBlob = skipBlob(res, 0);
+        if (afterBlob && afterBlob < res.size()) {
+            // A list tag like "[trojita]", unless it is all there is
+            res = res.mid(afterBlob).trimmed();
+            changed = true;
+            continue;
+        }
+        if (res.startsWith(QLatin1String("[fwd:"), Qt::CaseInsensitive) && res.endsWith(QLatin1Char(']'))) {
+            res = res.mid(5, res.size() - 6).trimmed();
+            reply = true;
+            changed = true;
+        }
+    }
+    if (isReply)
+        *isReply = reply;
+    return res;
+}
+
+
+LocalThreadingWorker::LocalThreadingWorker(): QObject(0)
+{
+}
+
+void LocalThreadingWorker::execute(LocalThreadingRequest *request)
+{
+    if (request->reset)
+        m_threading.clear();
+    m_threading.addMessages(request->messages);
+    request->messages.clear();
+    request->result = m_threading.threading();
+    emit finished(request);
+}
+
+}
+}
@@ -0,0 +1,173 @@
+/* Copyright (C) 2006 - 2013 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef IMAP_MODEL_LOCALTHREADING_H
+#define IMAP_MODEL_LOCALTHREADING_H
+
+#include <QDateTime>
+#include <QHash>
+#include <QMetaType>
+#include <QObject>
+#include <QVector>
+#include "Imap/Parser/ThreadingNode.h"
+
+/** @short Namespace for IMAP interaction */
+namespace Imap
+{
+
+/** @short Classes for handling of mailboxes and connections */
+namespace Mailbox
+{
+
+/** @short Headers of a message which matter for threading */
+struct LocalThreadingMessage
+{
+    uint uid;
+    QByteArray messageId;
+    /** @short The References header followed by the In-Reply-To, oldest ancestor first */
+    QList<QByteArray> references;
+    QString subject;
+    QDateTime date;
+
+    LocalThreadingMessage(): uid(0) {}
+};
+
+/** @short Client-side threading of messages based on their Message-Id and References headers
+
+This is the algorithm by Jamie Zawinski which is also the base of the REFERENCES threading from RFC 5256.  Messages are linked
+together as they are added through addMessages(), so that adding a few new arrivals to a huge mailbox is cheap.  The tree is
+built from these links by threading(); that step is linear in the number of messages.
+
+Messages are identified by their UIDs.  Adding a message with a known UID replaces its previous headers, which is how
+messages whose headers were not available at first get their proper place later.
+*/
+class LocalThreading
+{
+public:
+    LocalThreading();
+
+    void addMessages(const QList<LocalThreadingMessage> &messages);
+
+    /** @short Forget all messages */
+    void clear();
+
+    /** @short Return the threading in the same format as an UID THREAD response */
+    QVector<Imap::Responses::ThreadingNode> threading() const;
+
+    /** @short Return the subject with all the "Re:" and "Fwd:" prefixes and list tags removed
+
+    If @arg isReply is not null, it is set to true if some reply or forward marker was present.
+    */
+    static QString baseSubject(const QString &subject, bool *isReply = 0);
+
+private:
+    /** @short A node of the graph; it represents a message or an ID which some message refers to */
+    struct Container
+    {
+        /** @short UID of the message, or zero for an ID which is only known from the references */
+        uint uid;
+        /** @short Index of the parent container, -1 for none */
+        int parent;
+        QVector<int> children;
+        QString baseSubject;
+        bool isReply;
+        /** @short Sent date as time_t, for ordering the siblings */
+        uint date;
+        /** @short The message has no usable Message-Id, so nothing can refer to it */
+        bool anonymous;
+
+        Container(): uid(0), parent(-1), isReply(false), date(0), anonymous(true) {}
+    };
+
+    /** @short A node of the resulting tree along with the data which are needed for sorting and for grouping by the subject */
+    struct TreeNode
+    {
+        uint uid;
+        uint date;
+        bool isReply;
+        QString baseSubject;
+        QVector<TreeNode> children;
+
+        TreeNode(): uid(0), date(0), isReply(false) {}
+    };
+
+    void addMessage(const LocalThreadingMessage &message);
+    /** @short Find the container for the Message-Id, creating an empty one if it isn't known yet */
+    int containerForId(const QByteArray &messageId);
+    bool isAncestor(const int ancestor, int node) const;
+    void setParent(const int node, const int parent);
+    /** @short Convert the container into the nodes of the tree, leaving out the empty containers */
+    void prune(const int index, QVector<TreeNode> &output) const;
+
+    static bool sentEarlier(const TreeNode &a, const TreeNode &b);
+    /** @short Order the siblings by their date and let the empty nodes inherit the date and subject of their first child */
+    static void sortTree(QVector<TreeNode> &nodes);
+    /** @short Merge the threads whose roots share the same base subject */
+    static void groupBySubject(QVector<TreeNode> &roots);
+    static QVector<Imap::Responses::ThreadingNode> toThreadingNodes(const QVector<TreeNode> &nodes);
+
+    QVector<Container> m_containers;
+    QHash<QByteArray, int> m_idTable;
+    QHash<uint, int> m_uidTable;
+};
+
+/** @short Work item for the LocalThreadingWorker
+
+The request carries the new messages to the worker thread and the resulting tree back.
+*/
+struct LocalThreadingRequest
+{
+    /** @short Shall the worker forget all messages it knows before adding the new ones? */
+    bool reset;
+    QList<LocalThreadingMessage> messages;
+    QVector<Imap::Responses::ThreadingNode> result;
+    /** @short Opaque number which lets the requester recognize stale results */
+    uint generation;
+
+    LocalThreadingRequest(): reset(false), generation(0) {}
+};
+
+/** @short Runs the LocalThreading in a separate thread */
+class LocalThreadingWorker : public QObject
+{
+    Q_OBJECT
+public:
+    LocalThreadingWorker();
+
+public slots:
+    void execute(Imap::Mailbox::LocalThreadingRequest *request);
+
+signals:
+    /** @short The request has been processed; the receiver takes ownership of it */
+    void finished(Imap::Mailbox::LocalThreadingRequest *request);
+
+private:
+    LocalThreading m_threading;
+};
+
+}
+
+}
+
+Q_DECLARE_METATYPE(Imap::Mailbox::LocalThreadingRequest*)
+
+#endif /* IMAP_MODEL_LOCALTHREADING_H */
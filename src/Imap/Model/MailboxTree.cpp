@@ -461,8 +461,14 @@ void TreeItemMailbox::handleFetchResponse(Model *const model,
                 part->m_data = data;
             }
             part->m_fetchStatus = DONE;
-            if (message->uid())
+            if (message->uid()) {
                 model->cache()->setMsgPart(mailbox(), message->uid(), part->partId(), part->m_data);
+                if (part->mimeType() == QLatin1String("text/plain") || part->mimeType() == QLatin1String("text/html")) {
+                    // The cache cannot tell the text parts apart on its own; the decoding is up to it, though
+                    model->cache()->setMsgPartText(mailbox(), message->uid(), part->partId(), part->m_data,
+                                                   part->charset(), part->mimeType());
+                }
+            }
             changedParts.append(part);
         } else if (it.key() == "FLAGS") {
             // Only emit signals when the flags have actually changed
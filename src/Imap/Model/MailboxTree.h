@@ -51,6 +51,7 @@ class TreeItem
     friend class KeepMailboxOpenTask; // for direct access to m_children
     friend class MsgListModel; // for direct access to m_children
     friend class ThreadingMsgListModel; // for direct access to m_children
+    friend class BackgroundSyncScheduler; // for direct access to m_children
 
 protected:
     /** @short Availability of an item */
@@ -117,6 +118,7 @@ class TreeItemMailbox: public TreeItem
     friend class MailboxModel;
     friend class KeepMailboxOpenTask; // needs access to maintainingTask
     friend class SubscribeUnsubscribeTask; // needs access to m_metadata.flags
+    friend class BackgroundSyncScheduler; // needs access to maintainingTask
     static QLatin1String flagNoInferiors;
     static QLatin1String flagHasNoChildren;
     static QLatin1String flagHasChildren;
@@ -212,6 +214,7 @@ class TreeItemMessage: public TreeItem
     friend class ObtainSynchronizedMailboxTask; // needs access to m_offset
     friend class KeepMailboxOpenTask; // needs access to m_offset
     friend class UpdateFlagsTask; // needs access to m_flags
+    friend class ThreadingMsgListModel; // needs access to the headers for the local threading and to the m_wasUnread
     Message::Envelope m_envelope;
     QDateTime m_internalDate;
     uint m_size;
@@ -22,7 +22,8 @@
 
 #include "MemoryCache.h"
 #include <QDebug>
-#include <QFile>
+#include <QRegExp>
+#include "Imap/Encoders.h"
 
 //#define CACHE_DEBUG
 
@@ -31,18 +32,109 @@ namespace Imap
 namespace Mailbox
 {
 
-MemoryCache::MemoryCache(QObject *parent): AbstractCache(parent)
+MemoryCache::MemoryCache(QObject *parent): AbstractCache(parent), m_maxBytes(0)
 {
 }
 
+int MemoryCache::mailboxId(const QString &mailbox, const bool create)
+{
+    QHash<QString, int>::const_iterator it = m_mailboxIds.constFind(mailbox);
+    if (it != m_mailboxIds.constEnd())
+        return *it;
+    if (!create)
+        return -1;
+    const int id = m_mailboxIds.size();
+    m_mailboxIds[mailbox] = id;
+    return id;
+}
+
+int MemoryCache::mailboxId(const QString &mailbox) const
+{
+    return m_mailboxIds.value(mailbox, -1);
+}
+
+namespace {
+
+quint64 makeMessageKey(const int mailboxId, const uint uid)
+{
+    return (static_cast<quint64>(mailboxId) << 32) | uid;
+}
+
+/** @short Check whether each of the @arg words is a prefix of some word in the @arg haystack */
+bool containsAllWords(const QString &haystack, const QStringList &words)
+{
+    QStringList candidates = haystack.split(QRegExp(QLatin1String("\\W+")), QString::SkipEmptyParts);
+    Q_FOREACH(const QString &word, words) {
+        bool found = false;
+        Q_FOREACH(const QString &candidate, candidates) {
+            if (candidate.startsWith(word, Qt::CaseInsensitive)) {
+                found = true;
+                break;
+            }
+        }
+        if (!found)
+            return false;
+    }
+    return true;
+}
+
+}
+
+MemoryCache::MessageKey MemoryCache::rememberMessage(const QString &mailbox, const uint uid)
+{
+    const int id = mailboxId(mailbox, true);
+    m_messages[id].insert(uid);
+    return makeMessageKey(id, uid);
+}
+
+void MemoryCache::forgetMessage(const MessageKey key)
+{
+    m_flags.remove(key);
+    m_metadata.remove(key);
+    m_texts.remove(key);
+    QHash<MessageKey, QHash<QString, CachedPart> >::iterator it = m_parts.find(key);
+    if (it == m_parts.end())
+        return;
+    for (QHash<QString, CachedPart>::iterator part = it->begin(); part != it->end(); ++part) {
+        m_statistics.residentBytes -= part->data.size();
+        m_partsLru.erase(part->lru);
+    }
+    m_parts.erase(it);
+}
+
+void MemoryCache::enforceLimit()
+{
+    if (!m_maxBytes)
+        return;
+    qint64 freed = 0;
+    while (m_statistics.residentBytes > m_maxBytes && !m_partsLru.isEmpty()) {
+        const PartRef victim = m_partsLru.takeFirst();
+        QHash<MessageKey, QHash<QString, CachedPart> >::iterator it = m_parts.find(victim.message);
+        Q_ASSERT(it != m_parts.end());
+        QHash<QString, CachedPart>::iterator part = it->find(victim.partId);
+        Q_ASSERT(part != it->end());
+        freed += part->data.size();
+        m_statistics.residentBytes -= part->data.size();
+        ++m_statistics.evictions;
+        it->erase(part);
+        if (it->isEmpty())
+            m_parts.erase(it);
+    }
+#ifdef CACHE_DEBUG
+    qDebug() << "evicted" << freed << "bytes of message parts";
+#endif
+    if (freed)
+        emit evicted(freed);
+}
+
 QList<MailboxMetadata> MemoryCache::childMailboxes(const QString &mailbox) const
 {
-    return mailboxes[ mailbox ];
+    return m_childMailboxes.value(mailbox);
 }
 
 bool MemoryCache::childMailboxesFresh(const QString &mailbox) const
 {
-    return mailboxes.contains(mailbox);
+    return m_childMailboxes.contains(mailbox);
 }
 
 void MemoryCache::setChildMailboxes(const QString &mailbox, const QList<MailboxMetadata> &data)
@@ -50,12 +142,12 @@ void MemoryCache::setChildMailboxes(const QString &mailbox, const QList<MailboxM
 #ifdef CACHE_DEBUG
     qDebug() << "setting child mailboxes for" << mailbox << "to" << data;
 #endif
-    mailboxes[ mailbox ] = data;
+    m_childMailboxes[mailbox] = data;
 }
 
 SyncState MemoryCache::mailboxSyncState(const QString &mailbox) const
 {
-    return syncState[ mailbox ];
+    return m_syncState.value(mailbox);
 }
 
 void MemoryCache::setMailboxSyncState(const QString &mailbox, const SyncState &state)
@@ -63,7 +155,20 @@ void MemoryCache::setMailboxSyncState(const QString &mailbox, const SyncState &s
 #ifdef CACHE_DEBUG
     qDebug() << "setting mailbox sync state of" << mailbox << "to" << state;
 #endif
-    syncState[ mailbox ] = state;
+    m_syncState[mailbox] = state;
+}
+
+SyncState MemoryCache::mailboxStatus(const QString &mailbox) const
+{
+    return m_status.value(mailbox);
+}
+
+void MemoryCache::setMailboxStatus(const QString &mailbox, const SyncState &state)
+{
+#ifdef CACHE_DEBUG
+    qDebug() << "setting mailbox status of" << mailbox << "to" << state;
+#endif
+    m_status[mailbox] = state;
 }
 
 void MemoryCache::setUidMapping(const QString &mailbox, const QList<uint> &mapping)
@@ -71,7 +176,7 @@ void MemoryCache::setUidMapping(const QString &mailbox, const QList<uint> &mappi
 #ifdef CACHE_DEBUG
     qDebug() << "saving UID mapping for" << mailbox << "to" << mapping;
 #endif
-    seqToUid[ mailbox ] = mapping;
+    m_uidMapping[mailbox] = mapping;
 }
 
 void MemoryCache::clearUidMapping(const QString &mailbox)
@@ -79,7 +184,7 @@ void MemoryCache::clearUidMapping(const QString &mailbox)
 #ifdef CACHE_DEBUG
     qDebug() << "clearing UID mapping for" << mailbox;
 #endif
-    seqToUid.remove(mailbox);
+    m_uidMapping.remove(mailbox);
 }
 
 void MemoryCache::clearAllMessages(const QString &mailbox)
@@ -87,9 +192,12 @@ void MemoryCache::clearAllMessages(const QString &mailbox)
 #ifdef CACHE_DEBUG
     qDebug() << "pruging all info for mailbox" << mailbox;
 #endif
-    flags.remove(mailbox);
-    msgMetadata.remove(mailbox);
-    parts.remove(mailbox);
+    const int id = mailboxId(mailbox);
+    if (id == -1)
+        return;
+    Q_FOREACH(const uint uid, m_messages.take(id)) {
+        forgetMessage(makeMessageKey(id, uid));
+    }
 }
 
 void MemoryCache::clearMessage(const QString mailbox, uint uid)
@@ -97,12 +205,13 @@ void MemoryCache::clearMessage(const QString mailbox, uint uid)
 #ifdef CACHE_DEBUG
     qDebug() << "pruging all info for message" << mailbox << uid;
 #endif
-    if (flags.contains(mailbox))
-        flags[ mailbox ].remove(uid);
-    if (msgMetadata.contains(mailbox))
-        msgMetadata[ mailbox ].remove(uid);
-    if (parts.contains(mailbox))
-        parts[ mailbox ].remove(uid);
+    const int id = mailboxId(mailbox);
+    if (id == -1)
+        return;
+    QHash<int, QSet<uint> >::iterator it = m_messages.find(id);
+    if (it == m_messages.end() || !it->remove(uid))
+        return;
+    forgetMessage(makeMessageKey(id, uid));
 }
 
 void MemoryCache::setMsgPart(const QString &mailbox, uint uid, const QString &partId, const QByteArray &data)
@@ -110,7 +219,70 @@ void MemoryCache::setMsgPart(const QString &mailbox, uint uid, const QString &pa
 #ifdef CACHE_DEBUG
     qDebug() << "set message part" << mailbox << uid << partId << data.size();
 #endif
-    parts[ mailbox ][ uid ][ partId ] = data;
+    const MessageKey key = rememberMessage(mailbox, uid);
+    QHash<QString, CachedPart> &messageParts = m_parts[key];
+    QHash<QString, CachedPart>::iterator it = messageParts.find(partId);
+    if (it != messageParts.end()) {
+        m_statistics.residentBytes -= it->data.size();
+        m_partsLru.erase(it->lru);
+        messageParts.erase(it);
+    }
+    if (m_maxBytes && data.size() > m_maxBytes) {
+        // Storing it would push everything else out and then get evicted anyway
+        ++m_statistics.evictions;
+        if (messageParts.isEmpty())
+            m_parts.remove(key);
+        return;
+    }
+    CachedPart part;
+    part.data = data;
+    part.lru = m_partsLru.insert(m_partsLru.end(), PartRef(key, partId));
+    messageParts[partId] = part;
+    m_statistics.residentBytes += data.size();
+    enforceLimit();
+}
+
+void MemoryCache::setMsgPartText(const QString &mailbox, uint uid, const QString &partId, const QByteArray &data,
+                                 const QString &charset, const QString &mimeType)
+{
+    m_texts[rememberMessage(mailbox, uid)][partId] = decodeTextPartForIndex(data, charset, mimeType);
+}
+
+QList<uint> MemoryCache::fullTextSearch(const QString &mailbox, const QString &field, const QString &text) const
+{
+    QList<uint> res;
+    const QStringList words = text.split(QRegExp(QLatin1String("\\W+")), QString::SkipEmptyParts);
+    if (words.isEmpty())
+        return res;
+    const int id = mailboxId(mailbox);
+    if (id == -1)
+        return res;
+
+    const bool all = field == QLatin1String("TEXT");
+    Q_FOREACH(const uint uid, m_messages.value(id)) {
+        const MessageKey key = makeMessageKey(id, uid);
+        QStringList haystack;
+        QHash<MessageKey, MessageDataBundle>::const_iterator it = m_metadata.constFind(key);
+        if (it != m_metadata.constEnd()) {
+            const Imap::Message::Envelope &envelope = it->envelope;
+            if (all || field == QLatin1String("SUBJECT"))
+                haystack << envelope.subject;
+            if (all || field == QLatin1String("FROM"))
+                haystack << Imap::Message::MailAddress::prettyList(envelope.from, Imap::Message::MailAddress::FORMAT_READABLE);
+            if (all || field == QLatin1String("TO"))
+                haystack << Imap::Message::MailAddress::prettyList(envelope.to, Imap::Message::MailAddress::FORMAT_READABLE);
+            if (all || field == QLatin1String("CC"))
+                haystack << Imap::Message::MailAddress::prettyList(envelope.cc, Imap::Message::MailAddress::FORMAT_READABLE);
+            if (all || field == QLatin1String("BCC"))
+                haystack << Imap::Message::MailAddress::prettyList(envelope.bcc, Imap::Message::MailAddress::FORMAT_READABLE);
+        }
+        if (all || field == QLatin1String("BODY"))
+            haystack << m_texts.value(key).values();
+        if (containsAllWords(haystack.join(QLatin1String(" ")), words))
+            res << uid;
+    }
+    qSort(res);
+    return res;
 }
 
 void MemoryCache::setMsgFlags(const QString &mailbox, uint uid, const QStringList &newFlags)
@@ -118,55 +290,107 @@ void MemoryCache::setMsgFlags(const QString &mailbox, uint uid, const QStringLis
 #ifdef CACHE_DEBUG
     qDebug() << "set FLAGS for" << mailbox << uid << newFlags;
 #endif
-    flags[mailbox][uid] = newFlags;
+    m_flags[rememberMessage(mailbox, uid)] = newFlags;
 }
 
 QStringList MemoryCache::msgFlags(const QString &mailbox, uint uid) const
 {
-    return flags[mailbox][uid];
+    const int id = mailboxId(mailbox);
+    if (id == -1)
+        return QStringList();
+    return m_flags.value(makeMessageKey(id, uid));
+}
+
+QList<uint> MemoryCache::uidsWithFlag(const QString &mailbox, const QString &flag, const bool present) const
+{
+    QList<uint> res;
+    const int id = mailboxId(mailbox);
+    if (id == -1)
+        return res;
+    const QSet<uint> current = m_uidMapping.value(mailbox).toSet();
+    Q_FOREACH(const uint uid, m_messages.value(id)) {
+        if (!current.contains(uid))
+            continue;
+        QHash<MessageKey, QStringList>::const_iterator it = m_flags.constFind(makeMessageKey(id, uid));
+        if (it != m_flags.constEnd() && it->contains(flag, Qt::CaseInsensitive) == present)
+            res << uid;
+    }
+    qSort(res);
+    return res;
+}
+
+uint MemoryCache::countWithFlag(const QString &mailbox, const QString &flag, const bool present) const
+{
+    return uidsWithFlag(mailbox, flag, present).size();
 }
 
 QList<uint> MemoryCache::uidMapping(const QString &mailbox) const
 {
-    return seqToUid[ mailbox ];
+    return m_uidMapping.value(mailbox);
 }
 
 void MemoryCache::setMessageMetadata(const QString &mailbox, uint uid, const MessageDataBundle &metadata)
 {
-    msgMetadata[mailbox][uid] = metadata;
+    m_metadata[rememberMessage(mailbox, uid)] = metadata;
 }
 
 MemoryCache::MessageDataBundle MemoryCache::messageMetadata(const QString &mailbox, uint uid) const
 {
-    const QMap<uint, MessageDataBundle> &firstLevel = msgMetadata[ mailbox ];
-    QMap<uint, MessageDataBundle>::const_iterator it = firstLevel.find(uid);
-    if (it == firstLevel.end()) {
-        return MessageDataBundle();
+    const int id = mailboxId(mailbox);
+    if (id != -1) {
+        QHash<MessageKey, MessageDataBundle>::const_iterator it = m_metadata.constFind(makeMessageKey(id, uid));
+        if (it != m_metadata.constEnd()) {
+            ++m_statistics.hits;
+            return *it;
+        }
+    }
+    ++m_statistics.misses;
+    return MessageDataBundle();
+}
+
+QHash<uint, MemoryCache::MessageDataBundle> MemoryCache::metadataOfMessages(const QString &mailbox,
+                                                                            const QList<uint> &uids) const
+{
+    QHash<uint, MessageDataBundle> res;
+    const int id = mailboxId(mailbox);
+    if (id == -1)
+        return res;
+    Q_FOREACH(const uint uid, uids) {
+        QHash<MessageKey, MessageDataBundle>::const_iterator it = m_metadata.constFind(makeMessageKey(id, uid));
+        if (it != m_metadata.constEnd())
+            res[uid] = *it;
     }
-    return *it;
+    return res;
 }
 
 QByteArray MemoryCache::messagePart(const QString &mailbox, uint uid, const QString &partId) const
 {
-    if (! parts.contains(mailbox))
-        return QByteArray();
-    const QMap<uint, QMap<QString, QByteArray> > &mailboxParts = parts[ mailbox ];
-    if (! mailboxParts.contains(uid))
-        return QByteArray();
-    const QMap<QString, QByteArray> &messageParts = mailboxParts[ uid ];
-    if (! messageParts.contains(partId))
-        return QByteArray();
-    return messageParts[ partId ];
+    const int id = mailboxId(mailbox);
+    if (id != -1) {
+        QHash<MessageKey, QHash<QString, CachedPart> >::iterator it = m_parts.find(makeMessageKey(id, uid));
+        if (it != m_parts.end()) {
+            QHash<QString, CachedPart>::iterator part = it->find(partId);
+            if (part != it->end()) {
+                ++m_statistics.hits;
+                // Move the part to the end of the LRU list
+                m_partsLru.erase(part->lru);
+                part->lru = m_partsLru.insert(m_partsLru.end(), PartRef(it.key(), partId));
+                return part->data;
+            }
+        }
+    }
+    ++m_statistics.misses;
+    return QByteArray();
 }
 
 QVector<Imap::Responses::ThreadingNode> MemoryCache::messageThreading(const QString &mailbox)
 {
-    return threads[mailbox];
+    return m_threading.value(mailbox);
 }
 
 void MemoryCache::setMessageThreading(const QString &mailbox, const QVector<Imap::Responses::ThreadingNode> &threading)
 {
-    threads[mailbox] = threading;
+    m_threading[mailbox] = threading;
 }
 
 void MemoryCache::setRenewalThreshold(const int days)
@@ -174,5 +398,27 @@ void MemoryCache::setRenewalThreshold(const int days)
     Q_UNUSED(days);
 }
 
+void MemoryCache::beginBatch()
+{
+    // All writes are cheap enough already
+}
+
+void MemoryCache::commitBatch()
+{
+}
+
+void MemoryCache::setCacheBudget(const qint64 maxBytes, const int maxDays)
+{
+    // There's no point in expiring by age, nothing survives the end of the session anyway
+    Q_UNUSED(maxDays);
+    m_maxBytes = maxBytes;
+    enforceLimit();
+}
+
+MemoryCache::Statistics MemoryCache::statistics() const
+{
+    return m_statistics;
+}
+
 }
 }
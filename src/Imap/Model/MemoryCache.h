@@ -24,7 +24,9 @@
 #define IMAP_MODEL_MEMORYCACHE_H
 
 #include "Cache.h"
-#include <QMap>
+#include <QHash>
+#include <QLinkedList>
+#include <QSet>
 
 /** @short Namespace for IMAP interaction */
 namespace Imap
@@ -34,15 +36,33 @@ namespace Imap
 namespace Mailbox
 {
 
-/** @short A cache implementation that uses in-memory cache
+/** @short A cache implementation that keeps everything in memory
 
-    It also has an optional feature to dump the data to a local file and read
-    it back in. Is isn't suitable for real production use, but it's a good start.
+The per-message data are stored in flat hash tables keyed by a combination of the mailbox ID and the UID, so that no lookup
+has to compare the mailbox names.
+
+The amount of memory occupied by the message parts can be limited through setCacheBudget(); once the limit is reached,
+the least recently used parts are dropped.  The metadata, flags and all per-mailbox data are never evicted because they are
+small and because the Model relies on them for the synchronization.
  */
 class MemoryCache : public AbstractCache
 {
     Q_OBJECT
 public:
+    /** @short Counters describing how well the cache performs */
+    struct Statistics {
+        /** @short Number of lookups of message metadata and parts which were answered from the cache */
+        quint64 hits;
+        /** @short Number of lookups of message metadata and parts which found nothing */
+        quint64 misses;
+        /** @short Number of message parts which were dropped to stay within the limit */
+        quint64 evictions;
+        /** @short Number of bytes occupied by the data of the message parts */
+        qint64 residentBytes;
+
+        Statistics(): hits(0), misses(0), evictions(0), residentBytes(0) {}
+    };
+
     explicit MemoryCache(QObject *parent);
 
     virtual QList<MailboxMetadata> childMailboxes(const QString &mailbox) const;
@@ -52,6 +72,9 @@ public:
     virtual SyncState mailboxSyncState(const QString &mailbox) const;
     virtual void setMailboxSyncState(const QString &mailbox, const SyncState &state);
 
+    virtual SyncState mailboxStatus(const QString &mailbox) const;
+    virtual void setMailboxStatus(const QString &mailbox, const SyncState &state);
+
     virtual void setUidMapping(const QString &mailbox, const QList<uint> &mapping);
     virtual void clearUidMapping(const QString &mailbox);
     virtual QList<uint> uidMapping(const QString &mailbox) const;
@@ -61,26 +84,78 @@ public:
 
     virtual MessageDataBundle messageMetadata(const QString &mailbox, uint uid) const;
     virtual void setMessageMetadata(const QString &mailbox, uint uid, const MessageDataBundle &metadata);
+    virtual QHash<uint, MessageDataBundle> metadataOfMessages(const QString &mailbox, const QList<uint> &uids) const;
 
     virtual QStringList msgFlags(const QString &mailbox, uint uid) const;
     virtual void setMsgFlags(const QString &mailbox, uint uid, const QStringList &newFlags);
+    virtual QList<uint> uidsWithFlag(const QString &mailbox, const QString &flag, const bool present) const;
+    virtual uint countWithFlag(const QString &mailbox, const QString &flag, const bool present) const;
 
     virtual QByteArray messagePart(const QString &mailbox, uint uid, const QString &partId) const;
     virtual void setMsgPart(const QString &mailbox, uint uid, const QString &partId, const QByteArray &data);
+    virtual void setMsgPartText(const QString &mailbox, uint uid, const QString &partId, const QByteArray &data,
+                                const QString &charset, const QString &mimeType);
+    virtual QList<uint> fullTextSearch(const QString &mailbox, const QString &field, const QString &text) const;
 
     virtual QVector<Imap::Responses::ThreadingNode> messageThreading(const QString &mailbox);
     virtual void setMessageThreading(const QString &mailbox, const QVector<Imap::Responses::ThreadingNode> &threading);
 
     virtual void setRenewalThreshold(const int days);
+    virtual void beginBatch();
+    virtual void commitBatch();
+    /** @short Limit the size of the message parts kept in memory to @arg maxBytes; the @arg maxDays is ignored */
+    virtual void setCacheBudget(const qint64 maxBytes, const int maxDays);
+
+    /** @short Return the current values of the performance counters */
+    Statistics statistics() const;
 
 private:
-    QMap<QString, QList<MailboxMetadata> > mailboxes;
-    QMap<QString, SyncState> syncState;
-    QMap<QString, QList<uint> > seqToUid;
-    QMap<QString, QMap<uint,QStringList> > flags;
-    QMap<QString, QMap<uint, MessageDataBundle> > msgMetadata;
-    QMap<QString, QMap<uint, QMap<QString, QByteArray> > > parts;
-    QMap<QString, QVector<Imap::Responses::ThreadingNode> > threads;
+    /** @short The mailbox ID in the upper half and the UID in the lower one */
+    typedef quint64 MessageKey;
+
+    /** @short Identification of a message part in the LRU list */
+    struct PartRef {
+        MessageKey message;
+        QString partId;
+
+        PartRef(const MessageKey message, const QString &partId): message(message), partId(partId) {}
+    };
+
+    struct CachedPart {
+        QByteArray data;
+        /** @short Position of this part in the m_partsLru */
+        QLinkedList<PartRef>::iterator lru;
+    };
+
+    /** @short Return the ID of the mailbox, optionally allocating a new one; -1 means that the mailbox is not known */
+    int mailboxId(const QString &mailbox, const bool create);
+    int mailboxId(const QString &mailbox) const;
+    /** @short Return the key of a message, making sure that the message is listed in m_messages */
+    MessageKey rememberMessage(const QString &mailbox, const uint uid);
+    /** @short Remove all data of a message except its entry in m_messages */
+    void forgetMessage(const MessageKey key);
+    /** @short Drop the least recently used parts until the limit is satisfied */
+    void enforceLimit();
+
+    QHash<QString, QList<MailboxMetadata> > m_childMailboxes;
+    QHash<QString, SyncState> m_syncState;
+    QHash<QString, SyncState> m_status;
+    QHash<QString, QList<uint> > m_uidMapping;
+    QHash<QString, QVector<Imap::Responses::ThreadingNode> > m_threading;
+
+    QHash<QString, int> m_mailboxIds;
+    /** @short UIDs of all messages which have some data stored, indexed by the mailbox ID */
+    QHash<int, QSet<uint> > m_messages;
+    QHash<MessageKey, QStringList> m_flags;
+    QHash<MessageKey, MessageDataBundle> m_metadata;
+    /** @short Part data; the inner hash is indexed by the part ID */
+    mutable QHash<MessageKey, QHash<QString, CachedPart> > m_parts;
+    QHash<MessageKey, QHash<QString, QString> > m_texts;
+    /** @short All stored parts, starting with the least recently used one */
+    mutable QLinkedList<PartRef> m_partsLru;
+    /** @short Maximal size of the part data in bytes, or zero for no limit */
+    qint64 m_maxBytes;
+    mutable Statistics m_statistics;
 };
 
 }
@@ -31,6 +31,7 @@
 #endif
 #include <QtAlgorithms>
 #include "Model.h"
+#include "BackgroundSyncScheduler.h"
 #include "MailboxTree.h"
 #include "QAIM_reset.h"
 #include "TaskPresentationModel.h"
@@ -105,11 +106,11 @@ Model::Model(QObject *parent, AbstractCache *cache, SocketFactoryPtr socketFacto
     // parent
     QAbstractItemModel(parent),
     // our tools
-    m_cache(cache), m_socketFactory(socketFactory), m_taskFactory(taskFactory), m_maxParsers(4), m_mailboxes(0),
-    m_netPolicy(NETWORK_OFFLINE),  m_taskModel(0), m_hasImapPassword(false),
+    m_cache(0), m_socketFactory(socketFactory), m_taskFactory(taskFactory), m_maxParsers(4), m_mailboxes(0),
+    m_netPolicy(NETWORK_OFFLINE),  m_taskModel(0), m_hasImapPassword(false), m_resumingSession(false),
     m_networkSession(0), m_userPreferredNetworkMode(m_netPolicy)
 {
-    m_cache->setParent(this);
+    setCache(cache);
     m_startTls = m_socketFactory->startTlsRequired();
 
     m_mailboxes = new TreeItemMailbox(0);
@@ -143,6 +144,17 @@ Model::Model(QObject *parent, AbstractCache *cache, SocketFactoryPtr socketFacto
     m_periodicMailboxNumbersRefresh->setInterval(5 * 60 * 1000);
     connect(m_periodicMailboxNumbersRefresh, SIGNAL(timeout()), this, SLOT(invalidateAllMessageCounts()));
 
+    m_backgroundSync = new BackgroundSyncScheduler(this);
+
+    m_delayedNumberOfMessages = new QTimer(this);
+    m_delayedNumberOfMessages->setSingleShot(true);
+    m_delayedNumberOfMessages->setInterval(0);
+    connect(m_delayedNumberOfMessages, SIGNAL(timeout()), this, SLOT(slotRequestNumberOfMessages()));
+
+    m_resumeTimer = new QTimer(this);
+    m_resumeTimer->setSingleShot(true);
+    connect(m_resumeTimer, SIGNAL(timeout()), this, SLOT(slotResumeSession()));
+
 #ifdef TROJITA_HAS_QNETWORKSESSION
     m_networkConfigurationManager = new QNetworkConfigurationManager(this);
     connect(m_networkConfigurationManager, SIGNAL(onlineStateChanged(bool)), this, SLOT(slotNetworkConnectivityStatusChanged(bool)));
@@ -179,6 +191,10 @@ void Model::responseReceived(const QMap<Parser *,ParserState>::iterator it)
     ParserStateGuard guard(*it);
     Q_ASSERT(it->parser);
 
+    // All cache updates triggered by this round of responses get written at once. Should the cache get replaced in the
+    // meanwhile, the old one flushes its batch upon destruction and the new one ignores the unmatched commit.
+    m_cache->beginBatch();
+
     int counter = 0;
     while (it->parser && it->parser->hasResponse()) {
         QSharedPointer<Imap::Responses::AbstractResponse> resp = it->parser->getResponse();
@@ -282,6 +298,8 @@ void Model::responseReceived(const QMap<Parser *,ParserState>::iterator it)
         }
     }
 
+    m_cache->commitBatch();
+
     if (!it->parser) {
         // It's dead now
 
@@ -605,6 +623,16 @@ void Model::handleStatus(Imap::Parser *ptr, const Imap::Responses::Status *const
         list->m_recentMessageCount = resp->states[ Imap::Responses::Status::RECENT ];
     list->m_numberFetchingStatus = TreeItem::DONE;
     emitMessageCountChanged(mailbox);
+
+    // Remember the numbers so that they can be shown right after the next startup
+    SyncState status = cache()->mailboxStatus(mailbox->mailbox());
+    if (resp->states.contains(Imap::Responses::Status::MESSAGES))
+        status.setExists(resp->states[ Imap::Responses::Status::MESSAGES ]);
+    if (resp->states.contains(Imap::Responses::Status::UNSEEN))
+        status.setUnSeenCount(resp->states[ Imap::Responses::Status::UNSEEN ]);
+    if (resp->states.contains(Imap::Responses::Status::RECENT))
+        status.setRecent(resp->states[ Imap::Responses::Status::RECENT ]);
+    cache()->setMailboxStatus(mailbox->mailbox(), status);
 }
 
 void Model::handleFetch(Imap::Parser *ptr, const Imap::Responses::Fetch *const resp)
@@ -840,8 +868,11 @@ void Model::askForNumberOfMessages(TreeItemMsgList *item)
     TreeItemMailbox *mailboxPtr = dynamic_cast<TreeItemMailbox *>(item->parent());
     Q_ASSERT(mailboxPtr);
 
+    Imap::Mailbox::SyncState syncState = cache()->mailboxStatus(mailboxPtr->mailbox());
+
     if (networkPolicy() == NETWORK_OFFLINE) {
-        Imap::Mailbox::SyncState syncState = cache()->mailboxSyncState(mailboxPtr->mailbox());
+        if (!syncState.isUsableForNumbers())
+            syncState = cache()->mailboxSyncState(mailboxPtr->mailbox());
         if (syncState.isUsableForNumbers()) {
             item->m_unreadMessageCount = syncState.unSeenCount();
             item->m_totalMessageCount = syncState.exists();
@@ -849,13 +880,61 @@ void Model::askForNumberOfMessages(TreeItemMsgList *item)
             item->m_numberFetchingStatus = TreeItem::DONE;
             emitMessageCountChanged(mailboxPtr);
         } else {
-            item->m_numberFetchingStatus = TreeItem::UNAVAILABLE;
+            // There are no remembered numbers, but the messages themselves might have been cached, so let's count them
+            const uint total = cache()->uidMapping(mailboxPtr->mailbox()).size();
+            if (total) {
+                item->m_unreadMessageCount = cache()->countWithFlag(mailboxPtr->mailbox(), QLatin1String("\\Seen"), false);
+                item->m_totalMessageCount = total;
+                item->m_recentMessageCount = cache()->countWithFlag(mailboxPtr->mailbox(), QLatin1String("\\Recent"), true);
+                item->m_numberFetchingStatus = TreeItem::DONE;
+                emitMessageCountChanged(mailboxPtr);
+            } else {
+                item->m_numberFetchingStatus = TreeItem::UNAVAILABLE;
+            }
         }
     } else {
-        m_taskFactory->createNumberOfMessagesTask(this, mailboxPtr->toIndex(this));
+        if (syncState.isUsableForNumbers()) {
+            // Show the last known numbers right away; they will get updated as soon as the server responds
+            item->m_unreadMessageCount = syncState.unSeenCount();
+            item->m_totalMessageCount = syncState.exists();
+            item->m_recentMessageCount = syncState.recent();
+            item->m_numberFetchingStatus = TreeItem::DONE;
+            emitMessageCountChanged(mailboxPtr);
+        }
+        // The requests are collected and sent in batches so that we don't end up with a separate task per each mailbox
+        m_pendingNumberOfMessages << mailboxPtr->toIndex(this);
+        if (!m_delayedNumberOfMessages->isActive())
+            m_delayedNumberOfMessages->start();
     }
 }
 
+void Model::slotRequestNumberOfMessages()
+{
+    if (networkPolicy() == NETWORK_OFFLINE) {
+        m_pendingNumberOfMessages.clear();
+        return;
+    }
+
+    bool ok;
+    int batchSize = property("trojita-imap-status-batch-size").toInt(&ok);
+    if (!ok || batchSize <= 0)
+        batchSize = 100;
+
+    QList<QPersistentModelIndex> batch;
+    Q_FOREACH(const QPersistentModelIndex &mailbox, m_pendingNumberOfMessages) {
+        if (!mailbox.isValid() || batch.contains(mailbox))
+            continue;
+        batch << mailbox;
+        if (batch.size() == batchSize) {
+            m_taskFactory->createNumberOfMessagesTask(this, batch);
+            batch.clear();
+        }
+    }
+    if (!batch.isEmpty())
+        m_taskFactory->createNumberOfMessagesTask(this, batch);
+    m_pendingNumberOfMessages.clear();
+}
+
 void Model::askForMsgMetadata(TreeItemMessage *item, const PreloadingMode preloadMode)
 {
     Q_ASSERT(item->uid());
@@ -865,6 +944,39 @@ void Model::askForMsgMetadata(TreeItemMessage *item, const PreloadingMode preloa
     TreeItemMailbox *mailboxPtr = dynamic_cast<TreeItemMailbox *>(list->parent());
     Q_ASSERT(mailboxPtr);
 
+    // The neighbouring messages are likely to be needed soon
+    QList<TreeItemMessage *> preloaded;
+    if (preloadMode == PRELOAD_PER_POLICY && networkPolicy() == NETWORK_ONLINE) {
+        bool ok;
+        int preload = property("trojita-imap-preload-msg-metadata").toInt(&ok);
+        if (! ok)
+            preload = 50;
+        int order = item->row();
+        for (int i = qMax(0, order - preload); i < qMin(list->m_children.size(), order + preload); ++i) {
+            TreeItemMessage *message = dynamic_cast<TreeItemMessage *>(list->m_children[i]);
+            Q_ASSERT(message);
+            if (item != message && !message->fetched() && !message->loading() && message->uid())
+                preloaded << message;
+        }
+    }
+
+    QList<uint> uids;
+    uids << item->uid();
+    Q_FOREACH(TreeItemMessage *message, preloaded) {
+        uids << message->uid();
+    }
+    if (cache()->loadMessageMetadata(mailboxPtr->mailbox(), uids)) {
+        // Don't wait for the disk; slotCacheMetadataLoaded() continues once the data are ready
+        QSet<uint> &pending = m_metadataFromCache[mailboxPtr->mailbox()];
+        item->m_fetchStatus = TreeItem::LOADING;
+        pending << item->uid();
+        Q_FOREACH(TreeItemMessage *message, preloaded) {
+            message->m_fetchStatus = TreeItem::LOADING;
+            pending << message->uid();
+        }
+        return;
+    }
+
     if (item->uid()) {
         AbstractCache::MessageDataBundle data = cache()->messageMetadata(mailboxPtr->mailbox(), item->uid());
         if (data.uid == item->uid()) {
@@ -924,28 +1036,45 @@ void Model::askForMsgMetadata(TreeItemMessage *item, const PreloadingMode preloa
         }
 
         // preload
-        if (preloadMode != PRELOAD_PER_POLICY)
-            break;
-        bool ok;
-        int preload = property("trojita-imap-preload-msg-metadata").toInt(&ok);
-        if (! ok)
-            preload = 50;
-        int order = item->row();
-        for (int i = qMax(0, order - preload); i < qMin(list->m_children.size(), order + preload); ++i) {
-            TreeItemMessage *message = dynamic_cast<TreeItemMessage *>(list->m_children[i]);
-            Q_ASSERT(message);
-            if (item != message && !message->fetched() && !message->loading() && message->uid()) {
-                message->m_fetchStatus = TreeItem::LOADING;
-                // cannot ask the KeepTask directly, that'd completely ignore the cache
-                // but we absolutely have to block the preload :)
-                askForMsgMetadata(message, PRELOAD_DISABLED);
-            }
+        Q_FOREACH(TreeItemMessage *message, preloaded) {
+            message->m_fetchStatus = TreeItem::LOADING;
+            // cannot ask the KeepTask directly, that'd completely ignore the cache
+            // but we absolutely have to block the preload :)
+            askForMsgMetadata(message, PRELOAD_DISABLED);
         }
     }
     break;
     }
 }
 
+void Model::slotCacheMetadataLoaded(const QString &mailbox, const QList<uint> &uids)
+{
+    QHash<QString, QSet<uint> >::iterator pending = m_metadataFromCache.find(mailbox);
+    if (pending == m_metadataFromCache.end())
+        return;
+    QList<uint> wanted;
+    Q_FOREACH(const uint uid, uids) {
+        if (pending->remove(uid))
+            wanted << uid;
+    }
+    if (pending->isEmpty())
+        m_metadataFromCache.erase(pending);
+
+    TreeItemMailbox *mailboxPtr = findMailboxByName(mailbox);
+    if (!mailboxPtr || wanted.isEmpty() || !mailboxPtr->m_children[0]->fetched())
+        return;
+    qSort(wanted);
+    Q_FOREACH(TreeItemMessage *message, findMessagesByUids(mailboxPtr, wanted)) {
+        // The message might have been released or re-fetched by other means in the meanwhile
+        if (message->fetched() || !message->loading())
+            continue;
+        // This is going to be served from memory; whatever is not in the cache gets requested from the network
+        askForMsgMetadata(message, PRELOAD_DISABLED);
+        QModelIndex idx = message->toIndex(this);
+        emit dataChanged(idx, idx);
+    }
+}
+
 void Model::askForMsgPart(TreeItemPart *item, bool onlyFromCache)
 {
     // FIXME: fetch parts in chunks, not at once
@@ -961,7 +1090,19 @@ void Model::askForMsgPart(TreeItemPart *item, bool onlyFromCache)
     uint uid = static_cast<TreeItemMessage *>(item->message())->uid();
     Q_ASSERT(uid);
 
-    const QByteArray &data = cache()->messagePart(mailboxPtr->mailbox(), uid, item->partId());
+    if (cache()->loadMessagePart(mailboxPtr->mailbox(), uid, item->partId())) {
+        // The rest happens in slotCachePartLoaded()
+        item->m_fetchStatus = TreeItem::LOADING;
+        m_partsFromCache[mailboxPtr->mailbox()][uid][item->partId()] = onlyFromCache;
+        return;
+    }
+
+    handleCachedMsgPart(mailboxPtr, item, cache()->messagePart(mailboxPtr->mailbox(), uid, item->partId()), onlyFromCache);
+}
+
+/** @short Use the part data from the cache, or ask the network for them if they were not cached */
+void Model::handleCachedMsgPart(TreeItemMailbox *mailboxPtr, TreeItemPart *item, const QByteArray &data, bool onlyFromCache)
+{
     if (! data.isNull()) {
         item->m_data = data;
         item->m_fetchStatus = TreeItem::DONE;
@@ -971,7 +1112,11 @@ void Model::askForMsgPart(TreeItemPart *item, bool onlyFromCache)
     if (networkPolicy() == NETWORK_OFFLINE) {
         if (item->m_fetchStatus != TreeItem::DONE)
             item->m_fetchStatus = TreeItem::UNAVAILABLE;
-    } else if (! onlyFromCache) {
+    } else if (onlyFromCache) {
+        // The part was only being loaded from the cache, nothing has been requested from the network
+        if (item->m_fetchStatus == TreeItem::LOADING)
+            item->m_fetchStatus = TreeItem::NONE;
+    } else {
         KeepMailboxOpenTask *keepTask = findTaskResponsibleFor(mailboxPtr);
         TreeItemPart::PartFetchingMode fetchingMode = TreeItemPart::FETCH_PART_IMAP;
         if (keepTask->parser && accessParser(keepTask->parser).capabilitiesFresh &&
@@ -985,6 +1130,44 @@ void Model::askForMsgPart(TreeItemPart *item, bool onlyFromCache)
     }
 }
 
+void Model::slotCachePartLoaded(const QString &mailbox, const uint uid, const QString &partId, const QByteArray &data)
+{
+    QHash<QString, QMap<uint, QHash<QString, bool> > >::iterator pendingMailbox = m_partsFromCache.find(mailbox);
+    if (pendingMailbox == m_partsFromCache.end())
+        return;
+    QMap<uint, QHash<QString, bool> >::iterator pendingMessage = pendingMailbox->find(uid);
+    if (pendingMessage == pendingMailbox->end())
+        return;
+    QHash<QString, bool>::iterator pendingPart = pendingMessage->find(partId);
+    if (pendingPart == pendingMessage->end())
+        return;
+    const bool onlyFromCache = *pendingPart;
+    pendingMessage->erase(pendingPart);
+    if (pendingMessage->isEmpty())
+        pendingMailbox->erase(pendingMessage);
+    if (pendingMailbox->isEmpty())
+        m_partsFromCache.erase(pendingMailbox);
+
+    TreeItemMailbox *mailboxPtr = findMailboxByName(mailbox);
+    if (!mailboxPtr || !mailboxPtr->m_children[0]->fetched())
+        return;
+    QList<TreeItemMessage *> messages = findMessagesByUids(mailboxPtr, QList<uint>() << uid);
+    if (messages.isEmpty() || !messages.first()->fetched())
+        return;
+    TreeItemPart *part = 0;
+    try {
+        part = mailboxPtr->partIdToPtr(this, messages.first(), QLatin1String("BODY[") + partId + QLatin1Char(']'));
+    } catch (Imap::UnknownMessageIndex &) {
+        // The message got released and its structure is different now
+    }
+    // The part might have been released in the meanwhile, too
+    if (!part || !part->loading())
+        return;
+    handleCachedMsgPart(mailboxPtr, part, data, onlyFromCache);
+    QModelIndex idx = part->toIndex(this);
+    emit dataChanged(idx, idx);
+}
+
 void Model::resyncMailbox(const QModelIndex &mbox)
 {
     findTaskResponsibleFor(mbox)->resynchronizeMailbox();
@@ -999,24 +1182,17 @@ void Model::setNetworkPolicy(const NetworkPolicy policy)
     switch (policy) {
     case NETWORK_OFFLINE:
         for (QMap<Parser *,ParserState>::iterator it = m_parsers.begin(); it != m_parsers.end(); ++it) {
-            if (!it->parser || it->connState == CONN_STATE_LOGOUT) {
-                // there's no point in sending LOGOUT over these
-                continue;
-            }
-            Q_ASSERT(it->parser);
-            if (it->maintainingTask) {
-                // First of all, give the maintaining task a chance to finish its housekeeping
-                it->maintainingTask->stopForLogout();
-            }
-            // Kill all tasks that are also using this connection
-            Q_FOREACH(ImapTask *task, it->activeTasks) {
-                task->die();
-            }
-            it->logoutCmd = it->parser->logout();
-            it->connState = CONN_STATE_LOGOUT;
+            logoutParser(it.key());
         }
         m_netPolicy = NETWORK_OFFLINE;
         m_periodicMailboxNumbersRefresh->stop();
+        m_backgroundSync->stop();
+        // There's nothing to resume; the next connection shall go through a fresh login
+        m_resumeTimer->stop();
+        m_resumingSession = false;
+        m_resumeParser = 0;
+        m_resumeParts.clear();
+        m_resumeEnvelopes.clear();
         emit networkPolicyChanged();
         emit networkPolicyOffline();
 
@@ -1033,12 +1209,14 @@ void Model::setNetworkPolicy(const NetworkPolicy policy)
     case NETWORK_EXPENSIVE:
         m_netPolicy = NETWORK_EXPENSIVE;
         m_periodicMailboxNumbersRefresh->stop();
+        m_backgroundSync->stop();
         emit networkPolicyChanged();
         emit networkPolicyExpensive();
         break;
     case NETWORK_ONLINE:
         m_netPolicy = NETWORK_ONLINE;
         m_periodicMailboxNumbersRefresh->start();
+        m_backgroundSync->start();
         emit networkPolicyChanged();
         emit networkPolicyOnline();
         break;
@@ -1073,6 +1251,10 @@ void Model::handleSocketDisconnectedResponse(Parser *ptr, const Responses::Socke
 
         // But we still absolutely want to clean up and kill the connection/Parser anyway
         killParser(ptr, PARSER_KILL_EXPECTED);
+    } else if (prepareSessionResume(ptr)) {
+        // The user won't be bothered by an error message when we can reconnect on our own
+        logTrace(ptr->parserId(), Common::LOG_PARSE_ERROR, QString(), resp->message);
+        killParser(ptr, PARSER_KILL_EXPECTED);
     } else {
         logTrace(ptr->parserId(), Common::LOG_PARSE_ERROR, QString(), resp->message);
         killParser(ptr, PARSER_KILL_EXPECTED);
@@ -1081,6 +1263,96 @@ void Model::handleSocketDisconnectedResponse(Parser *ptr, const Responses::Socke
     }
 }
 
+/** @short Remember which mailbox was open over a connection which got lost so that it can be re-opened later
+
+The re-opening will reuse the capabilities of the lost connection, and therefore the ENABLE QRESYNC and the SELECT with the
+QRESYNC parameters can be pipelined right after the LOGIN.  The requests for message data which were not satisfied before the
+connection went away are replayed as well.
+
+Returns false if the caller shall treat the disconnect as a fatal error, either because the feature is not enabled through the
+trojita-imap-reconnect-delay property, because there was no mailbox open or because we're already recovering from the
+previous disconnect.
+*/
+bool Model::prepareSessionResume(Parser *parser)
+{
+    bool ok;
+    int delay = property("trojita-imap-reconnect-delay").toInt(&ok);
+    if (!ok || delay < 0 || m_resumingSession || m_netPolicy == NETWORK_OFFLINE)
+        return false;
+
+    KeepMailboxOpenTask *keepTask = accessParser(parser).maintainingTask;
+    if (!keepTask)
+        return false;
+
+    m_resumeParts.clear();
+    m_resumeEnvelopes.clear();
+    m_resumeMailbox = keepTask->collectPendingRequests(m_resumeParts, m_resumeEnvelopes);
+    if (!m_resumeMailbox.isValid())
+        return false;
+
+    logTrace(parser->parserId(), Common::LOG_OTHER, QLatin1String("Model"),
+             QString::fromUtf8("Connection lost, will reconnect in %1 ms").arg(QString::number(delay)));
+    m_resumingSession = true;
+    m_resumeTimer->start(delay);
+    return true;
+}
+
+void Model::slotResumeSession()
+{
+    if (!m_resumingSession)
+        return;
+
+    if (m_netPolicy == NETWORK_OFFLINE || !m_resumeMailbox.isValid()) {
+        m_resumingSession = false;
+        m_resumeParts.clear();
+        m_resumeEnvelopes.clear();
+        return;
+    }
+
+    m_resumeStarted.start();
+    KeepMailboxOpenTask *keepTask = findTaskResponsibleFor(m_resumeMailbox);
+    Q_ASSERT(keepTask);
+    // Only this connection may skip the CAPABILITY; the background sync and anything else opened in the meanwhile may not
+    m_resumeParser = keepTask->parser;
+    for (QMap<uint, QSet<QString> >::const_iterator it = m_resumeParts.constBegin(); it != m_resumeParts.constEnd(); ++it) {
+        Q_FOREACH(const QString &partId, *it) {
+            keepTask->requestPartDownload(it.key(), partId, 0);
+        }
+    }
+    Q_FOREACH(const uint uid, m_resumeEnvelopes) {
+        keepTask->requestEnvelopeDownload(uid);
+    }
+    m_resumeParts.clear();
+    m_resumeEnvelopes.clear();
+
+    if (keepTask->synchronizeConn && !keepTask->synchronizeConn->isFinished()) {
+        connect(keepTask->synchronizeConn, SIGNAL(completed(Imap::Mailbox::ImapTask*)), this, SLOT(slotSessionResumed()));
+        connect(keepTask->synchronizeConn, SIGNAL(failed(QString)), this, SLOT(slotSessionResumeFailed()));
+    } else {
+        // Somebody has re-opened the mailbox in the meanwhile
+        slotSessionResumed();
+    }
+}
+
+void Model::slotSessionResumed()
+{
+    if (!m_resumingSession)
+        return;
+
+    m_resumingSession = false;
+    m_resumeParser = 0;
+    const int msecs = m_resumeStarted.elapsed();
+    logTrace(m_resumeMailbox, Common::LOG_MAILBOX_SYNC, QLatin1String("Model"),
+             QString::fromUtf8("Mailbox usable again %1 ms after reconnecting").arg(QString::number(msecs)));
+    emit sessionResumed(m_resumeMailbox, msecs);
+}
+
+void Model::slotSessionResumeFailed()
+{
+    m_resumingSession = false;
+    m_resumeParser = 0;
+}
+
 void Model::handleParseErrorResponse(Imap::Parser *ptr, const Imap::Responses::ParseErrorResponse *const resp)
 {
     Q_ASSERT(ptr);
@@ -1128,6 +1400,10 @@ void Model::switchToMailbox(const QModelIndex &mbox)
     if (m_netPolicy == NETWORK_OFFLINE)
         return;
 
+    TreeItemMailbox *mailboxPtr = dynamic_cast<TreeItemMailbox *>(realTreeItem(mbox));
+    if (mailboxPtr)
+        m_backgroundSync->mailboxActivated(mailboxPtr->mailbox());
+
     findTaskResponsibleFor(mbox);
 }
 
@@ -1387,6 +1663,25 @@ void Model::handleSocketStateChanged(Parser *parser, Imap::ConnectionState state
     }
 }
 
+void Model::logoutParser(Parser *parser)
+{
+    QMap<Parser *,ParserState>::iterator it = m_parsers.find(parser);
+    if (it == m_parsers.end() || !it->parser || it->connState == CONN_STATE_LOGOUT) {
+        // there's no point in sending LOGOUT over these
+        return;
+    }
+    if (it->maintainingTask) {
+        // First of all, give the maintaining task a chance to finish its housekeeping
+        it->maintainingTask->stopForLogout();
+    }
+    // Kill all tasks that are also using this connection
+    Q_FOREACH(ImapTask *task, it->activeTasks) {
+        task->die();
+    }
+    it->logoutCmd = it->parser->logout();
+    it->connState = CONN_STATE_LOGOUT;
+}
+
 void Model::killParser(Parser *parser, ParserKillingMethod method)
 {
     if (method == PARSER_JUST_DELETE_LATER) {
@@ -1431,10 +1726,15 @@ void Model::slotParserLineSent(Parser *parser, const QByteArray &line)
 
 void Model::setCache(AbstractCache *cache)
 {
-    if (m_cache)
+    if (m_cache) {
+        m_cache->disconnect(this);
         m_cache->deleteLater();
+    }
     m_cache = cache;
     m_cache->setParent(this);
+    connect(m_cache, SIGNAL(messageMetadataLoaded(QString,QList<uint>)), this, SLOT(slotCacheMetadataLoaded(QString,QList<uint>)));
+    connect(m_cache, SIGNAL(messagePartLoaded(QString,uint,QString,QByteArray)),
+            this, SLOT(slotCachePartLoaded(QString,uint,QString,QByteArray)));
 }
 
 void Model::runReadyTasks()
@@ -1513,6 +1813,10 @@ KeepMailboxOpenTask *Model::findTaskResponsibleFor(TreeItemMailbox *mailboxPtr)
                 // this one is not usable
                 continue;
             }
+            if (m_backgroundSync->ownsParser(it.key())) {
+                // This connection is busy with background synchronization
+                continue;
+            }
             return m_taskFactory->createKeepMailboxOpenTask(this, mailboxPtr->toIndex(this), it.key());
         }
         // At this point, we have no other choice than to create a new connection
@@ -27,6 +27,7 @@
 
 #include <QAbstractItemModel>
 #include <QPointer>
+#include <QTime>
 #include <QTimer>
 #include "Cache.h"
 #include "../ConnectionState.h"
@@ -45,6 +46,7 @@ class QSslError;
 
 class FakeCapabilitiesInjector;
 class ImapModelIdleTest;
+class ImapModelOpenConnectionTest;
 class LibMailboxSync;
 
 namespace Composer {
@@ -70,6 +72,7 @@ class MsgListModel;
 class MailboxModel;
 class DelayedAskForChildrenOfMailbox;
 
+class BackgroundSyncScheduler;
 class ImapTask;
 class KeepMailboxOpenTask;
 class TaskPresentationModel;
@@ -349,6 +352,21 @@ private slots:
 
     void slotNetworkConnectivityStatusChanged(const bool online);
 
+    /** @short Send the STATUS commands which were queued by askForNumberOfMessages() */
+    void slotRequestNumberOfMessages();
+
+    /** @short Re-open the mailbox whose connection got lost, see prepareSessionResume() */
+    void slotResumeSession();
+    /** @short The mailbox is usable again after a reconnect */
+    void slotSessionResumed();
+    /** @short The re-opening of a mailbox after a reconnect did not succeed */
+    void slotSessionResumeFailed();
+
+    /** @short The metadata which askForMsgMetadata() asked the cache for are available */
+    void slotCacheMetadataLoaded(const QString &mailbox, const QList<uint> &uids);
+    /** @short The part data which askForMsgPart() asked the cache for are available */
+    void slotCachePartLoaded(const QString &mailbox, const uint uid, const QString &partId, const QByteArray &data);
+
 signals:
     /** @short This signal is emitted then the server sent us an ALERT response code */
     void alertReceived(const QString &message);
@@ -429,6 +447,9 @@ signals:
 
     void capabilitiesUpdated(const QStringList &capabilities);
 
+    /** @short A mailbox has been re-opened after its connection got lost; @arg msecs is the time it took to become usable */
+    void sessionResumed(const QModelIndex &mailbox, const int msecs);
+
     void logged(uint parserId, const Common::LogMessage &message);
 
 private:
@@ -480,9 +501,11 @@ private:
     friend class UidSubmitTask;
 
     friend class TestingTaskFactory; // needs access to socketFactory
+    friend class BackgroundSyncScheduler; // needs access to taskFactory and the ParserState
 
     friend class ::FakeCapabilitiesInjector; // for injecting fake capabilities
     friend class ::ImapModelIdleTest; // needs access to findTaskResponsibleFor() for IDLE testing
+    friend class ::ImapModelOpenConnectionTest; // needs access to the state of the session resume
     friend class TaskPresentationModel; // needs access to the ParserState
     friend class ::LibMailboxSync; // needs access to accessParser/ParserState
 
@@ -498,6 +521,7 @@ private:
 
     void askForMsgMetadata(TreeItemMessage *item, PreloadingMode preloadMode);
     void askForMsgPart(TreeItemPart *item, bool onlyFromCache=false);
+    void handleCachedMsgPart(TreeItemMailbox *mailboxPtr, TreeItemPart *item, const QByteArray &data, bool onlyFromCache);
 
     void finalizeList(Parser *parser, TreeItemMailbox *const mailboxPtr);
     void finalizeIncrementalList(Parser *parser, const QString &parentMailboxName);
@@ -547,6 +571,9 @@ private:
         PARSER_JUST_DELETE_LATER /**< @short Just call deleteLater(), nothing else */
     } ParserKillingMethod;
 
+    /** @short Stop all activity on the connection and ask the server to close it */
+    void logoutParser(Parser *parser);
+
     /** @short Dispose of the parser in a C++-safe way */
     void killParser(Parser *parser, ParserKillingMethod method=PARSER_KILL_HARD);
 
@@ -562,6 +589,8 @@ private:
 
     void informTasksAboutNewPassword();
 
+    bool prepareSessionResume(Parser *parser);
+
     QStringList onlineMessageFetch;
 
     /** @short Model visualizing the state of the tasks */
@@ -581,6 +610,34 @@ private:
 
     QTimer *m_periodicMailboxNumbersRefresh;
 
+    /** @short Mailboxes whose message counts shall be requested with the next batch of STATUS commands */
+    QList<QPersistentModelIndex> m_pendingNumberOfMessages;
+    QTimer *m_delayedNumberOfMessages;
+
+    /** @short UIDs of messages whose metadata are being read from the cache, indexed by the mailbox name */
+    QHash<QString, QSet<uint> > m_metadataFromCache;
+    /** @short Parts which are being read from the cache, and whether they shall not be requested from the network if missing */
+    QHash<QString, QMap<uint, QHash<QString, bool> > > m_partsFromCache;
+
+    /** @short Synchronization of the subscribed mailboxes over extra connections */
+    BackgroundSyncScheduler *m_backgroundSync;
+
+    /** @short Capabilities of the last connection which got past the authentication */
+    QStringList m_lastAuthenticatedCapabilities;
+    /** @short Is there a reconnect in progress after a connection got lost unexpectedly? */
+    bool m_resumingSession;
+    /** @short The connection which re-opens the mailbox, the only one allowed to reuse m_lastAuthenticatedCapabilities */
+    QPointer<Parser> m_resumeParser;
+    /** @short The mailbox which was kept open by the lost connection */
+    QPersistentModelIndex m_resumeMailbox;
+    /** @short Message parts which were requested over the lost connection, but have not arrived yet */
+    QMap<uint, QSet<QString> > m_resumeParts;
+    /** @short UIDs of messages whose metadata were requested over the lost connection, but have not arrived yet */
+    QList<uint> m_resumeEnvelopes;
+    QTimer *m_resumeTimer;
+    /** @short Start of the reconnect, used for measuring how long it takes for the mailbox to become usable again */
+    QTime m_resumeStarted;
+
     QStringList m_capabilitiesBlacklist;
 
     QNetworkConfigurationManager *m_networkConfigurationManager;
@@ -0,0 +1,553 @@
+/* Copyright (C) 2006 - 2013 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "PackPartCache.h"
+#include <QCryptographicHash>
+#include <QDebug>
+#include <QDir>
+#include <QSqlError>
+#include <QSqlRecord>
+#include <QStringList>
+#include <QTimer>
+#include "Common/SqlTransactionAutoAborter.h"
+
+namespace
+{
+/** @short Once the current pack grows above this size, a new one is started */
+const qint64 packSizeLimit = 256 * 1024 * 1024;
+
+/** @short How long to wait after the last removal before the unused data get reclaimed */
+const int compactionDelay = 60 * 1000;
+
+/** @short Size of the sample which is used for guessing whether the data are worth compressing */
+const int compressionProbeSize = 64 * 1024;
+}
+
+namespace Imap
+{
+namespace Mailbox
+{
+
+PackPartCache::PackPartCache(QObject *parent, const QString &name, const QString &cacheDir):
+    QObject(parent), m_cacheDir(cacheDir), m_name(name), m_currentPack(1), m_writer(0)
+{
+    if (!m_cacheDir.endsWith(QLatin1Char('/')))
+        m_cacheDir.append(QLatin1Char('/'));
+    m_packDir = m_cacheDir + QLatin1String("packs/");
+
+    m_compactionTimer = new QTimer(this);
+    m_compactionTimer->setSingleShot(true);
+    m_compactionTimer->setInterval(compactionDelay);
+    connect(m_compactionTimer, SIGNAL(timeout()), this, SLOT(compact()));
+}
+
+PackPartCache::~PackPartCache()
+{
+    qDeleteAll(m_readers);
+    delete m_writer;
+    const QString connectionName = m_db.connectionName();
+    m_queryPartBlob = QSqlQuery();
+    m_queryBlobByHash = QSqlQuery();
+    m_queryMessageSize = QSqlQuery();
+    m_queryAddBlob = QSqlQuery();
+    m_querySetPartRef = QSqlQuery();
+    m_queryClearMessage = QSqlQuery();
+    m_queryClearAllMessages = QSqlQuery();
+    m_db.close();
+    m_db = QSqlDatabase();
+    QSqlDatabase::removeDatabase(connectionName);
+}
+
+bool PackPartCache::open()
+{
+    QDir().mkpath(m_packDir);
+    m_db = QSqlDatabase::addDatabase(QLatin1String("QSQLITE"), m_name + QLatin1String("-packs"));
+    m_db.setDatabaseName(m_packDir + QLatin1String("index.sqlite"));
+    if (!m_db.open()) {
+        emit error(tr("PackPartCache: Can't open the index: %1").arg(m_db.lastError().text()));
+        return false;
+    }
+
+    if (!m_db.record(QLatin1String("part_refs")).contains(QLatin1String("blob"))) {
+        if (!createTables())
+            return false;
+    } else if (!m_db.record(QLatin1String("blobs")).contains(QLatin1String("compressed"))) {
+        // The first version of the index compressed everything
+        QSqlQuery q(m_db);
+        if (!q.exec(QLatin1String("ALTER TABLE blobs ADD COLUMN compressed INT NOT NULL DEFAULT 1"))) {
+            emitError(tr("Can't update the pack index"), q);
+            return false;
+        }
+    }
+    if (!prepareQueries())
+        return false;
+
+    QSqlQuery q(m_db);
+    if (!q.exec(QLatin1String("SELECT mailbox, uid, part_id FROM part_refs"))) {
+        emitError(tr("Can't load the locations of the parts"), q);
+        return false;
+    }
+    while (q.next())
+        m_locations[q.value(0).toString()][q.value(1).toUInt()].insert(q.value(2).toString());
+
+    // New data always go to a fresh pack so that a pack which was cut short by a crash is never appended to
+    Q_FOREACH(const QString &fileName, QDir(m_packDir).entryList(QStringList() << QLatin1String("*.pack"), QDir::Files)) {
+        m_currentPack = qMax(m_currentPack, fileName.section(QLatin1Char('.'), 0, 0).toInt() + 1);
+    }
+
+    importLegacyFiles();
+    scheduleCompaction();
+    return true;
+}
+
+bool PackPartCache::createTables()
+{
+    QSqlQuery q(m_db);
+    QStringList statements;
+    statements << QLatin1String("CREATE TABLE blobs ( "
+                                "id INTEGER PRIMARY KEY, "
+                                "hash BINARY NOT NULL UNIQUE, "
+                                "pack INT NOT NULL, "
+                                "offset INT NOT NULL, "
+                                "length INT NOT NULL, "
+                                "compressed INT NOT NULL"
+                                " )")
+               << QLatin1String("CREATE INDEX blobs_pack ON blobs ( pack )")
+               << QLatin1String("CREATE TABLE part_refs ( "
+                                "mailbox STRING NOT NULL, "
+                                "uid INT NOT NULL, "
+                                "part_id STRING NOT NULL, "
+                                "blob INT NOT NULL, "
+                                "PRIMARY KEY (mailbox, uid, part_id)"
+                                " )")
+               << QLatin1String("CREATE INDEX part_refs_blob ON part_refs ( blob )");
+    Q_FOREACH(const QString &statement, statements) {
+        if (!q.exec(statement)) {
+            emitError(tr("Can't create the pack index"), q);
+            return false;
+        }
+    }
+    return true;
+}
+
+bool PackPartCache::prepareQueries()
+{
+    m_queryPartBlob = QSqlQuery(m_db);
+    if (!m_queryPartBlob.prepare(QLatin1String("SELECT blobs.pack, blobs.offset, blobs.length, blobs.compressed FROM part_refs "
+                                               "JOIN blobs ON blobs.id = part_refs.blob "
+                                               "WHERE part_refs.mailbox = ? AND part_refs.uid = ? AND part_refs.part_id = ?"))) {
+        emitError(tr("Failed to prepare m_queryPartBlob"), m_queryPartBlob);
+        return false;
+    }
+
+    m_queryBlobByHash = QSqlQuery(m_db);
+    if (!m_queryBlobByHash.prepare(QLatin1String("SELECT id FROM blobs WHERE hash = ?"))) {
+        emitError(tr("Failed to prepare m_queryBlobByHash"), m_queryBlobByHash);
+        return false;
+    }
+
+    m_queryMessageSize = QSqlQuery(m_db);
+    if (!m_queryMessageSize.prepare(QLatin1String("SELECT SUM(blobs.length) FROM part_refs JOIN blobs ON blobs.id = part_refs.blob "
+                                                  "WHERE part_refs.mailbox = ?1 AND part_refs.uid = ?2 AND NOT EXISTS "
+                                                  "(SELECT 1 FROM part_refs AS other WHERE other.blob = part_refs.blob "
+                                                  "AND (other.mailbox != ?1 OR other.uid != ?2))"))) {
+        emitError(tr("Failed to prepare m_queryMessageSize"), m_queryMessageSize);
+        return false;
+    }
+
+    m_queryAddBlob = QSqlQuery(m_db);
+    if (!m_queryAddBlob.prepare(QLatin1String("INSERT INTO blobs ( hash, pack, offset, length, compressed ) VALUES ( ?, ?, ?, ?, ? )"))) {
+        emitError(tr("Failed to prepare m_queryAddBlob"), m_queryAddBlob);
+        return false;
+    }
+
+    m_querySetPartRef = QSqlQuery(m_db);
+    if (!m_querySetPartRef.prepare(QLatin1String("INSERT OR REPLACE INTO part_refs ( mailbox, uid, part_id, blob ) "
+                                                 "VALUES ( ?, ?, ?, ? )"))) {
+        emitError(tr("Failed to prepare m_querySetPartRef"), m_querySetPartRef);
+        return false;
+    }
+
+    m_queryClearMessage = QSqlQuery(m_db);
+    if (!m_queryClearMessage.prepare(QLatin1String("DELETE FROM part_refs WHERE mailbox = ? AND uid = ?"))) {
+        emitError(tr("Failed to prepare m_queryClearMessage"), m_queryClearMessage);
+        return false;
+    }
+
+    m_queryClearAllMessages = QSqlQuery(m_db);
+    if (!m_queryClearAllMessages.prepare(QLatin1String("DELETE FROM part_refs WHERE mailbox = ?"))) {
+        emitError(tr("Failed to prepare m_queryClearAllMessages"), m_queryClearAllMessages);
+        return false;
+    }
+    return true;
+}
+
+void PackPartCache::importLegacyFiles(const QString &relativePath)
+{
+    // Older versions used one directory per mailbox, named after the base64 of its name, with a file for each part.  The
+    // base64 can contain slashes, so some of these directories are nested.
+    QDir dir(m_cacheDir + relativePath);
+    Q_FOREACH(const QString &dirName, dir.entryList(QDir::Dirs | QDir::NoDotAndDotDot)) {
+        importLegacyFiles(relativePath.isEmpty() ? dirName : relativePath + QLatin1Char('/') + dirName);
+    }
+    if (relativePath.isEmpty())
+        return;
+
+    const QStringList files = dir.entryList(QStringList() << QLatin1String("*.cache"), QDir::Files);
+    if (!files.isEmpty()) {
+        // A trailing slash or a pair of them was lost when creating the directories; such parts cannot be attributed to
+        // their mailbox anymore, but they are still removed
+        const QByteArray encoded = relativePath.toUtf8();
+        const QByteArray decoded = QByteArray::fromBase64(encoded);
+        if (decoded.toBase64() == encoded) {
+            Common::SqlTransactionAutoAborter txn(&m_db);
+            const QString mailbox = QString::fromUtf8(decoded);
+            Q_FOREACH(const QString &fileName, files) {
+                const QString base = fileName.left(fileName.lastIndexOf(QLatin1Char('.')));
+                const int separator = base.indexOf(QLatin1Char('_'));
+                bool ok;
+                const uint uid = base.left(separator).toUInt(&ok);
+                if (separator == -1 || !ok)
+                    continue;
+                QFile file(dir.filePath(fileName));
+                if (!file.open(QIODevice::ReadOnly))
+                    continue;
+                const QByteArray data = qUncompress(file.readAll());
+                file.close();
+                if (!data.isEmpty())
+                    setMsgPart(mailbox, uid, base.mid(separator + 1), data);
+            }
+            txn.commit();
+        }
+
+        // Only remove the old files once they are safely in the packs
+        Q_FOREACH(const QString &fileName, files) {
+            dir.remove(fileName);
+        }
+    }
+    // This only succeeds for the directories which are empty by now, i.e. never for the one with the packs
+    QDir(m_cacheDir).rmdir(relativePath);
+}
+
+QString PackPartCache::packFileName(const int pack) const
+{
+    return m_packDir + QString::number(pack) + QLatin1String(".pack");
+}
+
+QFile *PackPartCache::packForReading(const int pack) const
+{
+    QHash<int, QFile *>::const_iterator it = m_readers.constFind(pack);
+    if (it != m_readers.constEnd())
+        return *it;
+
+    QFile *file = new QFile(packFileName(pack));
+    if (!file->open(QIODevice::ReadOnly)) {
+        emit error(tr("Couldn't open pack %1: %2").arg(file->fileName(), file->errorString()));
+        delete file;
+        return 0;
+    }
+    m_readers[pack] = file;
+    return file;
+}
+
+bool PackPartCache::appendToPack(const QByteArray &blob, int &pack, qint64 &offset)
+{
+    if (m_writer && m_writer->size() > 0 && m_writer->size() + blob.size() > packSizeLimit) {
+        delete m_writer;
+        m_writer = 0;
+        ++m_currentPack;
+    }
+    if (!m_writer) {
+        m_writer = new QFile(packFileName(m_currentPack));
+        if (!m_writer->open(QIODevice::WriteOnly | QIODevice::Append)) {
+            emit error(tr("Couldn't open pack %1 for writing: %2").arg(m_writer->fileName(), m_writer->errorString()));
+            delete m_writer;
+            m_writer = 0;
+            return false;
+        }
+    }
+
+    offset = m_writer->size();
+    pack = m_currentPack;
+    if (m_writer->write(blob) != blob.size() || !m_writer->flush()) {
+        emit error(tr("Couldn't write to pack %1: %2").arg(m_writer->fileName(), m_writer->errorString()));
+        return false;
+    }
+    return true;
+}
+
+QByteArray PackPartCache::readRawBlob(const int pack, const qint64 offset, const qint64 length) const
+{
+    QFile *file = packForReading(pack);
+    if (!file)
+        return QByteArray();
+    if (uchar *data = file->map(offset, length)) {
+        QByteArray res(reinterpret_cast<const char *>(data), length);
+        file->unmap(data);
+        return res;
+    }
+    // Mapping can fail on some filesystems; reading the old-fashioned way is still better than nothing
+    if (!file->seek(offset))
+        return QByteArray();
+    return file->read(length);
+}
+
+QByteArray PackPartCache::readBlob(const int pack, const qint64 offset, const qint64 length, const bool compressed) const
+{
+    if (!compressed) {
+        // A single copy out of the mapped pages
+        return readRawBlob(pack, offset, length);
+    }
+
+    QFile *file = packForReading(pack);
+    if (!file)
+        return QByteArray();
+    if (uchar *data = file->map(offset, length)) {
+        // Decompress straight from the mapped pages, without an intermediate copy of the compressed data
+        QByteArray res = qUncompress(data, length);
+        file->unmap(data);
+        return res;
+    }
+    return qUncompress(readRawBlob(pack, offset, length));
+}
+
+QByteArray PackPartCache::messagePart(const QString &mailbox, uint uid, const QString &partId) const
+{
+    m_queryPartBlob.bindValue(0, mailbox);
+    m_queryPartBlob.bindValue(1, uid);
+    m_queryPartBlob.bindValue(2, partId);
+    if (!m_queryPartBlob.exec()) {
+        emitError(tr("Query m_queryPartBlob failed"), m_queryPartBlob);
+        return QByteArray();
+    }
+    if (!m_queryPartBlob.first())
+        return QByteArray();
+    const int pack = m_queryPartBlob.value(0).toInt();
+    const qint64 offset = m_queryPartBlob.value(1).toLongLong();
+    const qint64 length = m_queryPartBlob.value(2).toLongLong();
+    const bool compressed = m_queryPartBlob.value(3).toBool();
+    m_queryPartBlob.finish();
+    return readBlob(pack, offset, length, compressed);
+}
+
+bool PackPartCache::contains(const QString &mailbox, uint uid, const QString &partId) const
+{
+    QHash<QString, QHash<uint, QSet<QString> > >::const_iterator mailboxIt = m_locations.constFind(mailbox);
+    if (mailboxIt == m_locations.constEnd())
+        return false;
+    QHash<uint, QSet<QString> >::const_iterator messageIt = mailboxIt->constFind(uid);
+    return messageIt != mailboxIt->constEnd() && messageIt->contains(partId);
+}
+
+void PackPartCache::setMsgPart(const QString &mailbox, uint uid, const QString &partId, const QByteArray &data)
+{
+    const QByteArray hash = QCryptographicHash::hash(data, QCryptographicHash::Sha1);
+    m_queryBlobByHash.bindValue(0, hash);
+    if (!m_queryBlobByHash.exec()) {
+        emitError(tr("Query m_queryBlobByHash failed"), m_queryBlobByHash);
+        return;
+    }
+
+    qint64 blob;
+    if (m_queryBlobByHash.first()) {
+        // This very data is already stored, so let's just refer to them
+        blob = m_queryBlobByHash.value(0).toLongLong();
+        m_queryBlobByHash.finish();
+    } else {
+        // Most of the big attachments are images or archives; there's no point in trying to compress all of them
+        const int probeSize = qMin(data.size(), compressionProbeSize);
+        const bool compress = qCompress(data.left(probeSize)).size() < probeSize * 9 / 10;
+        const QByteArray stored = compress ? qCompress(data) : data;
+        int pack;
+        qint64 offset;
+        if (!appendToPack(stored, pack, offset))
+            return;
+        m_queryAddBlob.bindValue(0, hash);
+        m_queryAddBlob.bindValue(1, pack);
+        m_queryAddBlob.bindValue(2, offset);
+        m_queryAddBlob.bindValue(3, stored.size());
+        m_queryAddBlob.bindValue(4, compress);
+        if (!m_queryAddBlob.exec()) {
+            emitError(tr("Query m_queryAddBlob failed"), m_queryAddBlob);
+            return;
+        }
+        blob = m_queryAddBlob.lastInsertId().toLongLong();
+    }
+
+    m_querySetPartRef.bindValue(0, mailbox);
+    m_querySetPartRef.bindValue(1, uid);
+    m_querySetPartRef.bindValue(2, partId);
+    m_querySetPartRef.bindValue(3, blob);
+    if (!m_querySetPartRef.exec()) {
+        emitError(tr("Query m_querySetPartRef failed"), m_querySetPartRef);
+        return;
+    }
+    m_locations[mailbox][uid].insert(partId);
+}
+
+qint64 PackPartCache::storedSize() const
+{
+    QSqlQuery q(m_db);
+    if (!q.exec(QLatin1String("SELECT COALESCE(SUM(length), 0) FROM blobs "
+                              "WHERE EXISTS (SELECT 1 FROM part_refs WHERE part_refs.blob = blobs.id)"))) {
+        emitError(tr("Failed to determine the size of the packs"), q);
+        return 0;
+    }
+    return q.first() ? q.value(0).toLongLong() : 0;
+}
+
+qint64 PackPartCache::messageSize(const QString &mailbox, uint uid) const
+{
+    QHash<QString, QHash<uint, QSet<QString> > >::const_iterator it = m_locations.constFind(mailbox);
+    if (it == m_locations.constEnd() || !it->contains(uid))
+        return 0;
+
+    m_queryMessageSize.bindValue(0, mailbox);
+    m_queryMessageSize.bindValue(1, uid);
+    if (!m_queryMessageSize.exec()) {
+        emitError(tr("Query m_queryMessageSize failed"), m_queryMessageSize);
+        return 0;
+    }
+    qint64 res = 0;
+    if (m_queryMessageSize.first())
+        res = m_queryMessageSize.value(0).toLongLong();
+    m_queryMessageSize.finish();
+    return res;
+}
+
+void PackPartCache::clearAllMessages(const QString &mailbox)
+{
+    m_queryClearAllMessages.bindValue(0, mailbox);
+    if (!m_queryClearAllMessages.exec()) {
+        emitError(tr("Query m_queryClearAllMessages failed"), m_queryClearAllMessages);
+    }
+    m_locations.remove(mailbox);
+    scheduleCompaction();
+}
+
+void PackPartCache::clearMessage(const QString mailbox, uint uid)
+{
+    // The index mirrors the part_refs table, so there's no need to touch the DB for messages without any big parts
+    QHash<QString, QHash<uint, QSet<QString> > >::iterator it = m_locations.find(mailbox);
+    if (it == m_locations.end() || it->remove(uid) == 0)
+        return;
+    m_queryClearMessage.bindValue(0, mailbox);
+    m_queryClearMessage.bindValue(1, uid);
+    if (!m_queryClearMessage.exec()) {
+        emitError(tr("Query m_queryClearMessage failed"), m_queryClearMessage);
+    }
+    scheduleCompaction();
+}
+
+void PackPartCache::scheduleCompaction()
+{
+    // Restarting the timer means that nothing happens while the messages are being removed in bulk
+    m_compactionTimer->start();
+}
+
+void PackPartCache::compact()
+{
+    QSqlQuery q(m_db);
+    if (!q.exec(QLatin1String("SELECT pack, SUM(length), "
+                              "SUM(CASE WHEN EXISTS (SELECT 1 FROM part_refs WHERE part_refs.blob = blobs.id) THEN length ELSE 0 END) "
+                              "FROM blobs GROUP BY pack"))) {
+        emitError(tr("Failed to find packs for compaction"), q);
+        return;
+    }
+    int victim = -1;
+    int candidates = 0;
+    while (q.next()) {
+        const int pack = q.value(0).toInt();
+        if (pack == m_currentPack)
+            continue;
+        // Rewriting a pack is worth it only when most of it is wasted
+        if (q.value(2).toLongLong() * 2 <= q.value(1).toLongLong()) {
+            if (victim == -1)
+                victim = pack;
+            ++candidates;
+        }
+    }
+    q.finish();
+    if (victim == -1)
+        return;
+
+    Common::SqlTransactionAutoAborter txn(&m_db);
+    QSqlQuery live(m_db);
+    QSqlQuery move(m_db);
+    if (!live.prepare(QLatin1String("SELECT id, offset, length FROM blobs WHERE pack = ? "
+                                    "AND EXISTS (SELECT 1 FROM part_refs WHERE part_refs.blob = blobs.id)")) ||
+            !move.prepare(QLatin1String("UPDATE blobs SET pack = ?, offset = ? WHERE id = ?"))) {
+        emitError(tr("Failed to prepare the compaction"), live);
+        return;
+    }
+    live.bindValue(0, victim);
+    if (!live.exec()) {
+        emitError(tr("Failed to list the live blobs"), live);
+        return;
+    }
+    while (live.next()) {
+        const qint64 length = live.value(2).toLongLong();
+        // There's no need to decompress anything, the blobs are copied verbatim
+        const QByteArray raw = readRawBlob(victim, live.value(1).toLongLong(), length);
+        if (raw.size() != length) {
+            emit error(tr("Pack %1 is damaged, not compacting it").arg(packFileName(victim)));
+            return;
+        }
+        int pack;
+        qint64 offset;
+        if (!appendToPack(raw, pack, offset))
+            return;
+        move.bindValue(0, pack);
+        move.bindValue(1, offset);
+        move.bindValue(2, live.value(0));
+        if (!move.exec()) {
+            emitError(tr("Failed to move a blob"), move);
+            return;
+        }
+    }
+    live.finish();
+
+    if (!q.exec(QString::fromUtf8("DELETE FROM blobs WHERE pack = %1").arg(victim))) {
+        emitError(tr("Failed to remove the unused blobs"), q);
+        return;
+    }
+    if (!txn.commit()) {
+        emit error(tr("PackPartCache: Failed to commit the compaction: %1").arg(m_db.lastError().text()));
+        return;
+    }
+
+    delete m_readers.take(victim);
+    QFile::remove(packFileName(victim));
+
+    if (candidates > 1)
+        m_compactionTimer->start();
+}
+
+void PackPartCache::emitError(const QString &message, const QSqlQuery &query) const
+{
+    const QString text = QString::fromUtf8("PackPartCache: Query Error: %1: %2").arg(message, query.lastError().text());
+    qDebug() << text;
+    emit error(text);
+}
+
+}
+}
@@ -0,0 +1,156 @@
+/* Copyright (C) 2006 - 2013 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef IMAP_MODEL_PACKPARTCACHE_H
+#define IMAP_MODEL_PACKPARTCACHE_H
+
+#include <QHash>
+#include <QObject>
+#include <QSet>
+#include <QSqlDatabase>
+#include <QSqlQuery>
+
+class QFile;
+class QTimer;
+
+namespace Imap
+{
+
+namespace Mailbox
+{
+
+/** @short Cache for storing big message parts in append-only pack files
+
+The data of each part is appended to the current pack file.  Parts which do not compress well, like most of the images
+and PDF files, are stored verbatim so that reading them is just a matter of copying them out of the mapped pack.  An SQLite index maps the SHA-1 of the
+uncompressed data to its location in the packs, and a separate table refers to these blobs from the (mailbox, UID, part)
+triples.  The same attachment which is present in many messages, or a message which got copied to another mailbox, is
+therefore stored just once.
+
+Removing a message only drops the references.  The space occupied by the blobs which are no longer referenced is reclaimed
+by the compaction which runs from a timer once the cache has been idle for a while; it copies the live blobs of a mostly
+unused pack to the current pack and removes the old file.
+
+The API is designed to be "similar" to the AbstractCache, but because certain
+operations do not really make much sense (like working with a list of mailboxes),
+we do not inherit from that abstract base class.
+*/
+class PackPartCache : public QObject
+{
+    Q_OBJECT
+public:
+    /** @short Create the cache occupying the "packs" subdirectory of @arg cacheDir */
+    PackPartCache(QObject *parent, const QString &name, const QString &cacheDir);
+    virtual ~PackPartCache();
+
+    /** @short Open the index and import the parts which were stored by older versions as one file per part */
+    bool open();
+
+    /** @short Delete all data of message parts which belongs to that particular mailbox */
+    void clearAllMessages(const QString &mailbox);
+    /** @short Delete all data for a particular message in the given mailbox */
+    void clearMessage(const QString mailbox, uint uid);
+
+    /** @short Is the part stored in this cache?
+
+    This is answered from memory, so the callers can find out where to look without querying the databases.
+    */
+    bool contains(const QString &mailbox, uint uid, const QString &partId) const;
+
+    /** @short Return data for some message part, or a null QByteArray if not found */
+    QByteArray messagePart(const QString &mailbox, uint uid, const QString &partId) const;
+    /** @short Store the data for a specified message part */
+    void setMsgPart(const QString &mailbox, uint uid, const QString &partId, const QByteArray &data);
+
+    /** @short Return the number of bytes occupied by the blobs which are still referenced */
+    qint64 storedSize() const;
+    /** @short Return the number of bytes which would be reclaimed by removing the message
+
+    The blobs which are shared with other messages are not counted.
+    */
+    qint64 messageSize(const QString &mailbox, uint uid) const;
+
+public slots:
+    /** @short Rewrite a single pack which consists mostly of unreferenced data
+
+    The timer is restarted when there are more packs which are worth compacting, so that the cache does not block for too
+    long at once.
+    */
+    void compact();
+
+signals:
+    /** @short An error has occurred while performing cache operations */
+    void error(const QString &message) const;
+
+private:
+    bool createTables();
+    bool prepareQueries();
+    /** @short Move the parts from the one-file-per-part layout used by older versions into the packs
+
+    The @arg relativePath is the directory below the cache root which gets processed along with all its subdirectories.
+    */
+    void importLegacyFiles(const QString &relativePath = QString());
+    /** @short Append the @arg blob to the current pack and return its location */
+    bool appendToPack(const QByteArray &blob, int &pack, qint64 &offset);
+    /** @short Map the blob into memory and decompress it if needed */
+    QByteArray readBlob(const int pack, const qint64 offset, const qint64 length, const bool compressed) const;
+    /** @short Return the content of a blob exactly as it is stored in the pack */
+    QByteArray readRawBlob(const int pack, const qint64 offset, const qint64 length) const;
+    /** @short Return an open file for reading of the given pack */
+    QFile *packForReading(const int pack) const;
+    QString packFileName(const int pack) const;
+    /** @short Make sure that the compaction gets a chance to run once the cache is idle */
+    void scheduleCompaction();
+
+    void emitError(const QString &message, const QSqlQuery &query) const;
+
+    /** @short Directory with the packs and their index */
+    QString m_packDir;
+    /** @short The root of the cache, as used by older versions */
+    QString m_cacheDir;
+    QString m_name;
+
+    QSqlDatabase m_db;
+    mutable QSqlQuery m_queryPartBlob;
+    mutable QSqlQuery m_queryBlobByHash;
+    mutable QSqlQuery m_queryMessageSize;
+    QSqlQuery m_queryAddBlob;
+    QSqlQuery m_querySetPartRef;
+    QSqlQuery m_queryClearMessage;
+    QSqlQuery m_queryClearAllMessages;
+
+    /** @short Number of the pack which new data are appended to */
+    int m_currentPack;
+    /** @short Files opened for reading, indexed by the pack number */
+    mutable QHash<int, QFile *> m_readers;
+    QFile *m_writer;
+    QTimer *m_compactionTimer;
+
+    /** @short The parts which are stored in the packs, indexed by mailbox and UID */
+    QHash<QString, QHash<uint, QSet<QString> > > m_locations;
+};
+
+}
+
+}
+
+#endif /* IMAP_MODEL_PACKPARTCACHE_H */
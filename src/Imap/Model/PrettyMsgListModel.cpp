@@ -220,6 +220,9 @@ bool PrettyMsgListModel::filterAcceptsRow(int source_row, const QModelIndex &sou
     if (!m_hideRead)
         return true;
 
+    if (ThreadingMsgListModel *threadingModel = qobject_cast<ThreadingMsgListModel*>(sourceModel()))
+        return threadingModel->isVisibleWhenHidingRead(source_row, source_parent);
+
     QModelIndex source_index = sourceModel()->index(source_row, 0, source_parent);
 
     for (QModelIndex test = source_index; test.isValid(); test = test.parent())
@@ -23,14 +23,94 @@
 #include "SQLCache.h"
 #include <QSqlError>
 #include <QSqlRecord>
+#include <QRegExp>
+#include <QSet>
+#include <QStringList>
 #include <QTimer>
 #include "Common/SqlTransactionAutoAborter.h"
+#include "Imap/Encoders.h"
 
 //#define CACHE_DEBUG
 
 namespace
 {
 static int streamVersion = QDataStream::Qt_4_6;
+
+/** @short Bits used for storing the system flags in the flags table */
+struct SystemFlag {
+    const char *name;
+    int bit;
+};
+
+static const SystemFlag systemFlags[] = {
+    {"\\Answered", 1 << 0},
+    {"\\Deleted", 1 << 1},
+    {"\\Draft", 1 << 2},
+    {"\\Flagged", 1 << 3},
+    {"\\Recent", 1 << 4},
+    {"\\Seen", 1 << 5}
+};
+
+/** @short Set when the message has some keywords in the msg_keywords table */
+static const int flagsHaveKeywords = 1 << 30;
+
+/** @short Number of consecutive UIDs whose metadata share a single compressed page */
+static const uint metadataPageSize = 64;
+
+/** @short How many decompressed pages to keep in memory */
+static const int metadataPageCacheSize = 32;
+
+/** @short Messages are stored in the full-text index under a docid which combines the mailbox ID and the UID */
+qint64 fullTextDocId(const int mailboxId, const uint uid)
+{
+    return (static_cast<qint64>(mailboxId) << 32) | uid;
+}
+
+/** @short Pages of metadata are indexed in memory by the mailbox ID and the page number */
+qint64 metadataPageKey(const int mailboxId, const uint page)
+{
+    return (static_cast<qint64>(mailboxId) << 32) | page;
+}
+
+/** @short Convert a list of addresses into something which is suitable for the full-text index */
+QString fullTextAddresses(const QList<Imap::Message::MailAddress> &addresses)
+{
+    QStringList res;
+    Q_FOREACH(const Imap::Message::MailAddress &address, addresses) {
+        res << address.name << address.mailbox << address.host;
+    }
+    return res.join(QLatin1String(" ")).toLower();
+}
+
+int systemFlagBit(const QString &flag)
+{
+    for (size_t i = 0; i < sizeof(systemFlags) / sizeof(systemFlags[0]); ++i) {
+        if (flag.compare(QLatin1String(systemFlags[i].name), Qt::CaseInsensitive) == 0)
+            return systemFlags[i].bit;
+    }
+    return 0;
+}
+
+/** @short Produce the uncompressed record which is stored in a metadata page */
+QByteArray serializeMetadata(const Imap::Mailbox::AbstractCache::MessageDataBundle &metadata)
+{
+    QByteArray buf;
+    QDataStream stream(&buf, QIODevice::ReadWrite);
+    stream.setVersion(streamVersion);
+    stream << metadata.envelope << metadata.internalDate << metadata.size << metadata.serializedBodyStructure
+           << metadata.hdrReferences << metadata.hdrListPost << metadata.hdrListPostNo;
+    return buf;
+}
+
+/** @short Fill the @arg metadata from the record produced by serializeMetadata() */
+void deserializeMetadata(const uint uid, const QByteArray &data, Imap::Mailbox::AbstractCache::MessageDataBundle &metadata)
+{
+    metadata.uid = uid;
+    QDataStream stream(data);
+    stream.setVersion(streamVersion);
+    stream >> metadata.envelope >> metadata.internalDate >> metadata.size >> metadata.serializedBodyStructure
+           >> metadata.hdrReferences >> metadata.hdrListPost >> metadata.hdrListPostNo;
+}
 }
 
 namespace Imap
@@ -60,7 +140,9 @@ namespace Mailbox
 QDate SQLCache::accessingThresholdDate = QDate(2012, 11, 1);
 
 SQLCache::SQLCache(QObject *parent):
-    AbstractCache(parent), delayedCommit(0), tooMuchTimeWithoutCommit(0), inTransaction(false), m_updateAccessIfOlder(0)
+    AbstractCache(parent), delayedCommit(0), tooMuchTimeWithoutCommit(0), inTransaction(false), m_updateAccessIfOlder(0),
+    m_fullTextIndex(false), m_batchDepth(0), m_metadataPages(metadataPageCacheSize),
+    m_threadLinksMailbox(-1)
 {
 }
 
@@ -94,6 +176,8 @@ void SQLCache::init()
 
 SQLCache::~SQLCache()
 {
+    if (db.isOpen())
+        flushStagedWrites();
     timeToCommit();
     db.close();
     QSqlDatabase::removeDatabase(db.connectionName());
@@ -108,6 +192,129 @@ if ( ! q.exec( QLatin1String("CREATE TABLE msg_threading ( " \
     return false; \
 }
 
+#define TROJITA_SQL_CACHE_CREATE_MAILBOXES \
+if (! q.exec(QLatin1String("CREATE TABLE mailboxes ( " \
+                           "id INTEGER PRIMARY KEY, " \
+                           "name STRING NOT NULL UNIQUE" \
+                           " )"))) { \
+    emitError(SQLCache::tr("Can't create table mailboxes"), q); \
+    return false; \
+}
+
+// The tables below are keyed by the mailbox_id. Their composite primary keys double as the indexes for the (mailbox_id, uid)
+// lookups, so no extra indexes are needed.
+#define TROJITA_SQL_CACHE_CREATE_V8_THREADING(TABLE) \
+if (! q.exec(QLatin1String("CREATE TABLE " TABLE " ( " \
+                           "mailbox_id INTEGER NOT NULL PRIMARY KEY, " \
+                           "threading BINARY" \
+                           " )"))) { \
+    emitError(SQLCache::tr("Can't create table %1").arg(QLatin1String(TABLE)), q); \
+    return false; \
+}
+
+#define TROJITA_SQL_CACHE_CREATE_V8_MSG_METADATA(TABLE) \
+if (! q.exec(QLatin1String("CREATE TABLE " TABLE " ( " \
+                           "mailbox_id INTEGER NOT NULL, " \
+                           "uid INT NOT NULL, " \
+                           "data BINARY, " \
+                           "lastAccessDate INT, " \
+                           "PRIMARY KEY (mailbox_id, uid)" \
+                           " )"))) { \
+    emitError(SQLCache::tr("Can't create table %1").arg(QLatin1String(TABLE)), q); \
+    return false; \
+}
+
+#define TROJITA_SQL_CACHE_CREATE_V8_FLAGS(TABLE) \
+if (! q.exec(QLatin1String("CREATE TABLE " TABLE " ( " \
+                           "mailbox_id INTEGER NOT NULL, " \
+                           "uid INT NOT NULL, " \
+                           "flags BINARY, " \
+                           "PRIMARY KEY (mailbox_id, uid)" \
+                           " )"))) { \
+    emitError(SQLCache::tr("Can't create table %1").arg(QLatin1String(TABLE)), q); \
+    return false; \
+}
+
+#define TROJITA_SQL_CACHE_CREATE_V8_PARTS(TABLE) \
+if (! q.exec(QLatin1String("CREATE TABLE " TABLE " ( " \
+                           "mailbox_id INTEGER NOT NULL, " \
+                           "uid INT NOT NULL, " \
+                           "part_id BINARY, " \
+                           "data BINARY, " \
+                           "PRIMARY KEY (mailbox_id, uid, part_id)" \
+                           " )"))) { \
+    emitError(SQLCache::tr("Can't create table %1").arg(QLatin1String(TABLE)), q); \
+    return false; \
+}
+
+// V9 stores the system flags as a bitmask and the keywords in a table of their own so that they can be queried
+#define TROJITA_SQL_CACHE_CREATE_V9_FLAGS \
+if (! q.exec(QLatin1String("CREATE TABLE flags ( " \
+                           "mailbox_id INTEGER NOT NULL, " \
+                           "uid INT NOT NULL, " \
+                           "system_flags INT NOT NULL, " \
+                           "PRIMARY KEY (mailbox_id, uid)" \
+                           " )"))) { \
+    emitError(SQLCache::tr("Can't create table flags"), q); \
+    return false; \
+} \
+if (! q.exec(QLatin1String("CREATE INDEX flags_system_flags ON flags ( mailbox_id, system_flags )"))) { \
+    emitError(SQLCache::tr("Can't create index flags_system_flags"), q); \
+    return false; \
+} \
+if (! q.exec(QLatin1String("CREATE TABLE msg_keywords ( " \
+                           "mailbox_id INTEGER NOT NULL, " \
+                           "uid INT NOT NULL, " \
+                           "keyword STRING NOT NULL, " \
+                           "PRIMARY KEY (mailbox_id, uid, keyword)" \
+                           " )"))) { \
+    emitError(SQLCache::tr("Can't create table msg_keywords"), q); \
+    return false; \
+} \
+if (! q.exec(QLatin1String("CREATE INDEX msg_keywords_keyword ON msg_keywords ( mailbox_id, keyword COLLATE NOCASE )"))) { \
+    emitError(SQLCache::tr("Can't create index msg_keywords_keyword"), q); \
+    return false; \
+}
+
+// V11 stores the metadata of up to metadataPageSize consecutive UIDs as a single compressed blob
+#define TROJITA_SQL_CACHE_CREATE_V11_METADATA_PAGES \
+if (! q.exec(QLatin1String("CREATE TABLE msg_metadata_pages ( " \
+                           "mailbox_id INTEGER NOT NULL, " \
+                           "page INT NOT NULL, " \
+                           "messages INT NOT NULL, " \
+                           "data BINARY, " \
+                           "PRIMARY KEY (mailbox_id, page)" \
+                           " )"))) { \
+    emitError(SQLCache::tr("Can't create table msg_metadata_pages"), q); \
+    return false; \
+}
+
+// V12 stores each node of the threading as a row of its own, linked to its parent and to its previous sibling
+#define TROJITA_SQL_CACHE_CREATE_V12_THREAD_NODES \
+if (! q.exec(QLatin1String("CREATE TABLE msg_thread_nodes ( " \
+                           "mailbox_id INTEGER NOT NULL, " \
+                           "node INTEGER NOT NULL, " \
+                           "parent INTEGER NOT NULL, " \
+                           "previous INTEGER NOT NULL, " \
+                           "PRIMARY KEY (mailbox_id, node)" \
+                           " )"))) { \
+    emitError(SQLCache::tr("Can't create table msg_thread_nodes"), q); \
+    return false; \
+}
+
+// V10 lets the cache expiration walk through the messages in the order of their last access
+#define TROJITA_SQL_CACHE_CREATE_V10_LAST_ACCESS_INDEX \
+if (! q.exec(QLatin1String("CREATE INDEX msg_metadata_last_access ON msg_metadata ( lastAccessDate, mailbox_id, uid )"))) { \
+    emitError(SQLCache::tr("Can't create index msg_metadata_last_access"), q); \
+    return false; \
+}
+
+#define TROJITA_SQL_CACHE_CREATE_CHILD_MAILBOXES_INDEX \
+if (! q.exec(QLatin1String("CREATE INDEX child_mailboxes_parent ON child_mailboxes ( parent )"))) { \
+    emitError(SQLCache::tr("Can't create index child_mailboxes_parent"), q); \
+    return false; \
+}
+
 #define TROJITA_SQL_CACHE_CREATE_SYNC_STATE \
 if ( ! q.exec( QLatin1String("CREATE TABLE mailbox_sync_state ( " \
                              "mailbox STRING NOT NULL PRIMARY KEY, " \
@@ -117,6 +324,15 @@ if ( ! q.exec( QLatin1String("CREATE TABLE mailbox_sync_state ( " \
     return false; \
 }
 
+#define TROJITA_SQL_CACHE_CREATE_MAILBOX_STATUS \
+if (! q.exec(QLatin1String("CREATE TABLE mailbox_status ( " \
+                           "mailbox STRING NOT NULL PRIMARY KEY, " \
+                           "status BINARY " \
+                           " )"))) { \
+    emitError(SQLCache::tr("Can't create table mailbox_status"), q); \
+    return false; \
+}
+
 #define TROJITA_SQL_CACHE_CREATE_MSG_METADATA \
     if (! q.exec(QLatin1String("CREATE TABLE msg_metadata (" \
                                "mailbox STRING NOT NULL, " \
@@ -207,13 +423,80 @@ bool SQLCache::open(const QString &name, const QString &fileName)
         }
     }
 
-    if (version != 6) {
+    if (version == 6) {
+        // V7 adds a table for remembering the results of the STATUS command
+        TROJITA_SQL_CACHE_CREATE_MAILBOX_STATUS;
+        version = 7;
+        if (! q.exec(QLatin1String("UPDATE trojita SET version = 7;"))) {
+            emitError(tr("Failed to update cache DB scheme from v6 to v7"), q);
+            return false;
+        }
+    }
+
+    if (version == 7) {
+        // V8 replaces the mailbox names in the per-message tables by integer IDs from the new mailboxes table
+        if (!migrateToV8())
+            return false;
+        version = 8;
+        if (! q.exec(QLatin1String("UPDATE trojita SET version = 8;"))) {
+            emitError(tr("Failed to update cache DB scheme from v7 to v8"), q);
+            return false;
+        }
+    }
+
+    if (version == 8) {
+        // V9 makes the flags queryable; the blobs have to be decoded, which is why this is not a plain SQL statement
+        if (!migrateToV9())
+            return false;
+        version = 9;
+        if (! q.exec(QLatin1String("UPDATE trojita SET version = 9;"))) {
+            emitError(tr("Failed to update cache DB scheme from v8 to v9"), q);
+            return false;
+        }
+    }
+
+    if (version == 9) {
+        if (!migrateToV10())
+            return false;
+        version = 10;
+        if (! q.exec(QLatin1String("UPDATE trojita SET version = 10;"))) {
+            emitError(tr("Failed to update cache DB scheme from v9 to v10"), q);
+            return false;
+        }
+    }
+
+    if (version == 10) {
+        if (!migrateToV11())
+            return false;
+        version = 11;
+        if (! q.exec(QLatin1String("UPDATE trojita SET version = 11;"))) {
+            emitError(tr("Failed to update cache DB scheme from v10 to v11"), q);
+            return false;
+        }
+    }
+
+    if (version == 11) {
+        if (!migrateToV12())
+            return false;
+        version = 12;
+        if (! q.exec(QLatin1String("UPDATE trojita SET version = 12;"))) {
+            emitError(tr("Failed to update cache DB scheme from v11 to v12"), q);
+            return false;
+        }
+    }
+
+    if (version != 12) {
         emitError(tr("Unknown version"));
         return false;
     }
 
     txn.commit();
 
+    // The journal mode cannot be changed from within a transaction
+    if (!setupJournal())
+        return false;
+    setupFullTextIndex();
+
     if (! prepareQueries()) {
         return false;
     }
@@ -232,7 +515,7 @@ bool SQLCache::createTables()
         emitError(tr("Failed to prepare table structures"), q);
         return false;
     }
-    if (! q.exec(QLatin1String("INSERT INTO trojita ( version ) VALUES ( 6 )"))) {
+    if (! q.exec(QLatin1String("INSERT INTO trojita ( version ) VALUES ( 12 )"))) {
         emitError(tr("Can't store version info"), q);
         return false;
     }
@@ -256,35 +539,285 @@ bool SQLCache::createTables()
         return false;
     }
 
-    TROJITA_SQL_CACHE_CREATE_MSG_METADATA;
+    TROJITA_SQL_CACHE_CREATE_CHILD_MAILBOXES_INDEX;
+    TROJITA_SQL_CACHE_CREATE_MAILBOXES;
+    TROJITA_SQL_CACHE_CREATE_V8_MSG_METADATA("msg_metadata");
+    TROJITA_SQL_CACHE_CREATE_V10_LAST_ACCESS_INDEX;
+    TROJITA_SQL_CACHE_CREATE_V11_METADATA_PAGES;
+    TROJITA_SQL_CACHE_CREATE_V9_FLAGS;
+    TROJITA_SQL_CACHE_CREATE_V8_PARTS("parts");
+    TROJITA_SQL_CACHE_CREATE_V12_THREAD_NODES;
+    TROJITA_SQL_CACHE_CREATE_SYNC_STATE;
+    TROJITA_SQL_CACHE_CREATE_MAILBOX_STATUS;
+
+    return true;
+}
+
+bool SQLCache::migrateToV8()
+{
+    QSqlQuery q(QString(), db);
 
-    if (! q.exec(QLatin1String("CREATE TABLE flags ("
-                               "mailbox STRING NOT NULL, "
-                               "uid INT NOT NULL, "
-                               "flags BINARY, "
-                               "PRIMARY KEY (mailbox, uid)"
-                               ")"))) {
-        emitError(tr("Can't create table flags"), q);
+    TROJITA_SQL_CACHE_CREATE_MAILBOXES;
+    if (!q.exec(QLatin1String("INSERT INTO mailboxes ( name ) "
+                              "SELECT mailbox FROM msg_metadata UNION SELECT mailbox FROM flags "
+                              "UNION SELECT mailbox FROM parts UNION SELECT mailbox FROM msg_threading"))) {
+        emitError(tr("Failed to populate the mailboxes table"), q);
+        return false;
     }
 
-    if (! q.exec(QLatin1String("CREATE TABLE parts ("
-                               "mailbox STRING NOT NULL, "
-                               "uid INT NOT NULL, "
-                               "part_id BINARY, "
-                               "data BINARY, "
-                               "PRIMARY KEY (mailbox, uid, part_id)"
-                               ")"))) {
-        emitError(tr("Can't create table parts"), q);
+    TROJITA_SQL_CACHE_CREATE_V8_MSG_METADATA("msg_metadata_v8");
+    TROJITA_SQL_CACHE_CREATE_V8_FLAGS("flags_v8");
+    TROJITA_SQL_CACHE_CREATE_V8_PARTS("parts_v8");
+    TROJITA_SQL_CACHE_CREATE_V8_THREADING("msg_threading_v8");
+
+    QStringList statements;
+    statements << QLatin1String("INSERT INTO msg_metadata_v8 SELECT mailboxes.id, uid, data, lastAccessDate "
+                                "FROM msg_metadata JOIN mailboxes ON mailboxes.name = msg_metadata.mailbox")
+               << QLatin1String("INSERT INTO flags_v8 SELECT mailboxes.id, uid, flags "
+                                "FROM flags JOIN mailboxes ON mailboxes.name = flags.mailbox")
+               << QLatin1String("INSERT INTO parts_v8 SELECT mailboxes.id, uid, part_id, data "
+                                "FROM parts JOIN mailboxes ON mailboxes.name = parts.mailbox")
+               << QLatin1String("INSERT INTO msg_threading_v8 SELECT mailboxes.id, threading "
+                                "FROM msg_threading JOIN mailboxes ON mailboxes.name = msg_threading.mailbox");
+    Q_FOREACH(const QString &table, QStringList() << QLatin1String("msg_metadata") << QLatin1String("flags")
+              << QLatin1String("parts") << QLatin1String("msg_threading")) {
+        statements << QString::fromUtf8("DROP TABLE %1").arg(table)
+                   << QString::fromUtf8("ALTER TABLE %1_v8 RENAME TO %1").arg(table);
+    }
+    Q_FOREACH(const QString &statement, statements) {
+        if (!q.exec(statement)) {
+            emitError(tr("Failed to migrate the cache to v8"), q);
+            return false;
+        }
     }
 
-    TROJITA_SQL_CACHE_CREATE_THREADING;
-    TROJITA_SQL_CACHE_CREATE_SYNC_STATE;
+    TROJITA_SQL_CACHE_CREATE_CHILD_MAILBOXES_INDEX;
+    return true;
+}
+
+bool SQLCache::migrateToV9()
+{
+    QSqlQuery q(QString(), db);
+
+    if (!q.exec(QLatin1String("ALTER TABLE flags RENAME TO flags_v8"))) {
+        emitError(tr("Failed to migrate the cache to v9"), q);
+        return false;
+    }
+    TROJITA_SQL_CACHE_CREATE_V9_FLAGS;
+
+    QSqlQuery insertFlags(db);
+    QSqlQuery insertKeyword(db);
+    if (!insertFlags.prepare(QLatin1String("INSERT INTO flags ( mailbox_id, uid, system_flags ) VALUES ( ?, ?, ? )")) ||
+            !insertKeyword.prepare(QLatin1String("INSERT OR REPLACE INTO msg_keywords ( mailbox_id, uid, keyword ) "
+                                                 "VALUES ( ?, ?, ? )"))) {
+        emitError(tr("Failed to migrate the cache to v9"), insertFlags);
+        return false;
+    }
+
+    if (!q.exec(QLatin1String("SELECT mailbox_id, uid, flags FROM flags_v8"))) {
+        emitError(tr("Failed to migrate the cache to v9"), q);
+        return false;
+    }
+    while (q.next()) {
+        QStringList flags;
+        QDataStream stream(q.value(2).toByteArray());
+        stream.setVersion(streamVersion);
+        stream >> flags;
+        int bits = 0;
+        QStringList keywords;
+        Q_FOREACH(const QString &flag, flags) {
+            if (int bit = systemFlagBit(flag))
+                bits |= bit;
+            else
+                keywords << flag;
+        }
+        if (!keywords.isEmpty())
+            bits |= flagsHaveKeywords;
+        insertFlags.bindValue(0, q.value(0));
+        insertFlags.bindValue(1, q.value(1));
+        insertFlags.bindValue(2, bits);
+        if (!insertFlags.exec()) {
+            emitError(tr("Failed to migrate the cache to v9"), insertFlags);
+            return false;
+        }
+        Q_FOREACH(const QString &keyword, keywords) {
+            insertKeyword.bindValue(0, q.value(0));
+            insertKeyword.bindValue(1, q.value(1));
+            insertKeyword.bindValue(2, keyword);
+            if (!insertKeyword.exec()) {
+                emitError(tr("Failed to migrate the cache to v9"), insertKeyword);
+                return false;
+            }
+        }
+    }
+
+    if (!q.exec(QLatin1String("DROP TABLE flags_v8"))) {
+        emitError(tr("Failed to migrate the cache to v9"), q);
+        return false;
+    }
+    return true;
+}
+
+bool SQLCache::migrateToV10()
+{
+    QSqlQuery q(QString(), db);
+
+    // Rows without the date would never be reached by walking the index
+    if (!q.exec(QLatin1String("UPDATE msg_metadata SET lastAccessDate = 0 WHERE lastAccessDate IS NULL"))) {
+        emitError(tr("Failed to migrate the cache to v10"), q);
+        return false;
+    }
+    TROJITA_SQL_CACHE_CREATE_V10_LAST_ACCESS_INDEX;
+    return true;
+}
+
+bool SQLCache::migrateToV11()
+{
+    QSqlQuery q(QString(), db);
+
+    // The existing rows are not converted; they are read as they are until the message gets written again
+    TROJITA_SQL_CACHE_CREATE_V11_METADATA_PAGES;
+    return true;
+}
+
+bool SQLCache::migrateToV12()
+{
+    QSqlQuery q(QString(), db);
+
+    TROJITA_SQL_CACHE_CREATE_V12_THREAD_NODES;
+
+    if (!q.exec(QLatin1String("SELECT mailbox_id, threading FROM msg_threading"))) {
+        emitError(tr("Failed to migrate the cache to v12"), q);
+        return false;
+    }
+    QSqlQuery insert(QString(), db);
+    if (!insert.prepare(QLatin1String("INSERT INTO msg_thread_nodes (mailbox_id, node, parent, previous) VALUES (?, ?, ?, ?)"))) {
+        emitError(tr("Failed to migrate the cache to v12"), insert);
+        return false;
+    }
+    while (q.next()) {
+        const int id = q.value(0).toInt();
+        QVector<Imap::Responses::ThreadingNode> threading;
+        QDataStream stream(qUncompress(q.value(1).toByteArray()));
+        stream.setVersion(streamVersion);
+        stream >> threading;
+        ThreadLinks links;
+        flattenThreading(threading, 0, links);
+        for (ThreadLinks::const_iterator it = links.constBegin(); it != links.constEnd(); ++it) {
+            insert.bindValue(0, id);
+            insert.bindValue(1, it.key());
+            insert.bindValue(2, it->parent);
+            insert.bindValue(3, it->previous);
+            if (!insert.exec()) {
+                emitError(tr("Failed to migrate the cache to v12"), insert);
+                return false;
+            }
+        }
+    }
+    q.finish();
+
+    if (!q.exec(QLatin1String("DROP TABLE msg_threading"))) {
+        emitError(tr("Failed to migrate the cache to v12"), q);
+        return false;
+    }
+    return true;
+}
 
+bool SQLCache::setupJournal()
+{
+    QSqlQuery q(QString(), db);
+
+    // The write-ahead log lets the readers proceed while a transaction is open and makes the commits much cheaper
+    if (!q.exec(QLatin1String("PRAGMA journal_mode = WAL"))) {
+        emitError(tr("Failed to switch to the WAL journal"), q);
+        return false;
+    }
+
+    // With WAL, NORMAL is still safe against corruption; a crash can only lose the most recent transactions
+    QString mode = QLatin1String("NORMAL");
+    if (parent()) {
+        const QString configured = parent()->property("trojita-sqlcache-synchronous").toString().toUpper();
+        if (configured == QLatin1String("OFF") || configured == QLatin1String("NORMAL") || configured == QLatin1String("FULL"))
+            mode = configured;
+    }
+    if (!q.exec(QString::fromUtf8("PRAGMA synchronous = %1").arg(mode))) {
+        emitError(tr("Failed to set the synchronous mode"), q);
+        return false;
+    }
     return true;
 }
 
+void SQLCache::setupFullTextIndex()
+{
+    QSqlQuery q(QString(), db);
+
+    // The table is not a part of the versioned schema because it's optional; the default tokenizer only folds the case of
+    // ASCII letters, which is why everything is converted to lowercase before it gets indexed
+    m_fullTextIndex = q.exec(QLatin1String("CREATE VIRTUAL TABLE IF NOT EXISTS msg_fulltext USING fts4 ( "
+                                           "subject, sender, to_addr, cc_addr, bcc_addr, body )"));
+    // The body column is a concatenation of the texts of all indexed parts, each of them prefixed by a space.  Their lengths
+    // are remembered in the order of the concatenation, so that a part which is fetched again replaces its old text.
+    if (m_fullTextIndex && !q.exec(QLatin1String("CREATE TABLE IF NOT EXISTS msg_fulltext_parts ( "
+                                                 "docid INTEGER NOT NULL, "
+                                                 "part_id STRING NOT NULL, "
+                                                 "length INTEGER NOT NULL, "
+                                                 "PRIMARY KEY (docid, part_id)"
+                                                 " )"))) {
+        emitError(tr("Can't create table msg_fulltext_parts"), q);
+        m_fullTextIndex = false;
+    }
+#ifdef CACHE_DEBUG
+    if (!m_fullTextIndex)
+        qDebug() << "Full-text index is not available:" << q.lastError().text();
+#endif
+}
+
+int SQLCache::mailboxId(const QString &mailbox, const bool create) const
+{
+    const QString name = mailbox.isEmpty() ? QLatin1String("") : mailbox;
+    QHash<QString, int>::const_iterator it = m_mailboxIds.constFind(name);
+    if (it != m_mailboxIds.constEnd())
+        return *it;
+
+    queryMailboxId.bindValue(0, name);
+    if (!queryMailboxId.exec()) {
+        emitError(tr("Query queryMailboxId failed"), queryMailboxId);
+        return -1;
+    }
+    if (queryMailboxId.first()) {
+        const int id = queryMailboxId.value(0).toInt();
+        queryMailboxId.finish();
+        m_mailboxIds[name] = id;
+        return id;
+    }
+
+    if (!create)
+        return -1;
+
+    queryAddMailboxId.bindValue(0, name);
+    if (!queryAddMailboxId.exec()) {
+        emitError(tr("Query queryAddMailboxId failed"), queryAddMailboxId);
+        return -1;
+    }
+    const int id = queryAddMailboxId.lastInsertId().toInt();
+    m_mailboxIds[name] = id;
+    return id;
+}
+
 bool SQLCache::prepareQueries()
 {
+    queryMailboxId = QSqlQuery(db);
+    if (!queryMailboxId.prepare(QLatin1String("SELECT id FROM mailboxes WHERE name = ?"))) {
+        emitError(tr("Failed to prepare queryMailboxId"), queryMailboxId);
+        return false;
+    }
+
+    queryAddMailboxId = QSqlQuery(db);
+    if (!queryAddMailboxId.prepare(QLatin1String("INSERT INTO mailboxes ( name ) VALUES ( ? )"))) {
+        emitError(tr("Failed to prepare queryAddMailboxId"), queryAddMailboxId);
+        return false;
+    }
+
     queryChildMailboxes = QSqlQuery(db);
     if (! queryChildMailboxes.prepare("SELECT mailbox, separator, flags FROM child_mailboxes WHERE parent = ?")) {
         emitError(tr("Failed to prepare queryChildMailboxes"), queryChildMailboxes);
@@ -317,6 +850,18 @@ bool SQLCache::prepareQueries()
         return false;
     }
 
+    queryMailboxStatus = QSqlQuery(db);
+    if (! queryMailboxStatus.prepare(QLatin1String("SELECT status FROM mailbox_status WHERE mailbox = ?"))) {
+        emitError(tr("Failed to prepare queryMailboxStatus"), queryMailboxStatus);
+        return false;
+    }
+
+    querySetMailboxStatus = QSqlQuery(db);
+    if (! querySetMailboxStatus.prepare(QLatin1String("INSERT OR REPLACE INTO mailbox_status ( mailbox, status ) VALUES ( ?, ? )"))) {
+        emitError(tr("Failed to prepare querySetMailboxStatus"), querySetMailboxStatus);
+        return false;
+    }
+
     queryUidMapping = QSqlQuery(db);
     if (! queryUidMapping.prepare(QLatin1String("SELECT mapping FROM uid_mapping WHERE mailbox = ?"))) {
         emitError(tr("Failed to prepare queryUidMapping"), queryUidMapping);
@@ -336,123 +881,297 @@ bool SQLCache::prepareQueries()
     }
 
     queryMessageMetadata = QSqlQuery(db);
-    if (! queryMessageMetadata.prepare(QLatin1String("SELECT data, lastAccessDate FROM msg_metadata WHERE mailbox = ? AND uid = ?"))) {
+    if (! queryMessageMetadata.prepare(QLatin1String("SELECT data, lastAccessDate FROM msg_metadata WHERE mailbox_id = ? AND uid = ?"))) {
         emitError(tr("Failed to prepare queryMessageMetadata"), queryMessageMetadata);
         return false;
     }
 
+    queryAllMessageMetadata = QSqlQuery(db);
+    if (!queryAllMessageMetadata.prepare(QLatin1String("SELECT uid, data FROM msg_metadata WHERE mailbox_id = ?"))) {
+        emitError(tr("Failed to prepare queryAllMessageMetadata"), queryAllMessageMetadata);
+        return false;
+    }
+
     queryAccessMessageMetadata = QSqlQuery(db);
-    if (!queryAccessMessageMetadata.prepare(QLatin1String("UPDATE msg_metadata SET lastAccessDate = ? WHERE mailbox = ? AND uid = ?"))) {
+    if (!queryAccessMessageMetadata.prepare(QLatin1String("UPDATE msg_metadata SET lastAccessDate = ? WHERE mailbox_id = ? AND uid = ?"))) {
         emitError(tr("Failed to prepare queryAccssMessageMetadata"), queryAccessMessageMetadata);
         return false;
     }
 
     querySetMessageMetadata = QSqlQuery(db);
-    if (! querySetMessageMetadata.prepare(QLatin1String("INSERT OR REPLACE INTO msg_metadata ( mailbox, uid, data, lastAccessDate ) VALUES ( ?, ?, ?, ? )"))) {
+    if (! querySetMessageMetadata.prepare(QLatin1String("INSERT OR REPLACE INTO msg_metadata ( mailbox_id, uid, data, lastAccessDate ) VALUES ( ?, ?, NULL, ? )"))) {
         emitError(tr("Failed to prepare querySetMessageMetadata"), querySetMessageMetadata);
         return false;
     }
 
     queryMessageFlags = QSqlQuery(db);
-    if (! queryMessageFlags.prepare(QLatin1String("SELECT flags FROM flags WHERE mailbox = ? AND uid = ?"))) {
+    if (! queryMessageFlags.prepare(QLatin1String("SELECT system_flags FROM flags WHERE mailbox_id = ? AND uid = ?"))) {
         emitError(tr("Failed to prepare queryMessageFlags"), queryMessageFlags);
         return false;
     }
 
+    queryMessageKeywords = QSqlQuery(db);
+    if (!queryMessageKeywords.prepare(QLatin1String("SELECT keyword FROM msg_keywords WHERE mailbox_id = ? AND uid = ?"))) {
+        emitError(tr("Failed to prepare queryMessageKeywords"), queryMessageKeywords);
+        return false;
+    }
+
     querySetMessageFlags = QSqlQuery(db);
-    if (! querySetMessageFlags.prepare(QLatin1String("INSERT OR REPLACE INTO flags ( mailbox, uid, flags ) VALUES ( ?, ?, ? )"))) {
+    if (! querySetMessageFlags.prepare(QLatin1String("INSERT OR REPLACE INTO flags ( mailbox_id, uid, system_flags ) VALUES ( ?, ?, ? )"))) {
         emitError(tr("Failed to prepare querySetMessageFlags"), querySetMessageFlags);
         return false;
     }
 
+    querySetMessageKeywords = QSqlQuery(db);
+    if (!querySetMessageKeywords.prepare(QLatin1String("INSERT OR REPLACE INTO msg_keywords ( mailbox_id, uid, keyword ) VALUES ( ?, ?, ? )"))) {
+        emitError(tr("Failed to prepare querySetMessageKeywords"), querySetMessageKeywords);
+        return false;
+    }
+
+    queryUidsWithSystemFlag = QSqlQuery(db);
+    if (!queryUidsWithSystemFlag.prepare(QLatin1String("SELECT uid FROM flags WHERE mailbox_id = ? AND (system_flags & ?) = ?"))) {
+        emitError(tr("Failed to prepare queryUidsWithSystemFlag"), queryUidsWithSystemFlag);
+        return false;
+    }
+
+    queryUidsWithKeyword = QSqlQuery(db);
+    if (!queryUidsWithKeyword.prepare(QLatin1String("SELECT uid FROM msg_keywords WHERE mailbox_id = ? AND keyword = ? COLLATE NOCASE"))) {
+        emitError(tr("Failed to prepare queryUidsWithKeyword"), queryUidsWithKeyword);
+        return false;
+    }
+
+    queryUidsWithoutKeyword = QSqlQuery(db);
+    if (!queryUidsWithoutKeyword.prepare(QLatin1String("SELECT uid FROM flags WHERE mailbox_id = ?1 AND uid NOT IN "
+                                                       "(SELECT uid FROM msg_keywords WHERE mailbox_id = ?1 AND keyword = ?2 COLLATE NOCASE)"))) {
+        emitError(tr("Failed to prepare queryUidsWithoutKeyword"), queryUidsWithoutKeyword);
+        return false;
+    }
+
     queryClearAllMessages1 = QSqlQuery(db);
-    if (! queryClearAllMessages1.prepare(QLatin1String("DELETE FROM msg_metadata WHERE mailbox = ?"))) {
+    if (! queryClearAllMessages1.prepare(QLatin1String("DELETE FROM msg_metadata WHERE mailbox_id = ?"))) {
         emitError(tr("Failed to prepare queryClearAllMessages1"), queryClearAllMessages1);
         return false;
     }
 
     queryClearAllMessages2 = QSqlQuery(db);
-    if (! queryClearAllMessages2.prepare(QLatin1String("DELETE FROM flags WHERE mailbox = ?"))) {
+    if (! queryClearAllMessages2.prepare(QLatin1String("DELETE FROM flags WHERE mailbox_id = ?"))) {
         emitError(tr("Failed to prepare queryClearAllMessages2"), queryClearAllMessages2);
         return false;
     }
 
     queryClearAllMessages3 = QSqlQuery(db);
-    if (! queryClearAllMessages3.prepare(QLatin1String("DELETE FROM parts WHERE mailbox = ?"))) {
+    if (! queryClearAllMessages3.prepare(QLatin1String("DELETE FROM parts WHERE mailbox_id = ?"))) {
         emitError(tr("Failed to prepare queryClearAllMessages3"), queryClearAllMessages3);
         return false;
     }
 
+    queryClearAllMessages4 = QSqlQuery(db);
+    if (!queryClearAllMessages4.prepare(QLatin1String("DELETE FROM msg_keywords WHERE mailbox_id = ?"))) {
+        emitError(tr("Failed to prepare queryClearAllMessages4"), queryClearAllMessages4);
+        return false;
+    }
+
     queryClearMessage1 = QSqlQuery(db);
-    if (! queryClearMessage1.prepare(QLatin1String("DELETE FROM msg_metadata WHERE mailbox = ? AND uid = ?"))) {
+    if (! queryClearMessage1.prepare(QLatin1String("DELETE FROM msg_metadata WHERE mailbox_id = ? AND uid = ?"))) {
         emitError(tr("Failed to prepare queryClearMessage1"), queryClearMessage1);
         return false;
     }
 
     queryClearMessage2 = QSqlQuery(db);
-    if (! queryClearMessage2.prepare(QLatin1String("DELETE FROM flags WHERE mailbox = ? AND uid = ?"))) {
+    if (! queryClearMessage2.prepare(QLatin1String("DELETE FROM flags WHERE mailbox_id = ? AND uid = ?"))) {
         emitError(tr("Failed to prepare queryClearMessage2"), queryClearMessage2);
         return false;
     }
 
     queryClearMessage3 = QSqlQuery(db);
-    if (! queryClearMessage3.prepare(QLatin1String("DELETE FROM parts WHERE mailbox = ? AND uid = ?"))) {
+    if (! queryClearMessage3.prepare(QLatin1String("DELETE FROM parts WHERE mailbox_id = ? AND uid = ?"))) {
         emitError(tr("Failed to prepare queryClearMessage3"), queryClearMessage3);
         return false;
     }
 
+    queryClearMessage4 = QSqlQuery(db);
+    if (!queryClearMessage4.prepare(QLatin1String("DELETE FROM msg_keywords WHERE mailbox_id = ? AND uid = ?"))) {
+        emitError(tr("Failed to prepare queryClearMessage4"), queryClearMessage4);
+        return false;
+    }
+
     queryMessagePart = QSqlQuery(db);
-    if (! queryMessagePart.prepare(QLatin1String("SELECT data FROM parts WHERE mailbox = ? AND uid = ? AND part_id = ?"))) {
+    if (! queryMessagePart.prepare(QLatin1String("SELECT data FROM parts WHERE mailbox_id = ? AND uid = ? AND part_id = ?"))) {
         emitError(tr("Failed to prepare queryMessagePart"), queryMessagePart);
         return false;
     }
 
     querySetMessagePart = QSqlQuery(db);
-    if (! querySetMessagePart.prepare(QLatin1String("INSERT OR REPLACE INTO parts ( mailbox, uid, part_id, data ) VALUES (?, ?, ?, ?)"))) {
+    if (! querySetMessagePart.prepare(QLatin1String("INSERT OR REPLACE INTO parts ( mailbox_id, uid, part_id, data ) VALUES (?, ?, ?, ?)"))) {
         emitError(tr("Failed to prepare querySetMessagePart"), querySetMessagePart);
         return false;
     }
 
     queryMessageThreading = QSqlQuery(db);
-    if (! queryMessageThreading.prepare(QLatin1String("SELECT threading FROM msg_threading WHERE mailbox = ?"))) {
+    if (! queryMessageThreading.prepare(QLatin1String("SELECT node, parent, previous FROM msg_thread_nodes WHERE mailbox_id = ?"))) {
         emitError(tr("Failed to prepare queryMessageThreading"), queryMessageThreading);
         return false;
     }
 
-    querySetMessageThreading = QSqlQuery(db);
-    if (! querySetMessageThreading.prepare(QLatin1String("INSERT OR REPLACE INTO msg_threading (mailbox, threading) VALUES  ( ?, ? )"))) {
-        emitError(tr("Failed to prepare querySetMessageThreading"), querySetMessageThreading);
+    querySetThreadNode = QSqlQuery(db);
+    if (! querySetThreadNode.prepare(QLatin1String("INSERT OR REPLACE INTO msg_thread_nodes (mailbox_id, node, parent, previous) "
+                                                   "VALUES (?, ?, ?, ?)"))) {
+        emitError(tr("Failed to prepare querySetThreadNode"), querySetThreadNode);
         return false;
     }
 
-#ifdef CACHE_DEBUG
-    qDebug() << "SQLCache::_prepareQueries() succeeded";
-#endif
-    return true;
-}
+    queryClearThreadNode = QSqlQuery(db);
+    if (! queryClearThreadNode.prepare(QLatin1String("DELETE FROM msg_thread_nodes WHERE mailbox_id = ? AND node = ?"))) {
+        emitError(tr("Failed to prepare queryClearThreadNode"), queryClearThreadNode);
+        return false;
+    }
 
-void SQLCache::emitError(const QString &message, const QSqlQuery &query) const
-{
-    emitError(QString::fromUtf8("SQLCache: Query Error: %1: %2").arg(message, query.lastError().text()));
-}
+    queryLeastRecentlyAccessed = QSqlQuery(db);
+    // The first condition is redundant, but it lets SQLite start the scan of the index at the right place. A message stored
+    // in a page is accounted for by its share of the compressed page.
+    if (!queryLeastRecentlyAccessed.prepare(QString::fromUtf8("SELECT msg_metadata.lastAccessDate, msg_metadata.mailbox_id, "
+                                                          "msg_metadata.uid, mailboxes.name, COALESCE(LENGTH(msg_metadata.data), "
+                                                          "(SELECT LENGTH(pages.data) / pages.messages FROM msg_metadata_pages pages "
+                                                          "WHERE pages.mailbox_id = msg_metadata.mailbox_id AND pages.page = msg_metadata.uid / %1), 0), "
+                                                          "(SELECT SUM(LENGTH(parts.data)) FROM parts "
+                                                          "WHERE parts.mailbox_id = msg_metadata.mailbox_id AND parts.uid = msg_metadata.uid) "
+                                                          "FROM msg_metadata JOIN mailboxes ON mailboxes.id = msg_metadata.mailbox_id "
+                                                          "WHERE msg_metadata.lastAccessDate >= ?1 AND (msg_metadata.lastAccessDate > ?1 "
+                                                          "OR msg_metadata.mailbox_id > ?2 OR (msg_metadata.mailbox_id = ?2 AND msg_metadata.uid > ?3)) "
+                                                          "ORDER BY msg_metadata.lastAccessDate, msg_metadata.mailbox_id, msg_metadata.uid "
+                                                          "LIMIT ?4").arg(metadataPageSize))) {
+        emitError(tr("Failed to prepare queryLeastRecentlyAccessed"), queryLeastRecentlyAccessed);
+        return false;
+    }
 
-void SQLCache::emitError(const QString &message, const QSqlDatabase &database) const
-{
-    emitError(QString::fromUtf8("SQLCache: DB Error: %1: %2").arg(message, database.lastError().text()));
-}
+    queryMetadataPage = QSqlQuery(db);
+    if (!queryMetadataPage.prepare(QLatin1String("SELECT data FROM msg_metadata_pages WHERE mailbox_id = ? AND page = ?"))) {
+        emitError(tr("Failed to prepare queryMetadataPage"), queryMetadataPage);
+        return false;
+    }
 
-void SQLCache::emitError(const QString &message) const
-{
-    qDebug() << message;
-    emit error(message);
-}
+    querySetMetadataPage = QSqlQuery(db);
+    if (!querySetMetadataPage.prepare(QLatin1String("INSERT OR REPLACE INTO msg_metadata_pages ( mailbox_id, page, messages, data ) "
+                                                    "VALUES ( ?, ?, ?, ? )"))) {
+        emitError(tr("Failed to prepare querySetMetadataPage"), querySetMetadataPage);
+        return false;
+    }
 
-QList<MailboxMetadata> SQLCache::childMailboxes(const QString &mailbox) const
-{
-    QList<MailboxMetadata> res;
-    queryChildMailboxes.bindValue(0, mailbox.isEmpty() ? QLatin1String("") : mailbox);
-    if (! queryChildMailboxes.exec()) {
-        emitError(tr("Query queryChildMailboxes failed"), queryChildMailboxes);
+    queryClearMetadataPage = QSqlQuery(db);
+    if (!queryClearMetadataPage.prepare(QLatin1String("DELETE FROM msg_metadata_pages WHERE mailbox_id = ? AND page = ?"))) {
+        emitError(tr("Failed to prepare queryClearMetadataPage"), queryClearMetadataPage);
+        return false;
+    }
+
+    queryClearAllMetadataPages = QSqlQuery(db);
+    if (!queryClearAllMetadataPages.prepare(QLatin1String("DELETE FROM msg_metadata_pages WHERE mailbox_id = ?"))) {
+        emitError(tr("Failed to prepare queryClearAllMetadataPages"), queryClearAllMetadataPages);
+        return false;
+    }
+
+    if (m_fullTextIndex) {
+        queryFullTextSetEnvelope = QSqlQuery(db);
+        if (!queryFullTextSetEnvelope.prepare(QLatin1String("INSERT OR REPLACE INTO msg_fulltext "
+                                                            "( docid, subject, sender, to_addr, cc_addr, bcc_addr, body ) "
+                                                            "VALUES ( ?1, ?2, ?3, ?4, ?5, ?6, "
+                                                            "COALESCE((SELECT body FROM msg_fulltext WHERE docid = ?1), '') )"))) {
+            emitError(tr("Failed to prepare queryFullTextSetEnvelope"), queryFullTextSetEnvelope);
+            return false;
+        }
+
+        queryFullTextBody = QSqlQuery(db);
+        if (!queryFullTextBody.prepare(QLatin1String("SELECT body FROM msg_fulltext WHERE docid = ?"))) {
+            emitError(tr("Failed to prepare queryFullTextBody"), queryFullTextBody);
+            return false;
+        }
+
+        queryFullTextSetBody = QSqlQuery(db);
+        if (!queryFullTextSetBody.prepare(QLatin1String("UPDATE msg_fulltext SET body = ? WHERE docid = ?"))) {
+            emitError(tr("Failed to prepare queryFullTextSetBody"), queryFullTextSetBody);
+            return false;
+        }
+
+        queryFullTextParts = QSqlQuery(db);
+        if (!queryFullTextParts.prepare(QLatin1String("SELECT part_id, length FROM msg_fulltext_parts WHERE docid = ? ORDER BY rowid"))) {
+            emitError(tr("Failed to prepare queryFullTextParts"), queryFullTextParts);
+            return false;
+        }
+
+        queryFullTextInsertPart = QSqlQuery(db);
+        if (!queryFullTextInsertPart.prepare(QLatin1String("INSERT INTO msg_fulltext_parts (docid, part_id, length) VALUES (?, ?, ?)"))) {
+            emitError(tr("Failed to prepare queryFullTextInsertPart"), queryFullTextInsertPart);
+            return false;
+        }
+
+        // An UPDATE keeps the rowid, and therefore the position of the part within the body
+        queryFullTextUpdatePart = QSqlQuery(db);
+        if (!queryFullTextUpdatePart.prepare(QLatin1String("UPDATE msg_fulltext_parts SET length = ? WHERE docid = ? AND part_id = ?"))) {
+            emitError(tr("Failed to prepare queryFullTextUpdatePart"), queryFullTextUpdatePart);
+            return false;
+        }
+
+        queryFullTextClearParts = QSqlQuery(db);
+        if (!queryFullTextClearParts.prepare(QLatin1String("DELETE FROM msg_fulltext_parts WHERE docid BETWEEN ? AND ?"))) {
+            emitError(tr("Failed to prepare queryFullTextClearParts"), queryFullTextClearParts);
+            return false;
+        }
+
+        queryFullTextInsertBody = QSqlQuery(db);
+        if (!queryFullTextInsertBody.prepare(QLatin1String("INSERT INTO msg_fulltext "
+                                                           "( docid, subject, sender, to_addr, cc_addr, bcc_addr, body ) "
+                                                           "VALUES ( ?, '', '', '', '', '', ? )"))) {
+            emitError(tr("Failed to prepare queryFullTextInsertBody"), queryFullTextInsertBody);
+            return false;
+        }
+
+        queryFullTextSearch = QSqlQuery(db);
+        if (!queryFullTextSearch.prepare(QLatin1String("SELECT docid FROM msg_fulltext WHERE msg_fulltext MATCH ? "
+                                                       "AND docid BETWEEN ? AND ?"))) {
+            emitError(tr("Failed to prepare queryFullTextSearch"), queryFullTextSearch);
+            return false;
+        }
+
+        queryFullTextClearMessage = QSqlQuery(db);
+        if (!queryFullTextClearMessage.prepare(QLatin1String("DELETE FROM msg_fulltext WHERE docid = ?"))) {
+            emitError(tr("Failed to prepare queryFullTextClearMessage"), queryFullTextClearMessage);
+            return false;
+        }
+
+        queryFullTextClearAll = QSqlQuery(db);
+        if (!queryFullTextClearAll.prepare(QLatin1String("DELETE FROM msg_fulltext WHERE docid BETWEEN ? AND ?"))) {
+            emitError(tr("Failed to prepare queryFullTextClearAll"), queryFullTextClearAll);
+            return false;
+        }
+    }
+
+#ifdef CACHE_DEBUG
+    qDebug() << "SQLCache::_prepareQueries() succeeded";
+#endif
+    return true;
+}
+
+void SQLCache::emitError(const QString &message, const QSqlQuery &query) const
+{
+    emitError(QString::fromUtf8("SQLCache: Query Error: %1: %2").arg(message, query.lastError().text()));
+}
+
+void SQLCache::emitError(const QString &message, const QSqlDatabase &database) const
+{
+    emitError(QString::fromUtf8("SQLCache: DB Error: %1: %2").arg(message, database.lastError().text()));
+}
+
+void SQLCache::emitError(const QString &message) const
+{
+    qDebug() << message;
+    emit error(message);
+}
+
+QList<MailboxMetadata> SQLCache::childMailboxes(const QString &mailbox) const
+{
+    QList<MailboxMetadata> res;
+    queryChildMailboxes.bindValue(0, mailbox.isEmpty() ? QLatin1String("") : mailbox);
+    if (! queryChildMailboxes.exec()) {
+        emitError(tr("Query queryChildMailboxes failed"), queryChildMailboxes);
         return res;
     }
     while (queryChildMailboxes.next()) {
@@ -544,6 +1263,40 @@ void SQLCache::setMailboxSyncState(const QString &mailbox, const SyncState &stat
     }
 }
 
+SyncState SQLCache::mailboxStatus(const QString &mailbox) const
+{
+    SyncState res;
+    queryMailboxStatus.bindValue(0, mailbox.isEmpty() ? QLatin1String("") : mailbox);
+    if (! queryMailboxStatus.exec()) {
+        emitError(tr("Query queryMailboxStatus failed"), queryMailboxStatus);
+        return res;
+    }
+    if (queryMailboxStatus.first()) {
+        QDataStream stream(queryMailboxStatus.value(0).toByteArray());
+        stream.setVersion(streamVersion);
+        stream >> res;
+    }
+    return res;
+}
+
+void SQLCache::setMailboxStatus(const QString &mailbox, const SyncState &state)
+{
+#ifdef CACHE_DEBUG
+    qDebug() << "Setting status for" << mailbox;
+#endif
+    touchingDB();
+    querySetMailboxStatus.bindValue(0, mailbox.isEmpty() ? QLatin1String("") : mailbox);
+    QByteArray buf;
+    QDataStream stream(&buf, QIODevice::ReadWrite);
+    stream.setVersion(streamVersion);
+    stream << state;
+    querySetMailboxStatus.bindValue(1, buf);
+    if (! querySetMailboxStatus.exec()) {
+        emitError(tr("Query querySetMailboxStatus failed"), querySetMailboxStatus);
+        return;
+    }
+}
+
 QList<uint> SQLCache::uidMapping(const QString &mailbox) const
 {
     QList<uint> res;
@@ -595,10 +1348,15 @@ void SQLCache::clearAllMessages(const QString &mailbox)
 #ifdef CACHE_DEBUG
     qDebug() << "Clearing all messages from" << mailbox;
 #endif
+    const int id = mailboxId(mailbox, false);
+    if (id == -1)
+        return;
+    flushStagedWrites();
     touchingDB();
-    queryClearAllMessages1.bindValue(0, mailbox.isEmpty() ? QLatin1String("") : mailbox);
-    queryClearAllMessages2.bindValue(0, mailbox.isEmpty() ? QLatin1String("") : mailbox);
-    queryClearAllMessages3.bindValue(0, mailbox.isEmpty() ? QLatin1String("") : mailbox);
+    queryClearAllMessages1.bindValue(0, id);
+    queryClearAllMessages2.bindValue(0, id);
+    queryClearAllMessages3.bindValue(0, id);
+    queryClearAllMessages4.bindValue(0, id);
     if (! queryClearAllMessages1.exec()) {
         emitError(tr("Query queryClearAllMessages1 failed"), queryClearAllMessages1);
     }
@@ -608,6 +1366,25 @@ void SQLCache::clearAllMessages(const QString &mailbox)
     if (! queryClearAllMessages3.exec()) {
         emitError(tr("Query queryClearAllMessages3 failed"), queryClearAllMessages3);
     }
+    if (!queryClearAllMessages4.exec()) {
+        emitError(tr("Query queryClearAllMessages4 failed"), queryClearAllMessages4);
+    }
+    queryClearAllMetadataPages.bindValue(0, id);
+    if (!queryClearAllMetadataPages.exec()) {
+        emitError(tr("Query queryClearAllMetadataPages failed"), queryClearAllMetadataPages);
+    }
+    Q_FOREACH(const qint64 key, m_metadataPages.keys()) {
+        if ((key >> 32) == id)
+            m_metadataPages.remove(key);
+    }
+    if (m_fullTextIndex) {
+        queryFullTextClearAll.bindValue(0, fullTextDocId(id, 0));
+        queryFullTextClearAll.bindValue(1, fullTextDocId(id, 0xffffffff));
+        if (!queryFullTextClearAll.exec()) {
+            emitError(tr("Query queryFullTextClearAll failed"), queryFullTextClearAll);
+        }
+        clearFullTextParts(fullTextDocId(id, 0), fullTextDocId(id, 0xffffffff));
+    }
 }
 
 void SQLCache::clearMessage(const QString mailbox, uint uid)
@@ -615,13 +1392,21 @@ void SQLCache::clearMessage(const QString mailbox, uint uid)
 #ifdef CACHE_DEBUG
     qDebug() << "Clearing message" << uid << "from" << mailbox;
 #endif
+    const int id = mailboxId(mailbox, false);
+    if (id == -1)
+        return;
+    // Nothing which is still waiting for the end of the batch may bring the message back
+    m_stagedMetadata.remove(fullTextDocId(id, uid));
+    m_stagedFlags.remove(fullTextDocId(id, uid));
     touchingDB();
-    queryClearMessage1.bindValue(0, mailbox.isEmpty() ? QLatin1String("") : mailbox);
+    queryClearMessage1.bindValue(0, id);
     queryClearMessage1.bindValue(1, uid);
-    queryClearMessage2.bindValue(0, mailbox.isEmpty() ? QLatin1String("") : mailbox);
+    queryClearMessage2.bindValue(0, id);
     queryClearMessage2.bindValue(1, uid);
-    queryClearMessage3.bindValue(0, mailbox.isEmpty() ? QLatin1String("") : mailbox);
+    queryClearMessage3.bindValue(0, id);
     queryClearMessage3.bindValue(1, uid);
+    queryClearMessage4.bindValue(0, id);
+    queryClearMessage4.bindValue(1, uid);
     if (! queryClearMessage1.exec()) {
         emitError(tr("Query queryClearMessage1 failed"), queryClearMessage1);
     }
@@ -631,23 +1416,52 @@ void SQLCache::clearMessage(const QString mailbox, uint uid)
     if (! queryClearMessage3.exec()) {
         emitError(tr("Query queryClearMessage3 failed"), queryClearMessage3);
     }
+    if (!queryClearMessage4.exec()) {
+        emitError(tr("Query queryClearMessage4 failed"), queryClearMessage4);
+    }
+    removeFromMetadataPage(id, uid);
+    if (m_fullTextIndex) {
+        queryFullTextClearMessage.bindValue(0, fullTextDocId(id, uid));
+        if (!queryFullTextClearMessage.exec()) {
+            emitError(tr("Query queryFullTextClearMessage failed"), queryFullTextClearMessage);
+        }
+        clearFullTextParts(fullTextDocId(id, uid), fullTextDocId(id, uid));
+    }
 }
 
 QStringList SQLCache::msgFlags(const QString &mailbox, uint uid) const
 {
+    flushStagedWrites();
     QStringList res;
-    queryMessageFlags.bindValue(0, mailbox.isEmpty() ? QLatin1String("") : mailbox);
+    const int id = mailboxId(mailbox, false);
+    if (id == -1)
+        return res;
+    queryMessageFlags.bindValue(0, id);
     queryMessageFlags.bindValue(1, uid);
     if (! queryMessageFlags.exec()) {
         emitError(tr("Query queryMessageFlags failed"), queryMessageFlags);
         return res;
     }
-    if (queryMessageFlags.first()) {
-        QDataStream stream(queryMessageFlags.value(0).toByteArray());
-        stream.setVersion(streamVersion);
-        stream >> res;
+    if (!queryMessageFlags.first()) {
+        // "Not found" is not an error here
+        return res;
+    }
+    const int bits = queryMessageFlags.value(0).toInt();
+    queryMessageFlags.finish();
+    for (size_t i = 0; i < sizeof(systemFlags) / sizeof(systemFlags[0]); ++i) {
+        if (bits & systemFlags[i].bit)
+            res << QLatin1String(systemFlags[i].name);
+    }
+    if (bits & flagsHaveKeywords) {
+        queryMessageKeywords.bindValue(0, id);
+        queryMessageKeywords.bindValue(1, uid);
+        if (!queryMessageKeywords.exec()) {
+            emitError(tr("Query queryMessageKeywords failed"), queryMessageKeywords);
+            return res;
+        }
+        while (queryMessageKeywords.next())
+            res << queryMessageKeywords.value(0).toString();
     }
-    // "Not found" is not an error here
     return res;
 }
 
@@ -656,41 +1470,84 @@ void SQLCache::setMsgFlags(const QString &mailbox, uint uid, const QStringList &
 #ifdef CACHE_DEBUG
     qDebug() << "Updating flags for" << mailbox << uid;
 #endif
+    const int id = mailboxId(mailbox, true);
+    if (id == -1)
+        return;
     touchingDB();
-    querySetMessageFlags.bindValue(0, mailbox.isEmpty() ? QLatin1String("") : mailbox);
-    querySetMessageFlags.bindValue(1, uid);
-    QByteArray buf;
-    QDataStream stream(&buf, QIODevice::ReadWrite);
-    stream.setVersion(streamVersion);
-    stream << flags;
-    querySetMessageFlags.bindValue(2, buf);
-    if (! querySetMessageFlags.exec()) {
-        emitError(tr("Query querySetMessageFlags failed"), querySetMessageFlags);
+    m_stagedFlags[fullTextDocId(id, uid)] = flags;
+    if (!m_batchDepth)
+        flushStagedWrites();
+}
+
+QList<uint> SQLCache::uidsWithFlag(const QString &mailbox, const QString &flag, const bool present) const
+{
+    flushStagedWrites();
+    QList<uint> res;
+    const int id = mailboxId(mailbox, false);
+    if (id == -1)
+        return res;
+
+    QSqlQuery *query;
+    if (int bit = systemFlagBit(flag)) {
+        query = &queryUidsWithSystemFlag;
+        query->bindValue(0, id);
+        query->bindValue(1, bit);
+        query->bindValue(2, present ? bit : 0);
+    } else {
+        query = present ? &queryUidsWithKeyword : &queryUidsWithoutKeyword;
+        query->bindValue(0, id);
+        query->bindValue(1, flag);
+    }
+    if (!query->exec()) {
+        emitError(tr("Query for UIDs with flag %1 failed").arg(flag), *query);
+        return res;
     }
+    // The flags of messages which have been expunged since might still be around
+    const QSet<uint> current = uidMapping(mailbox).toSet();
+    while (query->next()) {
+        const uint uid = query->value(0).toUInt();
+        if (current.contains(uid))
+            res << uid;
+    }
+    return res;
+}
+
+uint SQLCache::countWithFlag(const QString &mailbox, const QString &flag, const bool present) const
+{
+    // The UID map is a blob which SQL cannot look into, so the matching UIDs have to be checked against it one by one anyway
+    return uidsWithFlag(mailbox, flag, present).size();
 }
 
 AbstractCache::MessageDataBundle SQLCache::messageMetadata(const QString &mailbox, uint uid) const
 {
+    flushStagedWrites();
     AbstractCache::MessageDataBundle res;
-    queryMessageMetadata.bindValue(0, mailbox.isEmpty() ? QLatin1String("") : mailbox);
+    const int id = mailboxId(mailbox, false);
+    if (id == -1)
+        return res;
+    queryMessageMetadata.bindValue(0, id);
     queryMessageMetadata.bindValue(1, uid);
     if (! queryMessageMetadata.exec()) {
         emitError(tr("Query queryMessageMetadata failed"), queryMessageMetadata);
         return res;
     }
     if (queryMessageMetadata.first()) {
-        res.uid = uid;
-        QDataStream stream(qUncompress(queryMessageMetadata.value(0).toByteArray()));
-        stream.setVersion(streamVersion);
-        stream >> res.envelope >> res.internalDate >> res.size >> res.serializedBodyStructure >> res.hdrReferences
-                  >> res.hdrListPost >> res.hdrListPostNo;
+        // Rows written before the metadata got paged still carry their own blob
+        const QByteArray legacyData = queryMessageMetadata.value(0).toByteArray();
+        const int lastAccessTimestamp = queryMessageMetadata.value(1).toInt();
+        queryMessageMetadata.finish();
+        const QByteArray data = legacyData.isNull() ?
+                    metadataPage(id, uid / metadataPageSize).value(uid) : qUncompress(legacyData);
+        if (data.isEmpty())
+            return res;
+
+        deserializeMetadata(uid, data, res);
 
         if (m_updateAccessIfOlder) {
-            int lastAccessTimestamp = queryMessageMetadata.value(1).toInt();
             int currentDiff = accessingThresholdDate.daysTo(QDate::currentDate());
             if (lastAccessTimestamp < currentDiff - m_updateAccessIfOlder) {
                 queryAccessMessageMetadata.bindValue(0, currentDiff);
-                queryAccessMessageMetadata.bindValue(1, mailbox.isEmpty() ? QLatin1String("") : mailbox);
+                queryAccessMessageMetadata.bindValue(1, id);
                 queryAccessMessageMetadata.bindValue(2, uid);
                 if (!queryAccessMessageMetadata.exec()) {
                     emitError(tr("Query queryAccessMessageMetadata failed"), queryAccessMessageMetadata);
@@ -702,31 +1559,74 @@ AbstractCache::MessageDataBundle SQLCache::messageMetadata(const QString &mailbo
     return res;
 }
 
+QHash<uint, AbstractCache::MessageDataBundle> SQLCache::metadataOfMessages(const QString &mailbox, const QList<uint> &uids) const
+{
+    flushStagedWrites();
+    QHash<uint, MessageDataBundle> res;
+    const int id = mailboxId(mailbox, false);
+    if (id == -1 || uids.isEmpty())
+        return res;
+
+    // A single scan of the mailbox is much cheaper than looking up each message on its own
+    const QSet<uint> wanted = uids.toSet();
+    QList<uint> paged;
+    queryAllMessageMetadata.bindValue(0, id);
+    if (!queryAllMessageMetadata.exec()) {
+        emitError(tr("Query queryAllMessageMetadata failed"), queryAllMessageMetadata);
+        return res;
+    }
+    while (queryAllMessageMetadata.next()) {
+        const uint uid = queryAllMessageMetadata.value(0).toUInt();
+        if (!wanted.contains(uid))
+            continue;
+        const QByteArray legacyData = queryAllMessageMetadata.value(1).toByteArray();
+        if (legacyData.isNull()) {
+            paged << uid;
+        } else {
+            deserializeMetadata(uid, qUncompress(legacyData), res[uid]);
+        }
+    }
+    queryAllMessageMetadata.finish();
+
+    // Each page is decompressed just once
+    qSort(paged);
+    MetadataPage page;
+    uint pageNumber = 0;
+    bool havePage = false;
+    Q_FOREACH(const uint uid, paged) {
+        if (!havePage || uid / metadataPageSize != pageNumber) {
+            pageNumber = uid / metadataPageSize;
+            page = metadataPage(id, pageNumber);
+            havePage = true;
+        }
+        MetadataPage::const_iterator it = page.constFind(uid);
+        if (it != page.constEnd() && !it->isEmpty())
+            deserializeMetadata(uid, *it, res[uid]);
+    }
+    return res;
+}
+
 void SQLCache::setMessageMetadata(const QString &mailbox, uint uid, const MessageDataBundle &metadata)
 {
 #ifdef CACHE_DEBUG
     qDebug() << "Setting message metadata for" << uid << mailbox;
 #endif
+    const int id = mailboxId(mailbox, true);
+    if (id == -1)
+        return;
     touchingDB();
-    // Order of values: mailbox, uid, data
-    querySetMessageMetadata.bindValue(0, mailbox.isEmpty() ? QLatin1String("") : mailbox);
-    querySetMessageMetadata.bindValue(1, uid);
-    QByteArray buf;
-    QDataStream stream(&buf, QIODevice::ReadWrite);
-    stream.setVersion(streamVersion);
-    stream << metadata.envelope << metadata.internalDate << metadata.size << metadata.serializedBodyStructure
-           << metadata.hdrReferences << metadata.hdrListPost << metadata.hdrListPostNo;
-    querySetMessageMetadata.bindValue(2, qCompress(buf));
-    querySetMessageMetadata.bindValue(3, accessingThresholdDate.daysTo(QDate::currentDate()));
-    if (! querySetMessageMetadata.exec()) {
-        emitError(tr("Query querySetMessageMetadata failed"), querySetMessageMetadata);
-    }
+    m_stagedMetadata[fullTextDocId(id, uid)] = metadata;
+    if (!m_batchDepth)
+        flushStagedWrites();
 }
 
 QByteArray SQLCache::messagePart(const QString &mailbox, uint uid, const QString &partId) const
 {
     QByteArray res;
-    queryMessagePart.bindValue(0, mailbox.isEmpty() ? QLatin1String("") : mailbox);
+    const int id = mailboxId(mailbox, false);
+    if (id == -1)
+        return res;
+    queryMessagePart.bindValue(0, id);
     queryMessagePart.bindValue(1, uid);
     queryMessagePart.bindValue(2, partId);
     if (! queryMessagePart.exec()) {
@@ -745,8 +1645,11 @@ void SQLCache::setMsgPart(const QString &mailbox, uint uid, const QString &partI
 #ifdef CACHE_DEBUG
     qDebug() << "Saving message part" << partId << uid << mailbox;
 #endif
+    const int id = mailboxId(mailbox, true);
+    if (id == -1)
+        return;
     touchingDB();
-    querySetMessagePart.bindValue(0, mailbox.isEmpty() ? QLatin1String("") : mailbox);
+    querySetMessagePart.bindValue(0, id);
     querySetMessagePart.bindValue(1, uid);
     querySetMessagePart.bindValue(2, partId);
     querySetMessagePart.bindValue(3, qCompress(data));
@@ -755,38 +1658,296 @@ void SQLCache::setMsgPart(const QString &mailbox, uint uid, const QString &partI
     }
 }
 
-QVector<Imap::Responses::ThreadingNode> SQLCache::messageThreading(const QString &mailbox)
+void SQLCache::setMsgPartText(const QString &mailbox, uint uid, const QString &partId, const QByteArray &data,
+                              const QString &charset, const QString &mimeType)
 {
-    QVector<Imap::Responses::ThreadingNode> res;
-    queryMessageThreading.bindValue(0, mailbox.isEmpty() ? QLatin1String("") : mailbox);
-    if (! queryMessageThreading.exec()) {
-        emitError(tr("Query queryMessageThreading failed"), queryMessageThreading);
+    if (!m_fullTextIndex)
+        return;
+    flushStagedWrites();
+    touchingDB();
+    const int id = mailboxId(mailbox, true);
+    if (id == -1)
+        return;
+    const qint64 docId = fullTextDocId(id, uid);
+    const QString lowercase = decodeTextPartForIndex(data, charset, mimeType).toLower();
+
+    queryFullTextBody.bindValue(0, docId);
+    if (!queryFullTextBody.exec()) {
+        emitError(tr("Query queryFullTextBody failed"), queryFullTextBody);
+        return;
+    }
+    const bool hasRow = queryFullTextBody.first();
+    QString body = hasRow ? queryFullTextBody.value(0).toString() : QString();
+    queryFullTextBody.finish();
+
+    // Find out where the previous text of this part is
+    queryFullTextParts.bindValue(0, docId);
+    if (!queryFullTextParts.exec()) {
+        emitError(tr("Query queryFullTextParts failed"), queryFullTextParts);
+        return;
+    }
+    int offset = 0;
+    int partOffset = -1;
+    int partLength = 0;
+    while (queryFullTextParts.next()) {
+        const int length = queryFullTextParts.value(1).toInt();
+        if (queryFullTextParts.value(0).toString() == partId) {
+            partOffset = offset;
+            partLength = length;
+        }
+        offset += 1 + length;
+    }
+    queryFullTextParts.finish();
+
+    if (offset != body.size()) {
+        // The text was indexed by an older version which did not keep track of the parts; it's safer to start over
+        body.clear();
+        clearFullTextParts(docId, docId);
+        partOffset = -1;
+    }
+
+    if (partOffset != -1) {
+        body.replace(partOffset + 1, partLength, lowercase);
+        queryFullTextUpdatePart.bindValue(0, lowercase.size());
+        queryFullTextUpdatePart.bindValue(1, docId);
+        queryFullTextUpdatePart.bindValue(2, partId);
+        if (!queryFullTextUpdatePart.exec()) {
+            emitError(tr("Query queryFullTextUpdatePart failed"), queryFullTextUpdatePart);
+            return;
+        }
+    } else {
+        body += QLatin1Char(' ') + lowercase;
+        queryFullTextInsertPart.bindValue(0, docId);
+        queryFullTextInsertPart.bindValue(1, partId);
+        queryFullTextInsertPart.bindValue(2, lowercase.size());
+        if (!queryFullTextInsertPart.exec()) {
+            emitError(tr("Query queryFullTextInsertPart failed"), queryFullTextInsertPart);
+            return;
+        }
+    }
+
+    if (hasRow) {
+        queryFullTextSetBody.bindValue(0, body);
+        queryFullTextSetBody.bindValue(1, docId);
+        if (!queryFullTextSetBody.exec()) {
+            emitError(tr("Query queryFullTextSetBody failed"), queryFullTextSetBody);
+        }
+        return;
+    }
+
+    // The envelope has not been indexed, which can happen for caches which were created by older versions
+    queryFullTextInsertBody.bindValue(0, docId);
+    queryFullTextInsertBody.bindValue(1, body);
+    if (!queryFullTextInsertBody.exec()) {
+        emitError(tr("Query queryFullTextInsertBody failed"), queryFullTextInsertBody);
+    }
+}
+
+void SQLCache::clearFullTextParts(const qint64 fromDocId, const qint64 toDocId)
+{
+    queryFullTextClearParts.bindValue(0, fromDocId);
+    queryFullTextClearParts.bindValue(1, toDocId);
+    if (!queryFullTextClearParts.exec()) {
+        emitError(tr("Query queryFullTextClearParts failed"), queryFullTextClearParts);
+    }
+}
+
+QList<uint> SQLCache::fullTextSearch(const QString &mailbox, const QString &field, const QString &text) const
+{
+    flushStagedWrites();
+    QList<uint> res;
+    if (!m_fullTextIndex)
+        return res;
+    const int id = mailboxId(mailbox, false);
+    if (id == -1)
+        return res;
+
+    QString column;
+    if (field == QLatin1String("SUBJECT"))
+        column = QLatin1String("subject:");
+    else if (field == QLatin1String("FROM"))
+        column = QLatin1String("sender:");
+    else if (field == QLatin1String("TO"))
+        column = QLatin1String("to_addr:");
+    else if (field == QLatin1String("CC"))
+        column = QLatin1String("cc_addr:");
+    else if (field == QLatin1String("BCC"))
+        column = QLatin1String("bcc_addr:");
+    else if (field == QLatin1String("BODY"))
+        column = QLatin1String("body:");
+    else if (field != QLatin1String("TEXT"))
         return res;
+
+    // Only plain words are passed to the FTS query syntax, so that no user input can be interpreted as an operator
+    QStringList terms;
+    Q_FOREACH(const QString &word, text.toLower().split(QRegExp(QLatin1String("\\W+")), QString::SkipEmptyParts)) {
+        terms << column + word + QLatin1Char('*');
     }
-    if (queryMessageThreading.first()) {
-        QDataStream stream(qUncompress(queryMessageThreading.value(0).toByteArray()));
-        stream.setVersion(streamVersion);
-        stream >> res;
+    if (terms.isEmpty())
+        return res;
+
+    queryFullTextSearch.bindValue(0, terms.join(QLatin1String(" ")));
+    queryFullTextSearch.bindValue(1, fullTextDocId(id, 0));
+    queryFullTextSearch.bindValue(2, fullTextDocId(id, 0xffffffff));
+    if (!queryFullTextSearch.exec()) {
+        emitError(tr("Query queryFullTextSearch failed"), queryFullTextSearch);
+        return res;
     }
+    while (queryFullTextSearch.next())
+        res << static_cast<uint>(queryFullTextSearch.value(0).toLongLong() & 0xffffffff);
+    qSort(res);
     return res;
 }
 
+QVector<Imap::Responses::ThreadingNode> SQLCache::messageThreading(const QString &mailbox)
+{
+    const int id = mailboxId(mailbox, false);
+    if (id == -1)
+        return QVector<Imap::Responses::ThreadingNode>();
+    return buildThreading(threadLinks(id));
+}
+
 void SQLCache::setMessageThreading(const QString &mailbox, const QVector<Imap::Responses::ThreadingNode> &threading)
 {
 #ifdef CACHE_DEBUG
     qDebug() << "Setting threading for" << mailbox;
 #endif
-    touchingDB();
-    querySetMessageThreading.bindValue(0, mailbox.isEmpty() ? QLatin1String("") : mailbox);
-    QByteArray buf;
-    QDataStream stream(&buf, QIODevice::ReadWrite);
-    stream.setVersion(streamVersion);
-    stream << threading;
-    querySetMessageThreading.bindValue(1, qCompress(buf));
-    if (! querySetMessageThreading.exec()) {
-        emitError(tr("Query querySetMessageThreading failed"), querySetMessageThreading);
+    const int id = mailboxId(mailbox, true);
+    if (id == -1)
+        return;
+    ThreadLinks fresh;
+    flattenThreading(threading, 0, fresh);
+    // The old links have to be obtained before the m_threadLinks gets replaced
+    const ThreadLinks old = threadLinks(id);
+    if (storeThreadLinks(id, old, fresh)) {
+        m_threadLinks = fresh;
+        m_threadLinksMailbox = id;
+    } else {
+        m_threadLinksMailbox = -1;
+        m_threadLinks.clear();
+    }
+}
+
+const SQLCache::ThreadLinks &SQLCache::threadLinks(const int mailboxId) const
+{
+    if (m_threadLinksMailbox == mailboxId)
+        return m_threadLinks;
+
+    m_threadLinks.clear();
+    m_threadLinksMailbox = -1;
+    queryMessageThreading.bindValue(0, mailboxId);
+    if (! queryMessageThreading.exec()) {
+        emitError(tr("Query queryMessageThreading failed"), queryMessageThreading);
+        return m_threadLinks;
+    }
+    while (queryMessageThreading.next()) {
+        m_threadLinks.insert(queryMessageThreading.value(0).toULongLong(),
+                             ThreadLink(queryMessageThreading.value(1).toULongLong(), queryMessageThreading.value(2).toULongLong()));
     }
+    m_threadLinksMailbox = mailboxId;
+    return m_threadLinks;
+}
 
+bool SQLCache::storeThreadLinks(const int mailboxId, const ThreadLinks &old, const ThreadLinks &fresh)
+{
+    bool touched = false;
+    for (ThreadLinks::const_iterator it = fresh.constBegin(); it != fresh.constEnd(); ++it) {
+        ThreadLinks::const_iterator oldIt = old.constFind(it.key());
+        if (oldIt != old.constEnd() && *oldIt == *it)
+            continue;
+        if (!touched) {
+            touchingDB();
+            touched = true;
+        }
+        querySetThreadNode.bindValue(0, mailboxId);
+        querySetThreadNode.bindValue(1, it.key());
+        querySetThreadNode.bindValue(2, it->parent);
+        querySetThreadNode.bindValue(3, it->previous);
+        if (! querySetThreadNode.exec()) {
+            emitError(tr("Query querySetThreadNode failed"), querySetThreadNode);
+            return false;
+        }
+    }
+    for (ThreadLinks::const_iterator it = old.constBegin(); it != old.constEnd(); ++it) {
+        if (fresh.contains(it.key()))
+            continue;
+        if (!touched) {
+            touchingDB();
+            touched = true;
+        }
+        queryClearThreadNode.bindValue(0, mailboxId);
+        queryClearThreadNode.bindValue(1, it.key());
+        if (! queryClearThreadNode.exec()) {
+            emitError(tr("Query queryClearThreadNode failed"), queryClearThreadNode);
+            return false;
+        }
+    }
+    return true;
+}
+
+void SQLCache::flattenThreading(const QVector<Imap::Responses::ThreadingNode> &nodes, const quint64 parent, ThreadLinks &links)
+{
+    quint64 previous = 0;
+    Q_FOREACH(const Imap::Responses::ThreadingNode &node, nodes) {
+        quint64 id = node.num;
+        if (!id) {
+            // Find the first real descendant in the depth-first order; only the empty ancestors of that message can end up
+            // with the same UID, and these are told apart by their distance
+            QList<QPair<const Imap::Responses::ThreadingNode *, quint64> > queue;
+            queue << qMakePair(&node, quint64(0));
+            while (!queue.isEmpty()) {
+                QPair<const Imap::Responses::ThreadingNode *, quint64> item = queue.takeFirst();
+                if (item.first->num) {
+                    id = (item.second << 32) | item.first->num;
+                    break;
+                }
+                for (int i = item.first->children.size() - 1; i >= 0; --i)
+                    queue.prepend(qMakePair(&item.first->children[i], item.second + 1));
+            }
+            if (!id)
+                continue;
+        }
+        links.insert(id, ThreadLink(parent, previous));
+        flattenThreading(node.children, id, links);
+        previous = id;
+    }
+}
+
+namespace {
+
+/** @short Recursively rebuild the children of @arg parent, never visiting more than @arg budget nodes in total */
+QVector<Imap::Responses::ThreadingNode> buildThreadingChildren(const QHash<quint64, quint64> &firstChild,
+                                                                 const QHash<quint64, quint64> &nextSibling,
+                                                                 const quint64 parent, int &budget)
+{
+    QVector<Imap::Responses::ThreadingNode> res;
+    for (quint64 id = firstChild.value(parent); id && budget > 0; id = nextSibling.value(id)) {
+        --budget;
+        // The empty nodes have the distance to their first real descendant in the upper half of their IDs
+        Imap::Responses::ThreadingNode node(id >> 32 ? 0 : static_cast<uint>(id));
+        node.children = buildThreadingChildren(firstChild, nextSibling, id, budget);
+        res << node;
+    }
+    return res;
+}
+
+}
+
+QVector<Imap::Responses::ThreadingNode> SQLCache::buildThreading(const ThreadLinks &links)
+{
+    QHash<quint64, quint64> firstChild;
+    QHash<quint64, quint64> nextSibling;
+    firstChild.reserve(links.size());
+    nextSibling.reserve(links.size());
+    for (ThreadLinks::const_iterator it = links.constBegin(); it != links.constEnd(); ++it) {
+        if (it->previous)
+            nextSibling.insert(it->previous, it.key());
+        else
+            firstChild.insert(it->parent, it.key());
+    }
+    // A damaged table could contain cycles; the budget makes sure that the walk terminates even then
+    int budget = links.size();
+    return buildThreadingChildren(firstChild, nextSibling, 0, budget);
 }
 
 void SQLCache::touchingDB()
@@ -818,6 +1979,289 @@ void SQLCache::setRenewalThreshold(const int days)
     m_updateAccessIfOlder = days;
 }
 
+void SQLCache::setCacheBudget(const qint64 maxBytes, const int maxDays)
+{
+    // The expiration is driven by the CombinedCache because only that one knows about all places where the data live
+    Q_UNUSED(maxBytes);
+    Q_UNUSED(maxDays);
+}
+
+void SQLCache::beginBatch()
+{
+    ++m_batchDepth;
+}
+
+void SQLCache::commitBatch()
+{
+    if (!m_batchDepth)
+        return;
+    if (--m_batchDepth == 0)
+        flushStagedWrites();
+}
+
+void SQLCache::flushStagedWrites() const
+{
+    if (m_stagedMetadata.isEmpty() && m_stagedFlags.isEmpty() && m_stagedPageRemovals.isEmpty())
+        return;
+#ifdef CACHE_DEBUG
+    qDebug() << "Flushing" << m_stagedMetadata.size() << "metadata and" << m_stagedFlags.size() << "flags";
+#endif
+    // The batch is started from const methods which have to see the most recent data, though
+    const_cast<SQLCache *>(this)->touchingDB();
+
+    // Each affected page is rewritten just once, no matter how many of its messages have changed
+    QMap<qint64, MetadataPage> pages;
+    QSet<qint64> changedPages;
+    Q_FOREACH(const qint64 docId, m_stagedPageRemovals) {
+        const int id = static_cast<int>(docId >> 32);
+        const uint uid = static_cast<uint>(docId & 0xffffffff);
+        const qint64 pageKey = metadataPageKey(id, uid / metadataPageSize);
+        QMap<qint64, MetadataPage>::iterator page = pages.find(pageKey);
+        if (page == pages.end())
+            page = pages.insert(pageKey, metadataPage(id, uid / metadataPageSize));
+        // Messages which were never stored, or whose page is gone already, do not cause any writes
+        if (page->remove(uid))
+            changedPages.insert(pageKey);
+    }
+    m_stagedPageRemovals.clear();
+
+    if (!m_stagedMetadata.isEmpty()) {
+        const QVariant lastAccess = accessingThresholdDate.daysTo(QDate::currentDate());
+        QVariantList ids, uids, lastAccesses, docIds, subjects, senders, recipients, ccs, bccs;
+        for (QHash<qint64, MessageDataBundle>::const_iterator it = m_stagedMetadata.constBegin();
+             it != m_stagedMetadata.constEnd(); ++it) {
+            const int id = static_cast<int>(it.key() >> 32);
+            const uint uid = static_cast<uint>(it.key() & 0xffffffff);
+            const qint64 pageKey = metadataPageKey(id, uid / metadataPageSize);
+            QMap<qint64, MetadataPage>::iterator page = pages.find(pageKey);
+            if (page == pages.end())
+                page = pages.insert(pageKey, metadataPage(id, uid / metadataPageSize));
+            page->insert(uid, serializeMetadata(*it));
+            changedPages.insert(pageKey);
+            ids << id;
+            uids << uid;
+            lastAccesses << lastAccess;
+            if (m_fullTextIndex) {
+                docIds << it.key();
+                subjects << it->envelope.subject.toLower();
+                senders << fullTextAddresses(it->envelope.from);
+                recipients << fullTextAddresses(it->envelope.to);
+                ccs << fullTextAddresses(it->envelope.cc);
+                bccs << fullTextAddresses(it->envelope.bcc);
+            }
+        }
+        m_stagedMetadata.clear();
+
+        // Order of values: mailbox_id, uid, lastAccessDate
+        querySetMessageMetadata.bindValue(0, ids);
+        querySetMessageMetadata.bindValue(1, uids);
+        querySetMessageMetadata.bindValue(2, lastAccesses);
+        if (!querySetMessageMetadata.execBatch()) {
+            emitError(tr("Query querySetMessageMetadata failed"), querySetMessageMetadata);
+        }
+
+        if (m_fullTextIndex) {
+            queryFullTextSetEnvelope.bindValue(0, docIds);
+            queryFullTextSetEnvelope.bindValue(1, subjects);
+            queryFullTextSetEnvelope.bindValue(2, senders);
+            queryFullTextSetEnvelope.bindValue(3, recipients);
+            queryFullTextSetEnvelope.bindValue(4, ccs);
+            queryFullTextSetEnvelope.bindValue(5, bccs);
+            if (!queryFullTextSetEnvelope.execBatch()) {
+                emitError(tr("Query queryFullTextSetEnvelope failed"), queryFullTextSetEnvelope);
+            }
+        }
+    }
+
+    for (QMap<qint64, MetadataPage>::const_iterator it = pages.constBegin(); it != pages.constEnd(); ++it) {
+        if (changedPages.contains(it.key()))
+            storeMetadataPage(static_cast<int>(it.key() >> 32), static_cast<uint>(it.key() & 0xffffffff), *it);
+    }
+
+    if (!m_stagedFlags.isEmpty()) {
+        QVariantList ids, uids, bits, keywordIds, keywordUids, keywords;
+        for (QHash<qint64, QStringList>::const_iterator it = m_stagedFlags.constBegin(); it != m_stagedFlags.constEnd(); ++it) {
+            const int id = static_cast<int>(it.key() >> 32);
+            const uint uid = static_cast<uint>(it.key() & 0xffffffff);
+            int messageBits = 0;
+            Q_FOREACH(const QString &flag, *it) {
+                if (int bit = systemFlagBit(flag)) {
+                    messageBits |= bit;
+                } else {
+                    messageBits |= flagsHaveKeywords;
+                    keywordIds << id;
+                    keywordUids << uid;
+                    keywords << flag;
+                }
+            }
+            ids << id;
+            uids << uid;
+            bits << messageBits;
+        }
+        m_stagedFlags.clear();
+
+        querySetMessageFlags.bindValue(0, ids);
+        querySetMessageFlags.bindValue(1, uids);
+        querySetMessageFlags.bindValue(2, bits);
+        if (!querySetMessageFlags.execBatch()) {
+            emitError(tr("Query querySetMessageFlags failed"), querySetMessageFlags);
+            return;
+        }
+
+        queryClearMessage4.bindValue(0, ids);
+        queryClearMessage4.bindValue(1, uids);
+        if (!queryClearMessage4.execBatch()) {
+            emitError(tr("Query queryClearMessage4 failed"), queryClearMessage4);
+            return;
+        }
+        if (!keywords.isEmpty()) {
+            querySetMessageKeywords.bindValue(0, keywordIds);
+            querySetMessageKeywords.bindValue(1, keywordUids);
+            querySetMessageKeywords.bindValue(2, keywords);
+            if (!querySetMessageKeywords.execBatch()) {
+                emitError(tr("Query querySetMessageKeywords failed"), querySetMessageKeywords);
+            }
+        }
+    }
+}
+
+int SQLCache::currentAccessDate()
+{
+    return accessingThresholdDate.daysTo(QDate::currentDate());
+}
+
+QList<SQLCache::AccessRecord> SQLCache::leastRecentlyAccessed(const AccessRecord &after, const int limit) const
+{
+    QList<AccessRecord> res;
+    flushStagedWrites();
+    queryLeastRecentlyAccessed.bindValue(0, after.lastAccess);
+    queryLeastRecentlyAccessed.bindValue(1, after.mailboxId);
+    queryLeastRecentlyAccessed.bindValue(2, after.uid);
+    queryLeastRecentlyAccessed.bindValue(3, limit);
+    if (!queryLeastRecentlyAccessed.exec()) {
+        emitError(tr("Query queryLeastRecentlyAccessed failed"), queryLeastRecentlyAccessed);
+        return res;
+    }
+    while (queryLeastRecentlyAccessed.next()) {
+        AccessRecord record;
+        record.lastAccess = queryLeastRecentlyAccessed.value(0).toInt();
+        record.mailboxId = queryLeastRecentlyAccessed.value(1).toInt();
+        record.uid = queryLeastRecentlyAccessed.value(2).toUInt();
+        record.mailbox = queryLeastRecentlyAccessed.value(3).toString();
+        record.metadataSize = queryLeastRecentlyAccessed.value(4).toLongLong();
+        record.partsSize = queryLeastRecentlyAccessed.value(5).toLongLong();
+        res << record;
+    }
+    return res;
+}
+
+qint64 SQLCache::storedSize() const
+{
+    flushStagedWrites();
+    QSqlQuery q(QString(), db);
+    if (!q.exec(QLatin1String("SELECT (SELECT COALESCE(SUM(LENGTH(data)), 0) FROM msg_metadata) + "
+                              "(SELECT COALESCE(SUM(LENGTH(data)), 0) FROM msg_metadata_pages) + "
+                              "(SELECT COALESCE(SUM(LENGTH(data)), 0) FROM parts)"))) {
+        emitError(tr("Failed to determine the size of the cache"), q);
+        return 0;
+    }
+    return q.first() ? q.value(0).toLongLong() : 0;
+}
+
+void SQLCache::expireMessageParts(const QString &mailbox, uint uid)
+{
+    const int id = mailboxId(mailbox, false);
+    if (id == -1)
+        return;
+    touchingDB();
+    queryClearMessage3.bindValue(0, id);
+    queryClearMessage3.bindValue(1, uid);
+    if (!queryClearMessage3.exec()) {
+        emitError(tr("Query queryClearMessage3 failed"), queryClearMessage3);
+    }
+}
+
+void SQLCache::expireMessageMetadata(const QString &mailbox, uint uid)
+{
+    const int id = mailboxId(mailbox, false);
+    if (id == -1)
+        return;
+    m_stagedMetadata.remove(fullTextDocId(id, uid));
+    touchingDB();
+    queryClearMessage1.bindValue(0, id);
+    queryClearMessage1.bindValue(1, uid);
+    if (!queryClearMessage1.exec()) {
+        emitError(tr("Query queryClearMessage1 failed"), queryClearMessage1);
+    }
+    removeFromMetadataPage(id, uid);
+    if (m_fullTextIndex) {
+        queryFullTextClearMessage.bindValue(0, fullTextDocId(id, uid));
+        if (!queryFullTextClearMessage.exec()) {
+            emitError(tr("Query queryFullTextClearMessage failed"), queryFullTextClearMessage);
+        }
+        clearFullTextParts(fullTextDocId(id, uid), fullTextDocId(id, uid));
+    }
+}
+
+SQLCache::MetadataPage SQLCache::metadataPage(const int mailboxId, const uint page) const
+{
+    const qint64 key = metadataPageKey(mailboxId, page);
+    if (MetadataPage *cached = m_metadataPages.object(key))
+        return *cached;
+
+    MetadataPage res;
+    queryMetadataPage.bindValue(0, mailboxId);
+    queryMetadataPage.bindValue(1, page);
+    if (!queryMetadataPage.exec()) {
+        emitError(tr("Query queryMetadataPage failed"), queryMetadataPage);
+        return res;
+    }
+    if (queryMetadataPage.first()) {
+        QDataStream stream(qUncompress(queryMetadataPage.value(0).toByteArray()));
+        stream.setVersion(streamVersion);
+        stream >> res;
+        queryMetadataPage.finish();
+        m_metadataPages.insert(key, new MetadataPage(res));
+    }
+    // Pages which do not exist are not worth the memory; they would only push the real ones out
+    return res;
+}
+
+void SQLCache::storeMetadataPage(const int mailboxId, const uint page, const MetadataPage &data) const
+{
+    const qint64 key = metadataPageKey(mailboxId, page);
+    if (data.isEmpty()) {
+        m_metadataPages.remove(key);
+        queryClearMetadataPage.bindValue(0, mailboxId);
+        queryClearMetadataPage.bindValue(1, page);
+        if (!queryClearMetadataPage.exec()) {
+            emitError(tr("Query queryClearMetadataPage failed"), queryClearMetadataPage);
+        }
+        return;
+    }
+
+    QByteArray buf;
+    QDataStream stream(&buf, QIODevice::ReadWrite);
+    stream.setVersion(streamVersion);
+    stream << data;
+    querySetMetadataPage.bindValue(0, mailboxId);
+    querySetMetadataPage.bindValue(1, page);
+    querySetMetadataPage.bindValue(2, data.size());
+    querySetMetadataPage.bindValue(3, qCompress(buf));
+    if (!querySetMetadataPage.exec()) {
+        emitError(tr("Query querySetMetadataPage failed"), querySetMetadataPage);
+        m_metadataPages.remove(key);
+        return;
+    }
+    m_metadataPages.insert(key, new MetadataPage(data));
+}
+
+void SQLCache::removeFromMetadataPage(const int mailboxId, const uint uid) const
+{
+    m_stagedPageRemovals.insert(fullTextDocId(mailboxId, uid));
+    if (!m_batchDepth)
+        flushStagedWrites();
+}
 
 }
 }
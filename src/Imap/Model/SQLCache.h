@@ -24,8 +24,13 @@
 #define IMAP_MODEL_SQLCACHE_H
 
 #include "Cache.h"
+#include <QCache>
 #include <QSqlDatabase>
+#include <QHash>
+#include <QMap>
+#include <QSet>
 #include <QSqlQuery>
+#include <climits>
 
 class QTimer;
 
@@ -51,9 +56,21 @@ et cetera. In short, the layout of the database is supposed to act as a quick an
 cache and is certainly *not* meant to be accessed by third-party applications. Please, do
 consider it an opaque format.
 
+The threading is stored as one row per node which refers to the node's parent and to its previous sibling.  The rows of
+the last used mailbox are kept in memory, so that an update of the threading only writes the nodes which have moved and
+removes the ones which are gone; a new message which joins a thread costs a single row instead of the whole mailbox.
+
+The per-message tables refer to mailboxes through an integer ID from the mailboxes table.  The database uses the WAL
+journal; the level of the "synchronous" pragma can be set through the "trojita-sqlcache-synchronous" property of the
+parent object (OFF, NORMAL or FULL, defaulting to NORMAL).
+
+The message metadata are not compressed one by one.  A few hundred bytes do not give zlib enough context, so the metadata
+of messages with neighbouring UIDs are grouped into pages which are compressed as a whole and kept decompressed in a small
+in-memory cache.  The msg_metadata table only keeps the date of the last access; its data column is still read for the rows
+written by older versions.
+
 Some ideas for improvements:
-- Don't store full string mailbox names in each table, use another table for it
-- Merge uid_mapping with mailbox_sync_state, and also msg_metadata with flags
+- Merge uid_mapping with mailbox_sync_state
 - Serious embedded users might consider putting the database into a compressed filesystem,
   or using on-the-fly compression via sqlite's VFS subsystem
 
@@ -72,6 +89,9 @@ public:
     virtual SyncState mailboxSyncState(const QString &mailbox) const;
     virtual void setMailboxSyncState(const QString &mailbox, const SyncState &state);
 
+    virtual SyncState mailboxStatus(const QString &mailbox) const;
+    virtual void setMailboxStatus(const QString &mailbox, const SyncState &state);
+
     virtual void setUidMapping(const QString &mailbox, const QList<uint> &seqToUid);
     virtual void clearUidMapping(const QString &mailbox);
     virtual QList<uint> uidMapping(const QString &mailbox) const;
@@ -81,12 +101,18 @@ public:
 
     virtual MessageDataBundle messageMetadata(const QString &mailbox, uint uid) const;
     virtual void setMessageMetadata(const QString &mailbox, uint uid, const MessageDataBundle &metadata);
+    virtual QHash<uint, MessageDataBundle> metadataOfMessages(const QString &mailbox, const QList<uint> &uids) const;
 
     virtual QStringList msgFlags(const QString &mailbox, uint uid) const;
     virtual void setMsgFlags(const QString &mailbox, uint uid, const QStringList &flags);
+    virtual QList<uint> uidsWithFlag(const QString &mailbox, const QString &flag, const bool present) const;
+    virtual uint countWithFlag(const QString &mailbox, const QString &flag, const bool present) const;
 
     virtual QByteArray messagePart(const QString &mailbox, uint uid, const QString &partId) const;
     virtual void setMsgPart(const QString &mailbox, uint uid, const QString &partId, const QByteArray &data);
+    virtual void setMsgPartText(const QString &mailbox, uint uid, const QString &partId, const QByteArray &data,
+                                const QString &charset, const QString &mimeType);
+    virtual QList<uint> fullTextSearch(const QString &mailbox, const QString &field, const QString &text) const;
 
     virtual QVector<Imap::Responses::ThreadingNode> messageThreading(const QString &mailbox);
     virtual void setMessageThreading(const QString &mailbox, const QVector<Imap::Responses::ThreadingNode> &threading);
@@ -95,6 +121,40 @@ public:
     bool open(const QString &name, const QString &fileName);
 
     virtual void setRenewalThreshold(const int days);
+    virtual void beginBatch();
+    virtual void commitBatch();
+    virtual void setCacheBudget(const qint64 maxBytes, const int maxDays);
+
+    /** @short A cached message along with the information which the expiration needs */
+    struct AccessRecord {
+        QString mailbox;
+        int mailboxId;
+        uint uid;
+        /** @short The lastAccessDate, i.e. days since the accessingThresholdDate */
+        int lastAccess;
+        /** @short Size of the stored metadata in bytes; paged metadata count as an even share of their page */
+        qint64 metadataSize;
+        /** @short Size of the message parts stored in the database in bytes */
+        qint64 partsSize;
+
+        AccessRecord(): mailboxId(-1), uid(0), lastAccess(INT_MIN), metadataSize(0), partsSize(0) {}
+    };
+
+    /** @short Return up to @arg limit messages which follow @arg after in the order of their last access
+
+    The messages are ordered by the lastAccessDate and then by the mailbox and the UID, so that the caller can walk through the
+    whole cache in small steps by passing the last returned record back.  A default-constructed record starts at the
+    beginning.  Only the messages whose metadata are cached are considered.
+    */
+    QList<AccessRecord> leastRecentlyAccessed(const AccessRecord &after, const int limit) const;
+    /** @short Return the number of bytes occupied by the message metadata and parts */
+    qint64 storedSize() const;
+    /** @short Remove the parts of a message while keeping its metadata and flags */
+    void expireMessageParts(const QString &mailbox, uint uid);
+    /** @short Remove the metadata of a message along with its full-text index entry while keeping its flags */
+    void expireMessageMetadata(const QString &mailbox, uint uid);
+    /** @short Return today's date in the format used for the lastAccessDate */
+    static int currentAccessDate();
 
 private:
     /** @short Broadcast an error from the SQL query */
@@ -106,12 +166,70 @@ private:
 
     /** @short Blindly create all tables */
     bool createTables();
+    /** @short Convert the per-message tables from v7 to the integer mailbox IDs */
+    bool migrateToV8();
+    /** @short Split the flags into the system flags bitmask and the keywords table */
+    bool migrateToV9();
+    /** @short Index the message metadata by the date of their last access */
+    bool migrateToV10();
+    /** @short Add the table of the compressed metadata pages */
+    bool migrateToV11();
+    /** @short Convert the threading blobs into the per-node rows */
+    bool migrateToV12();
+    /** @short Switch to the WAL journal and set up the synchronous mode */
+    bool setupJournal();
+    /** @short Create the full-text index unless it exists already; the index is disabled if SQLite lacks the FTS4 support */
+    void setupFullTextIndex();
+    /** @short Forget the positions of the indexed parts of the messages in the given range of full-text document IDs */
+    void clearFullTextParts(const qint64 fromDocId, const qint64 toDocId);
+    /** @short Return the ID of the mailbox, optionally allocating a new one; -1 means that the mailbox is not known */
+    int mailboxId(const QString &mailbox, const bool create) const;
     /** @short Initialize the prepared queries */
     bool prepareQueries();
 
     /** @short We're about to touch the DB, so it might be a good time to start a transaction */
     void touchingDB();
 
+    /** @short Position of a stored thread node; zero stands for the root and for "no previous sibling" */
+    struct ThreadLink {
+        quint64 parent;
+        quint64 previous;
+        ThreadLink(const quint64 parent = 0, const quint64 previous = 0): parent(parent), previous(previous) {}
+        bool operator==(const ThreadLink &other) const { return parent == other.parent && previous == other.previous; }
+        bool operator!=(const ThreadLink &other) const { return !(*this == other); }
+    };
+    typedef QHash<quint64, ThreadLink> ThreadLinks;
+
+    /** @short Return the stored thread nodes of a mailbox, reusing the ones of the last used mailbox */
+    const ThreadLinks &threadLinks(const int mailboxId) const;
+    /** @short Write the changed nodes of the threading of a mailbox and remove the ones which are gone */
+    bool storeThreadLinks(const int mailboxId, const ThreadLinks &old, const ThreadLinks &fresh);
+    /** @short Assign IDs to the nodes of the threading and record where they are
+
+    Real nodes are identified by their UIDs.  The empty nodes get the UID of their first real descendant along with the
+    distance to it in the upper half, which keeps their IDs stable as long as that part of the thread does not change.  Empty
+    nodes without any real descendants are not stored at all.
+    */
+    static void flattenThreading(const QVector<Imap::Responses::ThreadingNode> &nodes, const quint64 parent, ThreadLinks &links);
+    /** @short Rebuild the threading from the stored nodes */
+    static QVector<Imap::Responses::ThreadingNode> buildThreading(const ThreadLinks &links);
+
+    /** @short Write the metadata and flags which were staged by a batch into the database
+
+    This has to be called before anything which reads or removes these data.  It is const because the reads have to call
+    it, too.
+    */
+    void flushStagedWrites() const;
+
+    /** @short Serialized metadata of the messages sharing a page, indexed by their UID */
+    typedef QMap<uint, QByteArray> MetadataPage;
+    /** @short Return the page of metadata, either from the memory or from the database */
+    MetadataPage metadataPage(const int mailboxId, const uint page) const;
+    /** @short Compress and store the page of metadata; an empty page is removed */
+    void storeMetadataPage(const int mailboxId, const uint page, const MetadataPage &data) const;
+    /** @short Remove the metadata of one message from its page once the batch is over */
+    void removeFromMetadataPage(const int mailboxId, const uint uid) const;
+
     /** @short Initialize the database */
     void init();
 
@@ -122,29 +240,58 @@ private slots:
 private:
     QSqlDatabase db;
 
+    mutable QSqlQuery queryMailboxId;
+    mutable QSqlQuery queryAddMailboxId;
     mutable QSqlQuery queryChildMailboxes;
     mutable QSqlQuery queryChildMailboxesFresh;
     mutable QSqlQuery querySetChildMailboxes;
     mutable QSqlQuery queryMailboxSyncState;
     mutable QSqlQuery querySetMailboxSyncState;
+    mutable QSqlQuery queryMailboxStatus;
+    mutable QSqlQuery querySetMailboxStatus;
     mutable QSqlQuery queryUidMapping;
     mutable QSqlQuery querySetUidMapping;
     mutable QSqlQuery queryClearUidMapping;
     mutable QSqlQuery queryMessageMetadata;
+    mutable QSqlQuery queryAllMessageMetadata;
     mutable QSqlQuery queryAccessMessageMetadata;
     mutable QSqlQuery querySetMessageMetadata;
     mutable QSqlQuery queryMessageFlags;
     mutable QSqlQuery querySetMessageFlags;
+    mutable QSqlQuery queryMessageKeywords;
+    mutable QSqlQuery querySetMessageKeywords;
+    mutable QSqlQuery queryUidsWithSystemFlag;
+    mutable QSqlQuery queryUidsWithKeyword;
+    mutable QSqlQuery queryUidsWithoutKeyword;
     mutable QSqlQuery queryClearAllMessages1;
     mutable QSqlQuery queryClearAllMessages2;
     mutable QSqlQuery queryClearAllMessages3;
+    mutable QSqlQuery queryClearAllMessages4;
     mutable QSqlQuery queryClearMessage1;
     mutable QSqlQuery queryClearMessage2;
     mutable QSqlQuery queryClearMessage3;
+    mutable QSqlQuery queryClearMessage4;
     mutable QSqlQuery queryMessagePart;
     mutable QSqlQuery querySetMessagePart;
     mutable QSqlQuery queryMessageThreading;
-    mutable QSqlQuery querySetMessageThreading;
+    mutable QSqlQuery querySetThreadNode;
+    mutable QSqlQuery queryClearThreadNode;
+    mutable QSqlQuery queryFullTextSetEnvelope;
+    mutable QSqlQuery queryFullTextBody;
+    mutable QSqlQuery queryFullTextSetBody;
+    mutable QSqlQuery queryFullTextParts;
+    mutable QSqlQuery queryFullTextInsertPart;
+    mutable QSqlQuery queryFullTextUpdatePart;
+    mutable QSqlQuery queryFullTextClearParts;
+    mutable QSqlQuery queryFullTextInsertBody;
+    mutable QSqlQuery queryFullTextSearch;
+    mutable QSqlQuery queryFullTextClearMessage;
+    mutable QSqlQuery queryFullTextClearAll;
+    mutable QSqlQuery queryLeastRecentlyAccessed;
+    mutable QSqlQuery queryMetadataPage;
+    mutable QSqlQuery querySetMetadataPage;
+    mutable QSqlQuery queryClearMetadataPage;
+    mutable QSqlQuery queryClearAllMetadataPages;
 
     QTimer *delayedCommit;
     QTimer *tooMuchTimeWithoutCommit;
@@ -158,6 +305,27 @@ private:
     To disable updating of the DB accesses, set to zero.
     */
     int m_updateAccessIfOlder;
+
+    /** @short Cache of the mailbox name -> ID mapping */
+    mutable QHash<QString, int> m_mailboxIds;
+
+    /** @short Is the msg_fulltext table available? */
+    bool m_fullTextIndex;
+
+    /** @short Nesting level of the beginBatch() calls */
+    int m_batchDepth;
+    /** @short Metadata waiting for the end of the batch, indexed by the mailbox ID and UID like the full-text index */
+    mutable QHash<qint64, MessageDataBundle> m_stagedMetadata;
+    /** @short Flags waiting for the end of the batch */
+    mutable QHash<qint64, QStringList> m_stagedFlags;
+    /** @short Messages whose metadata shall be removed from their pages at the end of the batch */
+    mutable QSet<qint64> m_stagedPageRemovals;
+    /** @short Recently used pages of metadata, indexed by the mailbox ID and the page number */
+    mutable QCache<qint64, MetadataPage> m_metadataPages;
+    /** @short ID of the mailbox whose thread nodes are in the m_threadLinks, or -1 */
+    mutable int m_threadLinksMailbox;
+    /** @short The stored thread nodes of the last used mailbox */
+    mutable ThreadLinks m_threadLinks;
 };
 
 }
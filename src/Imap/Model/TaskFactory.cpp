@@ -120,9 +120,9 @@ KeepMailboxOpenTask *TaskFactory::createKeepMailboxOpenTask(Model *model, const
     return new KeepMailboxOpenTask(model, mailbox, oldParser);
 }
 
-NumberOfMessagesTask *TaskFactory::createNumberOfMessagesTask(Model *model, const QModelIndex &mailbox)
+NumberOfMessagesTask *TaskFactory::createNumberOfMessagesTask(Model *model, const QList<QPersistentModelIndex> &mailboxes)
 {
-    return new NumberOfMessagesTask(model, mailbox);
+    return new NumberOfMessagesTask(model, mailboxes);
 }
 
 ObtainSynchronizedMailboxTask *TaskFactory::createObtainSynchronizedMailboxTask(Model *model, const QModelIndex &mailboxIndex,
@@ -161,9 +161,10 @@ UnSelectTask *TaskFactory::createUnSelectTask(Model *model, ImapTask *parentTask
     return new UnSelectTask(model, parentTask);
 }
 
-SortTask *TaskFactory::createSortTask(Model *model, const QModelIndex &mailbox, const QStringList &searchConditions, const QStringList &sortCriteria)
+SortTask *TaskFactory::createSortTask(Model *model, const QModelIndex &mailbox, const QStringList &searchConditions, const QStringList &sortCriteria,
+                                      const uint windowOffset, const uint windowSize)
 {
-    return new SortTask(model, mailbox, searchConditions, sortCriteria);
+    return new SortTask(model, mailbox, searchConditions, sortCriteria, windowOffset, windowSize);
 }
 
 AppendTask *TaskFactory::createAppendTask(Model *model, const QString &targetMailbox, const QByteArray &rawMessageData,
@@ -0,0 +1,777 @@
+/* Copyright (C) 2006 - 2013 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "ThreadedCache.h"
+#include <QMutexLocker>
+#include <QThread>
+#include "CombinedCache.h"
+
+namespace Imap
+{
+namespace Mailbox
+{
+
+ThreadedCacheWorker::ThreadedCacheWorker(const QString &name, const QString &cacheDir):
+    QObject(0), m_backend(0), m_name(name), m_cacheDir(cacheDir), m_read(0), m_scheduled(false)
+{
+}
+
+void ThreadedCacheWorker::enqueue(CacheRequest *request)
+{
+    QMutexLocker locker(&m_mutex);
+    m_queue << request;
+    schedule();
+}
+
+void ThreadedCacheWorker::execute(CacheRequest *request)
+{
+    QMutexLocker locker(&m_mutex);
+    Q_ASSERT(!m_read);
+    m_read = request;
+    schedule();
+    while (m_read)
+        m_readDone.wait(&m_mutex);
+}
+
+void ThreadedCacheWorker::schedule()
+{
+    if (m_scheduled)
+        return;
+    m_scheduled = true;
+    QMetaObject::invokeMethod(this, "processQueue", Qt::QueuedConnection);
+}
+
+bool ThreadedCacheWorker::mustPrecede(const CacheRequest *write, const CacheRequest *read)
+{
+    switch (read->kind) {
+    case CacheRequest::OPEN:
+        // Nothing can be written before the database is open
+        return false;
+    case CacheRequest::CLOSE:
+        return true;
+    default:
+        break;
+    }
+    if (write->kind == CacheRequest::BATCH) {
+        Q_FOREACH(const CacheRequest *item, write->batch) {
+            if (mustPrecede(item, read))
+                return true;
+        }
+        return false;
+    }
+    return write->mailbox == read->mailbox;
+}
+
+void ThreadedCacheWorker::processQueue()
+{
+    QMutexLocker locker(&m_mutex);
+    while (true) {
+        CacheRequest *request = 0;
+        if (m_read) {
+            bool blocked = false;
+            Q_FOREACH(const CacheRequest *write, m_queue) {
+                if (mustPrecede(write, m_read)) {
+                    blocked = true;
+                    break;
+                }
+            }
+            if (!blocked) {
+                locker.unlock();
+                run(m_read);
+                locker.relock();
+                m_read = 0;
+                m_readDone.wakeAll();
+                continue;
+            }
+            // The writes stay in their original order; the read gets its turn right after the last one it depends on
+            request = m_queue.takeFirst();
+        } else if (!m_queue.isEmpty()) {
+            request = m_queue.takeFirst();
+        } else {
+            m_scheduled = false;
+            return;
+        }
+        locker.unlock();
+        run(request);
+        locker.relock();
+    }
+}
+
+void ThreadedCacheWorker::run(CacheRequest *request)
+{
+    if (request->kind == CacheRequest::OPEN) {
+        // The database connection has to be created from within the thread which is going to use it
+        Q_ASSERT(!m_backend);
+        m_backend = new CombinedCache(this, m_name, m_cacheDir);
+        connect(m_backend, SIGNAL(error(QString)), this, SIGNAL(error(QString)));
+        connect(m_backend, SIGNAL(evicted(qint64)), this, SIGNAL(evicted(qint64)));
+        request->result = m_backend->open();
+        if (!request->result) {
+            delete m_backend;
+            m_backend = 0;
+        }
+        return;
+    }
+
+    if (request->kind == CacheRequest::CLOSE) {
+        // This commits the pending transaction
+        delete m_backend;
+        m_backend = 0;
+        return;
+    }
+
+    if (request->kind == CacheRequest::BATCH) {
+        // The backend gets to write all of them at once, which is much cheaper than one commit per request
+        if (m_backend)
+            m_backend->beginBatch();
+        Q_FOREACH(CacheRequest *item, request->batch) {
+            run(item);
+        }
+        if (m_backend)
+            m_backend->commitBatch();
+        delete request;
+        return;
+    }
+
+    if (m_backend) {
+        switch (request->kind) {
+        case CacheRequest::OPEN:
+        case CacheRequest::CLOSE:
+        case CacheRequest::BATCH:
+            Q_ASSERT(false);
+            break;
+        case CacheRequest::CHILD_MAILBOXES:
+            request->childMailboxes = m_backend->childMailboxes(request->mailbox);
+            break;
+        case CacheRequest::CHILD_MAILBOXES_FRESH:
+            request->result = m_backend->childMailboxesFresh(request->mailbox);
+            break;
+        case CacheRequest::SET_CHILD_MAILBOXES:
+            m_backend->setChildMailboxes(request->mailbox, request->childMailboxes);
+            break;
+        case CacheRequest::SYNC_STATE:
+            request->syncState = m_backend->mailboxSyncState(request->mailbox);
+            break;
+        case CacheRequest::SET_SYNC_STATE:
+            m_backend->setMailboxSyncState(request->mailbox, request->syncState);
+            break;
+        case CacheRequest::STATUS:
+            request->syncState = m_backend->mailboxStatus(request->mailbox);
+            break;
+        case CacheRequest::SET_STATUS:
+            m_backend->setMailboxStatus(request->mailbox, request->syncState);
+            break;
+        case CacheRequest::UID_MAPPING:
+            request->uidMapping = m_backend->uidMapping(request->mailbox);
+            break;
+        case CacheRequest::SET_UID_MAPPING:
+            m_backend->setUidMapping(request->mailbox, request->uidMapping);
+            break;
+        case CacheRequest::CLEAR_UID_MAPPING:
+            m_backend->clearUidMapping(request->mailbox);
+            break;
+        case CacheRequest::CLEAR_ALL_MESSAGES:
+            m_backend->clearAllMessages(request->mailbox);
+            break;
+        case CacheRequest::CLEAR_MESSAGE:
+            m_backend->clearMessage(request->mailbox, request->uid);
+            break;
+        case CacheRequest::METADATA:
+            request->metadata = m_backend->messageMetadata(request->mailbox, request->uid);
+            break;
+        case CacheRequest::METADATA_BULK:
+            request->metadataHash = m_backend->metadataOfMessages(request->mailbox, request->uidMapping);
+            break;
+        case CacheRequest::SET_METADATA:
+            m_backend->setMessageMetadata(request->mailbox, request->uid, request->metadata);
+            break;
+        case CacheRequest::FLAGS_BULK:
+            Q_FOREACH(const uint uid, request->uidMapping) {
+                request->flagsHash[uid] = m_backend->msgFlags(request->mailbox, uid);
+            }
+            break;
+        case CacheRequest::SET_FLAGS:
+            m_backend->setMsgFlags(request->mailbox, request->uid, request->flags);
+            break;
+        case CacheRequest::UIDS_WITH_FLAG:
+            request->uidMapping = m_backend->uidsWithFlag(request->mailbox, request->flag, request->present);
+            break;
+        case CacheRequest::COUNT_WITH_FLAG:
+            request->number = m_backend->countWithFlag(request->mailbox, request->flag, request->present);
+            break;
+        case CacheRequest::PART:
+            request->data = m_backend->messagePart(request->mailbox, request->uid, request->partId);
+            break;
+        case CacheRequest::SET_PART:
+            m_backend->setMsgPart(request->mailbox, request->uid, request->partId, request->data);
+            break;
+        case CacheRequest::SET_PART_TEXT:
+            m_backend->setMsgPartText(request->mailbox, request->uid, request->partId, request->data, request->charset,
+                                      request->mimeType);
+            break;
+        case CacheRequest::FULL_TEXT_SEARCH:
+            request->uidMapping = m_backend->fullTextSearch(request->mailbox, request->field, request->text);
+            break;
+        case CacheRequest::THREADING:
+            request->threading = m_backend->messageThreading(request->mailbox);
+            break;
+        case CacheRequest::SET_THREADING:
+            m_backend->setMessageThreading(request->mailbox, request->threading);
+            break;
+        case CacheRequest::SET_RENEWAL_THRESHOLD:
+            m_backend->setRenewalThreshold(request->number);
+            break;
+        case CacheRequest::SET_CACHE_BUDGET:
+            m_backend->setCacheBudget(request->bytes, request->number);
+            break;
+        case CacheRequest::LOAD_METADATA:
+            // Unlike the metadataOfMessages(), this is an access to the messages
+            Q_FOREACH(const uint uid, request->uidMapping) {
+                request->metadataHash[uid] = m_backend->messageMetadata(request->mailbox, uid);
+                request->flagsHash[uid] = m_backend->msgFlags(request->mailbox, uid);
+            }
+            break;
+        case CacheRequest::LOAD_PART:
+            request->data = m_backend->messagePart(request->mailbox, request->uid, request->partId);
+            break;
+        }
+    }
+
+    if (request->kind == CacheRequest::LOAD_METADATA || request->kind == CacheRequest::LOAD_PART) {
+        // Even a failed read has to be reported, otherwise the caller would wait forever
+        emit loaded(request);
+    } else if (request->async) {
+        delete request;
+    }
+}
+
+
+ThreadedCache::ThreadedCache(QObject *parent, const QString &name, const QString &cacheDir):
+    AbstractCache(parent), m_batchDepth(0)
+{
+    qRegisterMetaType<Imap::Mailbox::CacheRequest*>("Imap::Mailbox::CacheRequest*");
+    qRegisterMetaType<qint64>("qint64");
+    m_thread = new QThread(this);
+    m_worker = new ThreadedCacheWorker(name, cacheDir);
+    m_worker->moveToThread(m_thread);
+    connect(m_worker, SIGNAL(error(QString)), this, SIGNAL(error(QString)));
+    connect(m_worker, SIGNAL(evicted(qint64)), this, SIGNAL(evicted(qint64)));
+    connect(m_worker, SIGNAL(loaded(Imap::Mailbox::CacheRequest*)), this, SLOT(slotLoaded(Imap::Mailbox::CacheRequest*)));
+    m_thread->start(QThread::LowPriority);
+}
+
+ThreadedCache::~ThreadedCache()
+{
+    // Let the worker finish all pending writes and close the database before the thread goes away
+    CacheRequest request(CacheRequest::CLOSE);
+    runSync(request);
+    m_thread->quit();
+    m_thread->wait();
+    delete m_worker;
+    // The results which nobody is going to pick up anymore
+    qDeleteAll(m_loads);
+}
+
+bool ThreadedCache::open()
+{
+    CacheRequest request(CacheRequest::OPEN);
+    runSync(request);
+    return request.result;
+}
+
+void ThreadedCache::runSync(CacheRequest &request) const
+{
+    // The request might depend on the writes which are still waiting in the batch
+    flushBatch();
+    m_worker->execute(&request);
+}
+
+void ThreadedCache::post(CacheRequest *request)
+{
+    request->async = true;
+    if (m_batchDepth)
+        m_batch << request;
+    else
+        dispatch(request);
+}
+
+void ThreadedCache::dispatch(CacheRequest *request) const
+{
+    m_worker->enqueue(request);
+}
+
+void ThreadedCache::touchMailbox(const QString &mailbox) const
+{
+    if (!m_mirroredMailboxes.isEmpty() && m_mirroredMailboxes.last() == mailbox)
+        return;
+    m_mirroredMailboxes.removeOne(mailbox);
+    m_mirroredMailboxes << mailbox;
+    while (m_mirroredMailboxes.size() > maxMirroredMailboxes) {
+        // The backend still has everything, so forgetting the mirror is always safe
+        const QString victim = m_mirroredMailboxes.takeFirst();
+        m_uidMapping.remove(victim);
+        m_messages.remove(victim);
+    }
+}
+
+ThreadedCache::MirroredMessage *ThreadedCache::findMirror(const QString &mailbox, const uint uid) const
+{
+    touchMailbox(mailbox);
+    QHash<QString, MirroredMailbox>::iterator mirror = m_messages.find(mailbox);
+    if (mirror == m_messages.end())
+        return 0;
+    QHash<uint, MirroredMessage>::iterator it = mirror->messages.find(uid);
+    if (it == mirror->messages.end())
+        return 0;
+    mirror->lru.erase(it->lru);
+    it->lru = mirror->lru.insert(mirror->lru.end(), uid);
+    return &*it;
+}
+
+ThreadedCache::MirroredMessage &ThreadedCache::mirrorOf(const QString &mailbox, const uint uid) const
+{
+    if (MirroredMessage *message = findMirror(mailbox, uid))
+        return *message;
+    MirroredMailbox &mirror = m_messages[mailbox];
+    MirroredMessage &message = mirror.messages[uid];
+    message.lru = mirror.lru.insert(mirror.lru.end(), uid);
+    // The new entry is the most recently used one, so it survives the trimming
+    trimMirror(mirror);
+    return message;
+}
+
+void ThreadedCache::trimMirror(MirroredMailbox &mirror)
+{
+    while (mirror.messages.size() > maxMirroredMessages)
+        mirror.messages.remove(mirror.lru.takeFirst());
+}
+
+void ThreadedCache::noteWrite(const QString &mailbox, const uint uid)
+{
+    QHash<QString, QHash<uint, bool> >::iterator loading = m_loadingMetadata.find(mailbox);
+    if (loading == m_loadingMetadata.end())
+        return;
+    QHash<uint, bool>::iterator it = loading->find(uid);
+    if (it != loading->end())
+        *it = true;
+}
+
+void ThreadedCache::flushBatch() const
+{
+    if (m_batch.isEmpty())
+        return;
+    CacheRequest *request = new CacheRequest(CacheRequest::BATCH);
+    request->async = true;
+    request->batch = m_batch;
+    m_batch.clear();
+    dispatch(request);
+}
+
+QList<MailboxMetadata> ThreadedCache::childMailboxes(const QString &mailbox) const
+{
+    QHash<QString, QList<MailboxMetadata> >::const_iterator it = m_childMailboxes.constFind(mailbox);
+    if (it != m_childMailboxes.constEnd())
+        return *it;
+    CacheRequest request(CacheRequest::CHILD_MAILBOXES, mailbox);
+    runSync(request);
+    m_childMailboxes[mailbox] = request.childMailboxes;
+    return request.childMailboxes;
+}
+
+bool ThreadedCache::childMailboxesFresh(const QString &mailbox) const
+{
+    // The freshness depends on the time of the last update, so it cannot be remembered
+    CacheRequest request(CacheRequest::CHILD_MAILBOXES_FRESH, mailbox);
+    runSync(request);
+    return request.result;
+}
+
+void ThreadedCache::setChildMailboxes(const QString &mailbox, const QList<MailboxMetadata> &data)
+{
+    m_childMailboxes[mailbox] = data;
+    CacheRequest *request = new CacheRequest(CacheRequest::SET_CHILD_MAILBOXES, mailbox);
+    request->childMailboxes = data;
+    post(request);
+}
+
+SyncState ThreadedCache::mailboxSyncState(const QString &mailbox) const
+{
+    QHash<QString, SyncState>::const_iterator it = m_syncState.constFind(mailbox);
+    if (it != m_syncState.constEnd())
+        return *it;
+    CacheRequest request(CacheRequest::SYNC_STATE, mailbox);
+    runSync(request);
+    m_syncState[mailbox] = request.syncState;
+    return request.syncState;
+}
+
+void ThreadedCache::setMailboxSyncState(const QString &mailbox, const SyncState &state)
+{
+    m_syncState[mailbox] = state;
+    CacheRequest *request = new CacheRequest(CacheRequest::SET_SYNC_STATE, mailbox);
+    request->syncState = state;
+    post(request);
+}
+
+SyncState ThreadedCache::mailboxStatus(const QString &mailbox) const
+{
+    QHash<QString, SyncState>::const_iterator it = m_status.constFind(mailbox);
+    if (it != m_status.constEnd())
+        return *it;
+    CacheRequest request(CacheRequest::STATUS, mailbox);
+    runSync(request);
+    m_status[mailbox] = request.syncState;
+    return request.syncState;
+}
+
+void ThreadedCache::setMailboxStatus(const QString &mailbox, const SyncState &state)
+{
+    m_status[mailbox] = state;
+    CacheRequest *request = new CacheRequest(CacheRequest::SET_STATUS, mailbox);
+    request->syncState = state;
+    post(request);
+}
+
+QList<uint> ThreadedCache::uidMapping(const QString &mailbox) const
+{
+    touchMailbox(mailbox);
+    QHash<QString, QList<uint> >::const_iterator it = m_uidMapping.constFind(mailbox);
+    if (it != m_uidMapping.constEnd())
+        return *it;
+    CacheRequest request(CacheRequest::UID_MAPPING, mailbox);
+    runSync(request);
+    m_uidMapping[mailbox] = request.uidMapping;
+    return request.uidMapping;
+}
+
+void ThreadedCache::setUidMapping(const QString &mailbox, const QList<uint> &seqToUid)
+{
+    touchMailbox(mailbox);
+    m_uidMapping[mailbox] = seqToUid;
+    CacheRequest *request = new CacheRequest(CacheRequest::SET_UID_MAPPING, mailbox);
+    request->uidMapping = seqToUid;
+    post(request);
+}
+
+void ThreadedCache::clearUidMapping(const QString &mailbox)
+{
+    touchMailbox(mailbox);
+    m_uidMapping[mailbox] = QList<uint>();
+    post(new CacheRequest(CacheRequest::CLEAR_UID_MAPPING, mailbox));
+}
+
+void ThreadedCache::clearAllMessages(const QString &mailbox)
+{
+    // Forgetting the entries is enough; the next read will consult the backend after the removal has been performed
+    m_uidMapping.remove(mailbox);
+    m_messages.remove(mailbox);
+    m_threading.remove(mailbox);
+    QHash<QString, QHash<uint, bool> >::iterator loading = m_loadingMetadata.find(mailbox);
+    if (loading != m_loadingMetadata.end()) {
+        for (QHash<uint, bool>::iterator it = loading->begin(); it != loading->end(); ++it)
+            *it = true;
+    }
+    post(new CacheRequest(CacheRequest::CLEAR_ALL_MESSAGES, mailbox));
+}
+
+void ThreadedCache::clearMessage(const QString mailbox, uint uid)
+{
+    touchMailbox(mailbox);
+    QHash<QString, MirroredMailbox>::iterator mirror = m_messages.find(mailbox);
+    if (mirror != m_messages.end()) {
+        QHash<uint, MirroredMessage>::iterator it = mirror->messages.find(uid);
+        if (it != mirror->messages.end()) {
+            mirror->lru.erase(it->lru);
+            mirror->messages.erase(it);
+        }
+    }
+    noteWrite(mailbox, uid);
+    post(new CacheRequest(CacheRequest::CLEAR_MESSAGE, mailbox, uid));
+}
+
+AbstractCache::MessageDataBundle ThreadedCache::messageMetadata(const QString &mailbox, uint uid) const
+{
+    const MirroredMessage *message = findMirror(mailbox, uid);
+    if (message && message->hasMetadata)
+        return message->metadata;
+    CacheRequest request(CacheRequest::METADATA, mailbox, uid);
+    runSync(request);
+    MirroredMessage &mirror = mirrorOf(mailbox, uid);
+    mirror.hasMetadata = true;
+    mirror.metadata = request.metadata;
+    return request.metadata;
+}
+
+QHash<uint, AbstractCache::MessageDataBundle> ThreadedCache::metadataOfMessages(const QString &mailbox, const QList<uint> &uids) const
+{
+    touchMailbox(mailbox);
+    QHash<uint, MessageDataBundle> res;
+    CacheRequest request(CacheRequest::METADATA_BULK, mailbox);
+    const QHash<uint, MirroredMessage> &messages = m_messages[mailbox].messages;
+    Q_FOREACH(const uint uid, uids) {
+        QHash<uint, MirroredMessage>::const_iterator it = messages.constFind(uid);
+        if (it == messages.constEnd() || !it->hasMetadata)
+            request.uidMapping << uid;
+        else if (it->metadata.uid)
+            res[uid] = it->metadata;
+    }
+    if (request.uidMapping.isEmpty())
+        return res;
+    // The results are not mirrored; a whole mailbox would only push everything else out of the mirror
+    runSync(request);
+    for (QHash<uint, MessageDataBundle>::const_iterator it = request.metadataHash.constBegin();
+         it != request.metadataHash.constEnd(); ++it) {
+        res[it.key()] = *it;
+    }
+    return res;
+}
+
+bool ThreadedCache::loadMessageMetadata(const QString &mailbox, const QList<uint> &uids) const
+{
+    QHash<uint, bool> &loading = m_loadingMetadata[mailbox];
+    CacheRequest *request = new CacheRequest(CacheRequest::LOAD_METADATA, mailbox);
+    bool pending = false;
+    Q_FOREACH(const uint uid, uids) {
+        const MirroredMessage *message = findMirror(mailbox, uid);
+        if (message && message->hasMetadata && message->hasFlags)
+            continue;
+        pending = true;
+        // The messages which are being loaded already will be reported along with the earlier request
+        if (!loading.contains(uid)) {
+            loading[uid] = false;
+            request->uidMapping << uid;
+        }
+    }
+    if (request->uidMapping.isEmpty()) {
+        if (loading.isEmpty())
+            m_loadingMetadata.remove(mailbox);
+        delete request;
+        return pending;
+    }
+    request->async = true;
+    m_loads << request;
+    // The worker has to see the writes which are still waiting in the batch
+    flushBatch();
+    dispatch(request);
+    return true;
+}
+
+void ThreadedCache::setMessageMetadata(const QString &mailbox, uint uid, const MessageDataBundle &metadata)
+{
+    MirroredMessage &message = mirrorOf(mailbox, uid);
+    message.hasMetadata = true;
+    message.metadata = metadata;
+    noteWrite(mailbox, uid);
+    CacheRequest *request = new CacheRequest(CacheRequest::SET_METADATA, mailbox, uid);
+    request->metadata = metadata;
+    post(request);
+}
+
+QStringList ThreadedCache::msgFlags(const QString &mailbox, uint uid) const
+{
+    const MirroredMessage *message = findMirror(mailbox, uid);
+    if (message && message->hasFlags)
+        return message->flags;
+
+    // Opening a mailbox asks for the flags of all of its messages, so let's read them in a single round trip
+    CacheRequest request(CacheRequest::FLAGS_BULK, mailbox);
+    QHash<QString, QList<uint> >::const_iterator mapping = m_uidMapping.constFind(mailbox);
+    if (mapping != m_uidMapping.constEnd()) {
+        const QHash<uint, MirroredMessage> &messages = m_messages[mailbox].messages;
+        for (int i = qMax(0, mapping->size() - maxMirroredMessages); i < mapping->size(); ++i) {
+            const uint other = mapping->at(i);
+            QHash<uint, MirroredMessage>::const_iterator it = messages.constFind(other);
+            if (other != uid && (it == messages.constEnd() || !it->hasFlags))
+                request.uidMapping << other;
+        }
+    }
+    request.uidMapping << uid;
+    runSync(request);
+    Q_FOREACH(const uint other, request.uidMapping) {
+        MirroredMessage &mirror = mirrorOf(mailbox, other);
+        mirror.hasFlags = true;
+        mirror.flags = request.flagsHash[other];
+    }
+    return request.flagsHash[uid];
+}
+
+void ThreadedCache::setMsgFlags(const QString &mailbox, uint uid, const QStringList &flags)
+{
+    MirroredMessage &message = mirrorOf(mailbox, uid);
+    message.hasFlags = true;
+    message.flags = flags;
+    noteWrite(mailbox, uid);
+    CacheRequest *request = new CacheRequest(CacheRequest::SET_FLAGS, mailbox, uid);
+    request->flags = flags;
+    post(request);
+}
+
+QList<uint> ThreadedCache::uidsWithFlag(const QString &mailbox, const QString &flag, const bool present) const
+{
+    // The memory layer does not know about all messages, so this has to be answered by the backend
+    CacheRequest request(CacheRequest::UIDS_WITH_FLAG, mailbox);
+    request.flag = flag;
+    request.present = present;
+    runSync(request);
+    return request.uidMapping;
+}
+
+uint ThreadedCache::countWithFlag(const QString &mailbox, const QString &flag, const bool present) const
+{
+    CacheRequest request(CacheRequest::COUNT_WITH_FLAG, mailbox);
+    request.flag = flag;
+    request.present = present;
+    runSync(request);
+    return request.number;
+}
+
+QByteArray ThreadedCache::messagePart(const QString &mailbox, uint uid, const QString &partId) const
+{
+    CacheRequest request(CacheRequest::PART, mailbox, uid);
+    request.partId = partId;
+    runSync(request);
+    return request.data;
+}
+
+bool ThreadedCache::loadMessagePart(const QString &mailbox, uint uid, const QString &partId) const
+{
+    CacheRequest *request = new CacheRequest(CacheRequest::LOAD_PART, mailbox, uid);
+    request->partId = partId;
+    request->async = true;
+    m_loads << request;
+    flushBatch();
+    dispatch(request);
+    return true;
+}
+
+void ThreadedCache::setMsgPart(const QString &mailbox, uint uid, const QString &partId, const QByteArray &data)
+{
+    CacheRequest *request = new CacheRequest(CacheRequest::SET_PART, mailbox, uid);
+    request->partId = partId;
+    request->data = data;
+    post(request);
+}
+
+void ThreadedCache::setMsgPartText(const QString &mailbox, uint uid, const QString &partId, const QByteArray &data,
+                                   const QString &charset, const QString &mimeType)
+{
+    // Both the decoding and the indexing are expensive, which is exactly why they happen in the worker thread
+    CacheRequest *request = new CacheRequest(CacheRequest::SET_PART_TEXT, mailbox, uid);
+    request->partId = partId;
+    request->data = data;
+    request->charset = charset;
+    request->mimeType = mimeType;
+    post(request);
+}
+
+QList<uint> ThreadedCache::fullTextSearch(const QString &mailbox, const QString &field, const QString &text) const
+{
+    // The requests are processed in order, so everything which has been submitted for indexing so far is already visible
+    CacheRequest request(CacheRequest::FULL_TEXT_SEARCH, mailbox);
+    request.field = field;
+    request.text = text;
+    runSync(request);
+    return request.uidMapping;
+}
+
+QVector<Imap::Responses::ThreadingNode> ThreadedCache::messageThreading(const QString &mailbox)
+{
+    QHash<QString, QVector<Imap::Responses::ThreadingNode> >::const_iterator it = m_threading.constFind(mailbox);
+    if (it != m_threading.constEnd())
+        return *it;
+    CacheRequest request(CacheRequest::THREADING, mailbox);
+    runSync(request);
+    m_threading[mailbox] = request.threading;
+    return request.threading;
+}
+
+void ThreadedCache::setMessageThreading(const QString &mailbox, const QVector<Imap::Responses::ThreadingNode> &threading)
+{
+    m_threading[mailbox] = threading;
+    CacheRequest *request = new CacheRequest(CacheRequest::SET_THREADING, mailbox);
+    request->threading = threading;
+    post(request);
+}
+
+void ThreadedCache::setRenewalThreshold(const int days)
+{
+    CacheRequest *request = new CacheRequest(CacheRequest::SET_RENEWAL_THRESHOLD);
+    request->number = days;
+    post(request);
+}
+
+void ThreadedCache::setCacheBudget(const qint64 maxBytes, const int maxDays)
+{
+    // The expired data might still be served from the memory layer, which is fine as it only lives till the end of the session
+    CacheRequest *request = new CacheRequest(CacheRequest::SET_CACHE_BUDGET);
+    request->bytes = maxBytes;
+    request->number = maxDays;
+    post(request);
+}
+
+void ThreadedCache::slotLoaded(CacheRequest *request)
+{
+    m_loads.remove(request);
+
+    if (request->kind == CacheRequest::LOAD_PART) {
+        emit messagePartLoaded(request->mailbox, request->uid, request->partId, request->data);
+        delete request;
+        return;
+    }
+
+    Q_ASSERT(request->kind == CacheRequest::LOAD_METADATA);
+    QHash<QString, QHash<uint, bool> >::iterator loading = m_loadingMetadata.find(request->mailbox);
+    Q_FOREACH(const uint uid, request->uidMapping) {
+        // Whatever has been written since the request was sent is newer than what the worker has read
+        if (loading == m_loadingMetadata.end() || loading->take(uid))
+            continue;
+        MirroredMessage &message = mirrorOf(request->mailbox, uid);
+        if (!message.hasMetadata) {
+            message.hasMetadata = true;
+            message.metadata = request->metadataHash[uid];
+        }
+        if (!message.hasFlags) {
+            message.hasFlags = true;
+            message.flags = request->flagsHash[uid];
+        }
+    }
+    if (loading != m_loadingMetadata.end() && loading->isEmpty())
+        m_loadingMetadata.erase(loading);
+    emit messageMetadataLoaded(request->mailbox, request->uidMapping);
+    delete request;
+}
+
+void ThreadedCache::beginBatch()
+{
+    ++m_batchDepth;
+}
+
+void ThreadedCache::commitBatch()
+{
+    if (!m_batchDepth)
+        return;
+    if (--m_batchDepth == 0)
+        flushBatch();
+}
+
+}
+}
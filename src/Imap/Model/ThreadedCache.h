@@ -0,0 +1,326 @@
+/* Copyright (C) 2006 - 2013 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef IMAP_MODEL_THREADEDCACHE_H
+#define IMAP_MODEL_THREADEDCACHE_H
+
+#include <QHash>
+#include <QLinkedList>
+#include <QMetaType>
+#include <QMutex>
+#include <QSet>
+#include <QWaitCondition>
+#include "Cache.h"
+
+class ImapThreadedCacheTest;
+class QThread;
+
+/** @short Namespace for IMAP interaction */
+namespace Imap
+{
+
+/** @short Classes for handling of mailboxes and connections */
+namespace Mailbox
+{
+
+class CombinedCache;
+
+/** @short One operation which shall be performed by the ThreadedCacheWorker
+
+The request doubles as a storage for the result of the read operations.
+*/
+struct CacheRequest
+{
+    typedef enum {
+        OPEN,
+        CLOSE,
+        CHILD_MAILBOXES,
+        CHILD_MAILBOXES_FRESH,
+        SET_CHILD_MAILBOXES,
+        SYNC_STATE,
+        SET_SYNC_STATE,
+        STATUS,
+        SET_STATUS,
+        UID_MAPPING,
+        SET_UID_MAPPING,
+        CLEAR_UID_MAPPING,
+        CLEAR_ALL_MESSAGES,
+        CLEAR_MESSAGE,
+        METADATA,
+        /** @short Metadata of all messages from the uidMapping, as in AbstractCache::metadataOfMessages() */
+        METADATA_BULK,
+        SET_METADATA,
+        /** @short Flags of all messages listed in the uidMapping */
+        FLAGS_BULK,
+        SET_FLAGS,
+        UIDS_WITH_FLAG,
+        COUNT_WITH_FLAG,
+        PART,
+        SET_PART,
+        SET_PART_TEXT,
+        FULL_TEXT_SEARCH,
+        THREADING,
+        SET_THREADING,
+        SET_RENEWAL_THRESHOLD,
+        SET_CACHE_BUDGET,
+        BATCH,
+        /** @short Metadata and flags of the messages from the uidMapping, delivered through ThreadedCacheWorker::loaded() */
+        LOAD_METADATA,
+        /** @short A message part, delivered through ThreadedCacheWorker::loaded() */
+        LOAD_PART
+    } Kind;
+
+    Kind kind;
+    /** @short Shall the worker delete this request once it's done? */
+    bool async;
+
+    QString mailbox;
+    uint uid;
+    QString partId;
+    QByteArray data;
+    QStringList flags;
+    QString flag;
+    bool present;
+    /** @short The SEARCH key for FULL_TEXT_SEARCH */
+    QString field;
+    QString text;
+    /** @short The charset and the MIME type of the part data for SET_PART_TEXT */
+    QString charset;
+    QString mimeType;
+    QList<uint> uidMapping;
+    SyncState syncState;
+    QList<MailboxMetadata> childMailboxes;
+    AbstractCache::MessageDataBundle metadata;
+    QHash<uint, AbstractCache::MessageDataBundle> metadataHash;
+    QHash<uint, QStringList> flagsHash;
+    QVector<Imap::Responses::ThreadingNode> threading;
+    int number;
+    /** @short The size limit for SET_CACHE_BUDGET */
+    qint64 bytes;
+    /** @short Asynchronous requests which shall be executed within a single batch of the backend */
+    QList<CacheRequest *> batch;
+    bool result;
+
+    CacheRequest(const Kind kind, const QString &mailbox = QString(), const uint uid = 0):
+        kind(kind), async(false), mailbox(mailbox), uid(uid), present(false), number(0), bytes(0), result(false) {}
+};
+
+/** @short The part of the ThreadedCache which lives in the worker thread
+
+All access to the on-disk storage, including the creation of the database connection, happens from within the worker
+thread.
+
+The writes are kept in a queue which the worker processes in order.  A read does not have to wait for the whole queue,
+though; it is executed as soon as no queued write refers to the same mailbox.
+*/
+class ThreadedCacheWorker : public QObject
+{
+    Q_OBJECT
+public:
+    ThreadedCacheWorker(const QString &name, const QString &cacheDir);
+
+    /** @short Queue an asynchronous request; the worker takes ownership.  Called from the owning thread. */
+    void enqueue(CacheRequest *request);
+    /** @short Execute the request as soon as possible and wait for its completion.  Called from the owning thread. */
+    void execute(CacheRequest *request);
+
+private slots:
+    /** @short Work through the queue and the pending read */
+    void processQueue();
+
+signals:
+    void error(const QString &message);
+    void evicted(const qint64 bytes);
+    /** @short One of the LOAD_* requests has finished; the receiver takes ownership */
+    void loaded(Imap::Mailbox::CacheRequest *request);
+
+private:
+    void run(CacheRequest *request);
+    /** @short Make sure that processQueue() gets called; the m_mutex has to be locked */
+    void schedule();
+    /** @short Does the @arg write have to be performed before the @arg read? */
+    static bool mustPrecede(const CacheRequest *write, const CacheRequest *read);
+
+    CombinedCache *m_backend;
+    QString m_name;
+    QString m_cacheDir;
+
+    QMutex m_mutex;
+    QWaitCondition m_readDone;
+    /** @short Asynchronous requests which haven't been started yet */
+    QList<CacheRequest *> m_queue;
+    /** @short The request which the owning thread is waiting for */
+    CacheRequest *m_read;
+    /** @short Has the processQueue() been scheduled already? */
+    bool m_scheduled;
+};
+
+/** @short A cache which performs all disk I/O in a dedicated thread
+
+The actual storage is provided by a CombinedCache which lives in its own thread.  All write operations are queued and return
+immediately; this also means that the periodic commits of the SQL database never block the GUI.
+
+Reads are served from an in-memory layer whenever possible.  Because every modification goes through this class, the memory
+layer is authoritative for each item it has seen, including the negative results.  A read which misses the memory layer is
+forwarded to the worker thread and waits for its result.  It overtakes the queued writes unless some of them refer to the
+same mailbox, so that it still sees everything which has been written to that mailbox before.  Message parts are never kept
+in memory as they could be arbitrarily large.
+
+The callers which can wait use loadMessageMetadata() and loadMessagePart() instead, which do not block at all.
+
+The per-message data are only mirrored for the few most recently used mailboxes, and only up to a limited number of
+messages in each of them; the least recently used messages are dropped first.
+*/
+class ThreadedCache : public AbstractCache
+{
+    Q_OBJECT
+public:
+    ThreadedCache(QObject *parent, const QString &name, const QString &cacheDir);
+    virtual ~ThreadedCache();
+
+    virtual QList<MailboxMetadata> childMailboxes(const QString &mailbox) const;
+    virtual bool childMailboxesFresh(const QString &mailbox) const;
+    virtual void setChildMailboxes(const QString &mailbox, const QList<MailboxMetadata> &data);
+
+    virtual SyncState mailboxSyncState(const QString &mailbox) const;
+    virtual void setMailboxSyncState(const QString &mailbox, const SyncState &state);
+
+    virtual SyncState mailboxStatus(const QString &mailbox) const;
+    virtual void setMailboxStatus(const QString &mailbox, const SyncState &state);
+
+    virtual void setUidMapping(const QString &mailbox, const QList<uint> &seqToUid);
+    virtual void clearUidMapping(const QString &mailbox);
+    virtual QList<uint> uidMapping(const QString &mailbox) const;
+
+    virtual void clearAllMessages(const QString &mailbox);
+    virtual void clearMessage(const QString mailbox, uint uid);
+
+    virtual MessageDataBundle messageMetadata(const QString &mailbox, uint uid) const;
+    virtual void setMessageMetadata(const QString &mailbox, uint uid, const MessageDataBundle &metadata);
+    virtual QHash<uint, MessageDataBundle> metadataOfMessages(const QString &mailbox, const QList<uint> &uids) const;
+
+    virtual QStringList msgFlags(const QString &mailbox, uint uid) const;
+    virtual void setMsgFlags(const QString &mailbox, uint uid, const QStringList &flags);
+    virtual QList<uint> uidsWithFlag(const QString &mailbox, const QString &flag, const bool present) const;
+    virtual uint countWithFlag(const QString &mailbox, const QString &flag, const bool present) const;
+
+    virtual bool loadMessageMetadata(const QString &mailbox, const QList<uint> &uids) const;
+
+    virtual QByteArray messagePart(const QString &mailbox, uint uid, const QString &partId) const;
+    virtual bool loadMessagePart(const QString &mailbox, uint uid, const QString &partId) const;
+    virtual void setMsgPart(const QString &mailbox, uint uid, const QString &partId, const QByteArray &data);
+    virtual void setMsgPartText(const QString &mailbox, uint uid, const QString &partId, const QByteArray &data,
+                                const QString &charset, const QString &mimeType);
+    virtual QList<uint> fullTextSearch(const QString &mailbox, const QString &field, const QString &text) const;
+
+    virtual QVector<Imap::Responses::ThreadingNode> messageThreading(const QString &mailbox);
+    virtual void setMessageThreading(const QString &mailbox, const QVector<Imap::Responses::ThreadingNode> &threading);
+
+    virtual void setRenewalThreshold(const int days);
+    virtual void beginBatch();
+    virtual void commitBatch();
+    virtual void setCacheBudget(const qint64 maxBytes, const int maxDays);
+
+    /** @short Open a connection to the cache */
+    bool open();
+
+    /** @short Number of mailboxes whose per-message data are mirrored in memory */
+    static const int maxMirroredMailboxes = 4;
+    /** @short Number of messages in a single mailbox whose metadata and flags are mirrored in memory */
+    static const int maxMirroredMessages = 20000;
+
+private slots:
+    /** @short Pick up the results of loadMessageMetadata() or loadMessagePart() */
+    void slotLoaded(Imap::Mailbox::CacheRequest *request);
+
+private:
+    /** @short Metadata and flags of a single message; the negative results are remembered, too */
+    struct MirroredMessage {
+        bool hasMetadata;
+        bool hasFlags;
+        MessageDataBundle metadata;
+        QStringList flags;
+        /** @short Position of this message in the MirroredMailbox::lru */
+        QLinkedList<uint>::iterator lru;
+
+        MirroredMessage(): hasMetadata(false), hasFlags(false) {}
+    };
+
+    /** @short Per-message data of a single mailbox */
+    struct MirroredMailbox {
+        QHash<uint, MirroredMessage> messages;
+        /** @short UIDs of all mirrored messages, starting with the least recently used one */
+        QLinkedList<uint> lru;
+    };
+
+    /** @short Execute the request in the worker thread and wait for its completion */
+    void runSync(CacheRequest &request) const;
+    /** @short Mark the per-message mirrors of the @arg mailbox as recently used and drop those of the other mailboxes if needed */
+    void touchMailbox(const QString &mailbox) const;
+    /** @short Return the mirror of a message and mark it as the most recently used one, or 0 if it isn't mirrored */
+    MirroredMessage *findMirror(const QString &mailbox, const uint uid) const;
+    /** @short Like findMirror(), but creates an empty entry if needed */
+    MirroredMessage &mirrorOf(const QString &mailbox, const uint uid) const;
+    /** @short Drop the least recently used messages until the mirror fits within the limit */
+    static void trimMirror(MirroredMailbox &mirror);
+    /** @short Make sure that a pending loadMessageMetadata() does not overwrite the newer data of this message */
+    void noteWrite(const QString &mailbox, const uint uid);
+    /** @short Queue the request for an asynchronous execution; the worker takes ownership
+
+    Within a batch, the request is only remembered and passed to the worker along with the rest of the batch.
+    */
+    void post(CacheRequest *request);
+    /** @short Pass the request to the worker thread without waiting for its completion */
+    void dispatch(CacheRequest *request) const;
+    /** @short Send all requests collected in the current batch to the worker */
+    void flushBatch() const;
+
+    QThread *m_thread;
+    ThreadedCacheWorker *m_worker;
+    /** @short Nesting level of the beginBatch() calls */
+    int m_batchDepth;
+    /** @short Requests which were posted within the current batch */
+    mutable QList<CacheRequest *> m_batch;
+
+    mutable QHash<QString, QList<MailboxMetadata> > m_childMailboxes;
+    mutable QHash<QString, SyncState> m_syncState;
+    mutable QHash<QString, SyncState> m_status;
+    mutable QHash<QString, QList<uint> > m_uidMapping;
+    mutable QHash<QString, MirroredMailbox> m_messages;
+    /** @short Mailboxes whose per-message data are mirrored, the most recently used one last */
+    mutable QList<QString> m_mirroredMailboxes;
+    mutable QHash<QString, QVector<Imap::Responses::ThreadingNode> > m_threading;
+    /** @short Messages whose metadata are being loaded, and whether they have been modified since the load started */
+    mutable QHash<QString, QHash<uint, bool> > m_loadingMetadata;
+    /** @short The LOAD_* requests whose results haven't been picked up yet */
+    mutable QSet<CacheRequest *> m_loads;
+
+    friend class ::ImapThreadedCacheTest; // needs access to the mirrors
+};
+
+}
+
+}
+
+Q_DECLARE_METATYPE(Imap::Mailbox::CacheRequest*)
+
+#endif /* IMAP_MODEL_THREADEDCACHE_H */
@@ -24,7 +24,11 @@
 #include <algorithm>
 #include <QBuffer>
 #include <QDebug>
+#include <QThread>
+#include <QTime>
+#include <QTimer>
 #include "ItemRoles.h"
+#include "LocalThreading.h"
 #include "MailboxTree.h"
 #include "MsgListModel.h"
 #include "QAIM_reset.h"
@@ -35,7 +39,7 @@
 namespace
 {
 using Imap::Mailbox::ThreadNodeInfo;
-QByteArray dumpThreadNodeInfo(const QHash<uint,ThreadNodeInfo> &mapping, const uint nodeId, const uint offset)
+QByteArray dumpThreadNodeInfo(const ThreadNodeTable &mapping, const uint nodeId, const uint offset)
 {
     QByteArray res;
     QByteArray prefix(offset, ' ');
@@ -57,11 +61,83 @@ namespace Imap
 namespace Mailbox
 {
 
+/** @short How many results of SORT or SEARCH are requested at once in large mailboxes */
+static const int sortWindowSize = 200;
+
+/** @short Split the search conditions as built by the GUI into the keys and the texts to look for
+
+That is, the "OR" operators followed by pairs of a key and a text, each of them optionally prefixed by FUZZY.  Returns false
+for anything else, like a raw IMAP search expression.
+*/
+static bool parseQuickSearch(const QStringList &searchConditions, QStringList &keys, QStringList &texts, bool *fuzzy = 0)
+{
+    static QStringList supportedKeys = QStringList() << QLatin1String("SUBJECT") << QLatin1String("FROM") << QLatin1String("TO")
+                                                     << QLatin1String("CC") << QLatin1String("BCC") << QLatin1String("BODY")
+                                                     << QLatin1String("TEXT");
+    int pos = 0;
+    int operators = 0;
+    while (pos < searchConditions.size() && searchConditions[pos] == QLatin1String("OR")) {
+        ++operators;
+        ++pos;
+    }
+    if (fuzzy)
+        *fuzzy = false;
+    keys.clear();
+    texts.clear();
+    while (pos < searchConditions.size()) {
+        if (searchConditions[pos] == QLatin1String("FUZZY")) {
+            if (fuzzy)
+                *fuzzy = true;
+            ++pos;
+        }
+        if (pos + 1 >= searchConditions.size() || !supportedKeys.contains(searchConditions[pos]))
+            return false;
+        keys << searchConditions[pos];
+        texts << searchConditions[pos + 1];
+        pos += 2;
+    }
+    return !keys.isEmpty() && operators == keys.size() - 1;
+}
+
 ThreadingMsgListModel::ThreadingMsgListModel(QObject *parent):
-    QAbstractProxyModel(parent), threadingHelperLastId(0), modelResetInProgress(false), threadingInFlight(false),
+    QAbstractProxyModel(parent), threadingHelperLastId(0), m_threadingApplied(false), modelResetInProgress(false), threadingInFlight(false),
     m_shallBeThreading(false), m_sortTask(0), m_sortReverse(false), m_currentSortingCriteria(SORT_NONE),
-    m_searchValidity(RESULT_INVALIDATED)
+    m_sortResultTotal(0), m_sortResultReversed(false), m_messageListGeneration(0),
+    m_sortResultMessagesGeneration(0),
+    m_searchValidity(RESULT_INVALIDATED), m_hasLocalSearchResult(false),
+    m_hasRequestedSearchKey(false), m_localThreadingThread(0),
+    m_localThreadingWorker(0), m_threadLayoutWorker(0), m_localThreadingGeneration(0), m_backgroundLayoutThreshold(5000),
+    m_threadLayoutGeneration(0), m_threadLayoutInFlight(false), m_hasPendingThreadLayout(false)
 {
+    qRegisterMetaType<Imap::Mailbox::LocalThreadingRequest*>("Imap::Mailbox::LocalThreadingRequest*");
+    qRegisterMetaType<Imap::Mailbox::ThreadLayoutRequest*>("Imap::Mailbox::ThreadLayoutRequest*");
+
+    m_localThreadingTimer = new QTimer(this);
+    m_localThreadingTimer->setSingleShot(true);
+    m_localThreadingTimer->setInterval(100);
+    connect(m_localThreadingTimer, SIGNAL(timeout()), this, SLOT(slotRunLocalThreading()));
+
+    m_threadingTimeout = new QTimer(this);
+    m_threadingTimeout->setSingleShot(true);
+    m_threadingTimeout->setInterval(5000);
+    connect(m_threadingTimeout, SIGNAL(timeout()), this, SLOT(slotThreadingTimeout()));
+
+    // These connections are made before any proxy gets to see our signals, so the proxies won't use stale data
+    connect(this, SIGNAL(layoutChanged()), this, SLOT(invalidateHideReadState()));
+    connect(this, SIGNAL(modelReset()), this, SLOT(invalidateHideReadState()));
+    connect(this, SIGNAL(rowsInserted(QModelIndex,int,int)), this, SLOT(invalidateHideReadState()));
+    connect(this, SIGNAL(rowsRemoved(QModelIndex,int,int)), this, SLOT(invalidateHideReadState()));
+    connect(this, SIGNAL(rowsMoved(QModelIndex,int,int,QModelIndex,int)), this, SLOT(invalidateHideReadState()));
+}
+
+ThreadingMsgListModel::~ThreadingMsgListModel()
+{
+    if (m_localThreadingThread) {
+        m_localThreadingThread->quit();
+        m_localThreadingThread->wait();
+        delete m_localThreadingWorker;
+        delete m_threadLayoutWorker;
+    }
 }
 
 void ThreadingMsgListModel::setSourceModel(QAbstractItemModel *sourceModel)
@@ -71,7 +147,9 @@ void ThreadingMsgListModel::setSourceModel(QAbstractItemModel *sourceModel)
     unknownUids.clear();
     threadedRootIds.clear();
     m_currentSortResult.clear();
+    forgetSortWindows();
     m_searchValidity = RESULT_INVALIDATED;
+    ++m_messageListGeneration;
 
     if (this->sourceModel()) {
         // there's already something, so take care to disconnect all signals
@@ -121,6 +199,9 @@ void ThreadingMsgListModel::handleDataChanged(const QModelIndex &topLeft, const
     Q_ASSERT(topLeft.row() == bottomRight.row());
     QModelIndex translated = mapFromSource(topLeft);
 
+    if (translated.isValid())
+        refreshHideReadState(translated.internalId());
+
     emit dataChanged(translated, translated.sibling(translated.row(), bottomRight.column()));
 
     // We provide funny data like "does this thread contain unread messages?". Now the original signal might mean that flags of a
@@ -135,10 +216,20 @@ void ThreadingMsgListModel::handleDataChanged(const QModelIndex &topLeft, const
         emit dataChanged(rootCandidate, rootCandidate.sibling(rootCandidate.row(), bottomRight.column()));
     }
 
+    if (!m_localThreadingIncomplete.isEmpty()) {
+        TreeItemMessage *message = dynamic_cast<TreeItemMessage *>(static_cast<TreeItem *>(topLeft.internalPointer()));
+        if (message && message->fetched() && m_localThreadingIncomplete.contains(message->uid())) {
+            // The headers have arrived, so the message might belong to some thread after all
+            askForLocalThreading();
+        }
+    }
+
     QSet<TreeItem*>::iterator persistent = unknownUids.find(static_cast<TreeItem*>(topLeft.internalPointer()));
     if (persistent != unknownUids.end()) {
         // The message wasn't fully synced before, and now it is
         persistent = unknownUids.erase(persistent);
+        // Its UID might be a part of the sort result
+        ++m_messageListGeneration;
         if (unknownUids.isEmpty()) {
             wantThreading();
         }
@@ -164,7 +255,7 @@ QModelIndex ThreadingMsgListModel::index(int row, int column, const QModelIndex
 
     uint parentId = parent.isValid() ? parent.internalId() : 0;
 
-    QHash<uint,ThreadNodeInfo>::const_iterator it = threading.constFind(parentId);
+    ThreadNodeTable::const_iterator it = threading.constFind(parentId);
     Q_ASSERT(it != threading.constEnd());
 
     if (it->children.size() <= row)
@@ -184,11 +275,11 @@ QModelIndex ThreadingMsgListModel::parent(const QModelIndex &index) const
     if (index.row() < 0 || index.column() < 0 || index.column() >= MsgListModel::COLUMN_COUNT)
         return QModelIndex();
 
-    QHash<uint,ThreadNodeInfo>::const_iterator node = threading.constFind(index.internalId());
+    ThreadNodeTable::const_iterator node = threading.constFind(index.internalId());
     if (node == threading.constEnd())
         return QModelIndex();
 
-    QHash<uint,ThreadNodeInfo>::const_iterator parentNode = threading.constFind(node->parent);
+    ThreadNodeTable::const_iterator parentNode = threading.constFind(node->parent);
     Q_ASSERT(parentNode != threading.constEnd());
     Q_ASSERT(parentNode->internalId == node->parent);
 
@@ -203,7 +294,8 @@ bool ThreadingMsgListModel::hasChildren(const QModelIndex &parent) const
     if (parent.isValid() && parent.column() != 0)
         return false;
 
-    return ! threading.isEmpty() && ! threading.value(parent.internalId()).children.isEmpty();
+    ThreadNodeTable::const_iterator it = threading.constFind(parent.internalId());
+    return it != threading.constEnd() && !it->children.isEmpty();
 }
 
 int ThreadingMsgListModel::rowCount(const QModelIndex &parent) const
@@ -214,7 +306,8 @@ int ThreadingMsgListModel::rowCount(const QModelIndex &parent) const
     if (parent.isValid() && parent.column() != 0)
         return 0;
 
-    return threading.value(parent.internalId()).children.size();
+    ThreadNodeTable::const_iterator it = threading.constFind(parent.internalId());
+    return it == threading.constEnd() ? 0 : it->children.size();
 }
 
 int ThreadingMsgListModel::columnCount(const QModelIndex &parent) const
@@ -233,10 +326,11 @@ QModelIndex ThreadingMsgListModel::mapToSource(const QModelIndex &proxyIndex) co
     if (threading.isEmpty())
         return QModelIndex();
 
-    Imap::Mailbox::MsgListModel *msgList = qobject_cast<Imap::Mailbox::MsgListModel *>(sourceModel());
-    Q_ASSERT(msgList);
+    // This is called for each painted cell, so the qobject_cast is left to the debug builds
+    Q_ASSERT(qobject_cast<Imap::Mailbox::MsgListModel *>(sourceModel()));
+    Imap::Mailbox::MsgListModel *msgList = static_cast<Imap::Mailbox::MsgListModel *>(sourceModel());
 
-    QHash<uint,ThreadNodeInfo>::const_iterator node = threading.constFind(proxyIndex.internalId());
+    ThreadNodeTable::const_iterator node = threading.constFind(proxyIndex.internalId());
     if (node == threading.constEnd())
         return QModelIndex();
 
@@ -261,7 +355,7 @@ QModelIndex ThreadingMsgListModel::mapFromSource(const QModelIndex &sourceIndex)
 
     const uint internalId = *it;
 
-    QHash<uint,ThreadNodeInfo>::const_iterator node = threading.constFind(internalId);
+    ThreadNodeTable::const_iterator node = threading.constFind(internalId);
     if (node == threading.constEnd()) {
         // The filtering criteria say that this index shall not be visible
         return QModelIndex();
@@ -276,7 +370,7 @@ QVariant ThreadingMsgListModel::data(const QModelIndex &proxyIndex, int role) co
     if (! proxyIndex.isValid() || proxyIndex.model() != this)
         return QVariant();
 
-    QHash<uint,ThreadNodeInfo>::const_iterator it = threading.constFind(proxyIndex.internalId());
+    ThreadNodeTable::const_iterator it = threading.constFind(proxyIndex.internalId());
     Q_ASSERT(it != threading.constEnd());
 
     if (it->ptr) {
@@ -312,7 +406,7 @@ Qt::ItemFlags ThreadingMsgListModel::flags(const QModelIndex &index) const
     if (! index.isValid() || index.model() != this)
         return Qt::NoItemFlags;
 
-    QHash<uint,ThreadNodeInfo>::const_iterator it = threading.constFind(index.internalId());
+    ThreadNodeTable::const_iterator it = threading.constFind(index.internalId());
     Q_ASSERT(it != threading.constEnd());
     if (it->ptr)
         return QAbstractProxyModel::flags(index);
@@ -324,6 +418,7 @@ Qt::ItemFlags ThreadingMsgListModel::flags(const QModelIndex &index) const
 void ThreadingMsgListModel::handleRowsAboutToBeRemoved(const QModelIndex &parent, int start, int end)
 {
     Q_ASSERT(!parent.isValid());
+    ++m_messageListGeneration;
 
     for (int i = start; i <= end; ++i) {
         QModelIndex index = sourceModel()->index(i, 0, parent);
@@ -338,10 +433,11 @@ void ThreadingMsgListModel::handleRowsAboutToBeRemoved(const QModelIndex &parent
         }
 
         Q_ASSERT(translated.isValid());
-        QHash<uint,ThreadNodeInfo>::iterator it = threading.find(translated.internalId());
+        ThreadNodeTable::iterator it = threading.find(translated.internalId());
         Q_ASSERT(it != threading.end());
         it->uid = 0;
         it->ptr = 0;
+        m_unthreadedNodes.remove(it->internalId);
     }
     emit layoutAboutToBeChanged();
     updatePersistentIndexesPhase1();
@@ -374,6 +470,7 @@ void ThreadingMsgListModel::handleRowsAboutToBeInserted(const QModelIndex &paren
 void ThreadingMsgListModel::handleRowsInserted(const QModelIndex &parent, int start, int end)
 {
     Q_ASSERT(!parent.isValid());
+    ++m_messageListGeneration;
 
     for (int i = start; i <= end; ++i) {
         QModelIndex index = sourceModel()->index(i, 0);
@@ -391,11 +488,13 @@ void ThreadingMsgListModel::handleRowsInserted(const QModelIndex &parent, int st
         } else {
             threadedRootIds.append(node.internalId);
         }
+        m_unthreadedNodes.insert(node.internalId);
     }
     endInsertRows();
 
     if (!m_sortTask || !m_sortTask->isPersistent()) {
         m_currentSortResult.clear();
+        forgetSortWindows();
         if (m_searchValidity == RESULT_FRESH)
             m_searchValidity = RESULT_INVALIDATED;
     }
@@ -411,11 +510,17 @@ void ThreadingMsgListModel::resetMe()
         return;
 
     modelResetInProgress = true;
+    ++m_messageListGeneration;
+    // Whatever the LocalThreadingWorker is doing now is no longer relevant
+    ++m_localThreadingGeneration;
+    m_localThreadingMailbox.clear();
+    m_localSortingMailbox.clear();
     threading.clear();
     ptrToInternal.clear();
     unknownUids.clear();
     threadedRootIds.clear();
     m_currentSortResult.clear();
+    forgetSortWindows();
     m_searchValidity = RESULT_INVALIDATED;
     RESET_MODEL;
     updateNoThreading();
@@ -427,7 +532,10 @@ void ThreadingMsgListModel::resetMe()
 
 void ThreadingMsgListModel::updateNoThreading()
 {
+    forgetThreadLayout();
     threadingHelperLastId = 0;
+    m_threadingApplied = false;
+    m_unthreadedNodes.clear();
 
     if (!sourceModel()) {
         // Maybe we got reset because the parent model is no longer here...
@@ -450,7 +558,7 @@ void ThreadingMsgListModel::updateNoThreading()
 
     int upstreamMessages = sourceModel()->rowCount();
     QList<uint> allIds;
-    QHash<uint,ThreadNodeInfo> newThreading;
+    ThreadNodeTable newThreading;
     QHash<void *,uint> newPtrToInternal;
 
     if (upstreamMessages) {
@@ -466,6 +574,8 @@ void ThreadingMsgListModel::updateNoThreading()
         TreeItemMsgList *list = dynamic_cast<TreeItemMsgList *>(firstMessagePtr->parent());
         Q_ASSERT(list);
 
+        newThreading.reserve(upstreamMessages);
+        newPtrToInternal.reserve(upstreamMessages);
         for (int i = 0; i < upstreamMessages; ++i) {
             TreeItemMessage *ptr = static_cast<TreeItemMessage*>(list->m_children[i]);
             Q_ASSERT(ptr);
@@ -485,10 +595,12 @@ void ThreadingMsgListModel::updateNoThreading()
 
     if (newThreading.size()) {
         threading = newThreading;
+        // Don't let the following modifications copy the whole table
+        newThreading.clear();
         ptrToInternal = newPtrToInternal;
         threading[ 0 ].children = allIds;
         threading[ 0 ].ptr = 0;
-        threadingHelperLastId = newThreading.size();
+        threadingHelperLastId = upstreamMessages;
         threadedRootIds = threading[0].children;
     }
     updatePersistentIndexesPhase2();
@@ -623,7 +735,9 @@ void ThreadingMsgListModel::askForThreading(const uint firstUnknownUid)
         requestedAlgorithm = "ORDEREDSUBJECT";
     }
 
-    if (! requestedAlgorithm.isEmpty()) {
+    if (requestedAlgorithm.isEmpty()) {
+        askForLocalThreading();
+    } else {
         threadingInFlight = true;
         ThreadTask *threadTask;
         if (firstUnknownUid && realModel->capabilities().contains(QLatin1String("INCTHREAD"))) {
@@ -637,6 +751,7 @@ void ThreadingMsgListModel::askForThreading(const uint firstUnknownUid)
         } else {
             threadTask = realModel->m_taskFactory->createThreadTask(const_cast<Model *>(realModel), mailboxIndex,
                                                                     requestedAlgorithm, QStringList() << QLatin1String("ALL"));
+            m_threadingTimeout->start();
             connect(realModel, SIGNAL(threadingAvailable(QModelIndex,QByteArray,QStringList,QVector<Imap::Responses::ThreadingNode>)),
                     this, SLOT(slotThreadingAvailable(QModelIndex,QByteArray,QStringList,QVector<Imap::Responses::ThreadingNode>)));
             connect(realModel, SIGNAL(threadingFailed(QModelIndex,QByteArray,QStringList)),
@@ -681,7 +796,7 @@ void ThreadingMsgListModel::slotIncrementalThreadingAvailable(const Responses::E
     for (QList<TreeItemMessage*>::const_iterator it = affectedMessages.constBegin(); it != affectedMessages.constEnd(); ++it) {
         QHash<void *,uint>::const_iterator ptrMappingIt = ptrToInternal.constFind(*it);
         Q_ASSERT(ptrMappingIt != ptrToInternal.constEnd());
-        QHash<uint,ThreadNodeInfo>::iterator threadIt = threading.find(*ptrMappingIt);
+        ThreadNodeTable::iterator threadIt = threading.find(*ptrMappingIt);
         Q_ASSERT(threadIt != threading.end());
         uidToPtrCache[(*it)->uid()] = threadIt->ptr;
         threadIt->ptr = 0;
@@ -695,7 +810,7 @@ void ThreadingMsgListModel::slotIncrementalThreadingAvailable(const Responses::E
     emit layoutAboutToBeChanged();
     updatePersistentIndexesPhase1();
     for (Responses::ESearch::IncrementalThreadingData_t::const_iterator it = data.constBegin(); it != data.constEnd(); ++it) {
-        registerThreading(it->thread, 0, uidToPtrCache, usedNodes);
+        registerThreading(threading, ptrToInternal, threadingHelperLastId, it->thread, 0, uidToPtrCache, usedNodes);
         int actualOffset = threading[0].children.size() - 1;
         int expectedOffsetOfPrevious = threading[0].children.indexOf(it->previousThreadRoot);
         if (actualOffset == expectedOffsetOfPrevious + 1) {
@@ -711,6 +826,28 @@ void ThreadingMsgListModel::slotIncrementalThreadingAvailable(const Responses::E
     }
     updatePersistentIndexesPhase2();
     emit layoutChanged();
+
+    // The cache only writes the nodes which have moved, so keeping it up to date is cheap.  A sorted or filtered view does
+    // not contain the natural order of the threads, though.
+    if (m_currentSortingCriteria == SORT_NONE && m_currentSearchConditions.isEmpty() && !m_sortReverse) {
+        QVector<Responses::ThreadingNode> updated;
+        currentThreading(updated, 0);
+        const_cast<Model*>(realModel)->cache()->setMessageThreading(mailboxIndex.data(RoleMailboxName).toString(), updated);
+    }
+}
+
+void ThreadingMsgListModel::currentThreading(QVector<Imap::Responses::ThreadingNode> &output, const uint parentId) const
+{
+    ThreadNodeTable::const_iterator parentIt = threading.constFind(parentId);
+    Q_ASSERT(parentIt != threading.constEnd());
+    output.reserve(parentIt->children.size());
+    Q_FOREACH(const uint child, parentIt->children) {
+        ThreadNodeTable::const_iterator it = threading.constFind(child);
+        Q_ASSERT(it != threading.constEnd());
+        Imap::Responses::ThreadingNode node(it->ptr ? static_cast<TreeItemMessage*>(it->ptr)->uid() : 0);
+        currentThreading(node.children, child);
+        output << node;
+    }
 }
 
 void ThreadingMsgListModel::slotIncrementalThreadingFailed()
@@ -755,6 +892,7 @@ void ThreadingMsgListModel::slotThreadingFailed(const QModelIndex &mailbox, cons
 {
     // Better safe than sorry -- prevent infinite waiting to the maximal possible extent
     threadingInFlight = false;
+    m_threadingTimeout->stop();
 
     if (shouldIgnoreThisThreadingResponse(mailbox, algorithm, searchCriteria))
         return;
@@ -765,6 +903,8 @@ void ThreadingMsgListModel::slotThreadingFailed(const QModelIndex &mailbox, cons
                SLOT(slotThreadingFailed(QModelIndex,QByteArray,QStringList)));
 
     updateNoThreading();
+    if (m_shallBeThreading)
+        askForLocalThreading();
 }
 
 void ThreadingMsgListModel::slotThreadingAvailable(const QModelIndex &mailbox, const QByteArray &algorithm,
@@ -773,11 +913,16 @@ void ThreadingMsgListModel::slotThreadingAvailable(const QModelIndex &mailbox, c
 {
     // Better safe than sorry -- prevent infinite waiting to the maximal possible extent
     threadingInFlight = false;
+    m_threadingTimeout->stop();
 
     const Model *model = 0;
     if (shouldIgnoreThisThreadingResponse(mailbox, algorithm, searchCriteria, &model))
         return;
 
+    // The server's threading wins over whatever the local threading might still be computing
+    m_localThreadingTimer->stop();
+    ++m_localThreadingGeneration;
+
     disconnect(sender(), 0, this,
                SLOT(slotThreadingAvailable(QModelIndex,QByteArray,QStringList,QVector<Imap::Responses::ThreadingNode>)));
     disconnect(sender(), 0, this,
@@ -791,29 +936,314 @@ void ThreadingMsgListModel::slotThreadingAvailable(const QModelIndex &mailbox, c
         wantThreading();
 }
 
-void ThreadingMsgListModel::slotSortingAvailable(const QList<uint> &uids)
+void ThreadingMsgListModel::slotThreadingTimeout()
 {
-    if (!m_sortTask->isPersistent()) {
-        disconnect(m_sortTask, 0, this, SLOT(slotSortingAvailable(QList<uint>)));
-        disconnect(m_sortTask, 0, this, SLOT(slotSortingFailed()));
-        disconnect(m_sortTask, 0, this, SLOT(slotSortingIncrementalUpdate(Imap::Responses::ESearch::IncrementalContextData_t)));
+    if (!threadingInFlight)
+        return;
+    logTrace(QLatin1String("The THREAD command is taking too long, computing the threading locally"));
+    askForLocalThreading();
+}
+
+void ThreadingMsgListModel::askForLocalThreading()
+{
+    m_localThreadingTimer->start();
+}
+
+void ThreadingMsgListModel::slotRunLocalThreading()
+{
+    if (!sourceModel() || !sourceModel()->rowCount() || !m_shallBeThreading)
+        return;
 
-        m_sortTask = 0;
+    const Imap::Mailbox::Model *realModel;
+    QModelIndex someMessage = sourceModel()->index(0,0);
+    QModelIndex realIndex;
+    Imap::Mailbox::Model::realTreeItem(someMessage, &realModel, &realIndex);
+    const QString mailbox = realIndex.parent().parent().data(RoleMailboxName).toString();
+    TreeItemMsgList *list = dynamic_cast<TreeItemMsgList*>(static_cast<TreeItem*>(realIndex.parent().internalPointer()));
+    Q_ASSERT(list);
+
+    startWorkerThread();
+
+    LocalThreadingRequest *request = new LocalThreadingRequest();
+    if (mailbox != m_localThreadingMailbox) {
+        request->reset = true;
+        ++m_localThreadingGeneration;
+        m_localThreadingMailbox = mailbox;
+        m_localThreadingComplete.clear();
+        m_localThreadingIncomplete.clear();
+    }
+    request->generation = m_localThreadingGeneration;
+
+    // Headers of the messages which were not fetched yet come from the cache, all of them in a single query
+    QList<uint> uncached;
+    Q_FOREACH(TreeItem *item, list->m_children) {
+        TreeItemMessage *message = static_cast<TreeItemMessage *>(item);
+        if (message->uid() && !message->fetched() && !m_localThreadingComplete.contains(message->uid()))
+            uncached << message->uid();
     }
+    QHash<uint, AbstractCache::MessageDataBundle> cached;
+    if (!uncached.isEmpty())
+        cached = realModel->cache()->metadataOfMessages(mailbox, uncached);
+
+    // Only the messages which the worker doesn't know yet are sent over; the linking is the expensive part and happens there
+    Q_FOREACH(TreeItem *item, list->m_children) {
+        TreeItemMessage *message = static_cast<TreeItemMessage *>(item);
+        const uint uid = message->uid();
+        if (!uid || m_localThreadingComplete.contains(uid))
+            continue;
 
+        LocalThreadingMessage input;
+        input.uid = uid;
+        Message::Envelope envelope;
+        bool haveHeaders = false;
+        if (message->fetched()) {
+            envelope = message->m_envelope;
+            input.references = message->m_hdrReferences;
+            haveHeaders = true;
+        } else {
+            // Going through the cache directly does not trigger any network activity
+            QHash<uint, AbstractCache::MessageDataBundle>::const_iterator data = cached.constFind(uid);
+            if (data != cached.constEnd() && data->uid == uid) {
+                envelope = data->envelope;
+                input.references = data->hdrReferences;
+                haveHeaders = true;
+            }
+        }
+
+        if (haveHeaders) {
+            input.messageId = envelope.messageId;
+            if (!envelope.inReplyTo.isEmpty() &&
+                    (input.references.isEmpty() || input.references.last() != envelope.inReplyTo.first())) {
+                input.references << envelope.inReplyTo.first();
+            }
+            input.subject = envelope.subject;
+            input.date = envelope.date;
+            m_localThreadingComplete.insert(uid);
+            m_localThreadingIncomplete.remove(uid);
+        } else if (m_localThreadingIncomplete.contains(uid)) {
+            continue;
+        } else {
+            // The message has to be included anyway, otherwise it would disappear from the view
+            m_localThreadingIncomplete.insert(uid);
+        }
+        request->messages << input;
+    }
+
+    QMetaObject::invokeMethod(m_localThreadingWorker, "execute", Qt::QueuedConnection,
+                              Q_ARG(Imap::Mailbox::LocalThreadingRequest*, request));
+}
+
+void ThreadingMsgListModel::startWorkerThread()
+{
+    if (m_localThreadingThread)
+        return;
+
+    m_localThreadingThread = new QThread(this);
+    m_localThreadingWorker = new LocalThreadingWorker();
+    m_localThreadingWorker->moveToThread(m_localThreadingThread);
+    connect(m_localThreadingWorker, SIGNAL(finished(Imap::Mailbox::LocalThreadingRequest*)),
+            this, SLOT(slotLocalThreadingAvailable(Imap::Mailbox::LocalThreadingRequest*)), Qt::QueuedConnection);
+    m_threadLayoutWorker = new ThreadLayoutWorker();
+    m_threadLayoutWorker->moveToThread(m_localThreadingThread);
+    connect(m_threadLayoutWorker, SIGNAL(finished(Imap::Mailbox::ThreadLayoutRequest*)),
+            this, SLOT(slotThreadLayoutAvailable(Imap::Mailbox::ThreadLayoutRequest*)), Qt::QueuedConnection);
+    m_localThreadingThread->start(QThread::LowPriority);
+}
+
+void ThreadingMsgListModel::slotLocalThreadingAvailable(LocalThreadingRequest *request)
+{
+    const bool stale = request->generation != m_localThreadingGeneration;
+    QVector<Imap::Responses::ThreadingNode> mapping = request->result;
+    delete request;
+    if (stale || !m_shallBeThreading || !sourceModel() || !sourceModel()->rowCount())
+        return;
+
+    const Imap::Mailbox::Model *realModel;
+    QModelIndex someMessage = sourceModel()->index(0,0);
+    QModelIndex realIndex;
+    Imap::Mailbox::Model::realTreeItem(someMessage, &realModel, &realIndex);
+    TreeItemMsgList *list = dynamic_cast<TreeItemMsgList*>(static_cast<TreeItem*>(realIndex.parent().internalPointer()));
+    Q_ASSERT(list);
+
+    const uint highestUidInMailbox = findHighestUidInMailbox(list);
+    if (findHighEnoughNumber(mapping, highestUidInMailbox) < highestUidInMailbox) {
+        // More messages have arrived in the meanwhile; applying this would hide them
+        askForLocalThreading();
+        return;
+    }
+
+    if (requestedAlgorithm.isEmpty()) {
+        // Without the server's support, this is the threading which shall be reused next time
+        realModel->cache()->setMessageThreading(m_localThreadingMailbox, mapping);
+    }
+    applyThreading(mapping);
+}
+
+void ThreadingMsgListModel::slotSortingAvailable(const QList<uint> &uids)
+{
+    const bool remember = m_hasRequestedSearchKey;
+    if (!m_sortTask->isPersistent())
+        releaseSortTask();
+
+    // This is the complete result, but it might have been requested in the reversed order already
     m_currentSortResult = uids;
+    m_sortResultTotal = 0;
+    if (remember) {
+        m_requestedSearchKey.uids = uids;
+        m_requestedSearchKey.reversed = m_sortResultReversed;
+        rememberSearchResult(m_requestedSearchKey);
+        m_hasRequestedSearchKey = false;
+    }
     if (m_searchValidity == RESULT_ASKED)
         m_searchValidity = RESULT_FRESH;
     wantThreading();
+    emit sortingApplied(true);
 }
 
-void ThreadingMsgListModel::slotSortingFailed()
+void ThreadingMsgListModel::slotSortingWindowAvailable(const uint offset, const QList<uint> &uids, const uint total)
+{
+    bool remember = false;
+    if (m_sortTask && sender() == m_sortTask) {
+        remember = m_hasRequestedSearchKey;
+        // The first window of a new result; it is only remembered if it turns out to be the complete one
+        if (!m_sortTask->isPersistent())
+            releaseSortTask();
+        m_currentSortResult = uids;
+        m_sortResultTotal = 0;
+    } else if (m_sortWindowTask && sender() == m_sortWindowTask) {
+        m_sortWindowTask = 0;
+        if (offset > static_cast<uint>(m_currentSortResult.size())) {
+            // The known part of the result has shrunk in the meanwhile, so this one does not connect to it
+            return;
+        }
+        // The updates which arrived before this response have been applied by the server as well
+        m_currentSortResult.erase(m_currentSortResult.begin() + offset, m_currentSortResult.end());
+        m_currentSortResult += uids;
+    } else {
+        // A late response for a result which is no longer wanted
+        return;
+    }
+
+    if (total)
+        m_sortResultTotal = total;
+    else if (uids.size() < sortWindowSize)
+        m_sortResultTotal = m_currentSortResult.size();
+    else
+        m_sortResultTotal = qMax(m_sortResultTotal, m_currentSortResult.size() + 1);
+
+    if (remember && !hasPartialSortResult()) {
+        m_requestedSearchKey.uids = m_currentSortResult;
+        m_requestedSearchKey.reversed = m_sortResultReversed;
+        rememberSearchResult(m_requestedSearchKey);
+    }
+    m_hasRequestedSearchKey = false;
+
+    if (m_searchValidity == RESULT_ASKED) {
+        m_searchValidity = RESULT_FRESH;
+        wantThreading();
+        emit sortingApplied(true);
+    } else {
+        applySort();
+    }
+}
+
+void ThreadingMsgListModel::slotSortingWindowFailed()
 {
-    disconnect(m_sortTask, 0, this, SLOT(slotSortingAvailable(QList<uint>)));
-    disconnect(m_sortTask, 0, this, SLOT(slotSortingFailed()));
-    disconnect(m_sortTask, 0, this, SLOT(slotSortingIncrementalUpdate(Imap::Responses::ESearch::IncrementalContextData_t)));
+    if (sender() == m_sortWindowTask)
+        m_sortWindowTask = 0;
+}
 
+bool ThreadingMsgListModel::hasPartialSortResult() const
+{
+    return m_sortResultTotal > m_currentSortResult.size();
+}
+
+void ThreadingMsgListModel::forgetSortWindows()
+{
+    m_sortResultTotal = 0;
+    m_sortResultReversed = false;
+    m_sortWindowCriteria.clear();
+    m_sortWindowTask = 0;
+}
+
+void ThreadingMsgListModel::releaseSortTask()
+{
+    if (m_sortTask) {
+        disconnect(m_sortTask, 0, this, SLOT(slotSortingAvailable(QList<uint>)));
+        disconnect(m_sortTask, 0, this, SLOT(slotSortingFailed()));
+        disconnect(m_sortTask, 0, this, SLOT(slotSortingIncrementalUpdate(Imap::Responses::ESearch::IncrementalContextData_t)));
+        disconnect(m_sortTask, 0, this, SLOT(slotSortingWindowAvailable(uint,QList<uint>,uint)));
+    }
     m_sortTask = 0;
+    m_hasRequestedSearchKey = false;
+}
+
+bool ThreadingMsgListModel::canFetchMore(const QModelIndex &parent) const
+{
+    return !parent.isValid() && hasPartialSortResult() && !m_sortWindowTask;
+}
+
+void ThreadingMsgListModel::fetchMore(const QModelIndex &parent)
+{
+    if (!canFetchMore(parent) || !sourceModel()->rowCount())
+        return;
+
+    const Model *realModel;
+    QModelIndex realIndex;
+    Model::realTreeItem(sourceModel()->index(0, 0), &realModel, &realIndex);
+    QModelIndex mailboxIndex = realIndex.parent().parent();
+    Q_ASSERT(mailboxIndex.isValid());
+
+    m_sortWindowTask = realModel->m_taskFactory->createSortTask(const_cast<Model *>(realModel), mailboxIndex,
+                                                                m_currentSearchConditions, m_sortWindowCriteria,
+                                                                m_currentSortResult.size(), sortWindowSize);
+    connect(m_sortWindowTask, SIGNAL(sortingWindowAvailable(uint,QList<uint>,uint)),
+            this, SLOT(slotSortingWindowAvailable(uint,QList<uint>,uint)));
+    connect(m_sortWindowTask, SIGNAL(sortingFailed()), this, SLOT(slotSortingWindowFailed()));
+}
+
+void ThreadingMsgListModel::requestSorting(const Model *realModel, const QModelIndex &mailbox, const QStringList &searchConditions,
+                                           const QStringList &sortOptions)
+{
+    // IMAP has no way of aborting a command, but the result of a previous request which is still in flight can be ignored
+    releaseSortTask();
+    forgetSortWindows();
+    m_sortWindowCriteria = sortOptions;
+    m_hasRequestedSearchKey = searchCacheKey(mailbox, searchConditions, m_currentSortingCriteria, m_requestedSearchKey);
+
+    // Large mailboxes only get the first screenful, the rest is requested by fetchMore() as the user scrolls.  The windows
+    // have to be taken from the end in the reversed order, which is only possible by asking the server to reverse the SORT.
+    uint window = 0;
+    if (sourceModel()->rowCount() > sortWindowSize && (!m_sortReverse || !sortOptions.isEmpty())) {
+        window = sortWindowSize;
+        if (m_sortReverse) {
+            m_sortWindowCriteria.prepend(QLatin1String("REVERSE"));
+            m_sortResultReversed = true;
+        }
+    }
+
+    m_sortTask = realModel->m_taskFactory->createSortTask(const_cast<Model *>(realModel), mailbox, searchConditions,
+                                                          m_sortWindowCriteria, 0, window);
+    connect(m_sortTask, SIGNAL(sortingAvailable(QList<uint>)), this, SLOT(slotSortingAvailable(QList<uint>)));
+    connect(m_sortTask, SIGNAL(sortingWindowAvailable(uint,QList<uint>,uint)),
+            this, SLOT(slotSortingWindowAvailable(uint,QList<uint>,uint)));
+    connect(m_sortTask, SIGNAL(sortingFailed()), this, SLOT(slotSortingFailed()));
+    connect(m_sortTask, SIGNAL(incrementalSortUpdate(Imap::Responses::ESearch::IncrementalContextData_t)),
+            this, SLOT(slotSortingIncrementalUpdate(Imap::Responses::ESearch::IncrementalContextData_t)));
+}
+
+void ThreadingMsgListModel::slotSortingFailed()
+{
+    releaseSortTask();
+    if (m_hasLocalSearchResult && m_currentSortingCriteria == SORT_NONE) {
+        // The server could not help, but the local index has already provided something which is worth showing
+        m_currentSortResult = m_localSearchResult;
+        forgetSortWindows();
+        m_searchValidity = RESULT_FRESH;
+        applySort();
+        emit sortingApplied(true);
+        return;
+    }
     m_sortReverse = false;
     calculateNullSort();
     applySort();
@@ -823,11 +1253,19 @@ void ThreadingMsgListModel::slotSortingFailed()
 void ThreadingMsgListModel::slotSortingIncrementalUpdate(const Responses::ESearch::IncrementalContextData_t &updates)
 {
     for (Responses::ESearch::IncrementalContextData_t::const_iterator it = updates.constBegin(); it != updates.constEnd(); ++it) {
+        // When only the beginning of the result is known, the changes past its end just adjust the total count
+        const bool partial = hasPartialSortResult();
         switch (it->modification) {
         case Responses::ESearch::ContextIncrementalItem::ADDTO:
             for (int i = 0; i < it->uids.size(); ++i)  {
                 int offset = it->offset + i;
-                if (offset < 0 || offset >= m_currentSortResult.size()) {
+                if (partial) {
+                    if (offset < 0 || offset > m_sortResultTotal)
+                        throw MailboxException("ESEARCH: ADDTO out of bounds");
+                    ++m_sortResultTotal;
+                    if (offset >= m_currentSortResult.size())
+                        continue;
+                } else if (offset < 0 || offset >= m_currentSortResult.size()) {
                     throw MailboxException("ESEARCH: ADDTO out of bounds");
                 }
                 m_currentSortResult.insert(offset, it->uids[i]);
@@ -839,10 +1277,18 @@ void ThreadingMsgListModel::slotSortingIncrementalUpdate(const Responses::ESearc
                 if (it->offset == 0) {
                     // When the offset is not given, we have to find it ourselves
                     m_currentSortResult.removeOne(it->uids[i]);
+                    if (partial)
+                        --m_sortResultTotal;
                 } else {
                     // We're given an offset, so let's make sure it is a correct one
                     int offset = it->offset + i - 1;
-                    if (offset < 0 || offset >= m_currentSortResult.size()) {
+                    if (partial) {
+                        if (offset < 0 || offset >= m_sortResultTotal)
+                            throw MailboxException("ESEARCH: REMOVEFROM out of bounds");
+                        --m_sortResultTotal;
+                        if (offset >= m_currentSortResult.size())
+                            continue;
+                    } else if (offset < 0 || offset >= m_currentSortResult.size()) {
                         throw MailboxException("ESEARCH: REMOVEFROM out of bounds");
                     }
                     if (m_currentSortResult[offset] != it->uids[i]) {
@@ -862,11 +1308,12 @@ void ThreadingMsgListModel::slotSortingIncrementalUpdate(const Responses::ESearc
 void ThreadingMsgListModel::calculateNullSort()
 {
     m_currentSortResult.clear();
+    forgetSortWindows();
 #if QT_VERSION >= 0x040700
     m_currentSortResult.reserve(threadedRootIds.size());
 #endif
     Q_FOREACH(const uint internalId, threadedRootIds) {
-        QHash<uint,ThreadNodeInfo>::const_iterator it = threading.constFind(internalId);
+        ThreadNodeTable::const_iterator it = threading.constFind(internalId);
         if (it == threading.constEnd())
             continue;
         if (it->uid)
@@ -883,10 +1330,74 @@ void ThreadingMsgListModel::applyThreading(const QVector<Imap::Responses::Thread
         return;
     }
 
-    emit layoutAboutToBeChanged();
+    // Whatever is being built in the background right now is older than this response
+    forgetThreadLayout();
 
-    updatePersistentIndexesPhase1();
+    if (applyThreadingIncrementally(mapping))
+        return;
+
+    if (sourceModel()->rowCount() < m_backgroundLayoutThreshold) {
+        // Small mailboxes are done faster than it would take to pass the data to the other thread
+        ThreadLayoutRequest request;
+        snapshotThreadLayout(mapping, request);
+        buildThreadLayout(&request);
+        swapInThreadLayout(request);
+        return;
+    }
+
+    if (m_threadLayoutInFlight) {
+        // The worker can only work on one request at a time; the most recent response is the only one worth building
+        m_pendingThreadLayout = mapping;
+        m_hasPendingThreadLayout = true;
+        return;
+    }
+
+    ThreadLayoutRequest snapshot;
+    snapshotThreadLayout(mapping, snapshot);
+    startWorkerThread();
+    m_threadLayoutInFlight = true;
+    QMetaObject::invokeMethod(m_threadLayoutWorker, "execute", Qt::QueuedConnection,
+                              Q_ARG(Imap::Mailbox::ThreadLayoutRequest*, new ThreadLayoutRequest(snapshot)));
+}
+
+void ThreadingMsgListModel::snapshotThreadLayout(const QVector<Imap::Responses::ThreadingNode> &mapping,
+                                                 ThreadLayoutRequest &request)
+{
+    request.mapping = mapping;
+    request.generation = m_threadLayoutGeneration;
+    request.messageListGeneration = m_messageListGeneration;
+
+    int upstreamMessages = sourceModel()->rowCount();
+    if (!upstreamMessages)
+        return;
 
+    // Work with pointers instead going through the MVC API for performance.
+    // This matters (at least that's what by benchmarks said).
+    QModelIndex firstMessageIndex = sourceModel()->index(0, 0);
+    Q_ASSERT(firstMessageIndex.isValid());
+    const Model *realModel = 0;
+    TreeItem *firstMessagePtr = Model::realTreeItem(firstMessageIndex, &realModel);
+    Q_ASSERT(firstMessagePtr);
+    // If the next asserts fails, it means that the implementation of MsgListModel has changed and uses its own pointers
+    Q_ASSERT(firstMessagePtr == firstMessageIndex.internalPointer());
+    TreeItemMsgList *list = dynamic_cast<TreeItemMsgList *>(firstMessagePtr->parent());
+    Q_ASSERT(list);
+    request.uids.resize(upstreamMessages);
+    request.messages.resize(upstreamMessages);
+    for (int i = 0; i < upstreamMessages; ++i) {
+        const uint uid = static_cast<TreeItemMessage *>(list->m_children[i])->uid();
+        if (!uid) {
+            throw UnknownMessageIndex("Encountered a message with zero UID when threading. This is a bug in Trojita, sorry.");
+        }
+        request.uids[i] = uid;
+        request.messages[i] = list->m_children[i];
+    }
+}
+
+void ThreadingMsgListModel::buildThreadLayout(ThreadLayoutRequest *request)
+{
+    ThreadNodeTable &threading = request->threading;
+    QHash<void *,uint> &ptrToInternal = request->ptrToInternal;
     threading.clear();
     ptrToInternal.clear();
     // Default-construct the root node
@@ -895,51 +1406,34 @@ void ThreadingMsgListModel::applyThreading(const QVector<Imap::Responses::Thread
     // At first, initialize threading nodes for all messages which are right now available in the mailbox.
     // We risk that we will have to delete some of them later on, but this is likely better than doing a lookup
     // for each UID individually (remember, the THREAD response might contain UIDs in crazy order).
-    int upstreamMessages = sourceModel()->rowCount();
+    const int upstreamMessages = request->messages.size();
     QHash<uint,void *> uidToPtrCache;
     QSet<uint> usedNodes;
     uidToPtrCache.reserve(upstreamMessages);
     threading.reserve(upstreamMessages);
     ptrToInternal.reserve(upstreamMessages);
 
-    if (upstreamMessages) {
-        // Work with pointers instead going through the MVC API for performance.
-        // This matters (at least that's what by benchmarks said).
-        QModelIndex firstMessageIndex = sourceModel()->index(0, 0);
-        Q_ASSERT(firstMessageIndex.isValid());
-        const Model *realModel = 0;
-        TreeItem *firstMessagePtr = Model::realTreeItem(firstMessageIndex, &realModel);
-        Q_ASSERT(firstMessagePtr);
-        // If the next asserts fails, it means that the implementation of MsgListModel has changed and uses its own pointers
-        Q_ASSERT(firstMessagePtr == firstMessageIndex.internalPointer());
-        TreeItemMsgList *list = dynamic_cast<TreeItemMsgList *>(firstMessagePtr->parent());
-        Q_ASSERT(list);
-        for (int i = 0; i < upstreamMessages; ++i) {
-            ThreadNodeInfo node;
-            node.uid = dynamic_cast<TreeItemMessage *>(list->m_children[i])->uid();
-            if (! node.uid) {
-                throw UnknownMessageIndex("Encountered a message with zero UID when threading. This is a bug in Trojita, sorry.");
-            }
-
-            node.internalId = i + 1;
-            node.ptr = list->m_children[i];
-            uidToPtrCache[node.uid] = node.ptr;
-            threadingHelperLastId = node.internalId;
-            // We're creating a new node here
-            Q_ASSERT(!threading.contains(node.internalId));
-            threading[ node.internalId ] = node;
-            ptrToInternal[ node.ptr ] = node.internalId;
-        }
+    for (int i = 0; i < upstreamMessages; ++i) {
+        ThreadNodeInfo node;
+        node.uid = request->uids[i];
+        node.internalId = i + 1;
+        node.ptr = request->messages[i];
+        uidToPtrCache[node.uid] = node.ptr;
+        request->lastId = node.internalId;
+        // We're creating a new node here
+        Q_ASSERT(!threading.contains(node.internalId));
+        threading[ node.internalId ] = node;
+        ptrToInternal[ node.ptr ] = node.internalId;
     }
 
     // Mark the root node as always present
     usedNodes.insert(0);
 
     // Set up parents and find the list of all used nodes
-    registerThreading(mapping, 0, uidToPtrCache, usedNodes);
+    registerThreading(threading, ptrToInternal, request->lastId, request->mapping, 0, uidToPtrCache, usedNodes);
 
     // Now remove all messages which were not referenced in the THREAD response from our mapping
-    QHash<uint,ThreadNodeInfo>::iterator it = threading.begin();
+    ThreadNodeTable::iterator it = threading.begin();
     while (it != threading.end()) {
         if (usedNodes.contains(it.key())) {
             // this message should be shown
@@ -950,17 +1444,232 @@ void ThreadingMsgListModel::applyThreading(const QVector<Imap::Responses::Thread
             it = threading.erase(it);
         }
     }
-    pruneTree();
+
+    // The thread roots are taken from the finished tree by the swapInThreadLayout()
+    QList<uint> threadedRootIds;
+    pruneTree(threading, threadedRootIds);
+}
+
+void ThreadingMsgListModel::swapInThreadLayout(ThreadLayoutRequest &request)
+{
+    QTime timer;
+    timer.start();
+
+    emit layoutAboutToBeChanged();
+
+    updatePersistentIndexesPhase1();
+    threading.swap(request.threading);
+    qSwap(ptrToInternal, request.ptrToInternal);
+    qSwap(threadingHelperLastId, request.lastId);
     updatePersistentIndexesPhase2();
     if (rowCount())
         threadedRootIds = threading[0].children;
+    m_threadingApplied = true;
+    m_unthreadedNodes.clear();
     emit layoutChanged();
 
     // If the sorting was active before, we shall reactivate it now
     searchSortPreferenceImplementation(m_currentSearchConditions, m_currentSortingCriteria, m_sortReverse ? Qt::DescendingOrder : Qt::AscendingOrder);
+
+    logTrace(QString::fromUtf8("ThreadingMsgListModel: threading of %1 messages applied, the GUI thread was busy for %2 ms")
+             .arg(QString::number(request.messages.size()), QString::number(timer.elapsed())));
+}
+
+void ThreadingMsgListModel::forgetThreadLayout()
+{
+    ++m_threadLayoutGeneration;
+    m_pendingThreadLayout.clear();
+    m_hasPendingThreadLayout = false;
+}
+
+void ThreadingMsgListModel::slotThreadLayoutAvailable(ThreadLayoutRequest *request)
+{
+    m_threadLayoutInFlight = false;
+    const bool stale = request->generation != m_threadLayoutGeneration;
+    const bool messagesChanged = request->messageListGeneration != m_messageListGeneration;
+
+    if (!m_shallBeThreading || !sourceModel() || !sourceModel()->rowCount()) {
+        disposeThreadLayout(request);
+        return;
+    }
+
+    if (m_hasPendingThreadLayout) {
+        // A newer response has arrived in the meanwhile
+        QVector<Imap::Responses::ThreadingNode> mapping = m_pendingThreadLayout;
+        disposeThreadLayout(request);
+        applyThreading(mapping);
+        return;
+    }
+
+    if (stale) {
+        disposeThreadLayout(request);
+        return;
+    }
+
+    if (messagesChanged) {
+        // Messages have arrived or disappeared since the snapshot, so the pointers in the tree cannot be trusted anymore
+        QVector<Imap::Responses::ThreadingNode> mapping = request->mapping;
+        disposeThreadLayout(request);
+
+        QModelIndex realIndex;
+        const Model *realModel = 0;
+        Model::realTreeItem(sourceModel()->index(0, 0), &realModel, &realIndex);
+        TreeItemMsgList *list = dynamic_cast<TreeItemMsgList*>(static_cast<TreeItem*>(realIndex.parent().internalPointer()));
+        Q_ASSERT(list);
+        const uint highestUidInMailbox = findHighestUidInMailbox(list);
+        if (findHighEnoughNumber(mapping, highestUidInMailbox) >= highestUidInMailbox) {
+            logTrace(QLatin1String("ThreadingMsgListModel: the mailbox has changed while building the threads, building them again"));
+            applyThreading(mapping);
+        } else {
+            // Applying this response would hide the new arrivals
+            wantThreading();
+        }
+        return;
+    }
+
+    swapInThreadLayout(*request);
+    disposeThreadLayout(request);
+}
+
+void ThreadingMsgListModel::disposeThreadLayout(ThreadLayoutRequest *request)
+{
+    if (!m_threadLayoutWorker) {
+        delete request;
+        return;
+    }
+    QMetaObject::invokeMethod(m_threadLayoutWorker, "dispose", Qt::QueuedConnection,
+                              Q_ARG(Imap::Mailbox::ThreadLayoutRequest*, request));
 }
 
-void ThreadingMsgListModel::registerThreading(const QVector<Imap::Responses::ThreadingNode> &mapping, uint parentId, const QHash<uint,void *> &uidToPtr, QSet<uint> &usedNodes)
+bool ThreadingMsgListModel::applyThreadingIncrementally(const QVector<Imap::Responses::ThreadingNode> &mapping)
+{
+    // Sorting and searching reorder the thread roots on their own; the layout would change completely anyway
+    if (!m_threadingApplied || m_currentSortingCriteria != SORT_NONE || !m_currentSearchConditions.isEmpty() || m_sortReverse)
+        return false;
+    if (!sourceModel()->rowCount())
+        return false;
+
+    const Model *realModel = 0;
+    QModelIndex realIndex;
+    Model::realTreeItem(sourceModel()->index(0, 0), &realModel, &realIndex);
+    TreeItemMsgList *list = dynamic_cast<TreeItemMsgList*>(static_cast<TreeItem*>(realIndex.parent().internalPointer()));
+    Q_ASSERT(list);
+
+    // Walking the response is linear, but it doesn't touch the model; only the messages which move generate any signals
+    QVector<PrunedThreadNode> expected;
+    pruneMapping(mapping, expected, const_cast<Model*>(realModel), list);
+    QList<ThreadPlacement> placements;
+    if (!findThreadPlacements(expected, 0, placements)) {
+        logTrace(QLatin1String("ThreadingMsgListModel: the threading has changed, rebuilding it"));
+        return false;
+    }
+
+    // The placements are in the tree order, so each parent and all previous siblings are already where they should be
+    Q_FOREACH(const ThreadPlacement &placement, placements) {
+        ThreadNodeTable::iterator node = threading.find(placement.internalId);
+        Q_ASSERT(node != threading.end());
+        // All new arrivals start as thread roots
+        Q_ASSERT(node->parent == 0);
+        const int from = node->offset;
+        m_unthreadedNodes.remove(placement.internalId);
+        if (placement.parent == 0 && placement.row == from)
+            continue;
+        Q_ASSERT(placement.parent != 0 || placement.row < from);
+
+        QModelIndex destination;
+        if (placement.parent)
+            destination = createIndex(threading[placement.parent].offset, 0, placement.parent);
+        if (!beginMoveRows(QModelIndex(), from, from, destination, placement.row))
+            return false;
+
+        QList<uint> &roots = threading[0].children;
+        roots.removeAt(from);
+        for (int i = from; i < roots.size(); ++i)
+            threading[roots[i]].offset = i;
+
+        QList<uint> &siblings = threading[placement.parent].children;
+        siblings.insert(placement.row, placement.internalId);
+        node = threading.find(placement.internalId);
+        node->parent = placement.parent;
+        for (int i = placement.row; i < siblings.size(); ++i)
+            threading[siblings[i]].offset = i;
+
+        endMoveRows();
+
+        if (placement.parent) {
+            // The thread root shows the aggregated state of the whole thread
+            uint root = placement.parent;
+            while (threading[root].parent)
+                root = threading[root].parent;
+            QModelIndex rootIndex = createIndex(threading[root].offset, 0, root);
+            emit dataChanged(rootIndex, rootIndex.sibling(rootIndex.row(), columnCount() - 1));
+        }
+    }
+
+    threadedRootIds = threading[0].children;
+    logTrace(QString::fromUtf8("ThreadingMsgListModel: %1 new messages were threaded incrementally").arg(placements.size()));
+    return true;
+}
+
+void ThreadingMsgListModel::pruneMapping(const QVector<Imap::Responses::ThreadingNode> &mapping,
+                                         QVector<PrunedThreadNode> &output, Model *realModel, TreeItemMsgList *list) const
+{
+    Q_FOREACH(const Imap::Responses::ThreadingNode &node, mapping) {
+        PrunedThreadNode pruned;
+        if (node.num) {
+            QList<TreeItem*>::iterator it = realModel->findMessageOrNextOneByUid(list, node.num);
+            if (it != list->m_children.end() && static_cast<TreeItemMessage*>(*it)->uid() == node.num)
+                pruned.ptr = *it;
+        }
+        pruneMapping(node.children, pruned.children, realModel, list);
+
+        if (pruned.ptr) {
+            output.append(pruned);
+        } else if (!pruned.children.isEmpty()) {
+            // Just like the pruneTree(), promote the first child to replace the missing message
+            PrunedThreadNode replacement = pruned.children.first();
+            replacement.children += pruned.children.mid(1);
+            output.append(replacement);
+        }
+    }
+}
+
+bool ThreadingMsgListModel::findThreadPlacements(const QVector<PrunedThreadNode> &expected, const uint parentId,
+                                                 QList<ThreadPlacement> &placements) const
+{
+    ThreadNodeTable::const_iterator parent = threading.constFind(parentId);
+    Q_ASSERT(parent != threading.constEnd());
+    const QList<uint> &current = parent->children;
+    int pos = 0;
+    for (int i = 0; i < expected.size(); ++i) {
+        QHash<void *,uint>::const_iterator id = ptrToInternal.constFind(expected[i].ptr);
+        if (id == ptrToInternal.constEnd())
+            return false;
+
+        if (m_unthreadedNodes.contains(*id)) {
+            // A new arrival; its children, if any, have to be new as well because it has none so far
+            placements.append(ThreadPlacement(*id, parentId, i));
+        } else {
+            // The new arrivals which are still waiting at the end of the list of thread roots are not interesting here
+            while (pos < current.size() && m_unthreadedNodes.contains(current[pos]))
+                ++pos;
+            if (pos == current.size() || current[pos] != *id)
+                return false;
+            ++pos;
+        }
+
+        if (!findThreadPlacements(expected[i].children, *id, placements))
+            return false;
+    }
+
+    while (pos < current.size() && m_unthreadedNodes.contains(current[pos]))
+        ++pos;
+    return pos == current.size();
+}
+
+void ThreadingMsgListModel::registerThreading(ThreadNodeTable &threading, const QHash<void *,uint> &ptrToInternal, uint &lastId,
+                                              const QVector<Imap::Responses::ThreadingNode> &mapping, uint parentId,
+                                              const QHash<uint,void *> &uidToPtr, QSet<uint> &usedNodes)
 {
     Q_FOREACH(const Imap::Responses::ThreadingNode &node, mapping) {
         uint nodeId;
@@ -974,7 +1683,7 @@ void ThreadingMsgListModel::registerThreading(const QVector<Imap::Responses::Thr
             // simply hide.
             // The ptrIt which is initialized by the condition is used in the else branch.
             ThreadNodeInfo fake;
-            fake.internalId = ++threadingHelperLastId;
+            fake.internalId = ++lastId;
             fake.parent = parentId;
             Q_ASSERT(threading.contains(parentId));
             // The child will be registered to the list of parent's children after the if/else branch
@@ -993,7 +1702,7 @@ void ThreadingMsgListModel::registerThreading(const QVector<Imap::Responses::Thr
         threading[ parentId ].children.append(nodeId);
         threading[ nodeId ].parent = parentId;
         usedNodes.insert(nodeId);
-        registerThreading(node.children, nodeId, uidToPtr, usedNodes);
+        registerThreading(threading, ptrToInternal, lastId, node.children, nodeId, uidToPtr, usedNodes);
     }
 }
 
@@ -1031,7 +1740,7 @@ void ThreadingMsgListModel::updatePersistentIndexesPhase2()
             updatedIndexes.append(QModelIndex());
             continue;
         }
-        QHash<uint,ThreadNodeInfo>::const_iterator it = threading.constFind(*ptrIt);
+        ThreadNodeTable::const_iterator it = threading.constFind(*ptrIt);
         if (it == threading.constEnd()) {
             // Filtering doesn't accept this index, let's declare it dead
             updatedIndexes.append(QModelIndex());
@@ -1046,6 +1755,11 @@ void ThreadingMsgListModel::updatePersistentIndexesPhase2()
 }
 
 void ThreadingMsgListModel::pruneTree()
+{
+    pruneTree(threading, threadedRootIds);
+}
+
+void ThreadingMsgListModel::pruneTree(ThreadNodeTable &threading, QList<uint> &threadedRootIds)
 {
     // Our mapping (threading) is completely unsorted, which means that we simply don't have any way of walking the tree from
     // the top. Instead, we got to work with a random walk, processing nodes in an unspecified order.  If we iterated on the QHash
@@ -1055,7 +1769,7 @@ void ThreadingMsgListModel::pruneTree()
     for (QList<uint>::iterator id = pending.begin(); id != pending.end(); /* nothing */) {
         // Convert to the hashmap
         // The "it" iterator point to the current node in the threading mapping
-        QHash<uint, ThreadNodeInfo>::iterator it = threading.find(*id);
+        ThreadNodeTable::iterator it = threading.find(*id);
         if (it == threading.end()) {
             // We've already seen this node, that's due to promoting
             ++id;
@@ -1074,7 +1788,7 @@ void ThreadingMsgListModel::pruneTree()
             // a fake one
 
             // each node has a parent
-            QHash<uint, ThreadNodeInfo>::iterator parent = threading.find(it->parent);
+            ThreadNodeTable::iterator parent = threading.find(it->parent);
             Q_ASSERT(parent != threading.end());
 
             // and the node itself has to be found in its parent's children
@@ -1092,7 +1806,7 @@ void ThreadingMsgListModel::pruneTree()
 
                 // Update offsets of all further nodes, siblings to the one we've just deleted
                 while (childIt != parent->children.end()) {
-                    QHash<uint, ThreadNodeInfo>::iterator sibling = threading.find(*childIt);
+                    ThreadNodeTable::iterator sibling = threading.find(*childIt);
                     Q_ASSERT(sibling != threading.end());
                     --sibling->offset;
                     Q_ASSERT(sibling->offset >= 0);
@@ -1101,7 +1815,7 @@ void ThreadingMsgListModel::pruneTree()
             } else {
                 // This node has some children, so we can't just delete it. Instead of that, we promote its first child
                 // to replace this node.
-                QHash<uint, ThreadNodeInfo>::iterator replaceWith = threading.find(it->children.first());
+                ThreadNodeTable::iterator replaceWith = threading.find(it->children.first());
                 Q_ASSERT(replaceWith != threading.end());
 
                 // Make sure that the offsets are still correct
@@ -1118,7 +1832,7 @@ void ThreadingMsgListModel::pruneTree()
 
                 // Fix parent and offset information of all children of the replacement node
                 for (int i = 0; i < replaceWith->children.size(); ++i) {
-                    QHash<uint, ThreadNodeInfo>::iterator sibling = threading.find(replaceWith->children[i]);
+                    ThreadNodeTable::iterator sibling = threading.find(replaceWith->children[i]);
                     Q_ASSERT(sibling != threading.end());
 
                     sibling->parent = replaceWith.key();
@@ -1175,21 +1889,92 @@ Qt::DropActions ThreadingMsgListModel::supportedDropActions() const
 
 bool ThreadingMsgListModel::threadContainsUnreadMessages(const uint root) const
 {
-    // FIXME: cache the value somewhere...
-    QList<uint> queue;
-    queue.append(root);
-    while (! queue.isEmpty()) {
-        uint current = queue.takeFirst();
-        QHash<uint,ThreadNodeInfo>::const_iterator it = threading.constFind(current);
+    if (root >= static_cast<uint>(m_hideReadKnown.size()) || !m_hideReadKnown.testBit(root))
+        computeHideReadState(root);
+    return m_threadHasUnread.testBit(root);
+}
+
+uint ThreadingMsgListModel::threadRootOf(uint internalId) const
+{
+    ThreadNodeTable::const_iterator it = threading.constFind(internalId);
+    Q_ASSERT(it != threading.constEnd());
+    while (it->parent) {
+        internalId = it->parent;
+        it = threading.constFind(internalId);
         Q_ASSERT(it != threading.constEnd());
-        Q_ASSERT(it->ptr);
-        TreeItemMessage *message = dynamic_cast<TreeItemMessage *>(it->ptr);
-        Q_ASSERT(message);
-        if (! message->isMarkedAsRead())
-            return true;
-        queue.append(it->children);
     }
-    return false;
+    return internalId;
+}
+
+bool ThreadingMsgListModel::isVisibleWhenHidingRead(const int row, const QModelIndex &parent) const
+{
+    ThreadNodeTable::const_iterator parentIt = threading.constFind(parent.isValid() ? parent.internalId() : 0);
+    if (parentIt == threading.constEnd() || row < 0 || row >= parentIt->children.size())
+        return true;
+    const uint internalId = parentIt->children[row];
+    if (internalId >= static_cast<uint>(m_hideReadKnown.size()) || !m_hideReadKnown.testBit(internalId))
+        computeHideReadState(threadRootOf(internalId));
+    return m_hideReadVisible.testBit(internalId);
+}
+
+void ThreadingMsgListModel::computeHideReadState(const uint root, QList<uint> *changed) const
+{
+    // The nodes are listed in the breadth-first order, so each parent gets processed before its children
+    QList<uint> nodes;
+    nodes << root;
+    bool hasUnread = false;
+    uint maxId = root;
+    for (int i = 0; i < nodes.size(); ++i) {
+        ThreadNodeTable::const_iterator it = threading.constFind(nodes[i]);
+        Q_ASSERT(it != threading.constEnd());
+        if (it->ptr && !static_cast<TreeItemMessage *>(it->ptr)->isMarkedAsRead())
+            hasUnread = true;
+        maxId = qMax(maxId, nodes[i]);
+        nodes += it->children;
+    }
+
+    if (maxId >= static_cast<uint>(m_hideReadKnown.size())) {
+        // Some headroom, so that the arrays do not get resized for each new arrival
+        const int size = maxId + 1 + maxId / 8;
+        m_hideReadKnown.resize(size);
+        m_hideReadVisible.resize(size);
+        m_threadHasUnread.resize(size);
+    }
+
+    m_threadHasUnread.setBit(root, hasUnread);
+    Q_FOREACH(const uint internalId, nodes) {
+        ThreadNodeTable::const_iterator it = threading.constFind(internalId);
+        TreeItemMessage *message = static_cast<TreeItemMessage *>(it->ptr);
+        // A message which was unread keeps its whole subthread visible
+        const bool visible = hasUnread || (message && message->m_wasUnread) ||
+                (internalId != root && m_hideReadVisible.testBit(it->parent));
+        if (changed && m_hideReadKnown.testBit(internalId) && m_hideReadVisible.testBit(internalId) != visible)
+            changed->append(internalId);
+        m_hideReadVisible.setBit(internalId, visible);
+        m_hideReadKnown.setBit(internalId);
+    }
+}
+
+void ThreadingMsgListModel::refreshHideReadState(const uint internalId)
+{
+    const uint root = threadRootOf(internalId);
+    if (root >= static_cast<uint>(m_hideReadKnown.size()) || !m_hideReadKnown.testBit(root)) {
+        // Nobody has asked about this thread yet
+        return;
+    }
+
+    QList<uint> changed;
+    computeHideReadState(root, &changed);
+    Q_FOREACH(const uint id, changed) {
+        // The proxies will evaluate just these rows again
+        QModelIndex index = createIndex(threading[id].offset, 0, id);
+        emit dataChanged(index, index.sibling(index.row(), columnCount() - 1));
+    }
+}
+
+void ThreadingMsgListModel::invalidateHideReadState()
+{
+    m_hideReadKnown.fill(false);
 }
 
 /** @short Pass a debugging message to the real Model, if possible
@@ -1295,17 +2080,55 @@ bool ThreadingMsgListModel::searchSortPreferenceImplementation(const QStringList
         if (searchConditions.isEmpty()) {
             // This operation is special, it will immediately restore the original shape of the mailbox
             m_currentSearchConditions = searchConditions;
+            m_hasLocalSearchResult = false;
             calculateNullSort();
             applySort();
             return true;
-        } else if (searchConditions != m_currentSearchConditions || m_searchValidity != RESULT_FRESH) {
+        } else if (searchConditions != m_currentSearchConditions || m_searchValidity != RESULT_FRESH ||
+                   (hasPartialSortResult() && m_sortReverse)) {
             // We have to update our search conditions
-            m_sortTask = realModel->m_taskFactory->createSortTask(const_cast<Model *>(realModel), mailboxIndex, searchConditions,
-                                                                  QStringList());
-            connect(m_sortTask, SIGNAL(sortingAvailable(QList<uint>)), this, SLOT(slotSortingAvailable(QList<uint>)));
-            connect(m_sortTask, SIGNAL(sortingFailed()), this, SLOT(slotSortingFailed()));
-            connect(m_sortTask, SIGNAL(incrementalSortUpdate(Imap::Responses::ESearch::IncrementalContextData_t)),
-                    this, SLOT(slotSortingIncrementalUpdate(Imap::Responses::ESearch::IncrementalContextData_t)));
+            releaseSortTask();
+            m_hasLocalSearchResult = searchLocally(realModel, mailboxIndex, searchConditions, m_localSearchResult);
+
+            CachedSearchResult key;
+            bool exact = false;
+            const CachedSearchResult *cached = searchCacheKey(mailboxIndex, searchConditions, criterium, key) ?
+                        findCachedSearchResult(key, exact) : 0;
+            if (cached && (exact || cached->uids.isEmpty())) {
+                // Nothing has changed since we got this very result, or a broader search has not found anything at all
+                key.uids = cached->uids;
+                key.reversed = cached->reversed;
+                if (!exact)
+                    rememberSearchResult(key);
+                m_currentSearchConditions = searchConditions;
+                m_currentSortResult = key.uids;
+                forgetSortWindows();
+                m_sortResultReversed = key.reversed;
+                m_searchValidity = RESULT_FRESH;
+                applySort();
+                emit sortingApplied(true);
+                return true;
+            }
+
+            if (m_hasLocalSearchResult && realModel->networkPolicy() == Model::NETWORK_OFFLINE) {
+                m_currentSortResult = m_localSearchResult;
+                forgetSortWindows();
+                m_currentSearchConditions = searchConditions;
+                m_searchValidity = RESULT_FRESH;
+                applySort();
+                emit sortingApplied(true);
+                return true;
+            }
+
+            if (cached || m_hasLocalSearchResult) {
+                // Something is shown right away and the server's result replaces it when it arrives.  A broader search has
+                // found all matching messages and then some, while the local index only knows about the indexed ones.
+                m_currentSortResult = cached ? cached->uids : m_localSearchResult;
+                forgetSortWindows();
+                applySort();
+                emit sortingApplied(false);
+            }
+            requestSorting(realModel, mailboxIndex, searchConditions, QStringList());
             m_currentSearchConditions = searchConditions;
             m_searchValidity = RESULT_ASKED;
         } else {
@@ -1317,30 +2140,64 @@ bool ThreadingMsgListModel::searchSortPreferenceImplementation(const QStringList
         return true;
     }
 
-    if (!hasSort) {
-        // sorting is completely unsupported
-        return false;
+    if (!hasSort || realModel->networkPolicy() == Model::NETWORK_OFFLINE) {
+        // The server cannot help, so we sort on our own using whatever data are available
+        QList<uint> matching;
+        if (!searchConditions.isEmpty() && !searchLocally(realModel, mailboxIndex, searchConditions, matching))
+            return false;
+
+        if (m_sortTask && m_sortTask->isPersistent())
+            m_sortTask->cancelSortingUpdates();
+
+        m_currentSearchConditions = searchConditions;
+        m_currentSortingCriteria = criterium;
+        m_currentSortResult = sortLocally(realModel, mailboxIndex, criterium);
+        forgetSortWindows();
+        if (!searchConditions.isEmpty()) {
+            const QSet<uint> matchingSet = matching.toSet();
+            QList<uint> filtered;
+            Q_FOREACH(const uint uid, m_currentSortResult) {
+                if (matchingSet.contains(uid))
+                    filtered << uid;
+            }
+            m_currentSortResult = filtered;
+        }
+        m_searchValidity = RESULT_FRESH;
+        applySort();
+        emit sortingApplied(true);
+        return true;
     }
 
     Q_ASSERT(!sortOptions.isEmpty());
 
     if (m_currentSortingCriteria == criterium && m_currentSearchConditions == searchConditions &&
-            m_searchValidity != RESULT_INVALIDATED) {
+            m_searchValidity != RESULT_INVALIDATED && !(hasPartialSortResult() && m_sortReverse != m_sortResultReversed)) {
         applySort();
     } else {
         m_currentSearchConditions = searchConditions;
         m_currentSortingCriteria = criterium;
-        calculateNullSort();
-        applySort();
 
         if (m_sortTask && m_sortTask->isPersistent())
             m_sortTask->cancelSortingUpdates();
 
-        m_sortTask = realModel->m_taskFactory->createSortTask(const_cast<Model *>(realModel), mailboxIndex, searchConditions, sortOptions);
-        connect(m_sortTask, SIGNAL(sortingAvailable(QList<uint>)), this, SLOT(slotSortingAvailable(QList<uint>)));
-        connect(m_sortTask, SIGNAL(sortingFailed()), this, SLOT(slotSortingFailed()));
-        connect(m_sortTask, SIGNAL(incrementalSortUpdate(Imap::Responses::ESearch::IncrementalContextData_t)),
-                this, SLOT(slotSortingIncrementalUpdate(Imap::Responses::ESearch::IncrementalContextData_t)));
+        CachedSearchResult key;
+        bool exact = false;
+        const CachedSearchResult *cached = searchCacheKey(mailboxIndex, searchConditions, criterium, key) ?
+                    findCachedSearchResult(key, exact) : 0;
+        if (cached && exact) {
+            releaseSortTask();
+            m_currentSortResult = cached->uids;
+            forgetSortWindows();
+            m_sortResultReversed = cached->reversed;
+            m_searchValidity = RESULT_FRESH;
+            applySort();
+            emit sortingApplied(true);
+            return true;
+        }
+
+        calculateNullSort();
+        applySort();
+        requestSorting(realModel, mailboxIndex, searchConditions, sortOptions);
         m_searchValidity = RESULT_ASKED;
     }
 
@@ -1354,51 +2211,62 @@ void ThreadingMsgListModel::applySort()
         return;
     }
 
-    const Imap::Mailbox::Model *realModel;
-    QModelIndex someMessage = sourceModel()->index(0,0);
     QModelIndex realIndex;
-    Model::realTreeItem(someMessage, &realModel, &realIndex);
-    TreeItemMailbox *mailbox = dynamic_cast<TreeItemMailbox*>(static_cast<TreeItem*>(realIndex.parent().parent().internalPointer()));
-    Q_ASSERT(mailbox);
+    Model::realTreeItem(sourceModel()->index(0,0), 0, &realIndex);
+    TreeItemMsgList *list = dynamic_cast<TreeItemMsgList*>(static_cast<TreeItem*>(realIndex.parent().internalPointer()));
+    Q_ASSERT(list);
+
+    // Changing just the direction of the sort does not have to look the UIDs up again
+    if (m_sortResultMessagesGeneration != m_messageListGeneration || m_sortResultMessagesSource != m_currentSortResult)
+        mapSortResult(list);
+
+    // A result which the server has reversed already only has to be reversed when the user wants the opposite order
+    const bool reverse = m_sortReverse != m_sortResultReversed;
+
+    QBitArray isRoot(threadingHelperLastId + 1);
+    Q_FOREACH(const uint internalId, threadedRootIds) {
+        if (internalId >= static_cast<uint>(isRoot.size()))
+            isRoot.resize(internalId + 1);
+        isRoot.setBit(internalId);
+    }
 
     emit layoutAboutToBeChanged();
     updatePersistentIndexesPhase1();
-    QSet<uint> newlyUnreachable(threading[0].children.toSet());
+    const QList<uint> previousRoots = threading[0].children;
     threading[0].children.clear();
 #if QT_VERSION >= 0x040700
-    threading[0].children.reserve(m_currentSortResult.size());
+    threading[0].children.reserve(m_sortResultMessages.size());
 #endif
 
-    QSet<uint> allRootIds(threadedRootIds.toSet());
-
-    for (int i = 0; i < m_currentSortResult.size(); ++i) {
-        int offset = m_sortReverse ? m_currentSortResult.size() - 1 - i : i;
-        QList<TreeItemMessage *> messages = const_cast<Model*>(realModel)
-                ->findMessagesByUids(mailbox, QList<uint>() << m_currentSortResult[offset]);
-        if (messages.isEmpty()) {
+    QBitArray reachable(isRoot.size());
+    for (int i = 0; i < m_sortResultMessages.size(); ++i) {
+        TreeItem *message = m_sortResultMessages[reverse ? m_sortResultMessages.size() - 1 - i : i];
+        if (!message) {
             // wrong UID, weird
             continue;
         }
-        Q_ASSERT(messages.size() == 1);
-        QHash<void *,uint>::const_iterator it = ptrToInternal.constFind(messages.front());
+        QHash<void *,uint>::const_iterator it = ptrToInternal.constFind(message);
         Q_ASSERT(it != ptrToInternal.constEnd());
-        if (!allRootIds.contains(*it)) {
+        if (*it >= static_cast<uint>(isRoot.size()) || !isRoot.testBit(*it)) {
             // not a thread root, so don't show it
             continue;
         }
         threading[*it].offset = threading[0].children.size();
         threading[0].children.append(*it);
+        reachable.setBit(*it);
     }
 
     // Now remove everything which is no longer reachable from the root of the thread mapping
-    newlyUnreachable -= threading[0].children.toSet();
+    QList<uint> newlyUnreachable;
+    Q_FOREACH(const uint internalId, previousRoots) {
+        if (internalId >= static_cast<uint>(reachable.size()) || !reachable.testBit(internalId))
+            newlyUnreachable << internalId;
+    }
     while (!newlyUnreachable.isEmpty()) {
-        QSet<uint>::iterator it = newlyUnreachable.begin();
-        uint item = *it;
-        newlyUnreachable.erase(it);
-        QHash<uint,ThreadNodeInfo>::iterator threadingIt = threading.find(item);
+        uint item = newlyUnreachable.takeLast();
+        ThreadNodeTable::iterator threadingIt = threading.find(item);
         Q_ASSERT(threadingIt != threading.end());
-        newlyUnreachable += threadingIt->children.toSet();
+        newlyUnreachable += threadingIt->children;
         threading.erase(threadingIt);
     }
 
@@ -1406,6 +2274,224 @@ void ThreadingMsgListModel::applySort()
     emit layoutChanged();
 }
 
+void ThreadingMsgListModel::mapSortResult(const TreeItemMsgList *list)
+{
+    m_sortResultMessagesSource = m_currentSortResult;
+    m_sortResultMessagesGeneration = m_messageListGeneration;
+    m_sortResultMessages.fill(0, m_currentSortResult.size());
+
+    // Both sides of the merge have to be sorted by UID; the result of a plain SEARCH already is
+    QVector<QPair<uint, int> > byUid;
+    byUid.reserve(m_currentSortResult.size());
+    bool ordered = true;
+    for (int i = 0; i < m_currentSortResult.size(); ++i) {
+        if (i && m_currentSortResult[i] < m_currentSortResult[i - 1])
+            ordered = false;
+        byUid.append(qMakePair(m_currentSortResult[i], i));
+    }
+    if (!ordered)
+        qSort(byUid);
+
+    // The messages are sorted by UID as well, except for those whose UID is not known yet and which therefore get skipped
+    QList<TreeItem*>::const_iterator message = list->m_children.constBegin();
+    const QList<TreeItem*>::const_iterator end = list->m_children.constEnd();
+    for (QVector<QPair<uint, int> >::const_iterator it = byUid.constBegin(); it != byUid.constEnd() && message != end; ++it) {
+        while (message != end && static_cast<TreeItemMessage*>(*message)->uid() < it->first)
+            ++message;
+        if (message != end && static_cast<TreeItemMessage*>(*message)->uid() == it->first)
+            m_sortResultMessages[it->second] = *message;
+    }
+}
+
+QList<uint> ThreadingMsgListModel::sortLocally(const Model *realModel, const QModelIndex &mailbox, const SortCriterium criterium)
+{
+    const QString mailboxName = mailbox.data(RoleMailboxName).toString();
+    if (mailboxName != m_localSortingMailbox) {
+        m_localSorting.clear();
+        m_localSortingIncomplete.clear();
+        m_localSortingMailbox = mailboxName;
+    }
+
+    QModelIndex realIndex;
+    Model::realTreeItem(sourceModel()->index(0,0), 0, &realIndex);
+    TreeItemMsgList *list = dynamic_cast<TreeItemMsgList*>(static_cast<TreeItem*>(realIndex.parent().internalPointer()));
+    Q_ASSERT(list);
+
+    // Only the new messages and those whose data have arrived in the meanwhile have to be processed here
+    QList<uint> uncached;
+    Q_FOREACH(TreeItem *item, list->m_children) {
+        TreeItemMessage *message = static_cast<TreeItemMessage *>(item);
+        const uint uid = message->uid();
+        if (!uid)
+            continue;
+        const bool known = m_localSorting.contains(uid);
+        if (known && (!m_localSortingIncomplete.contains(uid) || !message->fetched()))
+            continue;
+
+        if (!message->fetched()) {
+            uncached << uid;
+            continue;
+        }
+        LocalSortingMessage input;
+        input.uid = uid;
+        input.envelope = message->m_envelope;
+        input.internalDate = message->m_internalDate;
+        input.size = message->m_size;
+        m_localSortingIncomplete.remove(uid);
+        m_localSorting.setMessage(input);
+    }
+
+    // The sort keys of the messages which were not fetched yet come from the cache, all of them in a single query
+    if (!uncached.isEmpty()) {
+        const QHash<uint, AbstractCache::MessageDataBundle> cached = realModel->cache()->metadataOfMessages(mailboxName, uncached);
+        Q_FOREACH(const uint uid, uncached) {
+            LocalSortingMessage input;
+            input.uid = uid;
+            QHash<uint, AbstractCache::MessageDataBundle>::const_iterator it = cached.constFind(uid);
+            if (it != cached.constEnd() && it->uid == uid) {
+                input.envelope = it->envelope;
+                input.internalDate = it->internalDate;
+                input.size = it->size;
+            } else {
+                // The message will be sorted as if it had empty headers until they arrive
+                m_localSortingIncomplete.insert(uid);
+            }
+            m_localSorting.setMessage(input);
+        }
+    }
+
+    LocalSorting::Key key = LocalSorting::KEY_ARRIVAL;
+    switch (criterium) {
+    case SORT_NONE:
+    case SORT_ARRIVAL:
+        key = LocalSorting::KEY_ARRIVAL;
+        break;
+    case SORT_CC:
+        key = LocalSorting::KEY_CC;
+        break;
+    case SORT_DATE:
+        key = LocalSorting::KEY_DATE;
+        break;
+    case SORT_FROM:
+        key = LocalSorting::KEY_FROM;
+        break;
+    case SORT_SIZE:
+        key = LocalSorting::KEY_SIZE;
+        break;
+    case SORT_SUBJECT:
+        key = LocalSorting::KEY_SUBJECT;
+        break;
+    case SORT_TO:
+        key = LocalSorting::KEY_TO;
+        break;
+    }
+    return m_localSorting.sortedUids(key);
+}
+
+bool ThreadingMsgListModel::searchLocally(const Model *realModel, const QModelIndex &mailbox, const QStringList &searchConditions,
+                                          QList<uint> &result) const
+{
+    QStringList keys, texts;
+    if (!parseQuickSearch(searchConditions, keys, texts))
+        return false;
+
+    const QString mailboxName = mailbox.data(RoleMailboxName).toString();
+    QSet<uint> uids;
+    for (int i = 0; i < keys.size(); ++i)
+        uids += realModel->cache()->fullTextSearch(mailboxName, keys[i], texts[i]).toSet();
+
+    result = uids.toList();
+    qSort(result);
+    return true;
+}
+
+bool ThreadingMsgListModel::searchCacheKey(const QModelIndex &mailbox, const QStringList &searchConditions,
+                                           const SortCriterium criterium, CachedSearchResult &key) const
+{
+    QStringList keys, texts;
+    if (!searchConditions.isEmpty() && !parseQuickSearch(searchConditions, keys, texts)) {
+        // These might refer to the flags, and their changes are not tracked by anything below
+        return false;
+    }
+
+    TreeItemMailbox *mailboxPtr = dynamic_cast<TreeItemMailbox*>(static_cast<TreeItem*>(mailbox.internalPointer()));
+    Q_ASSERT(mailboxPtr);
+    // All sort keys and the text-based search keys only depend on the set of messages.  Changes to that one bump the
+    // HIGHESTMODSEQ, but as it is not updated by each FETCH during the session, the UIDNEXT (new arrivals) and the number of
+    // messages (expunges) are checked as well.  Without CONDSTORE, nothing is cached at all.
+    key.mailbox = mailboxPtr->mailbox();
+    key.uidValidity = mailboxPtr->syncState.uidValidity();
+    key.highestModSeq = mailboxPtr->syncState.highestModSeq();
+    key.uidNext = mailboxPtr->syncState.uidNext();
+    key.exists = sourceModel()->rowCount();
+    key.criterium = criterium;
+    key.searchConditions = searchConditions;
+    key.uids.clear();
+    key.reversed = false;
+    return key.highestModSeq && key.uidValidity;
+}
+
+const ThreadingMsgListModel::CachedSearchResult *ThreadingMsgListModel::findCachedSearchResult(const CachedSearchResult &key,
+                                                                                               bool &exact) const
+{
+    const CachedSearchResult *broader = 0;
+    for (QList<CachedSearchResult>::const_iterator it = m_searchResultCache.constBegin(); it != m_searchResultCache.constEnd(); ++it) {
+        if (it->mailbox != key.mailbox || it->uidValidity != key.uidValidity || it->highestModSeq != key.highestModSeq ||
+                it->uidNext != key.uidNext || it->exists != key.exists || it->criterium != key.criterium)
+            continue;
+        if (it->searchConditions == key.searchConditions) {
+            exact = true;
+            return &*it;
+        }
+        if (key.criterium == SORT_NONE && (!broader || it->uids.size() < broader->uids.size()) &&
+                isNarrowerSearch(key.searchConditions, it->searchConditions)) {
+            broader = &*it;
+        }
+    }
+    exact = false;
+    return broader;
+}
+
+/** @short How many results of SEARCH and SORT are kept around */
+static const int searchResultCacheSize = 16;
+
+void ThreadingMsgListModel::rememberSearchResult(const CachedSearchResult &result)
+{
+    QList<CachedSearchResult>::iterator it = m_searchResultCache.begin();
+    while (it != m_searchResultCache.end()) {
+        if (it->mailbox == result.mailbox && ((it->criterium == result.criterium && it->searchConditions == result.searchConditions) ||
+                it->uidValidity != result.uidValidity || it->highestModSeq != result.highestModSeq ||
+                it->uidNext != result.uidNext || it->exists != result.exists)) {
+            // Either the same thing, or something which will never match again
+            it = m_searchResultCache.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    m_searchResultCache.prepend(result);
+    while (m_searchResultCache.size() > searchResultCacheSize)
+        m_searchResultCache.removeLast();
+}
+
+bool ThreadingMsgListModel::isNarrowerSearch(const QStringList &narrower, const QStringList &broader)
+{
+    QStringList narrowerKeys, narrowerTexts, broaderKeys, broaderTexts;
+    bool fuzzy;
+    if (!parseQuickSearch(narrower, narrowerKeys, narrowerTexts, &fuzzy) || fuzzy)
+        return false;
+    if (!parseQuickSearch(broader, broaderKeys, broaderTexts, &fuzzy) || fuzzy)
+        return false;
+    if (narrowerKeys != broaderKeys)
+        return false;
+
+    // The server looks for substrings, so a longer text can only match a subset of what its part has matched
+    for (int i = 0; i < narrowerTexts.size(); ++i) {
+        if (!narrowerTexts[i].contains(broaderTexts[i], Qt::CaseInsensitive))
+            return false;
+    }
+    return true;
+}
+
 QStringList ThreadingMsgListModel::currentSearchCondition() const
 {
     return m_currentSearchConditions;
@@ -1421,5 +2507,21 @@ Qt::SortOrder ThreadingMsgListModel::currentSortOrder() const
     return m_sortReverse ? Qt::DescendingOrder : Qt::AscendingOrder;
 }
 
+
+ThreadLayoutWorker::ThreadLayoutWorker(): QObject(0)
+{
+}
+
+void ThreadLayoutWorker::execute(ThreadLayoutRequest *request)
+{
+    ThreadingMsgListModel::buildThreadLayout(request);
+    emit finished(request);
+}
+
+void ThreadLayoutWorker::dispose(ThreadLayoutRequest *request)
+{
+    delete request;
+}
+
 }
 }
@@ -24,10 +24,14 @@
 #define IMAP_THREADINGMSGLISTMODEL_H
 
 #include <QAbstractProxyModel>
+#include <QBitArray>
 #include <QPointer>
 #include <QSet>
+#include <QVector>
 #include "Imap/Parser/Response.h"
+#include "LocalSorting.h"
 
+class QThread;
 class QTimer;
 class ImapModelThreadingTest;
 
@@ -39,6 +43,9 @@ namespace Imap
 namespace Mailbox
 {
 
+class LocalThreadingWorker;
+struct LocalThreadingRequest;
+class Model;
 class SortTask;
 class TreeItem;
 class TreeItemMsgList;
@@ -62,6 +69,163 @@ struct ThreadNodeInfo {
 
 QDebug operator<<(QDebug debug, const ThreadNodeInfo &node);
 
+/** @short Storage for the ThreadNodeInfo, indexed by their internal IDs
+
+The internal IDs are handed out sequentially, so the nodes are kept in a single contiguous array and each lookup is a plain
+array access instead of hashing.  This matters because index(), parent() and mapToSource() are called for each painted cell.
+The interface mimics the subset of QHash which used to be used for this purpose.
+*/
+class ThreadNodeTable
+{
+public:
+    class const_iterator;
+
+    class iterator
+    {
+    public:
+        iterator(): m_table(0), m_id(0) {}
+        uint key() const { return m_id; }
+        ThreadNodeInfo &operator*() const { return m_table->m_nodes[m_id]; }
+        ThreadNodeInfo *operator->() const { return &m_table->m_nodes[m_id]; }
+        iterator &operator++() { m_id = m_table->nextUsed(m_id + 1); return *this; }
+        bool operator==(const iterator &other) const { return m_id == other.m_id; }
+        bool operator!=(const iterator &other) const { return m_id != other.m_id; }
+    private:
+        friend class ThreadNodeTable;
+        friend class const_iterator;
+        iterator(ThreadNodeTable *table, const uint id): m_table(table), m_id(id) {}
+        ThreadNodeTable *m_table;
+        uint m_id;
+    };
+
+    class const_iterator
+    {
+    public:
+        const_iterator(): m_table(0), m_id(0) {}
+        const_iterator(const iterator &other): m_table(other.m_table), m_id(other.m_id) {}
+        uint key() const { return m_id; }
+        const ThreadNodeInfo &operator*() const { return m_table->m_nodes.at(m_id); }
+        const ThreadNodeInfo *operator->() const { return &m_table->m_nodes.at(m_id); }
+        const_iterator &operator++() { m_id = m_table->nextUsed(m_id + 1); return *this; }
+        bool operator==(const const_iterator &other) const { return m_id == other.m_id; }
+        bool operator!=(const const_iterator &other) const { return m_id != other.m_id; }
+    private:
+        friend class ThreadNodeTable;
+        const_iterator(const ThreadNodeTable *table, const uint id): m_table(table), m_id(id) {}
+        const ThreadNodeTable *m_table;
+        uint m_id;
+    };
+
+    ThreadNodeTable(): m_count(0) {}
+
+    bool isEmpty() const { return !m_count; }
+    int size() const { return m_count; }
+    void clear() { m_nodes.clear(); m_used.clear(); m_count = 0; }
+    void reserve(const int size) { m_nodes.reserve(size + 1); m_used.reserve(size + 1); }
+    /** @short Exchange the contents with the @arg other table; this does not copy any nodes */
+    void swap(ThreadNodeTable &other) { qSwap(m_nodes, other.m_nodes); qSwap(m_used, other.m_used); qSwap(m_count, other.m_count); }
+    bool contains(const uint id) const { return id < static_cast<uint>(m_used.size()) && m_used[id]; }
+
+    /** @short Access a node, creating a default-constructed one if it doesn't exist yet */
+    ThreadNodeInfo &operator[](const uint id)
+    {
+        if (id >= static_cast<uint>(m_nodes.size())) {
+            m_nodes.resize(id + 1);
+            m_used.resize(id + 1);
+        }
+        if (!m_used[id]) {
+            m_used[id] = true;
+            ++m_count;
+        }
+        return m_nodes[id];
+    }
+
+    iterator find(const uint id) { return contains(id) ? iterator(this, id) : end(); }
+    const_iterator constFind(const uint id) const { return contains(id) ? const_iterator(this, id) : constEnd(); }
+    iterator begin() { return iterator(this, nextUsed(0)); }
+    iterator end() { return iterator(this, m_nodes.size()); }
+    const_iterator constBegin() const { return const_iterator(this, nextUsed(0)); }
+    const_iterator constEnd() const { return const_iterator(this, m_nodes.size()); }
+
+    /** @short Remove the node and return an iterator pointing to the next one */
+    iterator erase(iterator it)
+    {
+        Q_ASSERT(contains(it.m_id));
+        m_nodes[it.m_id] = ThreadNodeInfo();
+        m_used[it.m_id] = false;
+        --m_count;
+        return iterator(this, nextUsed(it.m_id + 1));
+    }
+
+    QList<uint> keys() const
+    {
+        QList<uint> res;
+        for (const_iterator it = constBegin(); it != constEnd(); ++it)
+            res.append(it.key());
+        return res;
+    }
+
+private:
+    friend class iterator;
+    friend class const_iterator;
+
+    uint nextUsed(uint id) const
+    {
+        while (id < static_cast<uint>(m_used.size()) && !m_used[id])
+            ++id;
+        return id;
+    }
+
+    QVector<ThreadNodeInfo> m_nodes;
+    QVector<bool> m_used;
+    int m_count;
+};
+
+/** @short Work item for the ThreadLayoutWorker
+
+The request carries an immutable snapshot of the mailbox and the THREAD response to the worker thread and the complete tree
+back.  The pointers to the messages serve just as keys; they are never dereferenced outside of the GUI thread.
+*/
+struct ThreadLayoutRequest
+{
+    QVector<Imap::Responses::ThreadingNode> mapping;
+    /** @short UIDs of all messages in the mailbox, in the order of the upstream model */
+    QVector<uint> uids;
+    QVector<TreeItem *> messages;
+
+    ThreadNodeTable threading;
+    QHash<void *,uint> ptrToInternal;
+    /** @short Last internal ID which is used by the threading */
+    uint lastId;
+
+    /** @short Opaque number which lets the requester recognize stale results */
+    uint generation;
+    /** @short State of the list of messages at the time of the snapshot */
+    uint messageListGeneration;
+
+    ThreadLayoutRequest(): lastId(0), generation(0), messageListGeneration(0) {}
+};
+
+/** @short Builds the tree of threads for the ThreadingMsgListModel in a separate thread */
+class ThreadLayoutWorker : public QObject
+{
+    Q_OBJECT
+public:
+    ThreadLayoutWorker();
+
+public slots:
+    void execute(Imap::Mailbox::ThreadLayoutRequest *request);
+    /** @short Destroy the request along with the tree which it carries
+
+    Freeing a tree of a huge mailbox takes a while, so the GUI thread hands the replaced tree back here.
+    */
+    void dispose(Imap::Mailbox::ThreadLayoutRequest *request);
+
+signals:
+    /** @short The request has been processed; the receiver takes ownership of it */
+    void finished(Imap::Mailbox::ThreadLayoutRequest *request);
+};
+
 /** @short A model implementing view of the whole IMAP server
 
 The problem with threading is that due to the extremely asynchronous nature of the IMAP Model, we often get informed about indexes
@@ -76,6 +240,13 @@ The model should also refrain from sending extra THREAD commands to the server,
 message deletions, as it should be only a matter of replacing some node in the threading info with a fake ThreadNodeInfo node and running
 the pruneTree() method, except that we might not know the UID of the message in question, and hence can't know what to delete.
 
+When the server does not support threading, when its THREAD command fails or when it takes too long, the threading is
+computed locally from the Message-Id, In-Reply-To and References headers by the LocalThreading, which runs in a separate
+thread.  Its results go through the same applyThreading() as the server's responses.
+
+In large mailboxes, applyThreading() builds the tree in the ThreadLayoutWorker from a snapshot of the messages.  The GUI
+thread only swaps the finished tree in and updates the persistent indexes, so the view does not freeze while the threads of
+a huge mailbox are being put together.
 */
 class ThreadingMsgListModel: public QAbstractProxyModel
 {
@@ -121,6 +292,7 @@ public:
     } SortCriterium;
 
     explicit ThreadingMsgListModel(QObject *parent);
+    virtual ~ThreadingMsgListModel();
     virtual void setSourceModel(QAbstractItemModel *sourceModel);
 
     virtual QModelIndex index(int row, int column, const QModelIndex &parent=QModelIndex()) const;
@@ -130,6 +302,8 @@ public:
     virtual QModelIndex mapToSource(const QModelIndex &proxyIndex) const;
     virtual QModelIndex mapFromSource(const QModelIndex &sourceIndex) const;
     virtual bool hasChildren(const QModelIndex &parent=QModelIndex()) const;
+    virtual bool canFetchMore(const QModelIndex &parent) const;
+    virtual void fetchMore(const QModelIndex &parent);
     virtual QVariant data(const QModelIndex &proxyIndex, int role) const;
     virtual Qt::ItemFlags flags(const QModelIndex &index) const;
     QVariant headerData(int section, Qt::Orientation orientation, int role) const;
@@ -148,6 +322,14 @@ public:
     SortCriterium currentSortCriterium() const;
     Qt::SortOrder currentSortOrder() const;
 
+    /** @short Shall the message in the @arg row below the @arg parent remain visible when the read messages are hidden?
+
+    That is the case when its thread contains an unread message, or when the message or any of its ancestors was unread at the
+    time the mailbox got opened.  The answer is computed for the whole thread at once and kept until the thread changes, so
+    this is a constant-time lookup for the PrettyMsgListModel's filter.
+    */
+    bool isVisibleWhenHidingRead(const int row, const QModelIndex &parent) const;
+
 public slots:
     void resetMe();
     void handleDataChanged(const QModelIndex &topLeft, const QModelIndex &bottomRight);
@@ -168,6 +350,12 @@ public slots:
     /** @short SORT has failed */
     void slotSortingFailed();
 
+    /** @short A window of the SORT or SEARCH result has arrived */
+    void slotSortingWindowAvailable(const uint offset, const QList<uint> &uids, const uint total);
+
+    /** @short Asking for a further window of the result has failed */
+    void slotSortingWindowFailed();
+
     /** @short Dynamic update to the current SORT order */
     void slotSortingIncrementalUpdate(const Imap::Responses::ESearch::IncrementalContextData_t &updates);
 
@@ -182,19 +370,99 @@ public slots:
     void slotIncrementalThreadingAvailable(const Responses::ESearch::IncrementalThreadingData_t &data);
     void slotIncrementalThreadingFailed();
 
+private slots:
+    /** @short Pass the messages which the LocalThreadingWorker hasn't seen yet to it */
+    void slotRunLocalThreading();
+    /** @short The LocalThreadingWorker has produced a new tree */
+    void slotLocalThreadingAvailable(Imap::Mailbox::LocalThreadingRequest *request);
+    /** @short The ThreadLayoutWorker has built the tree requested by applyThreading() */
+    void slotThreadLayoutAvailable(Imap::Mailbox::ThreadLayoutRequest *request);
+    /** @short The server hasn't answered our THREAD command in time */
+    void slotThreadingTimeout();
+    /** @short The structure of the threads has changed, so the cached state of "hide read" has to be computed again */
+    void invalidateHideReadState();
+
 signals:
     void sortingFailed();
+    /** @short A result of the search or sort has been applied
+
+    The @arg isFinal is false when the result is shown just until the server's answer arrives.
+    */
+    void sortingApplied(const bool isFinal);
 
 private:
     /** @short Display messages without any threading at all, as a liner list */
     void updateNoThreading();
 
+    /** @short Ask the server for the SORT or SEARCH result; large mailboxes only get the first window of it */
+    void requestSorting(const Model *realModel, const QModelIndex &mailbox, const QStringList &searchConditions,
+                        const QStringList &sortOptions);
+    /** @short Does the m_currentSortResult contain just the beginning of the server's result? */
+    bool hasPartialSortResult() const;
+    /** @short The m_currentSortResult is about to be replaced by a complete result */
+    void forgetSortWindows();
+    /** @short Stop listening to the m_sortTask; whatever it reports later is not wanted anymore */
+    void releaseSortTask();
+
+    /** @short A complete result of SEARCH or SORT along with the state of the mailbox which it is valid for */
+    struct CachedSearchResult {
+        QString mailbox;
+        uint uidValidity;
+        quint64 highestModSeq;
+        uint uidNext;
+        int exists;
+        SortCriterium criterium;
+        QStringList searchConditions;
+        QList<uint> uids;
+        bool reversed;
+    };
+
+    /** @short Fill in the current state of the @arg mailbox for looking up the results
+
+    Returns false if the results of these conditions might change without the mailbox state changing, for example when a raw
+    IMAP search refers to the flags, or if the server does not provide the HIGHESTMODSEQ.
+    */
+    bool searchCacheKey(const QModelIndex &mailbox, const QStringList &searchConditions, const SortCriterium criterium,
+                        CachedSearchResult &key) const;
+    /** @short Find a result for the @arg key
+
+    If there is no exact match, a result of a broader search which the requested one refines might be returned instead.  The
+    @arg exact tells which one it is.
+    */
+    const CachedSearchResult *findCachedSearchResult(const CachedSearchResult &key, bool &exact) const;
+    void rememberSearchResult(const CachedSearchResult &result);
+    /** @short Is each message matching the @arg narrower conditions guaranteed to match the @arg broader ones as well? */
+    static bool isNarrowerSearch(const QStringList &narrower, const QStringList &broader);
+
     /** @short Ask the model for a THREAD response
 
     If the firstUnknownUid is different than zero, an incremental response is requested.
     */
     void askForThreading(const uint firstUnknownUid = 0);
 
+    /** @short Compute the threading locally, shortly after the last call of this function */
+    void askForLocalThreading();
+
+    /** @short Start the thread for the LocalThreadingWorker and the ThreadLayoutWorker unless it is running already */
+    void startWorkerThread();
+
+    /** @short Record the current messages of the mailbox in the @arg request */
+    void snapshotThreadLayout(const QVector<Imap::Responses::ThreadingNode> &mapping, ThreadLayoutRequest &request);
+    /** @short Build the tree of threads for the snapshot in the @arg request
+
+    This function only works with the request, so it can be called from any thread.
+    */
+    static void buildThreadLayout(ThreadLayoutRequest *request);
+    /** @short Replace the current tree with the one which was built for the @arg request
+
+    The previous tree ends up in the @arg request.
+    */
+    void swapInThreadLayout(ThreadLayoutRequest &request);
+    /** @short Let the ThreadLayoutWorker free the @arg request which we no longer need */
+    void disposeThreadLayout(ThreadLayoutRequest *request);
+    /** @short Make sure that the tree being built in the background won't replace the current one */
+    void forgetThreadLayout();
+
     void updatePersistentIndexesPhase1();
     void updatePersistentIndexesPhase2();
 
@@ -207,18 +475,61 @@ private:
     /** @short Apply cached THREAD response or ask for threading again */
     void wantThreading(const SkipSortSearch skipSortSearch = AUTO_SORT_SEARCH);
 
-    /** @short Convert the threading from a THREAD response and apply that threading to this model */
-    void registerThreading(const QVector<Imap::Responses::ThreadingNode> &mapping, uint parentId,
-                           const QHash<uint,void *> &uidToPtr, QSet<uint> &usedNodes);
+    /** @short Convert the threading from a THREAD response and apply that threading to the @arg threading
+
+    Nodes for messages which are missing from the @arg uidToPtr get their IDs after the @arg lastId.
+    */
+    static void registerThreading(ThreadNodeTable &threading, const QHash<void *,uint> &ptrToInternal, uint &lastId,
+                                  const QVector<Imap::Responses::ThreadingNode> &mapping, uint parentId,
+                                  const QHash<uint,void *> &uidToPtr, QSet<uint> &usedNodes);
 
     bool searchSortPreferenceImplementation(const QStringList &searchConditions, const SortCriterium criterium,
                                             const Qt::SortOrder order = Qt::AscendingOrder);
 
     /** @short Remove fake messages from the threading tree */
     void pruneTree();
+    static void pruneTree(ThreadNodeTable &threading, QList<uint> &threadedRootIds);
+
+    /** @short A node from the THREAD response in the shape which pruneTree() would give to it */
+    struct PrunedThreadNode {
+        TreeItem *ptr;
+        QVector<PrunedThreadNode> children;
+        PrunedThreadNode(): ptr(0) {}
+    };
+
+    /** @short Where shall a message which is not part of the threading yet go */
+    struct ThreadPlacement {
+        uint internalId;
+        uint parent;
+        int row;
+        ThreadPlacement(const uint internalId, const uint parent, const int row):
+            internalId(internalId), parent(parent), row(row) {}
+    };
+
+    /** @short Try to apply the @arg mapping by just moving the new arrivals into their threads
+
+    Returns false if the mapping changes the placement of some message which is already threaded, in which case the caller
+    has to rebuild the whole threading.
+    */
+    bool applyThreadingIncrementally(const QVector<Imap::Responses::ThreadingNode> &mapping);
+    void pruneMapping(const QVector<Imap::Responses::ThreadingNode> &mapping, QVector<PrunedThreadNode> &output,
+                      Model *realModel, TreeItemMsgList *list) const;
+    bool findThreadPlacements(const QVector<PrunedThreadNode> &expected, const uint parentId,
+                              QList<ThreadPlacement> &placements) const;
+    /** @short Convert the current threading below @arg parentId back into the form used by the cache */
+    void currentThreading(QVector<Imap::Responses::ThreadingNode> &output, const uint parentId) const;
 
     /** @short Check current thread for "unread messages" */
     bool threadContainsUnreadMessages(const uint root) const;
+    /** @short Return the internal ID of the root of the thread which contains the @arg internalId */
+    uint threadRootOf(uint internalId) const;
+    /** @short Compute the state used by isVisibleWhenHidingRead() for the whole thread of the @arg root
+
+    The nodes whose state was known before and has changed are appended to the @arg changed, if it is given.
+    */
+    void computeHideReadState(const uint root, QList<uint> *changed = 0) const;
+    /** @short Recompute the thread of a message whose flags have changed and announce the rows which shall appear or disappear */
+    void refreshHideReadState(const uint internalId);
 
     /** @short Is this someone else's THREAD response? */
     bool shouldIgnoreThisThreadingResponse(const QModelIndex &mailbox, const QByteArray &algorithm,
@@ -228,9 +539,22 @@ private:
     static uint findHighEnoughNumber(const QVector<Imap::Responses::ThreadingNode> &mapping, uint marker);
 
     void calculateNullSort();
+    /** @short Find the messages for all UIDs of the m_currentSortResult in a single pass over the @arg list */
+    void mapSortResult(const TreeItemMsgList *list);
+
+    /** @short Evaluate the search conditions against the cache's full-text index
+
+    Returns false if the conditions are not something which the local index can answer, for example a raw IMAP search
+    expression.  Otherwise the @arg result contains the sorted UIDs of matching messages which have been indexed so far.
+    */
+    bool searchLocally(const Model *realModel, const QModelIndex &mailbox, const QStringList &searchConditions,
+                       QList<uint> &result) const;
 
     uint findHighestUidInMailbox(TreeItemMsgList *list);
 
+    /** @short Sort all messages in the mailbox according to the @arg criterium without asking the server */
+    QList<uint> sortLocally(const Model *realModel, const QModelIndex &mailbox, const SortCriterium criterium);
+
     void logTrace(const QString &message);
 
 
@@ -244,7 +568,7 @@ private:
 
     This tree is indexed by our internal ID.
     */
-    QHash<uint,ThreadNodeInfo> threading;
+    ThreadNodeTable threading;
 
     /** @short Last assigned internal ID */
     uint threadingHelperLastId;
@@ -252,6 +576,19 @@ private:
     /** @short Messages with unknown UIDs */
     QSet<TreeItem*> unknownUids;
 
+    /** @short Nodes whose m_hideReadVisible is up to date, indexed by the internal ID */
+    mutable QBitArray m_hideReadKnown;
+    /** @short Shall the node remain visible when the read messages are hidden? */
+    mutable QBitArray m_hideReadVisible;
+    /** @short Does the thread starting at this root contain some unread message? */
+    mutable QBitArray m_threadHasUnread;
+
+    /** @short Is the current layout a result of applyThreading()? */
+    bool m_threadingApplied;
+
+    /** @short Internal IDs of messages which have arrived after the threading was applied */
+    QSet<uint> m_unthreadedNodes;
+
     /** @short Threading algorithm we're using for this request */
     QByteArray requestedAlgorithm;
 
@@ -289,10 +626,40 @@ private:
 
     /** @short The current result of the SORT operation
 
-    This variable holds the UIDs of all messages in this mailbox, sorted according to the current sorting criteria.
+    This variable holds the UIDs of all messages in this mailbox, sorted according to the current sorting criteria.  In large
+    mailboxes, only the beginning of the server's result might be known; see m_sortResultTotal.
     */
     QList<uint> m_currentSortResult;
 
+    /** @short Size of the server's result when only its beginning is known, zero otherwise
+
+    The rest of the result is requested through fetchMore() one window at a time.  The CONTEXT updates keep the known part
+    and this count consistent in the meanwhile.
+    */
+    int m_sortResultTotal;
+
+    /** @short Was the m_currentSortResult requested in the reversed order already? */
+    bool m_sortResultReversed;
+
+    /** @short The sort criteria which the windows of the current result are requested with */
+    QStringList m_sortWindowCriteria;
+
+    /** @short Task which is asking for the next window of the result */
+    QPointer<SortTask> m_sortWindowTask;
+
+    /** @short Messages at each position of the m_currentSortResult, or null where the UID is not known
+
+    Unlike the internal IDs, these survive the rebuilding of the threads, so the sort result only has to be looked up again
+    when it or the list of messages changes.
+    */
+    QVector<TreeItem *> m_sortResultMessages;
+    /** @short The sort result which the m_sortResultMessages were computed for */
+    QList<uint> m_sortResultMessagesSource;
+    /** @short Incremented whenever messages are added, removed or get their UID */
+    uint m_messageListGeneration;
+    /** @short The m_messageListGeneration which the m_sortResultMessages are valid for */
+    uint m_sortResultMessagesGeneration;
+
     /** @short Is the cached result of SEARCH/SORT fresh enough? */
     typedef enum {
         RESULT_ASKED, /**< We've asked for the data */
@@ -302,11 +669,61 @@ private:
 
     ResultValidity m_searchValidity;
 
+    /** @short Result of the current search as found in the local full-text index */
+    QList<uint> m_localSearchResult;
+
+    /** @short Could the current search conditions be evaluated locally? */
+    bool m_hasLocalSearchResult;
+
+    /** @short Recent results of SEARCH and SORT, the most recent one first */
+    QList<CachedSearchResult> m_searchResultCache;
+    /** @short The mailbox state which the result being asked for from the m_sortTask will be valid for */
+    CachedSearchResult m_requestedSearchKey;
+    /** @short Shall the result of the m_sortTask be remembered? */
+    bool m_hasRequestedSearchKey;
+
+    /** @short Thread in which the LocalThreadingWorker and the ThreadLayoutWorker live; created when needed for the first time */
+    QThread *m_localThreadingThread;
+    LocalThreadingWorker *m_localThreadingWorker;
+    ThreadLayoutWorker *m_threadLayoutWorker;
+    /** @short Delays the local threading, so that a burst of changes results in a single request */
+    QTimer *m_localThreadingTimer;
+    /** @short Gives up on waiting for the THREAD response */
+    QTimer *m_threadingTimeout;
+    /** @short The mailbox whose messages the LocalThreadingWorker has received */
+    QString m_localThreadingMailbox;
+    /** @short Incremented whenever the results which the LocalThreadingWorker is working on are no longer wanted */
+    uint m_localThreadingGeneration;
+    /** @short UIDs of messages which were passed to the LocalThreadingWorker along with their headers */
+    QSet<uint> m_localThreadingComplete;
+    /** @short UIDs of messages which were passed to the LocalThreadingWorker before their headers were available */
+    QSet<uint> m_localThreadingIncomplete;
+
+    /** @short Mailboxes with at least this many messages get their threads built by the ThreadLayoutWorker */
+    int m_backgroundLayoutThreshold;
+    /** @short Incremented whenever the tree which the ThreadLayoutWorker is building is no longer wanted */
+    uint m_threadLayoutGeneration;
+    /** @short Is the ThreadLayoutWorker busy with our request? */
+    bool m_threadLayoutInFlight;
+    /** @short THREAD response which shall be applied once the ThreadLayoutWorker finishes its current request */
+    QVector<Imap::Responses::ThreadingNode> m_pendingThreadLayout;
+    bool m_hasPendingThreadLayout;
+
+    /** @short Sort keys for the sorting without server's help */
+    LocalSorting m_localSorting;
+    /** @short The mailbox whose messages are in the m_localSorting */
+    QString m_localSortingMailbox;
+    /** @short UIDs of messages which were added to the m_localSorting before their data were available */
+    QSet<uint> m_localSortingIncomplete;
+
     friend class ::ImapModelThreadingTest; // needs access to wantThreading();
+    friend class ThreadLayoutWorker; // runs buildThreadLayout()
 };
 
 }
 
 }
 
+Q_DECLARE_METATYPE(Imap::Mailbox::ThreadLayoutRequest*)
+
 #endif /* IMAP_THREADINGMSGLISTMODEL_H */
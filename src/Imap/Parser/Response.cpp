@@ -785,6 +785,37 @@ ESearch::ESearch(const QByteArray &line, int &start): AbstractResponse(ESEARCH),
             }
             incThreadData.push_back(IncrementalThreadingItem_t(previousRoot, node.children));
             LowLevelParser::eatSpaces(line, start);
+        } else if (label == "PARTIAL") {
+            // RFC 5267: PARTIAL (first:last sequence-set-or-NIL)
+
+            if (start >= line.size() - 2)
+                throw NoData("ESEARCH PARTIAL: no data", line, start);
+
+            if (line[start] != '(')
+                throw UnexpectedHere("ESEARCH PARTIAL: missing '('", line, start);
+            ++start;
+
+            const uint first = LowLevelParser::getUInt(line, start);
+            if (start >= line.size() - 2 || line[start] != ':')
+                throw UnexpectedHere("ESEARCH PARTIAL: malformed range", line, start);
+            ++start;
+            const uint last = LowLevelParser::getUInt(line, start);
+            LowLevelParser::eatSpaces(line, start);
+
+            QList<uint> uids;
+            if (line.mid(start, 3).toUpper() == "NIL") {
+                start += 3;
+            } else {
+                uids = LowLevelParser::getSequence(line, start);
+            }
+            LowLevelParser::eatSpaces(line, start);
+
+            if (start >= line.size() - 2 || line[start] != ')')
+                throw UnexpectedHere("ESEARCH PARTIAL: missing ')'", line, start);
+            ++start;
+
+            partialData.push_back(PartialResult(first, last, uids));
+            LowLevelParser::eatSpaces(line, start);
         } else {
             // A generic case: be prepapred to accept a (sequence of) numbers
 
@@ -1199,6 +1230,13 @@ QTextStream &ESearch::dump(QTextStream &stream) const
         node.children = it->thread;
         stream << "INCTHREAD " << it->previousThreadRoot << " [THREAD parsed-into-sane-form follows] " << threadDumpHelper(node) << " ";
     }
+    for (PartialData_t::const_iterator it = partialData.constBegin(); it != partialData.constEnd(); ++it) {
+        stream << "PARTIAL (" << it->first << ":" << it->last << " ";
+        Q_FOREACH(const uint num, it->uids) {
+            stream << num << ' ';
+        }
+        stream << ") ";
+    }
     return stream;
 }
 
@@ -1455,7 +1493,8 @@ bool ESearch::eq(const AbstractResponse &other) const
     try {
         const ESearch &s = dynamic_cast<const ESearch &>(other);
         return tag == s.tag && seqOrUids == s.seqOrUids && listData == s.listData &&
-                incrementalContextData == s.incrementalContextData && incThreadData == s.incThreadData;
+                incrementalContextData == s.incrementalContextData && incThreadData == s.incThreadData &&
+                partialData == s.partialData;
     } catch (std::bad_cast &) {
         return false;
     }
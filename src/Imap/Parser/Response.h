@@ -507,6 +507,27 @@ public:
     /** @short The threading information, draft-imap-incthread */
     IncrementalThreadingData_t incThreadData;
 
+    /** @short One window of the results as requested through RETURN (PARTIAL first:last), RFC 5267 section 4.4 */
+    struct PartialResult {
+        /** @short Position of the first requested result, counting from one */
+        uint first;
+        /** @short Position of the last requested result */
+        uint last;
+        /** @short The results within the window, possibly fewer than requested */
+        QList<uint> uids;
+
+        PartialResult(const uint first, const uint last, const QList<uint> &uids): first(first), last(last), uids(uids) {}
+
+        bool operator==(const PartialResult &other) const {
+            return first == other.first && last == other.last && uids == other.uids;
+        }
+    };
+
+    typedef QList<PartialResult> PartialData_t;
+
+    /** @short The windowed results */
+    PartialData_t partialData;
+
     // Other forms of returned data are quite explicitly not supported.
 
     ESearch(const QByteArray &line, int &start);
@@ -516,6 +537,8 @@ public:
         AbstractResponse(ESEARCH), tag(tag), seqOrUids(seqOrUids), incrementalContextData(incrementalContextData) {}
     ESearch(const QByteArray &tag, const SequencesOrUids seqOrUids, const IncrementalThreadingData_t &incThreadData):
         AbstractResponse(ESEARCH), tag(tag), seqOrUids(seqOrUids), incThreadData(incThreadData) {}
+    ESearch(const QByteArray &tag, const SequencesOrUids seqOrUids, const ListData_t &listData, const PartialData_t &partialData):
+        AbstractResponse(ESEARCH), tag(tag), seqOrUids(seqOrUids), listData(listData), partialData(partialData) {}
     virtual QTextStream &dump(QTextStream &stream) const;
     virtual bool eq(const AbstractResponse &other) const;
     virtual void plug(Imap::Parser *parser, Imap::Mailbox::Model *model) const;
@@ -50,6 +50,8 @@ private:
     ImapTask *conn;
     QPersistentModelIndex mailbox;
     QList<uint> uids;
+
+    friend class KeepMailboxOpenTask; // needs to know what to re-request after a reconnect
 };
 
 }
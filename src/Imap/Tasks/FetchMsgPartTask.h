@@ -51,6 +51,8 @@ private:
     QList<uint> uids;
     QStringList parts;
     QPersistentModelIndex mailboxIndex;
+
+    friend class KeepMailboxOpenTask; // needs to know what to re-request after a reconnect
 };
 
 }
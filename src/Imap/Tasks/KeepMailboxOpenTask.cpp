@@ -328,6 +328,7 @@ void KeepMailboxOpenTask::perform()
     }
 
     activateTasks();
+    fetchNextFlagsWindow();
 
     if (model->accessParser(parser).capabilitiesFresh && model->accessParser(parser).capabilities.contains("IDLE")) {
         shouldRunIdle = true;
@@ -525,6 +526,17 @@ bool KeepMailboxOpenTask::handleStateHelper(const Imap::Responses::State *const
         // Don't forget to resume IDLE, if desired; that's easiest by simply behaving as if a "task" has just finished
         slotTaskDeleted(0);
         return true;
+    } else if (resp->tag == flagsSyncCmd) {
+        flagsSyncCmd.clear();
+
+        if (resp->kind != Responses::OK) {
+            // Whatever is left will be fetched by the next full resync
+            log("Background FETCH FLAGS has failed");
+            pendingFlagsSync.clear();
+        }
+        fetchNextFlagsWindow();
+        slotTaskDeleted(0);
+        return true;
     } else {
         return false;
     }
@@ -676,6 +688,53 @@ void KeepMailboxOpenTask::requestEnvelopeDownload(const uint uid)
     }
 }
 
+void KeepMailboxOpenTask::requestFlagsSync(const QList<Sequence> &uidWindows)
+{
+    pendingFlagsSync += uidWindows;
+    if (isRunning)
+        fetchNextFlagsWindow();
+}
+
+QModelIndex KeepMailboxOpenTask::collectPendingRequests(QMap<uint, QSet<QString> > &parts, QList<uint> &envelopes) const
+{
+    if (!waitingObtainTasks.isEmpty()) {
+        // The user has already switched to another mailbox, so our own requests are no longer interesting
+        ObtainSynchronizedMailboxTask *last = waitingObtainTasks.last();
+        return last->keepTaskChild ? QModelIndex(last->keepTaskChild->mailboxIndex) : QModelIndex();
+    }
+
+    for (QMap<uint, QSet<QString> >::const_iterator it = requestedParts.constBegin(); it != requestedParts.constEnd(); ++it)
+        parts[it.key()] += *it;
+    Q_FOREACH(const FetchMsgPartTask *task, fetchPartTasks) {
+        if (task->isFinished())
+            continue;
+        Q_FOREACH(const uint uid, task->uids) {
+            parts[uid] += task->parts.toSet();
+        }
+    }
+
+    envelopes += requestedEnvelopes;
+    Q_FOREACH(const FetchMsgMetadataTask *task, fetchMetadataTasks) {
+        if (!task->isFinished())
+            envelopes += task->uids;
+    }
+    return mailboxIndex;
+}
+
+void KeepMailboxOpenTask::fetchNextFlagsWindow()
+{
+    // There's no point in continuing when another mailbox is about to be selected; the next sync will have to re-fetch
+    // all flags anyway
+    if (shouldExit)
+        pendingFlagsSync.clear();
+
+    if (pendingFlagsSync.isEmpty() || !flagsSyncCmd.isEmpty())
+        return;
+
+    breakOrCancelPossibleIdle();
+    flagsSyncCmd = parser->uidFetch(pendingFlagsSync.takeFirst(), QStringList() << QLatin1String("FLAGS"));
+}
+
 void KeepMailboxOpenTask::slotFetchRequestedParts()
 {
     // FIXME: abort/die
@@ -826,7 +885,8 @@ bool KeepMailboxOpenTask::hasPendingInternalActions() const
 {
     bool hasToWaitForIdleTermination = idleLauncher ? idleLauncher->waitingForIdleTaggedTermination() : false;
     return !(dependingTasksForThisMailbox.isEmpty() && dependingTasksNoMailbox.isEmpty() && runningTasksForThisMailbox.isEmpty() &&
-             requestedParts.isEmpty() && requestedEnvelopes.isEmpty() && newArrivalsFetch.isEmpty()) || hasToWaitForIdleTermination;
+             requestedParts.isEmpty() && requestedEnvelopes.isEmpty() && newArrivalsFetch.isEmpty() && flagsSyncCmd.isEmpty()) ||
+            hasToWaitForIdleTermination;
 }
 
 /** @short Returns true if this task can be safely terminated
@@ -842,7 +902,7 @@ bool KeepMailboxOpenTask::isReadyToTerminate() const
 bool KeepMailboxOpenTask::canRunIdleRightNow() const
 {
     bool res = shouldRunIdle && dependingTasksForThisMailbox.isEmpty() &&
-            dependingTasksNoMailbox.isEmpty() && newArrivalsFetch.isEmpty();
+            dependingTasksNoMailbox.isEmpty() && newArrivalsFetch.isEmpty() && flagsSyncCmd.isEmpty() && pendingFlagsSync.isEmpty();
 
     // If there's just one active tasks, it's the "this" one. If there are more of them, let's see if it's just one more
     // and that one more thing is a SortTask which is in the "just updating" mode.
@@ -146,6 +146,15 @@ public:
     void requestPartDownload(const uint uid, const QString &partId, const uint estimatedSize);
     /** @short Request a delayed loading of a message envelope */
     void requestEnvelopeDownload(const uint uid);
+    /** @short Fetch FLAGS of these UID ranges one after another once the mailbox is synchronized */
+    void requestFlagsSync(const QList<Sequence> &uidWindows);
+
+    /** @short Find out what shall be re-opened and re-requested when this connection gets lost
+
+    The requests for message parts and envelopes which have not been satisfied yet are appended to @arg parts and
+    @arg envelopes.  The returned index points to the mailbox which shall be opened after a reconnect.
+    */
+    QModelIndex collectPendingRequests(QMap<uint, QSet<QString> > &parts, QList<uint> &envelopes) const;
 
     virtual QVariant taskData(const int role) const;
 
@@ -193,6 +202,9 @@ private:
     /** @short Activate the dependent tasks while also limiting the rate */
     void activateTasks();
 
+    /** @short Ask for FLAGS of the next window from pendingFlagsSync, unless there's one in flight already */
+    void fetchNextFlagsWindow();
+
     /** @short If there's an IDLE running, be sure to stop it. If it's queued, delay it. */
     void breakOrCancelPossibleIdle();
 
@@ -252,11 +264,16 @@ protected:
     QList<FetchMsgMetadataTask *> fetchMetadataTasks;
     CommandHandle tagIdle;
     QList<CommandHandle> newArrivalsFetch;
+    /** @short UID ranges whose FLAGS were left out from the initial synchronization */
+    QList<Sequence> pendingFlagsSync;
+    CommandHandle flagsSyncCmd;
     friend class IdleLauncher;
     friend class ObtainSynchronizedMailboxTask; // needs access to slotUnSelectCompleted()
     friend class SortTask; // needs access to breakOrCancelPossibleIdle()
     friend class UnSelectTask; // needs access to breakPossibleIdle()
     friend class TreeItemMailbox; // wants to know if our index is OK
+    friend class BackgroundSyncScheduler; // needs access to synchronizeConn
+    friend class Model; // needs access to synchronizeConn when resuming after a reconnect
     friend class ::ImapModelIdleTest;
     friend class ::LibMailboxSync;
 
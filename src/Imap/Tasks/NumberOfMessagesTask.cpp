@@ -33,11 +33,10 @@ namespace Mailbox
 {
 
 
-NumberOfMessagesTask::NumberOfMessagesTask(Model *model, const QModelIndex &mailbox):
-    ImapTask(model), mailboxIndex(mailbox)
+NumberOfMessagesTask::NumberOfMessagesTask(Model *model, const QList<QPersistentModelIndex> &mailboxes):
+    ImapTask(model), mailboxIndexes(mailboxes), m_hadFailures(false)
 {
-    TreeItemMailbox *mailboxPtr = dynamic_cast<TreeItemMailbox *>(static_cast<TreeItem *>(mailbox.internalPointer()));
-    Q_ASSERT(mailboxPtr);
+    Q_ASSERT(!mailboxes.isEmpty());
     conn = model->m_taskFactory->createGetAnyConnectionTask(model);
     conn->addDependentTask(this);
 }
@@ -49,16 +48,20 @@ void NumberOfMessagesTask::perform()
 
     IMAP_TASK_CHECK_ABORT_DIE;
 
-    if (! mailboxIndex.isValid()) {
-        // FIXME: add proper fix
-        log("Mailbox vanished before we could ask for number of messages inside");
-        _completed();
-        return;
+    Q_FOREACH(const QPersistentModelIndex &mailboxIndex, mailboxIndexes) {
+        if (! mailboxIndex.isValid()) {
+            // FIXME: add proper fix
+            log("Mailbox vanished before we could ask for number of messages inside");
+            continue;
+        }
+        TreeItemMailbox *mailbox = dynamic_cast<TreeItemMailbox *>(static_cast<TreeItem *>(mailboxIndex.internalPointer()));
+        Q_ASSERT(mailbox);
+
+        tags << parser->status(mailbox->mailbox(), requestedStatusOptions());
     }
-    TreeItemMailbox *mailbox = dynamic_cast<TreeItemMailbox *>(static_cast<TreeItem *>(mailboxIndex.internalPointer()));
-    Q_ASSERT(mailbox);
 
-    tag = parser->status(mailbox->mailbox(), requestedStatusOptions());
+    if (tags.isEmpty())
+        _completed();
 }
 
 /** @short What kind of information are we interested in? */
@@ -72,12 +75,18 @@ bool NumberOfMessagesTask::handleStateHelper(const Imap::Responses::State *const
     if (resp->tag.isEmpty())
         return false;
 
-    if (resp->tag == tag) {
-        if (resp->kind == Responses::OK) {
-            _completed();
-        } else {
-            _failed("STATUS has failed");
-            // FIXME: error handling
+    if (tags.removeOne(resp->tag)) {
+        if (resp->kind != Responses::OK) {
+            log(QLatin1String("STATUS has failed"));
+            m_hadFailures = true;
+        }
+        if (tags.isEmpty()) {
+            if (m_hadFailures) {
+                _failed("STATUS has failed");
+                // FIXME: error handling
+            } else {
+                _completed();
+            }
         }
         return true;
     } else {
@@ -87,12 +96,17 @@ bool NumberOfMessagesTask::handleStateHelper(const Imap::Responses::State *const
 
 QString NumberOfMessagesTask::debugIdentification() const
 {
-    if (! mailboxIndex.isValid())
-        return QLatin1String("[invalid mailboxIndex]");
-
-    TreeItemMailbox *mailbox = dynamic_cast<TreeItemMailbox *>(static_cast<TreeItem *>(mailboxIndex.internalPointer()));
-    Q_ASSERT(mailbox);
-    return QString::fromUtf8("attached to %1").arg(mailbox->mailbox());
+    QStringList names;
+    Q_FOREACH(const QPersistentModelIndex &mailboxIndex, mailboxIndexes) {
+        if (! mailboxIndex.isValid()) {
+            names << QLatin1String("[invalid mailboxIndex]");
+            continue;
+        }
+        TreeItemMailbox *mailbox = dynamic_cast<TreeItemMailbox *>(static_cast<TreeItem *>(mailboxIndex.internalPointer()));
+        Q_ASSERT(mailbox);
+        names << mailbox->mailbox();
+    }
+    return QString::fromUtf8("attached to %1").arg(names.join(QLatin1String(", ")));
 }
 
 QVariant NumberOfMessagesTask::taskData(const int role) const
@@ -31,12 +31,16 @@ namespace Imap
 namespace Mailbox
 {
 
-/** @short Ask for number of messages in a certain mailbox */
+/** @short Ask for number of messages in a batch of mailboxes
+
+The STATUS commands for all mailboxes are pipelined, i.e. they are sent at once and the task completes when the server has
+answered all of them.
+*/
 class NumberOfMessagesTask : public ImapTask
 {
     Q_OBJECT
 public:
-    NumberOfMessagesTask(Model *model, const QModelIndex &mailbox);
+    NumberOfMessagesTask(Model *model, const QList<QPersistentModelIndex> &mailboxes);
     virtual void perform();
 
     virtual bool handleStateHelper(const Imap::Responses::State *const resp);
@@ -47,9 +51,10 @@ public:
 
     static QStringList requestedStatusOptions();
 private:
-    CommandHandle tag;
+    QList<CommandHandle> tags;
     ImapTask *conn;
-    QPersistentModelIndex mailboxIndex;
+    QList<QPersistentModelIndex> mailboxIndexes;
+    bool m_hadFailures;
 };
 
 }
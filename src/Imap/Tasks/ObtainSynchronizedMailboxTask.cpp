@@ -583,12 +583,68 @@ void ObtainSynchronizedMailboxTask::syncFlags(TreeItemMailbox *mailbox)
         fetchModifier["CHANGEDSINCE"] = oldSyncState.highestModSeq();
         flagsCmd = parser->fetch(Sequence(1, mailbox->syncState.exists()), QStringList() << QLatin1String("FLAGS"), fetchModifier);
     } else {
-        flagsCmd = parser->fetch(Sequence(1, mailbox->syncState.exists()), QStringList() << QLatin1String("FLAGS"));
+        flagsCmd = parser->fetch(flagsSyncViewport(mailbox, list), QStringList() << QLatin1String("FLAGS"));
     }
     list->m_numberFetchingStatus = TreeItem::LOADING;
     emit model->mailboxSyncingProgress(mailboxIndex, status);
 }
 
+/** @short Decide which messages shall have their FLAGS fetched before the mailbox is declared as synchronized
+
+Without CONDSTORE, each resync has to fetch flags of all messages in the mailbox.  For huge mailboxes, that takes a lot of time,
+yet the user is typically only interested in a small part of the mailbox around the first unseen message (or at its end).  This
+function returns the sequence range of that "viewport" and hands the rest of the mailbox over to the KeepMailboxOpenTask which
+will fetch it later in windows of UIDs.
+
+The messages outside of the viewport keep using the flags from the cache in the meanwhile.
+*/
+Sequence ObtainSynchronizedMailboxTask::flagsSyncViewport(TreeItemMailbox *mailbox, TreeItemMsgList *list)
+{
+    const uint exists = mailbox->syncState.exists();
+    Sequence everything = Sequence(1, exists);
+
+    bool ok;
+    uint window = model->property("trojita-imap-flags-sync-window").toUInt(&ok);
+    if (!ok || !window || exists <= window || !keepTaskChild || static_cast<uint>(list->m_children.size()) != exists)
+        return everything;
+
+    // A server with CONDSTORE will get asked for just the changes next time; that only works if we have seen all flags at
+    // the time we save the HIGHESTMODSEQ
+    if (model->accessParser(parser).capabilities.contains(QLatin1String("CONDSTORE")) ||
+            model->accessParser(parser).capabilities.contains(QLatin1String("QRESYNC")))
+        return everything;
+
+    // Center the viewport around the same message which is going to be reported by notifyInterestingMessages()
+    uint anchor = mailbox->syncState.unSeenOffset() ? qMin(mailbox->syncState.unSeenOffset(), exists) : exists;
+    uint hi = qMin(exists, anchor + window / 2);
+    uint lo = hi > window ? hi - window + 1 : 1;
+    hi = qMin(exists, lo + window - 1);
+
+    // The remaining windows are identified by UIDs so that they survive any EXPUNGEs which could arrive in the meanwhile.
+    // The newer messages go first as they are usually closer to what is being shown.
+    QList<QPair<uint, uint> > ranges;
+    for (uint start = hi + 1; start <= exists; start += window)
+        ranges << qMakePair(start, qMin(exists, start + window - 1));
+    for (uint end = lo - 1; end >= 1; end = end > window ? end - window : 0)
+        ranges << qMakePair(end > window ? end - window + 1 : 1u, end);
+
+    QList<Sequence> windows;
+    for (QList<QPair<uint, uint> >::const_iterator it = ranges.constBegin(); it != ranges.constEnd(); ++it) {
+        uint firstUid = static_cast<TreeItemMessage *>(list->m_children[it->first - 1])->uid();
+        uint lastUid = static_cast<TreeItemMessage *>(list->m_children[it->second - 1])->uid();
+        if (!firstUid || !lastUid) {
+            // Some UIDs are not known yet, so the UID-based windows cannot be used
+            return everything;
+        }
+        windows << Sequence(firstUid, lastUid);
+    }
+
+    log(QString::fromUtf8("Syncing flags of messages %1:%2 first, %3 windows will follow")
+        .arg(QString::number(lo), QString::number(hi), QString::number(windows.size())), Common::LOG_MAILBOX_SYNC);
+    keepTaskChild->requestFlagsSync(windows);
+    return Sequence(lo, hi);
+}
+
 bool ObtainSynchronizedMailboxTask::handleResponseCodeInsideState(const Imap::Responses::State *const resp)
 {
     if (dieIfInvalidMailbox())
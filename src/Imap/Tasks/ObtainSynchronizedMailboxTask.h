@@ -75,6 +75,7 @@ private:
 
     void syncUids(TreeItemMailbox *mailbox, const uint lowestUidToQuery=0);
     void syncFlags(TreeItemMailbox *mailbox);
+    Sequence flagsSyncViewport(TreeItemMailbox *mailbox, TreeItemMsgList *list);
     void saveSyncState(TreeItemMailbox *mailbox);
     void updateHighestKnownUid(TreeItemMailbox *mailbox, const TreeItemMsgList *list) const;
 
@@ -263,6 +263,14 @@ bool OpenConnectionTask::handleStateHelper(const Imap::Responses::State *const r
             loginCmd.clear();
             // The LOGIN command is finished
             if (resp->kind == OK) {
+                if (resp->respCode != CAPABILITIES && !model->accessParser(parser).capabilitiesFresh &&
+                        model->m_resumingSession && model->m_resumeParser == parser &&
+                        !model->m_lastAuthenticatedCapabilities.isEmpty()) {
+                    // We're reconnecting after a lost connection. The server is unlikely to have changed its capabilities in the
+                    // meanwhile, so let's save a roundtrip and reuse them.
+                    log("Reusing capabilities of the previous connection", Common::LOG_OTHER);
+                    model->updateCapabilities(parser, model->m_lastAuthenticatedCapabilities);
+                }
                 if (resp->respCode == CAPABILITIES || model->accessParser(parser).capabilitiesFresh) {
                     // Capabilities are already known
                     if (TROJITA_COMPRESS_DEFLATE && model->accessParser(parser).capabilities.contains(QLatin1String("COMPRESS=DEFLATE"))) {
@@ -395,6 +403,8 @@ bool OpenConnectionTask::checkCapabilitiesResult(const Responses::State *const r
 
 void OpenConnectionTask::onComplete()
 {
+    model->m_lastAuthenticatedCapabilities = model->accessParser(parser).capabilities;
+
     // Optionally issue the ID command
     if (model->accessParser(parser).capabilities.contains(QLatin1String("ID"))) {
         model->m_taskFactory->createIdTask(model, this);
@@ -34,8 +34,10 @@ namespace Mailbox
 {
 
 
-SortTask::SortTask(Model *model, const QModelIndex &mailbox, const QStringList &searchConditions, const QStringList &sortCriteria):
+SortTask::SortTask(Model *model, const QModelIndex &mailbox, const QStringList &searchConditions, const QStringList &sortCriteria,
+                   const uint windowOffset, const uint windowSize):
     ImapTask(model), mailboxIndex(mailbox), searchConditions(searchConditions), sortCriteria(sortCriteria),
+    m_windowOffset(windowOffset), m_windowSize(windowSize), m_resultCount(0),
     m_persistentSearch(false), m_firstUntaggedReceived(false), m_firstCommandCompleted(false)
 {
     conn = model->findTaskResponsibleFor(mailbox);
@@ -61,6 +63,27 @@ void SortTask::perform()
     Q_ASSERT(keepTask);
     keepTask->feelFreeToAbortCaller(this);
 
+    // RFC 5267 defines the PARTIAL return option as a part of the CONTEXT extensions
+    const QStringList &capabilities = model->accessParser(parser).capabilities;
+    if (m_windowSize && model->accessParser(parser).capabilitiesFresh &&
+            (sortCriteria.isEmpty() ?
+                 capabilities.contains(QLatin1String("ESEARCH")) && capabilities.contains(QLatin1String("CONTEXT=SEARCH")) :
+                 capabilities.contains(QLatin1String("ESORT")) && capabilities.contains(QLatin1String("CONTEXT=SORT")))) {
+        QStringList returnOptions;
+        returnOptions << QString::fromUtf8("PARTIAL %1:%2").arg(m_windowOffset + 1).arg(m_windowOffset + m_windowSize);
+        if (!m_windowOffset) {
+            // Only the first window keeps listening for the updates; the later ones are just filling the gaps
+            m_persistentSearch = true;
+            returnOptions << QLatin1String("COUNT") << QLatin1String("UPDATE");
+        }
+        if (sortCriteria.isEmpty())
+            sortTag = parser->uidESearch("utf-8", searchConditions, returnOptions);
+        else
+            sortTag = parser->uidESort(sortCriteria, "utf-8", searchConditions, returnOptions);
+        return;
+    }
+    m_windowSize = 0;
+
     if (sortCriteria.isEmpty()) {
         if (model->accessParser(parser).capabilitiesFresh &&
                 model->accessParser(parser).capabilities.contains(QLatin1String("ESEARCH"))) {
@@ -128,7 +151,10 @@ bool SortTask::handleStateHelper(const Imap::Responses::State *const resp)
     if (resp->tag == sortTag) {
         m_firstCommandCompleted = true;
         if (resp->kind == Responses::OK) {
-            emit sortingAvailable(sortResult);
+            if (m_windowSize)
+                emit sortingWindowAvailable(m_windowOffset, sortResult, m_resultCount);
+            else
+                emit sortingAvailable(sortResult);
             if (!m_persistentSearch || _aborted) {
                 // This is a one-shot operation, we shall not remain as an active task, listening for further updates
                 _completed();
@@ -209,6 +235,26 @@ bool SortTask::handleESearch(const Responses::ESearch *const resp)
 
     Q_ASSERT(allIterator == resp->listData.constEnd());
 
+    if (m_windowSize && resp->incrementalContextData.isEmpty()) {
+        m_firstUntaggedReceived = true;
+        sortResult.clear();
+        Q_FOREACH(const Responses::ESearch::PartialResult &partial, resp->partialData) {
+            if (partial.first != m_windowOffset + 1)
+                throw UnexpectedResponseReceived("ESEARCH PARTIAL returned a different window than requested", *resp);
+            sortResult += partial.uids;
+        }
+
+        Responses::ESearch::CompareListDataIdentifier<Responses::ESearch::ListData_t> countComparator("COUNT");
+        Responses::ESearch::ListData_t::const_iterator countIterator =
+                std::find_if(resp->listData.constBegin(), resp->listData.constEnd(), countComparator);
+        if (countIterator != resp->listData.constEnd()) {
+            if (countIterator->second.size() != 1)
+                throw UnexpectedResponseReceived("ESEARCH: malformed COUNT", *resp);
+            m_resultCount = countIterator->second.front();
+        }
+        return true;
+    }
+
     if (resp->incrementalContextData.isEmpty()) {
         sortResult.clear();
         // This means that there have been no matches
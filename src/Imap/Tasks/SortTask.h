@@ -31,12 +31,19 @@ namespace Imap
 namespace Mailbox
 {
 
-/** @short Send a SORT command and take care of its processing */
+/** @short Send a SORT command and take care of its processing
+
+When a non-zero @arg windowSize is passed and the server supports CONTEXT=SORT (or CONTEXT=SEARCH for a plain search), only
+the results between the @arg windowOffset and windowOffset + windowSize are requested through RFC 5267's PARTIAL and reported
+through sortingWindowAvailable().  Only the first window asks for the COUNT and for the updates.  Without the server's
+support, the whole result is requested as usual and reported through sortingAvailable().
+*/
 class SortTask : public ImapTask
 {
     Q_OBJECT
 public:
-    SortTask(Model *model, const QModelIndex &mailbox, const QStringList &searchConditions, const QStringList &sortCriteria);
+    SortTask(Model *model, const QModelIndex &mailbox, const QStringList &searchConditions, const QStringList &sortCriteria,
+             const uint windowOffset = 0, const uint windowSize = 0);
     virtual void perform();
     virtual void abort();
 
@@ -56,6 +63,13 @@ signals:
     /** @short Sort result has arrived */
     void sortingAvailable(const QList<uint> &uids);
 
+    /** @short A window of the sort result has arrived
+
+    The @arg uids start at the zero-based position @arg offset of the complete result.  The @arg total is the size of the
+    complete result as reported by the server, or zero if the server has not told us.
+    */
+    void sortingWindowAvailable(const uint offset, const QList<uint> &uids, const uint total);
+
     /** @short Sort operation has failed */
     void sortingFailed();
 
@@ -73,6 +87,13 @@ private:
     QStringList sortCriteria;
     QList<uint> sortResult;
 
+    /** @short The zero-based position of the first requested result */
+    uint m_windowOffset;
+    /** @short How many results to ask for, or zero for the complete result */
+    uint m_windowSize;
+    /** @short Size of the complete result according to the COUNT, or zero if not known */
+    uint m_resultCount;
+
     /** @short Are we supposed to run in a "persistent mode", ie. keep listening for updates? */
     bool m_persistentSearch;
 
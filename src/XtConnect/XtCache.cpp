@@ -73,6 +73,16 @@ void XtCache::setMailboxSyncState( const QString& mailbox, const Imap::Mailbox::
     _sqlCache->setMailboxSyncState( mailbox, state );
 }
 
+Imap::Mailbox::SyncState XtCache::mailboxStatus( const QString& mailbox ) const
+{
+    return _sqlCache->mailboxStatus( mailbox );
+}
+
+void XtCache::setMailboxStatus( const QString& mailbox, const Imap::Mailbox::SyncState& state )
+{
+    _sqlCache->setMailboxStatus( mailbox, state );
+}
+
 QList<uint> XtCache::uidMapping( const QString& mailbox ) const
 {
     return _sqlCache->uidMapping( mailbox );
@@ -112,6 +122,22 @@ void XtCache::setMsgFlags( const QString& mailbox, uint uid, const QStringList&
     Q_UNUSED(flags);
 }
 
+QList<uint> XtCache::uidsWithFlag( const QString& mailbox, const QString& flag, const bool present ) const
+{
+    Q_UNUSED(mailbox);
+    Q_UNUSED(flag);
+    Q_UNUSED(present);
+    return QList<uint>();
+}
+
+uint XtCache::countWithFlag( const QString& mailbox, const QString& flag, const bool present ) const
+{
+    Q_UNUSED(mailbox);
+    Q_UNUSED(flag);
+    Q_UNUSED(present);
+    return 0;
+}
+
 XtCache::MessageDataBundle XtCache::messageMetadata( const QString& mailbox, uint uid ) const
 {
     Q_UNUSED(mailbox);
@@ -126,6 +152,13 @@ void XtCache::setMessageMetadata( const QString& mailbox, uint uid, const Messag
     Q_UNUSED(metadata);
 }
 
+QHash<uint, XtCache::MessageDataBundle> XtCache::metadataOfMessages( const QString& mailbox, const QList<uint>& uids ) const
+{
+    Q_UNUSED(mailbox);
+    Q_UNUSED(uids);
+    return QHash<uint, MessageDataBundle>();
+}
+
 QByteArray XtCache::messagePart( const QString& mailbox, uint uid, const QString& partId ) const
 {
     Q_UNUSED(mailbox);
@@ -142,6 +175,25 @@ void XtCache::setMsgPart( const QString& mailbox, uint uid, const QString& partI
     Q_UNUSED(data);
 }
 
+void XtCache::setMsgPartText( const QString& mailbox, uint uid, const QString& partId, const QByteArray& data,
+                              const QString& charset, const QString& mimeType )
+{
+    Q_UNUSED(mailbox);
+    Q_UNUSED(uid);
+    Q_UNUSED(partId);
+    Q_UNUSED(data);
+    Q_UNUSED(charset);
+    Q_UNUSED(mimeType);
+}
+
+QList<uint> XtCache::fullTextSearch( const QString& mailbox, const QString& field, const QString& text ) const
+{
+    Q_UNUSED(mailbox);
+    Q_UNUSED(field);
+    Q_UNUSED(text);
+    return QList<uint>();
+}
+
 XtCache::SavingState XtCache::messageSavingStatus( const QString &mailbox, const uint uid ) const
 {
     QStringList flags = _sqlCache->msgFlags( mailbox, uid );
@@ -187,4 +239,20 @@ void XtCache::setRenewalThreshold(const int days)
     Q_UNUSED(days);
 }
 
+void XtCache::beginBatch()
+{
+    _sqlCache->beginBatch();
+}
+
+void XtCache::commitBatch()
+{
+    _sqlCache->commitBatch();
+}
+
+void XtCache::setCacheBudget( const qint64 maxBytes, const int maxDays )
+{
+    Q_UNUSED(maxBytes);
+    Q_UNUSED(maxDays);
+}
+
 }
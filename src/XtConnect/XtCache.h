@@ -68,6 +68,9 @@ public:
     virtual Imap::Mailbox::SyncState mailboxSyncState( const QString& mailbox ) const;
     virtual void setMailboxSyncState( const QString& mailbox, const Imap::Mailbox::SyncState& state );
 
+    virtual Imap::Mailbox::SyncState mailboxStatus( const QString& mailbox ) const;
+    virtual void setMailboxStatus( const QString& mailbox, const Imap::Mailbox::SyncState& state );
+
     virtual void setUidMapping( const QString& mailbox, const QList<uint>& seqToUid );
     virtual void clearUidMapping( const QString& mailbox );
     virtual QList<uint> uidMapping( const QString& mailbox ) const;
@@ -77,16 +80,26 @@ public:
 
     virtual MessageDataBundle messageMetadata( const QString& mailbox, uint uid ) const;
     virtual void setMessageMetadata( const QString& mailbox, uint uid, const MessageDataBundle& metadata );
+    virtual QHash<uint, MessageDataBundle> metadataOfMessages( const QString& mailbox, const QList<uint>& uids ) const;
 
     /** @short Do nothing */
     virtual QStringList msgFlags( const QString& mailbox, uint uid ) const;
     /** @short Returns no data */
     virtual void setMsgFlags( const QString& mailbox, uint uid, const QStringList& flags );
+    /** @short Returns an empty list, flags are not cached */
+    virtual QList<uint> uidsWithFlag( const QString& mailbox, const QString& flag, const bool present ) const;
+    /** @short Returns zero, flags are not cached */
+    virtual uint countWithFlag( const QString& mailbox, const QString& flag, const bool present ) const;
 
     /** @short ALways returns an empty QByteArray */
     virtual QByteArray messagePart( const QString& mailbox, uint uid, const QString& partId ) const;
     /** @short Do nothing */
     virtual void setMsgPart( const QString& mailbox, uint uid, const QString& partId, const QByteArray& data );
+    /** @short Do nothing */
+    virtual void setMsgPartText( const QString& mailbox, uint uid, const QString& partId, const QByteArray& data,
+                                 const QString& charset, const QString& mimeType );
+    /** @short Returns an empty list, nothing is indexed */
+    virtual QList<uint> fullTextSearch( const QString& mailbox, const QString& field, const QString& text ) const;
 
     /** @short Do nothing */
     virtual QVector<Imap::Responses::ThreadingNode> messageThreading(const QString &mailbox);
@@ -97,6 +110,10 @@ public:
     bool open();
 
     void setRenewalThreshold(const int days);
+    virtual void beginBatch();
+    virtual void commitBatch();
+    /** @short Do nothing, the data are needed until they get saved into the DB */
+    virtual void setCacheBudget( const qint64 maxBytes, const int maxDays );
 
     /** @short Saving status of a message */
     typedef enum {
@@ -187,7 +187,7 @@ void XtConnect::setupModels()
     }
 
     m_model = new Imap::Mailbox::Model(this, m_cache ? static_cast<Imap::Mailbox::AbstractCache*>(m_cache) :
-                                                       static_cast<Imap::Mailbox::AbstractCache*>(new Imap::Mailbox::MemoryCache(this)),
+                                                       static_cast<Imap::Mailbox::AbstractCache*>(createMemoryCache(this)),
                                        factory, taskFactory, m_settings->value(SettingsNames::imapStartOffline).toBool());
     m_model->setObjectName( QLatin1String("model") );
     // We want to wait longer to increase the potential of better grouping -- we don't care much about the latency
@@ -205,6 +205,14 @@ void XtConnect::setupModels()
     connect( m_model, SIGNAL(connectionStateChanged(QObject*,Imap::ConnectionState)), this, SLOT(showConnectionStatus(QObject*,Imap::ConnectionState)) );
 }
 
+Imap::Mailbox::MemoryCache *XtConnect::createMemoryCache(QObject *parent)
+{
+    Imap::Mailbox::MemoryCache *cache = new Imap::Mailbox::MemoryCache(parent);
+    // The limit is in megabytes; the message parts are not needed once they have been stored into the database
+    cache->setCacheBudget(m_settings->value(Common::SettingsNames::xtMemoryCacheLimit, 64).toLongLong() * 1024 * 1024, 0);
+    return cache;
+}
+
 void XtConnect::alertReceived(const QString &alert)
 {
     qCritical() << "ALERT: " << alert;
@@ -255,7 +263,7 @@ void XtConnect::cacheError(const QString &error)
     qCritical() << "Cache error: " << error;
     if ( m_model ) {
         m_cache = 0;
-        m_model->setCache(new Imap::Mailbox::MemoryCache(m_model));
+        m_model->setCache(createMemoryCache(m_model));
     }
 }
 
@@ -321,6 +329,11 @@ void XtConnect::slotDumpStats()
     Q_FOREACH( const QPointer<MailSynchronizer> item, m_syncers ) {
         item->debugStats();
     }
+    if ( Imap::Mailbox::MemoryCache *cache = qobject_cast<Imap::Mailbox::MemoryCache*>( m_model->cache() ) ) {
+        Imap::Mailbox::MemoryCache::Statistics stats = cache->statistics();
+        qDebug() << "Memory cache:" << stats.hits << "hits," << stats.misses << "misses," << stats.evictions << "evictions,"
+                 << stats.residentBytes << "bytes resident";
+    }
 }
 
 void XtConnect::slotSqlError(const QString &message)
@@ -36,6 +36,12 @@
 
 class QSettings;
 
+namespace Imap {
+namespace Mailbox {
+class MemoryCache;
+}
+}
+
 namespace XtConnect {
 
 class XtCache;
@@ -79,6 +85,8 @@ public slots:
 
 private:
     void setupModels();
+    /** @short Create an in-memory cache whose size is limited according to the settings */
+    Imap::Mailbox::MemoryCache *createMemoryCache(QObject *parent);
 
     Imap::Mailbox::Model *m_model;
     QSettings *m_settings;
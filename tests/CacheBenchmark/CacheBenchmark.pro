@@ -0,0 +1,19 @@
+QT += core network sql
+QT -= gui
+CONFIG += console
+DEPENDPATH += ../../src/
+INCLUDEPATH += ../../src/
+TEMPLATE = app
+TARGET = cache-benchmark
+
+trojita_libs = Imap Streams Common
+myprefix = ../../src/
+include(../../src/linking.pri)
+include(../../configh.pri)
+include(../../src/Streams/ZlibLinking.pri)
+
+SOURCES += main.cpp
+
+# the upper makefile really wants to call `make check` in here...
+check.target = check
+QMAKE_EXTRA_TARGETS += check
@@ -0,0 +1,389 @@
+/* Copyright (C) 2006 - 2013 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QFileInfo>
+#include <QStringList>
+#include <QTextStream>
+#include <QTime>
+#include "Imap/Model/PackPartCache.h"
+#include "Imap/Model/SQLCache.h"
+#include "Imap/Model/ThreadedCache.h"
+
+/** @short Measure the size and the throughput of the SQLCache
+
+Usage: cache-benchmark [--messages=N] [--mailboxes=N] [--lookups=N] [--searches=N] [--bodies] [--synchronous=OFF|NORMAL|FULL]
+    [--parts=N] [--sync=N] [--threads=N] [--keep]
+
+The database is created in a fresh directory below the system's temporary directory.  Each message gets a typical
+envelope, a serialized BODYSTRUCTURE and a few flags.  With --bodies, a short text body is added to the full-text index as
+well.  The insert phase writes the messages in batches of 100, like the synchronization does, and measures the time including
+the final commit and the indexing.  The lookup phase reopens the database and reads the metadata and flags of random
+messages; the scroll phase then reads the metadata of all messages in one mailbox in the order of their UIDs.  The search
+phase runs full-text queries for random words against random mailboxes.
+
+With --parts, big message parts are stored both in the PackPartCache and in the one-file-per-part layout which was used
+previously.  Every distinct attachment is present in four messages, as if it was forwarded or copied around.  The disk usage
+is compared, as well as the time it takes to read all parts back in a random order after the stores were reopened.
+
+With --sync, the metadata and flags of all messages are written through a ThreadedCache into an empty cache, the way a first
+synchronization of a mailbox does it.  This happens once with each write passed to the cache separately and once with the
+writes grouped into batches of N messages.  Both the time spent in the calling thread and the total time until the worker
+has written everything are reported.
+
+With --threads, the threading of a mailbox with N messages in threads of five is stored, then a single new arrival is added
+to one of the threads and the threading is stored again.  The time of the update and the time it takes to load the threading
+after the cache was reopened are reported.
+*/
+
+namespace {
+
+Imap::Mailbox::AbstractCache::MessageDataBundle fakeMessage(const uint uid)
+{
+    using namespace Imap::Message;
+    QList<MailAddress> from, to;
+    from << MailAddress(QString::fromUtf8("Sender %1").arg(uid % 97), QString(), QString::fromUtf8("sender%1").arg(uid % 97),
+                        QLatin1String("example.org"));
+    to << MailAddress(QLatin1String("Recipient"), QString(), QLatin1String("rcpt"), QLatin1String("example.net"));
+    Imap::Mailbox::AbstractCache::MessageDataBundle res;
+    res.uid = uid;
+    res.envelope = Envelope(QDateTime::currentDateTime(), QString::fromUtf8("Re: Benchmarking thread %1").arg(uid / 5),
+                            from, from, from, to, QList<MailAddress>(), QList<MailAddress>(), QList<QByteArray>(),
+                            "<" + QByteArray::number(uid) + "@benchmark.example.org>");
+    res.internalDate = QDateTime::currentDateTime();
+    res.size = 2000 + uid % 50000;
+    res.serializedBodyStructure = QByteArray(300, 'x');
+    res.hdrReferences << "<" + QByteArray::number(uid / 5) + "@benchmark.example.org>";
+    return res;
+}
+
+const char *vocabulary[] = {
+    "meeting", "report", "invoice", "schedule", "release", "review", "budget", "travel", "patch", "question",
+    "summary", "deadline", "customer", "contract", "server", "backup", "holiday", "agenda", "minutes", "draft"
+};
+const uint vocabularySize = sizeof(vocabulary) / sizeof(vocabulary[0]);
+
+QString fakeBody(const uint uid)
+{
+    QStringList words;
+    for (uint i = 0; i < 60; ++i)
+        words << QLatin1String(vocabulary[(uid * 7 + i * 13) % vocabularySize]);
+    words << QString::fromUtf8("ticket%1").arg(uid % 10000);
+    return words.join(QLatin1String(" "));
+}
+
+/** @short A big, moderately compressible attachment */
+QByteArray fakeAttachment(const uint seed)
+{
+    QByteArray res;
+    res.reserve(1200 * 1024);
+    quint32 state = seed * 2654435761u + 1;
+    while (res.size() < 1200 * 1024) {
+        state = state * 1103515245 + 12345;
+        res.append(QByteArray::number(state >> 8, 36)).append(' ');
+    }
+    return res;
+}
+
+qint64 directorySize(const QString &path)
+{
+    qint64 res = 0;
+    QDir dir(path);
+    Q_FOREACH(const QFileInfo &info, dir.entryInfoList(QDir::Files | QDir::Dirs | QDir::NoDotAndDotDot)) {
+        res += info.isDir() ? directorySize(info.filePath()) : info.size();
+    }
+    return res;
+}
+
+/** @short Store the messages through a ThreadedCache, grouping them into batches of the given size unless it is zero */
+void syncMessages(QTextStream &out, const QString &dir, const uint messages, const uint batchSize)
+{
+    QTime timer;
+    int callerTime = 0;
+    {
+        Imap::Mailbox::ThreadedCache cache(0, QLatin1String("benchmark-sync"), dir);
+        if (!cache.open())
+            return;
+        timer.start();
+        for (uint uid = 1; uid <= messages; ++uid) {
+            if (batchSize && uid % batchSize == 1)
+                cache.beginBatch();
+            cache.setMessageMetadata(QLatin1String("INBOX"), uid, fakeMessage(uid));
+            cache.setMsgFlags(QLatin1String("INBOX"), uid, QStringList() << QLatin1String("\\Seen"));
+            if (batchSize && (uid % batchSize == 0 || uid == messages))
+                cache.commitBatch();
+        }
+        callerTime = timer.elapsed();
+        // The destructor waits for the worker to finish
+    }
+    const int totalTime = timer.elapsed();
+    out << "sync:    " << messages << " messages " << (batchSize ? QString::fromUtf8("in batches of %1").arg(batchSize) :
+                                                         QString::fromUtf8("unbatched"))
+        << ", " << callerTime << " ms in the caller, " << totalTime << " ms total ("
+        << (totalTime ? qint64(messages) * 1000 / totalTime : 0) << " messages/s)" << endl;
+}
+
+/** @short Build the threading of @arg messages messages in threads of five, with the @arg extra UID appended to the first thread */
+QVector<Imap::Responses::ThreadingNode> fakeThreading(const uint messages, const uint extra)
+{
+    QVector<Imap::Responses::ThreadingNode> res;
+    for (uint root = 1; root <= messages; root += 5) {
+        Imap::Responses::ThreadingNode node(root);
+        for (uint uid = root + 1; uid < root + 5 && uid <= messages; ++uid)
+            node.children << Imap::Responses::ThreadingNode(uid);
+        res << node;
+    }
+    if (extra && !res.isEmpty())
+        res[0].children << Imap::Responses::ThreadingNode(extra);
+    return res;
+}
+
+void removeDirectory(const QString &path)
+{
+    QDir dir(path);
+    Q_FOREACH(const QFileInfo &info, dir.entryInfoList(QDir::Files | QDir::Dirs | QDir::NoDotAndDotDot)) {
+        if (info.isDir())
+            removeDirectory(info.filePath());
+        else
+            dir.remove(info.fileName());
+    }
+    QDir().rmdir(path);
+}
+
+qint64 databaseSize(const QString &fileName)
+{
+    // With the WAL journal, the not-yet-checkpointed data live in a separate file
+    return QFileInfo(fileName).size() + QFileInfo(fileName + QLatin1String("-wal")).size();
+}
+
+}
+
+int main(int argc, char **argv)
+{
+    QCoreApplication app(argc, argv);
+    QTextStream out(stdout);
+    QTextStream err(stderr);
+
+    uint messages = 500000, mailboxes = 5, lookups = 100000, searches = 100, parts = 0, syncBatch = 0, threads = 0;
+    QString synchronous;
+    bool keep = false, bodies = false;
+    QStringList args = app.arguments();
+    args.removeFirst();
+    Q_FOREACH(const QString &arg, args) {
+        const QString value = arg.section(QLatin1Char('='), 1);
+        if (arg.startsWith(QLatin1String("--messages="))) {
+            messages = value.toUInt();
+        } else if (arg.startsWith(QLatin1String("--mailboxes="))) {
+            mailboxes = qMax(1u, value.toUInt());
+        } else if (arg.startsWith(QLatin1String("--lookups="))) {
+            lookups = value.toUInt();
+        } else if (arg.startsWith(QLatin1String("--searches="))) {
+            searches = value.toUInt();
+        } else if (arg.startsWith(QLatin1String("--parts="))) {
+            parts = value.toUInt();
+        } else if (arg.startsWith(QLatin1String("--sync="))) {
+            syncBatch = value.toUInt();
+        } else if (arg.startsWith(QLatin1String("--threads="))) {
+            threads = value.toUInt();
+        } else if (arg == QLatin1String("--bodies")) {
+            bodies = true;
+        } else if (arg.startsWith(QLatin1String("--synchronous="))) {
+            synchronous = value;
+        } else if (arg == QLatin1String("--keep")) {
+            keep = true;
+        } else {
+            err << "Unrecognized argument " << arg << endl;
+            return 1;
+        }
+    }
+
+    const QString dir = QDir::tempPath() + QString::fromUtf8("/trojita-cache-benchmark-%1").arg(app.applicationPid());
+    QDir().mkpath(dir);
+    const QString fileName = dir + QLatin1String("/imap.cache.sqlite");
+
+    // SQLCache reads its configuration from the parent object's properties
+    QObject config;
+    if (!synchronous.isEmpty())
+        config.setProperty("trojita-sqlcache-synchronous", synchronous);
+
+    QTime timer;
+    {
+        Imap::Mailbox::SQLCache cache(&config);
+        if (!cache.open(QLatin1String("benchmark-insert"), fileName))
+            return 1;
+        timer.start();
+        const uint perMailbox = messages / mailboxes;
+        for (uint m = 0; m < mailboxes; ++m) {
+            const QString mailbox = QString::fromUtf8("INBOX/Folder %1").arg(m);
+            for (uint uid = 1; uid <= perMailbox; ++uid) {
+                if (uid % 100 == 1)
+                    cache.beginBatch();
+                cache.setMessageMetadata(mailbox, uid, fakeMessage(uid));
+                cache.setMsgFlags(mailbox, uid, QStringList() << QLatin1String("\\Seen") << QLatin1String("$Label1"));
+                if (bodies) {
+                    cache.setMsgPartText(mailbox, uid, QLatin1String("1"), fakeBody(uid).toUtf8(), QLatin1String("utf-8"),
+                                         QLatin1String("text/plain"));
+                }
+                if (uid % 100 == 0 || uid == perMailbox)
+                    cache.commitBatch();
+            }
+        }
+        // The destructor commits the transaction
+    }
+    const int insertTime = timer.elapsed();
+    out << "insert:  " << messages << " messages in " << insertTime << " ms ("
+        << (insertTime ? qint64(messages) * 1000 / insertTime : 0) << " messages/s)" << endl;
+    out << "size:    " << databaseSize(fileName) / 1024 << " kB" << endl;
+
+    {
+        Imap::Mailbox::SQLCache cache(&config);
+        if (!cache.open(QLatin1String("benchmark-lookup"), fileName))
+            return 1;
+        const uint perMailbox = messages / mailboxes;
+        qsrand(42);
+        timer.start();
+        uint found = 0;
+        for (uint i = 0; i < lookups && perMailbox; ++i) {
+            const QString mailbox = QString::fromUtf8("INBOX/Folder %1").arg(qrand() % mailboxes);
+            const uint uid = 1 + qrand() % perMailbox;
+            if (cache.messageMetadata(mailbox, uid).uid == uid && !cache.msgFlags(mailbox, uid).isEmpty())
+                ++found;
+        }
+        const int lookupTime = timer.elapsed();
+        out << "lookup:  " << found << "/" << lookups << " messages in " << lookupTime << " ms ("
+            << (lookupTime ? qint64(lookups) * 1000 / lookupTime : 0) << " lookups/s)" << endl;
+
+        timer.start();
+        for (uint uid = 1; uid <= perMailbox; ++uid)
+            cache.messageMetadata(QLatin1String("INBOX/Folder 0"), uid);
+        const int scrollTime = timer.elapsed();
+        out << "scroll:  " << perMailbox << " messages in " << scrollTime << " ms ("
+            << (scrollTime ? qint64(perMailbox) * 1000 / scrollTime : 0) << " messages/s)" << endl;
+
+        timer.start();
+        qint64 hits = 0;
+        int slowest = 0;
+        for (uint i = 0; i < searches; ++i) {
+            const QString mailbox = QString::fromUtf8("INBOX/Folder %1").arg(qrand() % mailboxes);
+            QTime single;
+            single.start();
+            if (bodies && i % 2) {
+                hits += cache.fullTextSearch(mailbox, QLatin1String("BODY"),
+                                             QString::fromUtf8("ticket%1").arg(qrand() % 10000)).size();
+            } else {
+                hits += cache.fullTextSearch(mailbox, QLatin1String("SUBJECT"),
+                                             QString::fromUtf8("thread %1").arg(qrand() % qMax(1u, perMailbox / 5))).size();
+            }
+            slowest = qMax(slowest, single.elapsed());
+        }
+        const int searchTime = timer.elapsed();
+        out << "search:  " << searches << " queries with " << hits << " hits in " << searchTime << " ms ("
+            << (searches ? searchTime / double(searches) : 0) << " ms/query, slowest " << slowest << " ms)" << endl;
+    }
+
+    if (parts) {
+        const QString legacyDir = dir + QLatin1String("/legacy");
+        const QString packDir = dir + QLatin1String("/packed");
+        const QString mailbox = QLatin1String("INBOX");
+        QDir().mkpath(legacyDir);
+        {
+            Imap::Mailbox::PackPartCache packs(0, QLatin1String("benchmark-packs"), packDir);
+            if (!packs.open())
+                return 1;
+            timer.start();
+            for (uint uid = 1; uid <= parts; ++uid)
+                packs.setMsgPart(mailbox, uid, QLatin1String("2"), fakeAttachment(uid / 4));
+            out << "packs:   " << parts << " parts stored in " << timer.elapsed() << " ms, "
+                << directorySize(packDir) / 1024 << " kB" << endl;
+
+            timer.start();
+            for (uint uid = 1; uid <= parts; ++uid) {
+                QFile file(QString::fromUtf8("%1/%2_2.cache").arg(legacyDir, QString::number(uid)));
+                if (file.open(QIODevice::WriteOnly))
+                    file.write(qCompress(fakeAttachment(uid / 4)));
+            }
+            out << "files:   " << parts << " parts stored in " << timer.elapsed() << " ms, "
+                << directorySize(legacyDir) / 1024 << " kB" << endl;
+        }
+
+        QList<uint> order;
+        for (uint uid = 1; uid <= parts; ++uid)
+            order.insert(qrand() % (order.size() + 1), uid);
+        {
+            Imap::Mailbox::PackPartCache packs(0, QLatin1String("benchmark-packs-read"), packDir);
+            if (!packs.open())
+                return 1;
+            timer.start();
+            qint64 bytes = 0;
+            Q_FOREACH(const uint uid, order)
+                bytes += packs.messagePart(mailbox, uid, QLatin1String("2")).size();
+            out << "packs:   " << bytes / 1024 << " kB read in " << timer.elapsed() << " ms" << endl;
+        }
+        timer.start();
+        qint64 bytes = 0;
+        Q_FOREACH(const uint uid, order) {
+            QFile file(QString::fromUtf8("%1/%2_2.cache").arg(legacyDir, QString::number(uid)));
+            if (file.open(QIODevice::ReadOnly))
+                bytes += qUncompress(file.readAll()).size();
+        }
+        out << "files:   " << bytes / 1024 << " kB read in " << timer.elapsed() << " ms" << endl;
+    }
+
+    if (syncBatch) {
+        const QString unbatchedDir = dir + QLatin1String("/sync-unbatched");
+        const QString batchedDir = dir + QLatin1String("/sync-batched");
+        QDir().mkpath(unbatchedDir);
+        QDir().mkpath(batchedDir);
+        syncMessages(out, unbatchedDir, messages, 0);
+        syncMessages(out, batchedDir, messages, syncBatch);
+    }
+
+    if (threads) {
+        const QString mailbox = QLatin1String("INBOX/Threads");
+        {
+            Imap::Mailbox::SQLCache cache(&config);
+            if (!cache.open(QLatin1String("benchmark-threads"), fileName))
+                return 1;
+            timer.start();
+            cache.setMessageThreading(mailbox, fakeThreading(threads, 0));
+            out << "threads: " << threads << " messages stored in " << timer.elapsed() << " ms" << endl;
+            const QVector<Imap::Responses::ThreadingNode> updated = fakeThreading(threads, threads + 1);
+            timer.start();
+            cache.setMessageThreading(mailbox, updated);
+            out << "threads: one new arrival stored in " << timer.elapsed() << " ms" << endl;
+        }
+        Imap::Mailbox::SQLCache cache(&config);
+        if (!cache.open(QLatin1String("benchmark-threads-read"), fileName))
+            return 1;
+        timer.start();
+        const int roots = cache.messageThreading(mailbox).size();
+        out << "threads: " << roots << " threads loaded in " << timer.elapsed() << " ms" << endl;
+    }
+
+    if (keep) {
+        out << "database kept at " << fileName << endl;
+    } else {
+        removeDirectory(dir);
+    }
+    return 0;
+}
@@ -0,0 +1,1049 @@
+/* Copyright (C) 2006 - 2013 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "FakeImapServer.h"
+#include <QHostAddress>
+#include <QRegExp>
+#include <QTcpSocket>
+#include <QTimer>
+
+namespace {
+
+QByteArray quoted(const QByteArray &str)
+{
+    QByteArray res = str;
+    res.replace('\\', "\\\\");
+    res.replace('"', "\\\"");
+    return '"' + res + '"';
+}
+
+QByteArray literal(const QByteArray &data)
+{
+    return '{' + QByteArray::number(data.size()) + "}\r\n" + data;
+}
+
+/** @short Format a sorted list of numbers as a compact sequence set */
+QByteArray compressSet(const QList<uint> &numbers)
+{
+    QByteArray res;
+    int i = 0;
+    while (i < numbers.size()) {
+        int j = i;
+        while (j + 1 < numbers.size() && numbers[j + 1] == numbers[j] + 1)
+            ++j;
+        if (!res.isEmpty())
+            res += ',';
+        res += QByteArray::number(numbers[i]);
+        if (j > i)
+            res += ':' + QByteArray::number(numbers[j]);
+        i = j + 1;
+    }
+    return res;
+}
+
+/** @short Strip the "Re:" and "Fwd:" prefixes as a very rough approximation of the RFC 5256 base subject */
+QString baseSubject(QString subject)
+{
+    static QRegExp prefix(QLatin1String("^\\s*(re|fwd?)\\s*:\\s*"), Qt::CaseInsensitive);
+    while (prefix.indexIn(subject) == 0)
+        subject = subject.mid(prefix.matchedLength());
+    return subject.toLower();
+}
+
+/** @short Comparator for the SORT command */
+class SortComparator
+{
+public:
+    SortComparator(const SyntheticMailbox *mailbox, const QList<QByteArray> &criteria): m_mailbox(mailbox)
+    {
+        bool reverse = false;
+        Q_FOREACH(const QByteArray &item, criteria) {
+            if (item == "REVERSE") {
+                reverse = true;
+                continue;
+            }
+            m_keys << qMakePair(item, reverse);
+            reverse = false;
+            if (item == "SUBJECT" && m_subjects.isEmpty()) {
+                m_subjects.resize(mailbox->exists());
+                for (uint i = 0; i < mailbox->exists(); ++i)
+                    m_subjects[i] = baseSubject(mailbox->subject(i + 1));
+            } else if (item == "FROM" && m_froms.isEmpty()) {
+                m_froms.resize(mailbox->exists());
+                for (uint i = 0; i < mailbox->exists(); ++i)
+                    m_froms[i] = mailbox->from(i + 1);
+            }
+        }
+    }
+
+    bool operator()(const uint a, const uint b) const
+    {
+        typedef QPair<QByteArray, bool> Key;
+        Q_FOREACH(const Key &key, m_keys) {
+            int cmp = 0;
+            if (key.first == "SUBJECT") {
+                cmp = m_subjects[a - 1].compare(m_subjects[b - 1]);
+            } else if (key.first == "FROM") {
+                cmp = m_froms[a - 1].compare(m_froms[b - 1]);
+            } else if (key.first == "SIZE") {
+                const uint sa = m_mailbox->size(a);
+                const uint sb = m_mailbox->size(b);
+                cmp = sa < sb ? -1 : (sa > sb ? 1 : 0);
+            } else {
+                // ARRIVAL and DATE are both monotonic with the sequence number; other keys are not supported
+                cmp = a < b ? -1 : (a > b ? 1 : 0);
+            }
+            if (key.second)
+                cmp = -cmp;
+            if (cmp)
+                return cmp < 0;
+        }
+        return a < b;
+    }
+
+private:
+    const SyntheticMailbox *m_mailbox;
+    QList<QPair<QByteArray, bool> > m_keys;
+    QVector<QString> m_subjects;
+    QVector<QString> m_froms;
+};
+
+}
+
+ServerConfig::ServerConfig():
+    latency(0), bandwidth(0), condstore(true), qresync(true), esearch(true), sort(true), thread(true)
+{
+    mailboxes << QLatin1String("INBOX");
+}
+
+bool ServerConfig::parseArguments(QStringList &args, QString &error)
+{
+    QStringList remaining;
+    Q_FOREACH(const QString &arg, args) {
+        if (!arg.startsWith(QLatin1String("--"))) {
+            remaining << arg;
+            continue;
+        }
+        const int eq = arg.indexOf(QLatin1Char('='));
+        const QString key = arg.mid(2, eq == -1 ? -1 : eq - 2);
+        const QString value = eq == -1 ? QString() : arg.mid(eq + 1);
+        bool ok = true;
+        if (key == QLatin1String("messages")) {
+            spec.messageCount = value.toUInt(&ok);
+        } else if (key == QLatin1String("mailboxes")) {
+            const uint count = value.toUInt(&ok);
+            mailboxes.clear();
+            mailboxes << QLatin1String("INBOX");
+            for (uint i = 1; i < count; ++i)
+                mailboxes << QString::fromUtf8("Folder%1").arg(i);
+        } else if (key == QLatin1String("thread-depth")) {
+            spec.threadDepth = value.toUInt(&ok);
+        } else if (key == QLatin1String("seen")) {
+            spec.seenPercent = value.toUInt(&ok);
+        } else if (key == QLatin1String("flagged")) {
+            spec.flaggedPercent = value.toUInt(&ok);
+        } else if (key == QLatin1String("attachments")) {
+            spec.attachmentPercent = value.toUInt(&ok);
+        } else if (key == QLatin1String("attachment-size")) {
+            spec.attachmentSize = value.toUInt(&ok);
+        } else if (key == QLatin1String("body-size")) {
+            spec.bodySize = value.toUInt(&ok);
+        } else if (key == QLatin1String("latency")) {
+            latency = value.toInt(&ok);
+        } else if (key == QLatin1String("bandwidth")) {
+            bandwidth = value.toInt(&ok);
+        } else if (key == QLatin1String("user")) {
+            user = value;
+        } else if (key == QLatin1String("password")) {
+            password = value;
+        } else if (key == QLatin1String("no-condstore")) {
+            condstore = false;
+            qresync = false;
+        } else if (key == QLatin1String("no-qresync")) {
+            qresync = false;
+        } else if (key == QLatin1String("no-esearch")) {
+            esearch = false;
+        } else if (key == QLatin1String("no-sort")) {
+            sort = false;
+        } else if (key == QLatin1String("no-thread")) {
+            thread = false;
+        } else {
+            error = QString::fromUtf8("Unrecognized option %1").arg(arg);
+            return false;
+        }
+        if (!ok) {
+            error = QString::fromUtf8("Invalid value for %1").arg(arg);
+            return false;
+        }
+    }
+    args = remaining;
+    return true;
+}
+
+QString ServerConfig::usage()
+{
+    return QString::fromUtf8(
+                "  --messages=N          number of messages in each mailbox (default 1000)\n"
+                "  --mailboxes=N         number of mailboxes, including the INBOX (default 1)\n"
+                "  --thread-depth=N      number of messages in each thread (default 1)\n"
+                "  --seen=PERCENT        percentage of \\Seen messages (default 90)\n"
+                "  --flagged=PERCENT     percentage of \\Flagged messages (default 5)\n"
+                "  --attachments=PERCENT percentage of messages with an attachment (default 10)\n"
+                "  --attachment-size=N   size of each attachment in bytes (default 51200)\n"
+                "  --body-size=N         size of the text body in bytes (default 2000)\n"
+                "  --latency=MS          delay of each response in milliseconds (default 0)\n"
+                "  --bandwidth=BPS       simulated link speed in bytes per second (default unlimited)\n"
+                "  --user=NAME           required user name (default: accept anything)\n"
+                "  --password=PASS       required password\n"
+                "  --no-condstore        do not advertise CONDSTORE (implies --no-qresync)\n"
+                "  --no-qresync          do not advertise QRESYNC\n"
+                "  --no-esearch          do not advertise ESEARCH\n"
+                "  --no-sort             do not advertise SORT\n"
+                "  --no-thread           do not advertise THREAD\n");
+}
+
+FakeImapServer::FakeImapServer(QObject *parent, const ServerConfig &config): QTcpServer(parent), m_config(config)
+{
+    Q_FOREACH(const QString &name, config.mailboxes) {
+        m_mailboxes[name] = new SyntheticMailbox(name, config.spec);
+    }
+    connect(this, SIGNAL(newConnection()), this, SLOT(slotNewConnection()));
+}
+
+FakeImapServer::~FakeImapServer()
+{
+    qDeleteAll(m_mailboxes);
+}
+
+SyntheticMailbox *FakeImapServer::mailbox(const QString &name) const
+{
+    if (name.toUpper() == QLatin1String("INBOX"))
+        return m_mailboxes.value(QLatin1String("INBOX"));
+    return m_mailboxes.value(name);
+}
+
+void FakeImapServer::slotNewConnection()
+{
+    while (QTcpSocket *socket = nextPendingConnection()) {
+        new FakeImapSession(this, socket);
+    }
+}
+
+FakeImapSession::FakeImapSession(FakeImapServer *server, QTcpSocket *socket):
+    QObject(socket), m_server(server), m_socket(socket), m_literalRemaining(0), m_linkFreeAt(0),
+    m_authenticated(false), m_selected(0), m_readOnly(false), m_qresyncEnabled(false), m_condstoreActive(false),
+    m_loggingOut(false)
+{
+    m_flushTimer = new QTimer(this);
+    m_flushTimer->setSingleShot(true);
+    connect(m_flushTimer, SIGNAL(timeout()), this, SLOT(slotFlush()));
+    connect(socket, SIGNAL(readyRead()), this, SLOT(slotReadyRead()));
+    connect(socket, SIGNAL(disconnected()), socket, SLOT(deleteLater()));
+    m_clock.start();
+
+    send("* OK [CAPABILITY " + capabilities() + "] Fake IMAP server ready\r\n");
+    commit();
+}
+
+QByteArray FakeImapSession::capabilities() const
+{
+    const ServerConfig &config = m_server->config();
+    QByteArray res = "IMAP4rev1 LITERAL+ IDLE UIDPLUS ENABLE ID NAMESPACE UNSELECT";
+    if (config.condstore)
+        res += " CONDSTORE";
+    if (config.qresync)
+        res += " QRESYNC";
+    if (config.esearch)
+        res += " ESEARCH";
+    if (config.sort)
+        res += " SORT";
+    if (config.thread)
+        res += " THREAD=REFERENCES THREAD=ORDEREDSUBJECT";
+    return res;
+}
+
+void FakeImapSession::send(const QByteArray &data)
+{
+    m_pending += data;
+}
+
+void FakeImapSession::commit()
+{
+    if (m_pending.isEmpty())
+        return;
+
+    const ServerConfig &config = m_server->config();
+    const int now = m_clock.elapsed();
+    // The link is modelled as a single pipe: a response cannot start before the previous one has been fully transmitted
+    const int start = qMax(now + config.latency, m_linkFreeAt);
+    const int transfer = config.bandwidth > 0 ? static_cast<int>(qint64(m_pending.size()) * 1000 / config.bandwidth) : 0;
+    m_linkFreeAt = start + transfer;
+    m_output << qMakePair(m_linkFreeAt, m_pending);
+    m_pending.clear();
+    if (!m_flushTimer->isActive())
+        m_flushTimer->start(qMax(0, m_output.first().first - now));
+}
+
+void FakeImapSession::slotFlush()
+{
+    if (!m_socket)
+        return;
+
+    const int now = m_clock.elapsed();
+    while (!m_output.isEmpty() && m_output.first().first <= now) {
+        m_socket->write(m_output.takeFirst().second);
+    }
+    if (!m_output.isEmpty()) {
+        m_flushTimer->start(m_output.first().first - now);
+    } else if (m_loggingOut) {
+        m_socket->disconnectFromHost();
+    }
+}
+
+void FakeImapSession::sendTagged(const QByteArray &tag, const QByteArray &status, const QByteArray &text)
+{
+    send(tag + ' ' + status + ' ' + text + "\r\n");
+    commit();
+}
+
+void FakeImapSession::slotReadyRead()
+{
+    m_input += m_socket->readAll();
+    static QRegExp literalMarker(QLatin1String("\\{(\\d+)(\\+?)\\}$"));
+
+    while (true) {
+        if (m_literalRemaining) {
+            if (m_input.size() < m_literalRemaining)
+                return;
+            // Literals are only used for strings in this server, so it is safe to convert them to a quoted form
+            m_command += quoted(m_input.left(m_literalRemaining));
+            m_input = m_input.mid(m_literalRemaining);
+            m_literalRemaining = 0;
+            continue;
+        }
+
+        const int pos = m_input.indexOf('\n');
+        if (pos == -1)
+            return;
+        QByteArray line = m_input.left(pos);
+        m_input = m_input.mid(pos + 1);
+        if (line.endsWith('\r'))
+            line.chop(1);
+
+        if (literalMarker.indexIn(QString::fromUtf8(line)) != -1) {
+            m_command += line.left(literalMarker.pos(0));
+            m_literalRemaining = literalMarker.cap(1).toInt();
+            if (literalMarker.cap(2).isEmpty()) {
+                send("+ Ready for literal data\r\n");
+                commit();
+            }
+            if (m_literalRemaining)
+                continue;
+            m_command += "\"\"";
+            continue;
+        }
+
+        m_command += line;
+        handleCommand(m_command);
+        m_command.clear();
+    }
+}
+
+FakeImapSession::Tokens FakeImapSession::tokenize(const QByteArray &line) const
+{
+    Tokens res;
+    int i = 0;
+    while (i < line.size()) {
+        const char c = line[i];
+        if (c == ' ') {
+            ++i;
+        } else if (c == '(') {
+            res << Token(Token::OPEN, "(");
+            ++i;
+        } else if (c == ')') {
+            res << Token(Token::CLOSE, ")");
+            ++i;
+        } else if (c == '"') {
+            QByteArray value;
+            ++i;
+            while (i < line.size() && line[i] != '"') {
+                if (line[i] == '\\' && i + 1 < line.size())
+                    ++i;
+                value += line[i];
+                ++i;
+            }
+            ++i;
+            res << Token(Token::STRING, value);
+        } else {
+            // An atom; the section specifiers like BODY.PEEK[HEADER.FIELDS (From)] are kept together
+            const int start = i;
+            int depth = 0;
+            while (i < line.size()) {
+                const char ch = line[i];
+                if (ch == '[')
+                    ++depth;
+                else if (ch == ']')
+                    --depth;
+                else if (depth == 0 && (ch == ' ' || ch == '(' || ch == ')'))
+                    break;
+                ++i;
+            }
+            res << Token(Token::ATOM, line.mid(start, i - start));
+        }
+    }
+    return res;
+}
+
+void FakeImapSession::handleCommand(const QByteArray &line)
+{
+    if (!m_idleTag.isEmpty()) {
+        if (line.toUpper() == "DONE") {
+            sendTagged(m_idleTag, "OK", "IDLE terminated");
+            m_idleTag.clear();
+        } else {
+            send("* BAD Expected DONE\r\n");
+            commit();
+        }
+        return;
+    }
+
+    const Tokens tokens = tokenize(line);
+    if (tokens.size() < 2) {
+        send("* BAD Malformed command\r\n");
+        commit();
+        return;
+    }
+
+    const QByteArray tag = tokens[0].value;
+    QByteArray command = tokens[1].value.toUpper();
+    Tokens args = tokens.mid(2);
+    bool useUids = false;
+    if (command == "UID" && !args.isEmpty()) {
+        useUids = true;
+        command = args.takeFirst().value.toUpper();
+    }
+
+    if (command == "CAPABILITY") {
+        send("* CAPABILITY " + capabilities() + "\r\n");
+        sendTagged(tag, "OK", "CAPABILITY completed");
+        return;
+    } else if (command == "NOOP") {
+        sendTagged(tag, "OK", "NOOP completed");
+        return;
+    } else if (command == "LOGOUT") {
+        send("* BYE See you\r\n");
+        m_loggingOut = true;
+        sendTagged(tag, "OK", "LOGOUT completed");
+        return;
+    } else if (command == "ID") {
+        send("* ID (\"name\" \"FakeImapServer\")\r\n");
+        sendTagged(tag, "OK", "ID completed");
+        return;
+    } else if (command == "LOGIN") {
+        cmdLogin(tag, args);
+        return;
+    }
+
+    if (!m_authenticated) {
+        sendTagged(tag, "BAD", "Not authenticated");
+        return;
+    }
+
+    if (command == "ENABLE") {
+        QByteArray enabled;
+        Q_FOREACH(const Token &token, args) {
+            const QByteArray item = token.value.toUpper();
+            if (item == "QRESYNC" && m_server->config().qresync) {
+                m_qresyncEnabled = true;
+                m_condstoreActive = true;
+                enabled += " QRESYNC";
+            } else if (item == "CONDSTORE" && m_server->config().condstore) {
+                m_condstoreActive = true;
+                enabled += " CONDSTORE";
+            }
+        }
+        send("* ENABLED" + enabled + "\r\n");
+        sendTagged(tag, "OK", "ENABLE completed");
+    } else if (command == "NAMESPACE") {
+        send("* NAMESPACE ((\"\" \"/\")) NIL NIL\r\n");
+        sendTagged(tag, "OK", "NAMESPACE completed");
+    } else if (command == "LIST" || command == "LSUB") {
+        cmdList(tag, args, command);
+    } else if (command == "STATUS") {
+        cmdStatus(tag, args);
+    } else if (command == "SELECT" || command == "EXAMINE") {
+        cmdSelect(tag, args, command == "EXAMINE");
+    } else if (command == "IDLE") {
+        m_idleTag = tag;
+        send("+ idling\r\n");
+        commit();
+    } else if (!m_selected) {
+        sendTagged(tag, "BAD", "No mailbox selected");
+    } else if (command == "UNSELECT" || command == "CLOSE") {
+        m_selected = 0;
+        sendTagged(tag, "OK", "Mailbox closed");
+    } else if (command == "EXPUNGE") {
+        // Messages are never removed from the generated mailboxes
+        sendTagged(tag, "OK", "EXPUNGE completed");
+    } else if (command == "FETCH") {
+        cmdFetch(tag, args, useUids);
+    } else if (command == "STORE") {
+        cmdStore(tag, args, useUids);
+    } else if (command == "SEARCH") {
+        cmdSearch(tag, args, useUids);
+    } else if (command == "SORT") {
+        cmdSort(tag, args, useUids);
+    } else if (command == "THREAD") {
+        cmdThread(tag, args, useUids);
+    } else {
+        sendTagged(tag, "BAD", "Unsupported command");
+    }
+}
+
+void FakeImapSession::cmdLogin(const QByteArray &tag, const Tokens &args)
+{
+    if (args.size() != 2) {
+        sendTagged(tag, "BAD", "LOGIN expects two arguments");
+        return;
+    }
+    const ServerConfig &config = m_server->config();
+    if (!config.user.isEmpty() &&
+            (QString::fromUtf8(args[0].value) != config.user || QString::fromUtf8(args[1].value) != config.password)) {
+        sendTagged(tag, "NO", "[AUTHENTICATIONFAILED] Invalid credentials");
+        return;
+    }
+    m_authenticated = true;
+    sendTagged(tag, "OK", "[CAPABILITY " + capabilities() + "] Logged in");
+}
+
+void FakeImapSession::cmdList(const QByteArray &tag, const Tokens &args, const QByteArray &command)
+{
+    if (args.size() < 2) {
+        sendTagged(tag, "BAD", "Missing arguments");
+        return;
+    }
+    const QString pattern = QString::fromUtf8(args[0].value + args[1].value);
+    if (pattern.isEmpty()) {
+        send("* " + command + " (\\Noselect) \"/\" \"\"\r\n");
+    } else {
+        QString re = QRegExp::escape(pattern);
+        re.replace(QLatin1String("\\*"), QLatin1String(".*"));
+        re.replace(QLatin1Char('%'), QLatin1String("[^/]*"));
+        QRegExp matcher(re);
+        Q_FOREACH(const SyntheticMailbox *mailbox, m_server->mailboxes()) {
+            if (matcher.exactMatch(mailbox->name()))
+                send("* " + command + " (\\HasNoChildren) \"/\" " + quoted(mailbox->name().toUtf8()) + "\r\n");
+        }
+    }
+    sendTagged(tag, "OK", command + " completed");
+}
+
+void FakeImapSession::cmdStatus(const QByteArray &tag, const Tokens &args)
+{
+    SyntheticMailbox *mailbox = args.isEmpty() ? 0 : m_server->mailbox(QString::fromUtf8(args[0].value));
+    if (!mailbox) {
+        sendTagged(tag, "NO", "No such mailbox");
+        return;
+    }
+    QList<QByteArray> items;
+    for (int i = 1; i < args.size(); ++i) {
+        if (args[i].kind != Token::ATOM)
+            continue;
+        const QByteArray item = args[i].value.toUpper();
+        if (item == "MESSAGES")
+            items << "MESSAGES " + QByteArray::number(mailbox->exists());
+        else if (item == "RECENT")
+            items << "RECENT 0";
+        else if (item == "UIDNEXT")
+            items << "UIDNEXT " + QByteArray::number(mailbox->uidNext());
+        else if (item == "UIDVALIDITY")
+            items << "UIDVALIDITY " + QByteArray::number(mailbox->uidValidity());
+        else if (item == "UNSEEN")
+            items << "UNSEEN " + QByteArray::number(mailbox->unseen());
+        else if (item == "HIGHESTMODSEQ" && m_server->config().condstore)
+            items << "HIGHESTMODSEQ " + QByteArray::number(mailbox->highestModSeq());
+    }
+    QByteArray joined;
+    Q_FOREACH(const QByteArray &item, items) {
+        if (!joined.isEmpty())
+            joined += ' ';
+        joined += item;
+    }
+    send("* STATUS " + quoted(mailbox->name().toUtf8()) + " (" + joined + ")\r\n");
+    sendTagged(tag, "OK", "STATUS completed");
+}
+
+void FakeImapSession::cmdSelect(const QByteArray &tag, const Tokens &args, const bool readOnly)
+{
+    SyntheticMailbox *mailbox = args.isEmpty() ? 0 : m_server->mailbox(QString::fromUtf8(args[0].value));
+    m_selected = 0;
+    if (!mailbox) {
+        sendTagged(tag, "NO", "No such mailbox");
+        return;
+    }
+
+    const ServerConfig &config = m_server->config();
+    quint64 knownModSeq = 0;
+    bool resync = false;
+    for (int i = 1; i < args.size(); ++i) {
+        const QByteArray item = args[i].value.toUpper();
+        if (item == "CONDSTORE" && config.condstore) {
+            m_condstoreActive = true;
+        } else if (item == "QRESYNC" && m_qresyncEnabled && i + 3 < args.size()) {
+            // QRESYNC (uidvalidity modseq [known-uids ...])
+            if (args[i + 2].value.toUInt() == mailbox->uidValidity()) {
+                resync = true;
+                knownModSeq = args[i + 3].value.toULongLong();
+            }
+        }
+    }
+
+    m_selected = mailbox;
+    m_readOnly = readOnly;
+    send("* FLAGS (\\Answered \\Flagged \\Deleted \\Seen \\Draft)\r\n");
+    send("* OK [PERMANENTFLAGS (\\Answered \\Flagged \\Deleted \\Seen)] Flags permitted\r\n");
+    send("* " + QByteArray::number(mailbox->exists()) + " EXISTS\r\n");
+    send("* 0 RECENT\r\n");
+    send("* OK [UIDVALIDITY " + QByteArray::number(mailbox->uidValidity()) + "] UIDs valid\r\n");
+    send("* OK [UIDNEXT " + QByteArray::number(mailbox->uidNext()) + "] Predicted next UID\r\n");
+    if (const uint firstUnseen = mailbox->firstUnseen())
+        send("* OK [UNSEEN " + QByteArray::number(firstUnseen) + "] First unseen\r\n");
+    if (config.condstore)
+        send("* OK [HIGHESTMODSEQ " + QByteArray::number(mailbox->highestModSeq()) + "] Highest\r\n");
+    if (resync) {
+        // Nothing ever gets expunged, so there is never a VANISHED (EARLIER) to report
+        for (uint seq = 1; seq <= mailbox->exists(); ++seq) {
+            if (mailbox->modSeq(seq) > knownModSeq) {
+                send("* " + QByteArray::number(seq) + " FETCH (UID " + QByteArray::number(seq) + " FLAGS " + mailbox->flags(seq) +
+                     " MODSEQ (" + QByteArray::number(mailbox->modSeq(seq)) + "))\r\n");
+            }
+        }
+    }
+    sendTagged(tag, "OK", readOnly ? "[READ-ONLY] EXAMINE completed" : "[READ-WRITE] SELECT completed");
+}
+
+QList<uint> FakeImapSession::parseSet(const QByteArray &set, const bool useUids) const
+{
+    // UIDs are the same as sequence numbers, so the only difference is that out-of-range UIDs are silently ignored
+    Q_UNUSED(useUids);
+    QList<uint> res;
+    const uint max = m_selected->exists();
+    Q_FOREACH(const QByteArray &item, set.split(',')) {
+        const int colon = item.indexOf(':');
+        const QByteArray loStr = colon == -1 ? item : item.left(colon);
+        const QByteArray hiStr = colon == -1 ? item : item.mid(colon + 1);
+        uint lo = loStr == "*" ? max : loStr.toUInt();
+        uint hi = hiStr == "*" ? max : hiStr.toUInt();
+        if (lo > hi)
+            qSwap(lo, hi);
+        lo = qMax(lo, 1u);
+        hi = qMin(hi, max);
+        for (uint i = lo; i <= hi; ++i)
+            res << i;
+    }
+    return res;
+}
+
+bool FakeImapSession::inSet(const QByteArray &set, const uint value) const
+{
+    const uint max = m_selected->exists();
+    Q_FOREACH(const QByteArray &item, set.split(',')) {
+        const int colon = item.indexOf(':');
+        const QByteArray loStr = colon == -1 ? item : item.left(colon);
+        const QByteArray hiStr = colon == -1 ? item : item.mid(colon + 1);
+        uint lo = loStr == "*" ? max : loStr.toUInt();
+        uint hi = hiStr == "*" ? max : hiStr.toUInt();
+        if (lo > hi)
+            qSwap(lo, hi);
+        if (value >= lo && value <= hi)
+            return true;
+    }
+    return false;
+}
+
+QByteArray FakeImapSession::fetchItem(const uint seq, const QByteArray &item) const
+{
+    const QByteArray upper = item.toUpper();
+    if (upper == "UID")
+        return "UID " + QByteArray::number(seq);
+    if (upper == "FLAGS")
+        return "FLAGS " + m_selected->flags(seq);
+    if (upper == "RFC822.SIZE")
+        return "RFC822.SIZE " + QByteArray::number(m_selected->size(seq));
+    if (upper == "ENVELOPE")
+        return "ENVELOPE " + m_selected->envelope(seq);
+    if (upper == "BODYSTRUCTURE" || upper == "BODY")
+        return upper + ' ' + m_selected->bodyStructure(seq);
+    if (upper == "INTERNALDATE")
+        return "INTERNALDATE " + quoted(m_selected->internalDate(seq));
+    if (upper == "MODSEQ")
+        return "MODSEQ (" + QByteArray::number(m_selected->modSeq(seq)) + ')';
+    if (upper == "RFC822.HEADER")
+        return "RFC822.HEADER " + literal(m_selected->headers(seq));
+
+    if (upper.startsWith("BODY[") || upper.startsWith("BODY.PEEK[")) {
+        // BODY[] is treated like BODY.PEEK[], i.e. the \Seen flag is never set implicitly
+        const int open = item.indexOf('[');
+        const int close = item.lastIndexOf(']');
+        const QByteArray section = item.mid(open + 1, close - open - 1);
+        const QByteArray upperSection = section.toUpper();
+        QByteArray data;
+        if (upperSection.startsWith("HEADER.FIELDS")) {
+            const bool negate = upperSection.startsWith("HEADER.FIELDS.NOT");
+            const int listStart = section.indexOf('(');
+            const int listEnd = section.lastIndexOf(')');
+            QList<QByteArray> names;
+            Q_FOREACH(const QByteArray &name, section.mid(listStart + 1, listEnd - listStart - 1).split(' ')) {
+                if (!name.isEmpty())
+                    names << name.toLower();
+            }
+            bool keep = false;
+            Q_FOREACH(const QByteArray &headerLine, m_selected->headers(seq).split('\n')) {
+                const QByteArray trimmed = headerLine.endsWith('\r') ? headerLine.left(headerLine.size() - 1) : headerLine;
+                if (trimmed.isEmpty())
+                    continue;
+                if (trimmed[0] != ' ' && trimmed[0] != '\t') {
+                    const QByteArray name = trimmed.left(trimmed.indexOf(':')).toLower();
+                    keep = names.contains(name) != negate;
+                }
+                if (keep)
+                    data += trimmed + "\r\n";
+            }
+            data += "\r\n";
+        } else {
+            data = m_selected->part(seq, section);
+        }
+
+        QByteArray name = "BODY[" + section + ']';
+        const int partialStart = item.indexOf('<', close);
+        if (partialStart != -1) {
+            const QList<QByteArray> range = item.mid(partialStart + 1, item.size() - partialStart - 2).split('.');
+            const int offset = range[0].toInt();
+            data = data.mid(offset, range.size() > 1 ? range[1].toInt() : -1);
+            name += '<' + QByteArray::number(offset) + '>';
+        }
+        return name + ' ' + literal(data);
+    }
+
+    return QByteArray();
+}
+
+void FakeImapSession::cmdFetch(const QByteArray &tag, const Tokens &args, const bool useUids)
+{
+    if (args.size() < 2) {
+        sendTagged(tag, "BAD", "FETCH expects arguments");
+        return;
+    }
+
+    const QList<uint> messages = parseSet(args[0].value, useUids);
+    QList<QByteArray> items;
+    int i = 1;
+    if (args[i].kind == Token::OPEN) {
+        ++i;
+        while (i < args.size() && args[i].kind != Token::CLOSE)
+            items << args[i++].value;
+        ++i;
+    } else {
+        items << args[i++].value;
+    }
+
+    QList<QByteArray> expanded;
+    Q_FOREACH(const QByteArray &item, items) {
+        const QByteArray upper = item.toUpper();
+        if (upper == "ALL" || upper == "FAST" || upper == "FULL") {
+            expanded << "FLAGS" << "INTERNALDATE" << "RFC822.SIZE";
+            if (upper != "FAST")
+                expanded << "ENVELOPE";
+            if (upper == "FULL")
+                expanded << "BODY";
+        } else {
+            expanded << item;
+        }
+    }
+
+    quint64 changedSince = 0;
+    for (; i < args.size(); ++i) {
+        if (args[i].value.toUpper() == "CHANGEDSINCE" && i + 1 < args.size())
+            changedSince = args[i + 1].value.toULongLong();
+    }
+
+    bool hasUid = false, hasModSeq = false;
+    Q_FOREACH(const QByteArray &item, expanded) {
+        if (item.toUpper() == "UID")
+            hasUid = true;
+        else if (item.toUpper() == "MODSEQ")
+            hasModSeq = true;
+    }
+    if (useUids && !hasUid)
+        expanded.prepend("UID");
+    if ((m_condstoreActive || changedSince) && !hasModSeq)
+        expanded << "MODSEQ";
+
+    Q_FOREACH(const uint seq, messages) {
+        if (changedSince && m_selected->modSeq(seq) <= changedSince)
+            continue;
+        QByteArray line = "* " + QByteArray::number(seq) + " FETCH (";
+        bool first = true;
+        Q_FOREACH(const QByteArray &item, expanded) {
+            const QByteArray data = fetchItem(seq, item);
+            if (data.isEmpty())
+                continue;
+            if (!first)
+                line += ' ';
+            line += data;
+            first = false;
+        }
+        send(line + ")\r\n");
+    }
+    sendTagged(tag, "OK", "FETCH completed");
+}
+
+void FakeImapSession::cmdStore(const QByteArray &tag, const Tokens &args, const bool useUids)
+{
+    if (args.size() < 3) {
+        sendTagged(tag, "BAD", "STORE expects arguments");
+        return;
+    }
+    if (m_readOnly) {
+        sendTagged(tag, "NO", "Mailbox is read-only");
+        return;
+    }
+
+    const QByteArray item = args[1].value.toUpper();
+    const char mode = item.startsWith('+') ? '+' : (item.startsWith('-') ? '-' : '=');
+    const bool silent = item.endsWith(".SILENT");
+    QStringList flags;
+    for (int i = 2; i < args.size(); ++i) {
+        if (args[i].kind == Token::ATOM)
+            flags << QString::fromUtf8(args[i].value);
+    }
+
+    Q_FOREACH(const uint seq, parseSet(args[0].value, useUids)) {
+        m_selected->storeFlags(seq, flags, mode);
+        if (silent && !m_condstoreActive)
+            continue;
+        QByteArray line = "* " + QByteArray::number(seq) + " FETCH (";
+        if (useUids)
+            line += "UID " + QByteArray::number(seq) + ' ';
+        line += "FLAGS " + m_selected->flags(seq);
+        if (m_condstoreActive)
+            line += " MODSEQ (" + QByteArray::number(m_selected->modSeq(seq)) + ')';
+        send(line + ")\r\n");
+    }
+    sendTagged(tag, "OK", "STORE completed");
+}
+
+bool FakeImapSession::matches(const Tokens &criteria, int &pos, const uint seq) const
+{
+    if (pos >= criteria.size())
+        return true;
+
+    const Token &token = criteria[pos++];
+    if (token.kind == Token::OPEN) {
+        bool res = true;
+        while (pos < criteria.size() && criteria[pos].kind != Token::CLOSE) {
+            // All keys have to be consumed even when the result is already known
+            if (!matches(criteria, pos, seq))
+                res = false;
+        }
+        ++pos;
+        return res;
+    }
+
+    const QByteArray key = token.value.toUpper();
+    const QByteArray flags = m_selected->flags(seq);
+    if (key == "ALL" || key == "OLD")
+        return true;
+    if (key == "RECENT")
+        return false;
+    if (key == "SEEN")
+        return flags.contains("\\Seen");
+    if (key == "UNSEEN" || key == "NEW")
+        return !flags.contains("\\Seen");
+    if (key == "FLAGGED")
+        return flags.contains("\\Flagged");
+    if (key == "UNFLAGGED")
+        return !flags.contains("\\Flagged");
+    if (key == "ANSWERED")
+        return flags.contains("\\Answered");
+    if (key == "UNANSWERED")
+        return !flags.contains("\\Answered");
+    if (key == "DELETED")
+        return flags.contains("\\Deleted");
+    if (key == "UNDELETED")
+        return !flags.contains("\\Deleted");
+    if (key == "NOT")
+        return !matches(criteria, pos, seq);
+    if (key == "OR") {
+        const bool a = matches(criteria, pos, seq);
+        const bool b = matches(criteria, pos, seq);
+        return a || b;
+    }
+
+    if (!key.isEmpty() && (QChar::fromLatin1(key[0]).isDigit() || key[0] == '*'))
+        return inSet(key, seq);
+
+    if (pos >= criteria.size())
+        return false;
+    const QByteArray arg = criteria[pos++].value;
+    if (key == "UID")
+        return inSet(arg, seq);
+    if (key == "SUBJECT")
+        return m_selected->subject(seq).contains(QString::fromUtf8(arg), Qt::CaseInsensitive);
+    if (key == "FROM")
+        return m_selected->from(seq).contains(QString::fromUtf8(arg), Qt::CaseInsensitive);
+    if (key == "TO" || key == "CC" || key == "BCC")
+        return QString::fromUtf8(m_selected->headers(seq)).contains(QString::fromUtf8(arg), Qt::CaseInsensitive);
+    if (key == "BODY")
+        return QString::fromUtf8(m_selected->part(seq, "1")).contains(QString::fromUtf8(arg), Qt::CaseInsensitive);
+    if (key == "TEXT") {
+        const QString needle = QString::fromUtf8(arg);
+        return m_selected->subject(seq).contains(needle, Qt::CaseInsensitive) ||
+                m_selected->from(seq).contains(needle, Qt::CaseInsensitive) ||
+                QString::fromUtf8(m_selected->part(seq, "1")).contains(needle, Qt::CaseInsensitive);
+    }
+    if (key == "LARGER")
+        return m_selected->size(seq) > arg.toUInt();
+    if (key == "SMALLER")
+        return m_selected->size(seq) < arg.toUInt();
+    if (key == "MODSEQ")
+        return m_selected->modSeq(seq) >= arg.toULongLong();
+    if (key == "KEYWORD")
+        return false;
+    if (key == "UNKEYWORD")
+        return true;
+    if (key == "SINCE" || key == "BEFORE" || key == "ON" || key == "SENTSINCE" || key == "SENTBEFORE" || key == "SENTON")
+        // Date-based criteria are accepted but not evaluated
+        return true;
+
+    // Unknown keys are assumed to take no argument and to match everything
+    --pos;
+    return true;
+}
+
+QList<uint> FakeImapSession::search(const Tokens &criteria, int pos) const
+{
+    if (pos + 1 < criteria.size() && criteria[pos].value.toUpper() == "CHARSET")
+        pos += 2;
+
+    QList<uint> res;
+    for (uint seq = 1; seq <= m_selected->exists(); ++seq) {
+        int p = pos;
+        bool ok = true;
+        while (ok && p < criteria.size())
+            ok = matches(criteria, p, seq);
+        if (ok)
+            res << seq;
+    }
+    return res;
+}
+
+void FakeImapSession::cmdSearch(const QByteArray &tag, const Tokens &args, const bool useUids)
+{
+    int pos = 0;
+    bool esearch = false;
+    QList<QByteArray> options;
+    if (!args.isEmpty() && args[0].value.toUpper() == "RETURN") {
+        if (!m_server->config().esearch) {
+            sendTagged(tag, "BAD", "ESEARCH is disabled");
+            return;
+        }
+        esearch = true;
+        pos = 2;
+        while (pos < args.size() && args[pos].kind != Token::CLOSE)
+            options << args[pos++].value.toUpper();
+        ++pos;
+        if (options.isEmpty())
+            options << "ALL";
+    }
+
+    const QList<uint> result = search(args, pos);
+    if (esearch) {
+        QByteArray line = "* ESEARCH (TAG " + quoted(tag) + ')';
+        if (useUids)
+            line += " UID";
+        Q_FOREACH(const QByteArray &option, options) {
+            if (option == "COUNT")
+                line += " COUNT " + QByteArray::number(result.size());
+            else if (result.isEmpty())
+                continue;
+            else if (option == "MIN")
+                line += " MIN " + QByteArray::number(result.first());
+            else if (option == "MAX")
+                line += " MAX " + QByteArray::number(result.last());
+            else if (option == "ALL")
+                line += " ALL " + compressSet(result);
+        }
+        send(line + "\r\n");
+    } else {
+        QByteArray line = "* SEARCH";
+        Q_FOREACH(const uint seq, result)
+            line += ' ' + QByteArray::number(seq);
+        send(line + "\r\n");
+    }
+    sendTagged(tag, "OK", "SEARCH completed");
+}
+
+void FakeImapSession::cmdSort(const QByteArray &tag, const Tokens &args, const bool useUids)
+{
+    Q_UNUSED(useUids);
+    if (!m_server->config().sort) {
+        sendTagged(tag, "BAD", "SORT is disabled");
+        return;
+    }
+    if (args.isEmpty() || args[0].kind != Token::OPEN) {
+        sendTagged(tag, "BAD", "Expected sort criteria");
+        return;
+    }
+
+    QList<QByteArray> criteria;
+    int pos = 1;
+    while (pos < args.size() && args[pos].kind != Token::CLOSE)
+        criteria << args[pos++].value.toUpper();
+    // Skip the closing paren and the mandatory charset
+    pos += 2;
+
+    QList<uint> result = search(args, pos);
+    qStableSort(result.begin(), result.end(), SortComparator(m_selected, criteria));
+
+    QByteArray line = "* SORT";
+    Q_FOREACH(const uint seq, result)
+        line += ' ' + QByteArray::number(seq);
+    send(line + "\r\n");
+    sendTagged(tag, "OK", "SORT completed");
+}
+
+void FakeImapSession::cmdThread(const QByteArray &tag, const Tokens &args, const bool useUids)
+{
+    if (!m_server->config().thread) {
+        sendTagged(tag, "BAD", "THREAD is disabled");
+        return;
+    }
+    if (args.size() < 2) {
+        sendTagged(tag, "BAD", "Expected threading algorithm and charset");
+        return;
+    }
+    // Both REFERENCES and ORDEREDSUBJECT yield the same result for the generated threads
+    const QList<uint> matching = search(args, 2);
+    send("* THREAD " + m_selected->threadResponse(matching, useUids) + "\r\n");
+    sendTagged(tag, "OK", "THREAD completed");
+}
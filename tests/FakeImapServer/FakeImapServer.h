@@ -0,0 +1,172 @@
+/* Copyright (C) 2006 - 2013 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef FAKEIMAPSERVER_FAKEIMAPSERVER_H
+#define FAKEIMAPSERVER_FAKEIMAPSERVER_H
+
+#include <QList>
+#include <QMap>
+#include <QPair>
+#include <QPointer>
+#include <QTcpServer>
+#include <QTime>
+#include "SyntheticMailbox.h"
+
+class QTcpSocket;
+class QTimer;
+
+/** @short Configuration of the FakeImapServer */
+struct ServerConfig
+{
+    GeneratorSpec spec;
+    /** @short Names of the top-level mailboxes; each of them gets generated according to the spec */
+    QStringList mailboxes;
+    /** @short One-way delay added to each response, in milliseconds */
+    int latency;
+    /** @short Simulated link speed in bytes per second; zero means unlimited */
+    int bandwidth;
+    bool condstore;
+    bool qresync;
+    bool esearch;
+    bool sort;
+    bool thread;
+    QString user;
+    QString password;
+
+    ServerConfig();
+
+    /** @short Parse the generator spec and the toggles from command-line arguments like --messages=1000 or --no-qresync
+
+    Returns false and fills the @arg error if some of the arguments is not recognized.  Arguments which do not start with two
+    dashes are left in the @arg args for the caller.
+    */
+    bool parseArguments(QStringList &args, QString &error);
+
+    /** @short Human-readable description of the supported arguments */
+    static QString usage();
+};
+
+class FakeImapServer;
+
+/** @short One client connected to the FakeImapServer
+
+This is by no means a complete or correct IMAP server.  It implements just enough of RFC 3501 and of the extensions which
+Trojita makes use of so that the real Model can be tested against mailboxes of arbitrary size.  Each complete response to a
+command is delayed according to the configured latency and bandwidth.
+*/
+class FakeImapSession : public QObject
+{
+    Q_OBJECT
+public:
+    FakeImapSession(FakeImapServer *server, QTcpSocket *socket);
+
+private slots:
+    void slotReadyRead();
+    void slotFlush();
+
+private:
+    /** @short A single token of a command */
+    struct Token {
+        typedef enum {ATOM, STRING, OPEN, CLOSE} Kind;
+        Kind kind;
+        QByteArray value;
+        Token(const Kind kind, const QByteArray &value): kind(kind), value(value) {}
+    };
+    typedef QList<Token> Tokens;
+
+    void handleCommand(const QByteArray &line);
+    Tokens tokenize(const QByteArray &line) const;
+
+    void cmdLogin(const QByteArray &tag, const Tokens &args);
+    void cmdList(const QByteArray &tag, const Tokens &args, const QByteArray &command);
+    void cmdStatus(const QByteArray &tag, const Tokens &args);
+    void cmdSelect(const QByteArray &tag, const Tokens &args, const bool readOnly);
+    void cmdFetch(const QByteArray &tag, const Tokens &args, const bool useUids);
+    void cmdStore(const QByteArray &tag, const Tokens &args, const bool useUids);
+    void cmdSearch(const QByteArray &tag, const Tokens &args, const bool useUids);
+    void cmdSort(const QByteArray &tag, const Tokens &args, const bool useUids);
+    void cmdThread(const QByteArray &tag, const Tokens &args, const bool useUids);
+
+    /** @short Convert a sequence set like 1:3,7,10:* into a list of sequence numbers */
+    QList<uint> parseSet(const QByteArray &set, const bool useUids) const;
+    /** @short Evaluate search criteria starting at @arg pos against a message */
+    bool matches(const Tokens &criteria, int &pos, const uint seq) const;
+    QList<uint> search(const Tokens &criteria, int pos) const;
+    /** @short Check whether the @arg value is contained in a sequence set without expanding it */
+    bool inSet(const QByteArray &set, const uint value) const;
+    QByteArray fetchItem(const uint seq, const QByteArray &item) const;
+
+    /** @short Append data to the response which is being built */
+    void send(const QByteArray &data);
+    /** @short Schedule the current response for delivery, subject to the simulated latency and bandwidth */
+    void commit();
+    void sendTagged(const QByteArray &tag, const QByteArray &status, const QByteArray &text);
+    QByteArray capabilities() const;
+
+    FakeImapServer *m_server;
+    QPointer<QTcpSocket> m_socket;
+    QByteArray m_input;
+    /** @short The command which is being assembled from lines and literals */
+    QByteArray m_command;
+    int m_literalRemaining;
+    /** @short Pending output along with the time (as in m_clock) when it shall be written */
+    QList<QPair<int, QByteArray> > m_output;
+    QByteArray m_pending;
+    QTimer *m_flushTimer;
+    QTime m_clock;
+    /** @short Time when the simulated link becomes free again */
+    int m_linkFreeAt;
+
+    bool m_authenticated;
+    SyntheticMailbox *m_selected;
+    bool m_readOnly;
+    bool m_qresyncEnabled;
+    /** @short Whether to include MODSEQ in each FETCH response */
+    bool m_condstoreActive;
+    bool m_loggingOut;
+    QByteArray m_idleTag;
+};
+
+/** @short A local IMAP server which serves generated mailboxes
+
+See ServerConfig for the supported options.  The server listens on the loopback interface only.
+*/
+class FakeImapServer : public QTcpServer
+{
+    Q_OBJECT
+public:
+    FakeImapServer(QObject *parent, const ServerConfig &config);
+    virtual ~FakeImapServer();
+
+    const ServerConfig &config() const { return m_config; }
+    SyntheticMailbox *mailbox(const QString &name) const;
+    QList<SyntheticMailbox *> mailboxes() const { return m_mailboxes.values(); }
+
+private slots:
+    void slotNewConnection();
+
+private:
+    ServerConfig m_config;
+    QMap<QString, SyntheticMailbox *> m_mailboxes;
+};
+
+#endif // FAKEIMAPSERVER_FAKEIMAPSERVER_H
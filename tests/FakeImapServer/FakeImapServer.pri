@@ -0,0 +1,7 @@
+# Shared by the standalone server and by the benchmark which embeds it
+INCLUDEPATH += $$PWD
+DEPENDPATH += $$PWD
+HEADERS += $$PWD/FakeImapServer.h \
+    $$PWD/SyntheticMailbox.h
+SOURCES += $$PWD/FakeImapServer.cpp \
+    $$PWD/SyntheticMailbox.cpp
@@ -0,0 +1,12 @@
+QT += core network
+QT -= gui
+CONFIG += console
+TEMPLATE = app
+TARGET = fake-imap-server
+
+include(FakeImapServer.pri)
+SOURCES += main.cpp
+
+# the upper makefile really wants to call `make check` in here...
+check.target = check
+QMAKE_EXTRA_TARGETS += check
@@ -0,0 +1,346 @@
+/* Copyright (C) 2006 - 2013 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "SyntheticMailbox.h"
+#include <QDateTime>
+#include <QHash>
+#include <QLocale>
+
+namespace {
+
+/** @short A cheap, deterministic hash which decides about the random-looking properties of each message */
+uint mix(uint x, const uint salt)
+{
+    x ^= salt * 0x9e3779b9u;
+    x ^= x >> 16;
+    x *= 0x85ebca6bu;
+    x ^= x >> 13;
+    x *= 0xc2b2ae35u;
+    x ^= x >> 16;
+    return x;
+}
+
+QByteArray quoted(const QString &str)
+{
+    QByteArray res = str.toUtf8();
+    res.replace('\\', "\\\\");
+    res.replace('"', "\\\"");
+    return '"' + res + '"';
+}
+
+QByteArray address(const QString &name, const QString &mailbox, const QString &host)
+{
+    return "((" + quoted(name) + " NIL " + quoted(mailbox) + " " + quoted(host) + "))";
+}
+
+const char boundary[] = "=_synthetic_boundary_=";
+
+/** @short Length of a base64-encoded blob of @arg size bytes, including the CRLFs after each line */
+uint base64WrappedSize(const uint size)
+{
+    const uint encoded = (size + 2) / 3 * 4;
+    const uint lines = (encoded + 75) / 76;
+    return encoded + 2 * lines;
+}
+
+}
+
+GeneratorSpec::GeneratorSpec():
+    messageCount(1000), threadDepth(1), seenPercent(90), flaggedPercent(5), attachmentPercent(10), attachmentSize(50 * 1024),
+    bodySize(2000)
+{
+}
+
+SyntheticMailbox::SyntheticMailbox(const QString &name, const GeneratorSpec &spec):
+    m_name(name), m_spec(spec), m_highestModSeq(1)
+{
+    if (!m_spec.threadDepth)
+        m_spec.threadDepth = 1;
+    const uint salt = qHash(name);
+    m_flags.resize(spec.messageCount);
+    m_modSeq.fill(1, spec.messageCount);
+    for (uint i = 0; i < spec.messageCount; ++i) {
+        const uint seed = mix(i + 1, salt);
+        quint8 flags = 0;
+        if (seed % 100 < spec.seenPercent)
+            flags |= FLAG_SEEN;
+        if ((seed / 100) % 100 < spec.flaggedPercent)
+            flags |= FLAG_FLAGGED;
+        if ((seed / 10000) % 100 < spec.seenPercent / 4)
+            flags |= FLAG_ANSWERED;
+        m_flags[i] = flags;
+    }
+}
+
+uint SyntheticMailbox::unseen() const
+{
+    uint res = 0;
+    for (int i = 0; i < m_flags.size(); ++i) {
+        if (!(m_flags[i] & FLAG_SEEN))
+            ++res;
+    }
+    return res;
+}
+
+uint SyntheticMailbox::firstUnseen() const
+{
+    for (int i = 0; i < m_flags.size(); ++i) {
+        if (!(m_flags[i] & FLAG_SEEN))
+            return i + 1;
+    }
+    return 0;
+}
+
+QByteArray SyntheticMailbox::flags(const uint seq) const
+{
+    const quint8 flags = m_flags[seq - 1];
+    QList<QByteArray> res;
+    if (flags & FLAG_SEEN)
+        res << "\\Seen";
+    if (flags & FLAG_FLAGGED)
+        res << "\\Flagged";
+    if (flags & FLAG_ANSWERED)
+        res << "\\Answered";
+    if (flags & FLAG_DELETED)
+        res << "\\Deleted";
+    QByteArray out = "(";
+    for (int i = 0; i < res.size(); ++i) {
+        if (i)
+            out += ' ';
+        out += res[i];
+    }
+    return out + ')';
+}
+
+void SyntheticMailbox::storeFlags(const uint seq, const QStringList &flags, const char mode)
+{
+    quint8 mask = 0;
+    Q_FOREACH(const QString &flag, flags) {
+        const QString lower = flag.toLower();
+        if (lower == QLatin1String("\\seen"))
+            mask |= FLAG_SEEN;
+        else if (lower == QLatin1String("\\flagged"))
+            mask |= FLAG_FLAGGED;
+        else if (lower == QLatin1String("\\answered"))
+            mask |= FLAG_ANSWERED;
+        else if (lower == QLatin1String("\\deleted"))
+            mask |= FLAG_DELETED;
+        // Keywords are silently ignored; the PERMANENTFLAGS tell the client about that
+    }
+
+    quint8 &current = m_flags[seq - 1];
+    switch (mode) {
+    case '+':
+        current |= mask;
+        break;
+    case '-':
+        current &= ~mask;
+        break;
+    default:
+        current = mask;
+    }
+    m_modSeq[seq - 1] = ++m_highestModSeq;
+}
+
+QString SyntheticMailbox::subject(const uint seq) const
+{
+    const uint thread = (seq - 1) / m_spec.threadDepth;
+    const bool isReply = (seq - 1) % m_spec.threadDepth;
+    return QString::fromUtf8("%1Thread %2 in %3").arg(isReply ? QLatin1String("Re: ") : QLatin1String(""),
+                                                      QString::number(thread), m_name);
+}
+
+QString SyntheticMailbox::from(const uint seq) const
+{
+    return QString::fromUtf8("user%1").arg(QString::number(mix(seq, 7) % 50));
+}
+
+bool SyntheticMailbox::hasAttachment(const uint seq) const
+{
+    return m_spec.attachmentSize && mix(seq, 13) % 100 < m_spec.attachmentPercent;
+}
+
+uint SyntheticMailbox::threadRoot(const uint seq) const
+{
+    return (seq - 1) / m_spec.threadDepth * m_spec.threadDepth + 1;
+}
+
+QByteArray SyntheticMailbox::internalDate(const uint seq) const
+{
+    QDateTime date(QDate(2013, 1, 1), QTime(0, 0), Qt::UTC);
+    return QLocale::c().toString(date.addSecs(seq * 60), QLatin1String("dd-MMM-yyyy hh:mm:ss")).toUtf8() + " +0000";
+}
+
+QByteArray SyntheticMailbox::envelope(const uint seq) const
+{
+    QDateTime date(QDate(2013, 1, 1), QTime(0, 0), Qt::UTC);
+    const QByteArray dateStr = QLocale::c().toString(date.addSecs(seq * 60), QLatin1String("ddd, dd MMM yyyy hh:mm:ss")).toUtf8()
+            + " +0000";
+    const QString user = from(seq);
+    const QByteArray fromAddr = address(user, user, QLatin1String("example.org"));
+    const QByteArray toAddr = address(QLatin1String("Fake Recipient"), QLatin1String("rcpt"), QLatin1String("example.org"));
+    const QByteArray inReplyTo = seq == threadRoot(seq) ?
+                QByteArray("NIL") : QByteArray("\"<") + QByteArray::number(seq - 1) + "@synthetic.example.org>\"";
+    return "(" + quoted(QString::fromUtf8(dateStr)) + " " + quoted(subject(seq)) + " " + fromAddr + " " + fromAddr + " " +
+            fromAddr + " " + toAddr + " NIL NIL " + inReplyTo + " \"<" + QByteArray::number(seq) + "@synthetic.example.org>\")";
+}
+
+QByteArray SyntheticMailbox::text(const uint seq) const
+{
+    static const QByteArray filler("The quick brown fox jumps over the lazy dog. ");
+    QByteArray res;
+    res.reserve(m_spec.bodySize + 80);
+    res += "This is message " + QByteArray::number(seq) + ".\r\n";
+    QByteArray line;
+    while (static_cast<uint>(res.size()) < m_spec.bodySize) {
+        line += filler;
+        if (line.size() > 70) {
+            res += line.trimmed() + "\r\n";
+            line.clear();
+        }
+    }
+    return res;
+}
+
+QByteArray SyntheticMailbox::attachment(const uint seq) const
+{
+    QByteArray raw(m_spec.attachmentSize, '\0');
+    for (uint i = 0; i < m_spec.attachmentSize; ++i)
+        raw[i] = static_cast<char>((seq + i * 31) & 0xff);
+    return raw;
+}
+
+QByteArray SyntheticMailbox::bodyStructure(const uint seq) const
+{
+    const QByteArray body = text(seq);
+    const QByteArray textPart = "(\"text\" \"plain\" (\"charset\" \"us-ascii\") NIL NIL \"7bit\" " +
+            QByteArray::number(body.size()) + " " + QByteArray::number(body.count('\n')) + ")";
+    if (!hasAttachment(seq))
+        return textPart;
+
+    return "(" + textPart + "(\"application\" \"octet-stream\" (\"name\" \"file-" + QByteArray::number(seq) +
+            ".bin\") NIL NIL \"base64\" " + QByteArray::number(base64WrappedSize(m_spec.attachmentSize)) + ") \"mixed\")";
+}
+
+QByteArray SyntheticMailbox::headers(const uint seq) const
+{
+    QByteArray res;
+    const QString user = from(seq);
+    QDateTime date(QDate(2013, 1, 1), QTime(0, 0), Qt::UTC);
+    res += "Date: " + QLocale::c().toString(date.addSecs(seq * 60), QLatin1String("ddd, dd MMM yyyy hh:mm:ss")).toUtf8() +
+            " +0000\r\n";
+    res += "From: " + user.toUtf8() + " <" + user.toUtf8() + "@example.org>\r\n";
+    res += "To: Fake Recipient <rcpt@example.org>\r\n";
+    res += "Subject: " + subject(seq).toUtf8() + "\r\n";
+    res += "Message-ID: <" + QByteArray::number(seq) + "@synthetic.example.org>\r\n";
+    if (seq != threadRoot(seq)) {
+        res += "In-Reply-To: <" + QByteArray::number(seq - 1) + "@synthetic.example.org>\r\n";
+        res += "References:";
+        for (uint i = threadRoot(seq); i < seq; ++i)
+            res += " <" + QByteArray::number(i) + "@synthetic.example.org>";
+        res += "\r\n";
+    }
+    res += "MIME-Version: 1.0\r\n";
+    if (hasAttachment(seq))
+        res += QByteArray("Content-Type: multipart/mixed; boundary=\"") + boundary + "\"\r\n";
+    else
+        res += "Content-Type: text/plain; charset=us-ascii\r\n";
+    res += "\r\n";
+    return res;
+}
+
+uint SyntheticMailbox::size(const uint seq) const
+{
+    if (!hasAttachment(seq))
+        return headers(seq).size() + text(seq).size();
+    // Avoid generating the attachment just to find out its size
+    return headers(seq).size() + multipartBody(seq, QByteArray()).size() + base64WrappedSize(m_spec.attachmentSize);
+}
+
+QByteArray SyntheticMailbox::multipartBody(const uint seq, const QByteArray &encodedAttachment) const
+{
+    return QByteArray("--") + boundary + "\r\n" + part(seq, "1.MIME") + text(seq) + "\r\n--" + boundary + "\r\n" +
+            part(seq, "2.MIME") + encodedAttachment + "\r\n--" + boundary + "--\r\n";
+}
+
+QByteArray SyntheticMailbox::part(const uint seq, const QByteArray &partId) const
+{
+    const QByteArray id = partId.toUpper();
+    if (id == "HEADER")
+        return headers(seq);
+
+    if (!hasAttachment(seq)) {
+        if (id.isEmpty())
+            return headers(seq) + text(seq);
+        if (id == "TEXT" || id == "1")
+            return text(seq);
+        return QByteArray();
+    }
+
+    if (id == "1")
+        return text(seq);
+    if (id == "1.MIME")
+        return "Content-Type: text/plain; charset=us-ascii\r\n\r\n";
+    if (id == "2.MIME")
+        return "Content-Type: application/octet-stream; name=\"file-" + QByteArray::number(seq) +
+                ".bin\"\r\nContent-Transfer-Encoding: base64\r\n\r\n";
+
+    QByteArray encoded = attachment(seq).toBase64();
+    QByteArray wrapped;
+    wrapped.reserve(base64WrappedSize(m_spec.attachmentSize));
+    for (int i = 0; i < encoded.size(); i += 76)
+        wrapped += encoded.mid(i, 76) + "\r\n";
+    if (id == "2")
+        return wrapped;
+
+    const QByteArray body = multipartBody(seq, wrapped);
+    if (id == "TEXT")
+        return body;
+    if (id.isEmpty())
+        return headers(seq) + body;
+    return QByteArray();
+}
+
+QByteArray SyntheticMailbox::threadResponse(const QList<uint> &matching, const bool useUids) const
+{
+    // UIDs are the same as sequence numbers in this mailbox
+    Q_UNUSED(useUids);
+
+    // All messages in a thread form a linear chain, so the output is trivial to construct
+    QByteArray res;
+    uint currentRoot = 0;
+    Q_FOREACH(const uint seq, matching) {
+        const uint root = threadRoot(seq);
+        if (root != currentRoot) {
+            if (currentRoot)
+                res += ')';
+            res += '(';
+            currentRoot = root;
+        } else {
+            res += ' ';
+        }
+        res += QByteArray::number(seq);
+    }
+    if (currentRoot)
+        res += ')';
+    return res;
+}
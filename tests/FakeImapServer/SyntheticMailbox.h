@@ -0,0 +1,114 @@
+/* Copyright (C) 2006 - 2013 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef FAKEIMAPSERVER_SYNTHETICMAILBOX_H
+#define FAKEIMAPSERVER_SYNTHETICMAILBOX_H
+
+#include <QByteArray>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+/** @short Parameters of the generated mailboxes */
+struct GeneratorSpec
+{
+    /** @short Number of messages in each mailbox */
+    uint messageCount;
+    /** @short Number of messages in each thread; 1 means no threading at all */
+    uint threadDepth;
+    /** @short Percentage of messages which are marked as \\Seen */
+    uint seenPercent;
+    /** @short Percentage of messages which are marked as \\Flagged */
+    uint flaggedPercent;
+    /** @short Percentage of messages which carry an attachment */
+    uint attachmentPercent;
+    /** @short Size of each attachment in bytes */
+    uint attachmentSize;
+    /** @short Size of the text/plain body in bytes */
+    uint bodySize;
+
+    GeneratorSpec();
+};
+
+/** @short A mailbox whose messages are generated on the fly
+
+Only the flags and the MODSEQ of each message are actually stored; everything else is computed from the message's position and
+the GeneratorSpec.  This keeps the memory usage reasonable even for mailboxes with millions of messages.
+
+The UID of a message is always its one-based sequence number, and the UIDVALIDITY never changes.
+*/
+class SyntheticMailbox
+{
+public:
+    typedef enum {
+        FLAG_SEEN = 1,
+        FLAG_FLAGGED = 2,
+        FLAG_ANSWERED = 4,
+        FLAG_DELETED = 8
+    } Flag;
+
+    SyntheticMailbox(const QString &name, const GeneratorSpec &spec);
+
+    QString name() const { return m_name; }
+    uint exists() const { return m_flags.size(); }
+    uint uidValidity() const { return 1; }
+    uint uidNext() const { return exists() + 1; }
+    quint64 highestModSeq() const { return m_highestModSeq; }
+    uint unseen() const;
+    /** @short Sequence number of the first unseen message, or zero */
+    uint firstUnseen() const;
+
+    QByteArray flags(const uint seq) const;
+    quint64 modSeq(const uint seq) const { return m_modSeq[seq - 1]; }
+    /** @short Change flags of the message; @arg mode is '+', '-' or anything else for a replace */
+    void storeFlags(const uint seq, const QStringList &flags, const char mode);
+
+    QByteArray envelope(const uint seq) const;
+    QByteArray bodyStructure(const uint seq) const;
+    QByteArray internalDate(const uint seq) const;
+    uint size(const uint seq) const;
+    QByteArray headers(const uint seq) const;
+    /** @short Return the text of a MIME part, or the full message for an empty partId */
+    QByteArray part(const uint seq, const QByteArray &partId) const;
+
+    QString subject(const uint seq) const;
+    QString from(const uint seq) const;
+    bool hasAttachment(const uint seq) const;
+
+    /** @short The thread root of each message as a sequence number */
+    uint threadRoot(const uint seq) const;
+    /** @short Build the THREAD response for the messages in @arg matching (sequence numbers) */
+    QByteArray threadResponse(const QList<uint> &matching, const bool useUids) const;
+
+private:
+    QByteArray text(const uint seq) const;
+    QByteArray attachment(const uint seq) const;
+    QByteArray multipartBody(const uint seq, const QByteArray &encodedAttachment) const;
+
+    QString m_name;
+    GeneratorSpec m_spec;
+    QVector<quint8> m_flags;
+    QVector<quint64> m_modSeq;
+    quint64 m_highestModSeq;
+};
+
+#endif // FAKEIMAPSERVER_SYNTHETICMAILBOX_H
@@ -0,0 +1,75 @@
+/* Copyright (C) 2006 - 2013 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <QCoreApplication>
+#include <QHostAddress>
+#include <QStringList>
+#include <QTextStream>
+#include "FakeImapServer.h"
+
+/** @short A standalone IMAP server with generated mailboxes for load testing
+
+Usage: fake-imap-server [--port=N] [generator options]
+*/
+int main(int argc, char **argv)
+{
+    QCoreApplication app(argc, argv);
+    QTextStream err(stderr);
+
+    QStringList args = app.arguments();
+    args.removeFirst();
+
+    quint16 port = 1143;
+    QStringList serverArgs;
+    Q_FOREACH(const QString &arg, args) {
+        if (arg.startsWith(QLatin1String("--port="))) {
+            bool ok;
+            port = arg.mid(7).toUShort(&ok);
+            if (!ok) {
+                err << "Invalid port: " << arg << endl;
+                return 1;
+            }
+        } else if (arg == QLatin1String("--help")) {
+            err << "Usage: fake-imap-server [--port=N] [options]" << endl << ServerConfig::usage();
+            return 0;
+        } else {
+            serverArgs << arg;
+        }
+    }
+
+    ServerConfig config;
+    QString error;
+    if (!config.parseArguments(serverArgs, error) || !serverArgs.isEmpty()) {
+        err << (error.isEmpty() ? QString::fromUtf8("Unexpected argument %1").arg(serverArgs.first()) : error) << endl
+            << ServerConfig::usage();
+        return 1;
+    }
+
+    FakeImapServer server(0, config);
+    if (!server.listen(QHostAddress::LocalHost, port)) {
+        err << "Cannot listen on port " << port << ": " << server.errorString() << endl;
+        return 1;
+    }
+    err << "Serving " << config.mailboxes.size() << " mailbox(es) with " << config.spec.messageCount
+        << " messages each on 127.0.0.1:" << server.serverPort() << endl;
+    return app.exec();
+}
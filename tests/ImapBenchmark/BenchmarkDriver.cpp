@@ -0,0 +1,188 @@
+/* Copyright (C) 2006 - 2013 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "BenchmarkDriver.h"
+#include <QCoreApplication>
+#include <QTextStream>
+#include <QTime>
+#include "Imap/Model/ItemRoles.h"
+#include "Imap/Model/MemoryCache.h"
+#include "Imap/Model/MsgListModel.h"
+#include "Imap/Model/TaskFactory.h"
+#include "Imap/Model/ThreadingMsgListModel.h"
+#include "Streams/SocketFactory.h"
+
+BenchmarkDriver::BenchmarkDriver(QObject *parent, const QString &host, const quint16 port):
+    QObject(parent), mailbox(QLatin1String("INBOX")), searchText(QLatin1String("Thread 1")), pageSize(50), pages(20),
+    timeout(600 * 1000), m_authenticated(false), m_synced(false), m_searchDone(false)
+{
+    Imap::Mailbox::SocketFactoryPtr factory(new Imap::Mailbox::TlsAbleSocketFactory(host, port));
+    factory->setStartTlsRequired(false);
+    Imap::Mailbox::TaskFactoryPtr taskFactory(new Imap::Mailbox::TaskFactory());
+    m_model = new Imap::Mailbox::Model(this, new Imap::Mailbox::MemoryCache(this), factory, taskFactory, false);
+    m_model->setObjectName(QLatin1String("model"));
+    m_msgListModel = new Imap::Mailbox::MsgListModel(this, m_model);
+    m_threadingModel = new Imap::Mailbox::ThreadingMsgListModel(this);
+    m_threadingModel->setSourceModel(m_msgListModel);
+
+    connect(m_model, SIGNAL(authRequested()), this, SLOT(slotAuthRequested()), Qt::QueuedConnection);
+    connect(m_model, SIGNAL(connectionStateChanged(QObject*,Imap::ConnectionState)),
+            this, SLOT(slotConnectionStateChanged(QObject*,Imap::ConnectionState)));
+    connect(m_model, SIGNAL(mailboxSyncingProgress(QModelIndex,Imap::Mailbox::MailboxSyncingProgress)),
+            this, SLOT(slotSyncingProgress(QModelIndex,Imap::Mailbox::MailboxSyncingProgress)));
+    connect(m_model, SIGNAL(connectionError(QString)), this, SLOT(slotConnectionError(QString)));
+    connect(m_model, SIGNAL(authAttemptFailed(QString)), this, SLOT(slotConnectionError(QString)));
+    connect(m_threadingModel, SIGNAL(layoutChanged()), this, SLOT(slotSearchDone()));
+    connect(m_threadingModel, SIGNAL(modelReset()), this, SLOT(slotSearchDone()));
+    connect(m_threadingModel, SIGNAL(sortingFailed()), this, SLOT(slotSearchDone()));
+}
+
+void BenchmarkDriver::slotAuthRequested()
+{
+    m_model->setImapUser(user);
+    m_model->setImapPassword(password);
+}
+
+void BenchmarkDriver::slotConnectionStateChanged(QObject *parser, Imap::ConnectionState state)
+{
+    Q_UNUSED(parser);
+    if (state >= Imap::CONN_STATE_AUTHENTICATED && state != Imap::CONN_STATE_LOGOUT)
+        m_authenticated = true;
+}
+
+void BenchmarkDriver::slotSyncingProgress(const QModelIndex &mailbox, Imap::Mailbox::MailboxSyncingProgress state)
+{
+    if (state == Imap::Mailbox::STATE_DONE && mailbox == m_msgListModel->currentMailbox())
+        m_synced = true;
+}
+
+void BenchmarkDriver::slotConnectionError(const QString &message)
+{
+    m_error = message;
+}
+
+void BenchmarkDriver::slotSearchDone()
+{
+    m_searchDone = true;
+}
+
+bool BenchmarkDriver::waitFor(const bool &flag, const QString &what)
+{
+    QTime timer;
+    timer.start();
+    while (!flag) {
+        if (!m_error.isEmpty()) {
+            QTextStream(stderr) << "Error while waiting for " << what << ": " << m_error << endl;
+            return false;
+        }
+        if (timer.elapsed() > timeout) {
+            QTextStream(stderr) << "Timeout while waiting for " << what << endl;
+            return false;
+        }
+        QCoreApplication::processEvents(QEventLoop::WaitForMoreEvents, 50);
+    }
+    return true;
+}
+
+void BenchmarkDriver::report(const QString &phase, const int msecs, const QString &details)
+{
+    QTextStream out(stdout);
+    out << qSetFieldWidth(8) << left << phase << qSetFieldWidth(8) << right << msecs << qSetFieldWidth(0) << " ms";
+    if (!details.isEmpty())
+        out << "  (" << details << ")";
+    out << endl;
+}
+
+bool BenchmarkDriver::run()
+{
+    QTime timer;
+
+    // Asking for the list of mailboxes is what makes the Model connect
+    timer.start();
+    m_model->rowCount(QModelIndex());
+    if (!waitFor(m_authenticated, QLatin1String("login")))
+        return false;
+    report(QLatin1String("login"), timer.elapsed());
+
+    // The mailbox is only known after the LIST has finished
+    timer.start();
+    bool found = false;
+    while (!found) {
+        m_msgListModel->setMailbox(mailbox);
+        found = m_msgListModel->currentMailbox().isValid();
+        if (!found) {
+            if (!m_error.isEmpty() || timer.elapsed() > timeout) {
+                QTextStream(stderr) << "Mailbox " << mailbox << " not found" << endl;
+                return false;
+            }
+            QCoreApplication::processEvents(QEventLoop::WaitForMoreEvents, 50);
+        }
+    }
+    m_msgListModel->rowCount();
+    if (!waitFor(m_synced, QLatin1String("mailbox synchronization")))
+        return false;
+    const int rows = m_msgListModel->rowCount();
+    report(QLatin1String("select"), timer.elapsed(), QString::fromUtf8("%1 messages").arg(rows));
+
+    // Scrolling: request a page worth of envelopes, wait for all of them, continue with the next page
+    timer.start();
+    int fetched = 0;
+    for (int page = 0; page < pages && page * pageSize < rows; ++page) {
+        QList<QPersistentModelIndex> indexes;
+        for (int row = page * pageSize; row < qMin(rows, (page + 1) * pageSize); ++row) {
+            QModelIndex index = m_msgListModel->index(row, 0);
+            index.data(Imap::Mailbox::RoleMessageSubject);
+            indexes << index;
+        }
+        QTime pageTimer;
+        pageTimer.start();
+        while (!indexes.isEmpty()) {
+            if (indexes.first().isValid() && !indexes.first().data(Imap::Mailbox::RoleIsFetched).toBool()) {
+                if (!m_error.isEmpty() || pageTimer.elapsed() > timeout) {
+                    QTextStream(stderr) << "Envelopes did not arrive: " << m_error << endl;
+                    return false;
+                }
+                QCoreApplication::processEvents(QEventLoop::WaitForMoreEvents, 50);
+                continue;
+            }
+            indexes.removeFirst();
+            ++fetched;
+        }
+    }
+    report(QLatin1String("scroll"), timer.elapsed(), QString::fromUtf8("%1 envelopes").arg(fetched));
+
+    if (!searchText.isEmpty()) {
+        timer.start();
+        m_searchDone = false;
+        if (m_threadingModel->setUserSearchingSortingPreference(
+                    QStringList() << QLatin1String("SUBJECT") << searchText, Imap::Mailbox::ThreadingMsgListModel::SORT_NONE)) {
+            if (!waitFor(m_searchDone, QLatin1String("search")))
+                return false;
+            report(QLatin1String("search"), timer.elapsed(),
+                   QString::fromUtf8("%1 matches").arg(m_threadingModel->rowCount()));
+        } else {
+            QTextStream(stderr) << "Search could not be started" << endl;
+        }
+    }
+
+    return true;
+}
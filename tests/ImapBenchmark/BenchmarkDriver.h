@@ -0,0 +1,86 @@
+/* Copyright (C) 2006 - 2013 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef IMAPBENCHMARK_BENCHMARKDRIVER_H
+#define IMAPBENCHMARK_BENCHMARKDRIVER_H
+
+#include <QObject>
+#include <QStringList>
+#include "Imap/ConnectionState.h"
+#include "Imap/Model/Model.h"
+
+namespace Imap {
+namespace Mailbox {
+class MsgListModel;
+class ThreadingMsgListModel;
+}
+}
+
+/** @short Drive the real Model against an IMAP server and measure how long the typical user actions take
+
+The measured phases are:
+- login: from the first request until the connection is authenticated,
+- select: from opening the mailbox until it is fully synchronized,
+- scroll: paging through the message list and waiting for the envelopes of each page,
+- search: a quick search through the ThreadingMsgListModel.
+*/
+class BenchmarkDriver : public QObject
+{
+    Q_OBJECT
+public:
+    BenchmarkDriver(QObject *parent, const QString &host, const quint16 port);
+
+    QString user;
+    QString password;
+    QString mailbox;
+    QString searchText;
+    int pageSize;
+    int pages;
+    /** @short How long to wait for each phase, in milliseconds */
+    int timeout;
+
+    /** @short Run all phases and print the results on the standard output; returns false on error */
+    bool run();
+
+private slots:
+    void slotAuthRequested();
+    void slotConnectionStateChanged(QObject *parser, Imap::ConnectionState state);
+    void slotSyncingProgress(const QModelIndex &mailbox, Imap::Mailbox::MailboxSyncingProgress state);
+    void slotConnectionError(const QString &message);
+    void slotSearchDone();
+
+private:
+    /** @short Process events until the @arg flag gets set, an error occurs or the timeout expires */
+    bool waitFor(const bool &flag, const QString &what);
+    void report(const QString &phase, const int msecs, const QString &details = QString());
+
+    Imap::Mailbox::Model *m_model;
+    Imap::Mailbox::MsgListModel *m_msgListModel;
+    Imap::Mailbox::ThreadingMsgListModel *m_threadingModel;
+
+    bool m_authenticated;
+    bool m_synced;
+    bool m_searchDone;
+    QString m_error;
+};
+
+#endif // IMAPBENCHMARK_BENCHMARKDRIVER_H
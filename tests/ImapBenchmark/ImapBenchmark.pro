@@ -0,0 +1,22 @@
+QT += core network
+QT -= gui
+CONFIG += console
+DEPENDPATH += ../../src/
+INCLUDEPATH += ../../src/
+TEMPLATE = app
+TARGET = imap-benchmark
+
+include(../FakeImapServer/FakeImapServer.pri)
+
+trojita_libs = Imap Streams Common
+myprefix = ../../src/
+include(../../src/linking.pri)
+include(../../configh.pri)
+include(../../src/Streams/ZlibLinking.pri)
+
+HEADERS += BenchmarkDriver.h
+SOURCES += BenchmarkDriver.cpp main.cpp
+
+# the upper makefile really wants to call `make check` in here...
+check.target = check
+QMAKE_EXTRA_TARGETS += check
@@ -0,0 +1,106 @@
+/* Copyright (C) 2006 - 2013 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <QCoreApplication>
+#include <QHostAddress>
+#include <QStringList>
+#include <QTextStream>
+#include "BenchmarkDriver.h"
+#include "FakeImapServer.h"
+
+/** @short Measure the Model's performance against a generated mailbox
+
+Unless --host is given, an in-process FakeImapServer is started and all unrecognized options are passed to it.
+*/
+int main(int argc, char **argv)
+{
+    QCoreApplication app(argc, argv);
+    QTextStream err(stderr);
+
+    QStringList args = app.arguments();
+    args.removeFirst();
+
+    QString host;
+    quint16 port = 0;
+    QString user = QLatin1String("user");
+    QString password = QLatin1String("password");
+    QString mailbox = QLatin1String("INBOX");
+    QString search = QLatin1String("Thread 1");
+    int pageSize = 50, pages = 20;
+    QStringList serverArgs;
+    Q_FOREACH(const QString &arg, args) {
+        const QString value = arg.section(QLatin1Char('='), 1);
+        if (arg.startsWith(QLatin1String("--host="))) {
+            host = value;
+        } else if (arg.startsWith(QLatin1String("--port="))) {
+            port = value.toUShort();
+        } else if (arg.startsWith(QLatin1String("--login-user="))) {
+            user = value;
+        } else if (arg.startsWith(QLatin1String("--login-password="))) {
+            password = value;
+        } else if (arg.startsWith(QLatin1String("--mailbox="))) {
+            mailbox = value;
+        } else if (arg.startsWith(QLatin1String("--search="))) {
+            search = value;
+        } else if (arg.startsWith(QLatin1String("--page-size="))) {
+            pageSize = qMax(1, value.toInt());
+        } else if (arg.startsWith(QLatin1String("--pages="))) {
+            pages = value.toInt();
+        } else if (arg == QLatin1String("--help")) {
+            err << "Usage: imap-benchmark [--host=H --port=N] [--login-user=U] [--login-password=P] [--mailbox=NAME]" << endl
+                << "                      [--search=TEXT] [--page-size=N] [--pages=N] [server options]" << endl
+                << ServerConfig::usage();
+            return 0;
+        } else {
+            serverArgs << arg;
+        }
+    }
+
+    FakeImapServer *server = 0;
+    if (host.isEmpty()) {
+        ServerConfig config;
+        QString error;
+        if (!config.parseArguments(serverArgs, error) || !serverArgs.isEmpty()) {
+            err << (error.isEmpty() ? QString::fromUtf8("Unexpected argument %1").arg(serverArgs.first()) : error) << endl;
+            return 1;
+        }
+        server = new FakeImapServer(&app, config);
+        if (!server->listen(QHostAddress::LocalHost, port)) {
+            err << "Cannot start the server: " << server->errorString() << endl;
+            return 1;
+        }
+        host = QLatin1String("127.0.0.1");
+        port = server->serverPort();
+    } else if (!serverArgs.isEmpty()) {
+        err << "Server options make no sense with --host" << endl;
+        return 1;
+    }
+
+    BenchmarkDriver driver(0, host, port);
+    driver.user = user;
+    driver.password = password;
+    driver.mailbox = mailbox;
+    driver.searchText = search;
+    driver.pageSize = pageSize;
+    driver.pages = pages;
+    return driver.run() ? 0 : 1;
+}
@@ -18,9 +18,11 @@ include(../../configh.pri)
 HEADERS += ../TagGenerator.h \
     FakeCapabilitiesInjector.h \
     test_LibMailboxSync.h \
-    ModelEvents.h
+    ModelEvents.h \
+    ../Utils/CacheHelpers.h
 SOURCES += test_LibMailboxSync.cpp \
-    ModelEvents.cpp
+    ModelEvents.cpp \
+    ../Utils/CacheHelpers.cpp
 
 # the upper makefile really wants to call `make check` in here...
 check.target = check
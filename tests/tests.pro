@@ -1,7 +1,10 @@
 TEMPLATE = subdirs
 SUBDIRS  = \
     test_LibMailboxSync \
-    tests
+    tests \
+    FakeImapServer \
+    ImapBenchmark \
+    CacheBenchmark
 CONFIG += ordered
 
 # At first, we define the "check" target which simply propagates the "check" call below
@@ -0,0 +1,77 @@
+/* Copyright (C) 2006 - 2013 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <QtTest>
+#include "test_Imap_BackgroundSync.h"
+#include "../headless_test.h"
+#include "Streams/FakeSocket.h"
+
+/** @short The mailbox B gets synchronized over a new connection */
+void ImapModelBackgroundSyncTest::helperBackgroundSyncOfB(TagGenerator &tags)
+{
+    // Opening the connection and starting the round involves a few trips through the event loop
+    for (int i = 0; i < 10; ++i)
+        QCoreApplication::processEvents();
+    QCOMPARE(model->taskModel()->rowCount(), 2);
+    cClient(tags.mk("SELECT b\r\n"));
+    cServer(QByteArray("* 0 exists\r\n") + tags.last("ok completed\r\n"));
+    cEmpty();
+}
+
+/** @short Going offline or to the expensive mode shall not leave the background connections behind */
+void ImapModelBackgroundSyncTest::testOfflineOnlineReleasesConnections()
+{
+    model->setProperty("trojita-imap-background-sync-connections", 1);
+    model->setProperty("trojita-imap-background-sync-delay", 0);
+
+    // The mailbox B is a recently used one, and nothing keeps it open once the user moves on to C
+    helperSyncBNoMessages();
+    model->switchToMailbox(idxC);
+    cClient(t.mk("SELECT c\r\n"));
+    cServer(QByteArray("* 0 exists\r\n") + t.last("ok completed\r\n"));
+    cEmpty();
+    QCOMPARE(model->taskModel()->rowCount(), 1);
+
+    model->setNetworkOnline();
+    TagGenerator background;
+    helperBackgroundSyncOfB(background);
+
+    for (int round = 0; round < 3; ++round) {
+        // The extra connection gets closed, the one which the user works with stays
+        model->setNetworkExpensive();
+        cClient(background.mk("LOGOUT\r\n"));
+        cServer(background.last("OK logged out\r\n"));
+        QCOMPARE(model->taskModel()->rowCount(), 1);
+
+        model->setNetworkOnline();
+        background.reset();
+        helperBackgroundSyncOfB(background);
+    }
+
+    // Going offline closes everything
+    model->setNetworkOffline();
+    cClient(background.mk("LOGOUT\r\n"));
+    cServer(background.last("OK logged out\r\n"));
+    QCOMPARE(model->taskModel()->rowCount(), 1);
+}
+
+TROJITA_HEADLESS_TEST( ImapModelBackgroundSyncTest )
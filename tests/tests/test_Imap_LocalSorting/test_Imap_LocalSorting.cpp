@@ -0,0 +1,132 @@
+/* Copyright (C) 2006 - 2013 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <QTest>
+#include "test_Imap_LocalSorting.h"
+#include "../headless_test.h"
+#include "Imap/Model/LocalSorting.h"
+
+using namespace Imap::Mailbox;
+using Imap::Message::MailAddress;
+
+namespace {
+
+LocalSortingMessage message(const uint uid, const QString &subject, const QString &from, const int day, const uint size)
+{
+    LocalSortingMessage res;
+    res.uid = uid;
+    res.envelope.subject = subject;
+    res.envelope.from << MailAddress(from, QString(), QLatin1String("someone"), QLatin1String("example.org"));
+    res.envelope.date = QDateTime(QDate(2013, 1, day), QTime(12, 0));
+    // The messages arrive in the opposite order than the one in which they were sent
+    res.internalDate = QDateTime(QDate(2013, 2, 28 - day), QTime(12, 0));
+    res.size = size;
+    return res;
+}
+
+}
+
+void ImapLocalSortingTest::testKeys()
+{
+    LocalSorting sorting;
+    sorting.setMessage(message(10, QLatin1String("Re: beta"), QLatin1String("Carol"), 3, 300));
+    sorting.setMessage(message(11, QLatin1String("alpha"), QLatin1String("bob"), 1, 100));
+    sorting.setMessage(message(12, QLatin1String("[list] Gamma"), QLatin1String("Alice"), 2, 100));
+    sorting.setMessage(message(13, QLatin1String("Beta"), QString(), 2, 200));
+
+    QCOMPARE(sorting.sortedUids(LocalSorting::KEY_DATE), QList<uint>() << 11 << 12 << 13 << 10);
+    QCOMPARE(sorting.sortedUids(LocalSorting::KEY_ARRIVAL), QList<uint>() << 10 << 12 << 13 << 11);
+    QCOMPARE(sorting.sortedUids(LocalSorting::KEY_SIZE), QList<uint>() << 11 << 12 << 13 << 10);
+    QCOMPARE(sorting.sortedUids(LocalSorting::KEY_SUBJECT), QList<uint>() << 11 << 10 << 13 << 12);
+    // Addresses without a display name are sorted by the address itself
+    QCOMPARE(sorting.sortedUids(LocalSorting::KEY_FROM), QList<uint>() << 12 << 11 << 10 << 13);
+    // Nobody has any recipients, so the UIDs decide
+    QCOMPARE(sorting.sortedUids(LocalSorting::KEY_TO), QList<uint>() << 10 << 11 << 12 << 13);
+
+    QCOMPARE(LocalSorting::subjectKey(QLatin1String("Re: [trojita] Fwd: Hello World")), QString::fromUtf8("hello world"));
+    QCOMPARE(LocalSorting::addressKey(QList<MailAddress>()), QString());
+}
+
+/** @short New and changed messages are merged into the existing ordering */
+void ImapLocalSortingTest::testIncrementalUpdates()
+{
+    LocalSorting sorting;
+    for (uint i = 1; i <= 20; ++i)
+        sorting.setMessage(message(i, QString::number(i % 7), QString(), i, i * 10));
+    QList<uint> bySize;
+    for (uint i = 1; i <= 20; ++i)
+        bySize << i;
+    QCOMPARE(sorting.sortedUids(LocalSorting::KEY_SIZE), bySize);
+
+    // A new arrival which is smaller than anything else
+    sorting.setMessage(message(21, QString(), QString(), 1, 5));
+    bySize.prepend(21);
+    QCOMPARE(sorting.sortedUids(LocalSorting::KEY_SIZE), bySize);
+
+    // A message whose data were not available at first
+    LocalSortingMessage unknown;
+    unknown.uid = 22;
+    sorting.setMessage(unknown);
+    bySize.prepend(22);
+    QCOMPARE(sorting.sortedUids(LocalSorting::KEY_SIZE), bySize);
+    sorting.setMessage(message(22, QString(), QString(), 1, 155));
+    bySize.removeFirst();
+    bySize.insert(bySize.indexOf(15) + 1, 22);
+    QCOMPARE(sorting.sortedUids(LocalSorting::KEY_SIZE), bySize);
+
+    // The result has to match a sort from scratch
+    LocalSorting fresh;
+    for (uint i = 1; i <= 20; ++i)
+        fresh.setMessage(message(i, QString::number(i % 7), QString(), i, i * 10));
+    fresh.setMessage(message(21, QString(), QString(), 1, 5));
+    fresh.setMessage(message(22, QString(), QString(), 1, 155));
+    QCOMPARE(sorting.sortedUids(LocalSorting::KEY_SUBJECT), fresh.sortedUids(LocalSorting::KEY_SUBJECT));
+    QCOMPARE(sorting.sortedUids(LocalSorting::KEY_SIZE), fresh.sortedUids(LocalSorting::KEY_SIZE));
+
+    sorting.clear();
+    QCOMPARE(sorting.size(), 0);
+    QVERIFY(sorting.sortedUids(LocalSorting::KEY_SIZE).isEmpty());
+}
+
+/** @short Sort fifty thousand messages by their subject */
+void ImapLocalSortingTest::testBenchmarkFullSort()
+{
+    // Big enough to show the cost of the comparisons, small enough for each run of the unit tests
+    const int num = 50000;
+    LocalSorting sorting;
+    for (int i = 1; i <= num; ++i) {
+        LocalSortingMessage input;
+        input.uid = i;
+        input.envelope.subject = QString::fromUtf8("Re: subject %1").arg((i * 7919) % 5000);
+        input.size = i;
+        sorting.setMessage(input);
+    }
+
+    QBENCHMARK {
+        // Only the copy gets sorted, so each iteration has to start from scratch
+        LocalSorting copy;
+        copy = sorting;
+        QCOMPARE(copy.sortedUids(LocalSorting::KEY_SUBJECT).size(), num);
+    }
+}
+
+TROJITA_HEADLESS_TEST(ImapLocalSortingTest)
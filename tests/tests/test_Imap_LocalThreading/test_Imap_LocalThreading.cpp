@@ -0,0 +1,166 @@
+/* Copyright (C) 2006 - 2013 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <QTest>
+#include "test_Imap_LocalThreading.h"
+#include "../headless_test.h"
+#include "Imap/Model/LocalThreading.h"
+
+using namespace Imap::Mailbox;
+
+namespace {
+
+LocalThreadingMessage message(const uint uid, const QByteArray &messageId, const QString &subject, const int day,
+                              const QList<QByteArray> &references = QList<QByteArray>())
+{
+    LocalThreadingMessage res;
+    res.uid = uid;
+    res.messageId = messageId;
+    res.subject = subject;
+    res.date = QDateTime(QDate(2013, 1, day), QTime(12, 0));
+    res.references = references;
+    return res;
+}
+
+/** @short Convert the threading into a compact textual form like "1(2, 3), 4" */
+QString dump(const QVector<Imap::Responses::ThreadingNode> &nodes)
+{
+    QStringList res;
+    Q_FOREACH(const Imap::Responses::ThreadingNode &node, nodes) {
+        QString item = QString::number(node.num);
+        if (!node.children.isEmpty())
+            item += QLatin1Char('(') + dump(node.children) + QLatin1Char(')');
+        res << item;
+    }
+    return res.join(QLatin1String(", "));
+}
+
+}
+
+/** @short Messages which refer to each other form a single thread */
+void ImapLocalThreadingTest::testReplyChain()
+{
+    LocalThreading threading;
+    QList<LocalThreadingMessage> messages;
+    messages << message(1, "a@x", QLatin1String("first"), 1)
+             << message(2, "b@x", QLatin1String("Re: first"), 2, QList<QByteArray>() << "a@x")
+             << message(3, "c@x", QLatin1String("Re: first"), 3, QList<QByteArray>() << "a@x" << "b@x")
+             << message(4, "d@x", QLatin1String("unrelated"), 4)
+             << message(5, "e@x", QLatin1String("Re: first"), 5, QList<QByteArray>() << "a@x");
+    threading.addMessages(messages);
+    QCOMPARE(dump(threading.threading()), QString::fromUtf8("1(2(3), 5), 4"));
+}
+
+/** @short A parent which is not in the mailbox is represented by an empty node, but only if it joins several messages */
+void ImapLocalThreadingTest::testMissingParent()
+{
+    LocalThreading threading;
+    QList<LocalThreadingMessage> messages;
+    messages << message(1, "a@x", QLatin1String("Re: gone"), 1, QList<QByteArray>() << "parent@x")
+             << message(2, "b@x", QLatin1String("Re: gone"), 2, QList<QByteArray>() << "parent@x")
+             << message(3, "c@x", QLatin1String("Re: lonely"), 3, QList<QByteArray>() << "other@x");
+    threading.addMessages(messages);
+    QCOMPARE(dump(threading.threading()), QString::fromUtf8("0(1, 2), 3"));
+}
+
+/** @short Messages without any references are grouped by their subject */
+void ImapLocalThreadingTest::testSubjectGrouping()
+{
+    LocalThreading threading;
+    QList<LocalThreadingMessage> messages;
+    messages << message(1, "a@x", QLatin1String("Hello"), 1)
+             << message(2, "b@x", QLatin1String("Re: hello"), 2)
+             << message(3, "c@x", QLatin1String("Status"), 3)
+             << message(4, "d@x", QLatin1String("[list] status"), 4)
+             << message(5, QByteArray(), QString(), 5)
+             << message(6, QByteArray(), QString(), 6);
+    threading.addMessages(messages);
+    QCOMPARE(dump(threading.threading()), QString::fromUtf8("1(2), 0(3, 4), 5, 6"));
+}
+
+/** @short New arrivals and messages whose headers become known later are linked into the existing threads */
+void ImapLocalThreadingTest::testIncrementalAdditions()
+{
+    LocalThreading threading;
+
+    // The headers of the first message are not available yet
+    QList<LocalThreadingMessage> messages;
+    LocalThreadingMessage unknown;
+    unknown.uid = 1;
+    messages << unknown
+             << message(2, "b@x", QLatin1String("Re: topic"), 2, QList<QByteArray>() << "a@x");
+    threading.addMessages(messages);
+    QCOMPARE(dump(threading.threading()), QString::fromUtf8("1, 2"));
+
+    messages.clear();
+    messages << message(1, "a@x", QLatin1String("topic"), 1);
+    threading.addMessages(messages);
+    QCOMPARE(dump(threading.threading()), QString::fromUtf8("1(2)"));
+
+    // A reply to the reply arrives
+    messages.clear();
+    messages << message(3, "c@x", QLatin1String("Re: topic"), 3, QList<QByteArray>() << "a@x" << "b@x");
+    threading.addMessages(messages);
+    QCOMPARE(dump(threading.threading()), QString::fromUtf8("1(2(3))"));
+
+    // Re-adding a message with known headers is a no-op
+    messages.clear();
+    messages << message(3, "c@x", QLatin1String("Re: topic"), 3);
+    threading.addMessages(messages);
+    QCOMPARE(dump(threading.threading()), QString::fromUtf8("1(2(3))"));
+
+    threading.clear();
+    QCOMPARE(dump(threading.threading()), QString());
+}
+
+void ImapLocalThreadingTest::testBaseSubject()
+{
+    QFETCH(QString, subject);
+    QFETCH(QString, baseSubject);
+    QFETCH(bool, isReply);
+
+    bool reply = !isReply;
+    QCOMPARE(LocalThreading::baseSubject(subject, &reply), baseSubject);
+    QCOMPARE(reply, isReply);
+}
+
+void ImapLocalThreadingTest::testBaseSubject_data()
+{
+    QTest::addColumn<QString>("subject");
+    QTest::addColumn<QString>("baseSubject");
+    QTest::addColumn<bool>("isReply");
+
+    QTest::newRow("plain") << QString::fromUtf8("Hello") << QString::fromUtf8("Hello") << false;
+    QTest::newRow("whitespace") << QString::fromUtf8("  Hello \t world ") << QString::fromUtf8("Hello world") << false;
+    QTest::newRow("re") << QString::fromUtf8("Re: Hello") << QString::fromUtf8("Hello") << true;
+    QTest::newRow("re-uppercase") << QString::fromUtf8("RE: Hello") << QString::fromUtf8("Hello") << true;
+    QTest::newRow("re-counter") << QString::fromUtf8("Re[2]: Hello") << QString::fromUtf8("Hello") << true;
+    QTest::newRow("nested") << QString::fromUtf8("Re: Fwd: re: Hello") << QString::fromUtf8("Hello") << true;
+    QTest::newRow("list-tag") << QString::fromUtf8("[trojita] Hello") << QString::fromUtf8("Hello") << false;
+    QTest::newRow("list-tag-reply") << QString::fromUtf8("Re: [trojita] Re: Hello") << QString::fromUtf8("Hello") << true;
+    QTest::newRow("just-a-tag") << QString::fromUtf8("[PATCH]") << QString::fromUtf8("[PATCH]") << false;
+    QTest::newRow("fwd-trailer") << QString::fromUtf8("Hello (fwd)") << QString::fromUtf8("Hello") << true;
+    QTest::newRow("fwd-wrapper") << QString::fromUtf8("[Fwd: Hello]") << QString::fromUtf8("Hello") << true;
+    QTest::newRow("not-a-prefix") << QString::fromUtf8("Regarding: Hello") << QString::fromUtf8("Regarding: Hello") << false;
+}
+
+TROJITA_HEADLESS_TEST(ImapLocalThreadingTest)
@@ -0,0 +1,2 @@
+TARGET = test_Imap_LocalThreading
+include(../tests.pri)
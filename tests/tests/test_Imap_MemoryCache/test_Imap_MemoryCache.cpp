@@ -0,0 +1,198 @@
+/* Copyright (C) 2006 - 2013 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <QSignalSpy>
+#include <QTest>
+#include "test_Imap_MemoryCache.h"
+#include "../headless_test.h"
+#include "Utils/CacheHelpers.h"
+#include "Imap/Model/MemoryCache.h"
+
+using namespace Imap::Mailbox;
+using namespace TestUtils;
+
+namespace {
+
+/** @short Return a part of the given size whose contents identify it */
+QByteArray partData(const char c, const int size)
+{
+    return QByteArray(size, c);
+}
+
+}
+
+void ImapMemoryCacheTest::init()
+{
+    m_cache = new MemoryCache(0);
+}
+
+void ImapMemoryCacheTest::cleanup()
+{
+    delete m_cache;
+    m_cache = 0;
+}
+
+/** @short The part which was used the longest time ago shall go first, both writes and reads count as a use */
+void ImapMemoryCacheTest::testLruEvictionOrder()
+{
+    const QString mailbox = QLatin1String("a");
+    m_cache->setCacheBudget(30, 0);
+    m_cache->setMsgPart(mailbox, 1, QLatin1String("1"), partData('a', 10));
+    m_cache->setMsgPart(mailbox, 2, QLatin1String("1"), partData('b', 10));
+    m_cache->setMsgPart(mailbox, 3, QLatin1String("1"), partData('c', 10));
+    QCOMPARE(m_cache->statistics().evictions, quint64(0));
+
+    // Reading the oldest part makes the second one the least recently used
+    QCOMPARE(m_cache->messagePart(mailbox, 1, QLatin1String("1")), partData('a', 10));
+    m_cache->setMsgPart(mailbox, 4, QLatin1String("1"), partData('d', 10));
+    QCOMPARE(m_cache->statistics().evictions, quint64(1));
+    QCOMPARE(m_cache->messagePart(mailbox, 2, QLatin1String("1")), QByteArray());
+    QCOMPARE(m_cache->messagePart(mailbox, 3, QLatin1String("1")), partData('c', 10));
+    QCOMPARE(m_cache->messagePart(mailbox, 1, QLatin1String("1")), partData('a', 10));
+    QCOMPARE(m_cache->messagePart(mailbox, 4, QLatin1String("1")), partData('d', 10));
+
+    // The reads above have put the part of UID 3 at the head of the list
+    m_cache->setMsgPart(mailbox, 5, QLatin1String("1"), partData('e', 10));
+    QCOMPARE(m_cache->statistics().evictions, quint64(2));
+    QCOMPARE(m_cache->messagePart(mailbox, 3, QLatin1String("1")), QByteArray());
+    QCOMPARE(m_cache->messagePart(mailbox, 1, QLatin1String("1")), partData('a', 10));
+
+    // Overwriting a part counts as a use as well and does not leave the old data behind
+    m_cache->setMsgPart(mailbox, 4, QLatin1String("1"), partData('D', 10));
+    QCOMPARE(m_cache->statistics().residentBytes, qint64(30));
+    m_cache->setMsgPart(mailbox, 6, QLatin1String("1"), partData('f', 10));
+    QCOMPARE(m_cache->messagePart(mailbox, 5, QLatin1String("1")), QByteArray());
+    QCOMPARE(m_cache->messagePart(mailbox, 4, QLatin1String("1")), partData('D', 10));
+    QCOMPARE(m_cache->statistics().evictions, quint64(3));
+}
+
+/** @short The limit shall hold after each write and after lowering it, and it shall only affect the message parts */
+void ImapMemoryCacheTest::testLimitEnforcement()
+{
+    const QString mailbox = QLatin1String("a");
+    QSignalSpy evictedSpy(m_cache, SIGNAL(evicted(qint64)));
+
+    // Without any limit, everything stays
+    for (uint uid = 1; uid <= 4; ++uid) {
+        m_cache->setMessageMetadata(mailbox, uid, message(uid, QString::number(uid)));
+        m_cache->setMsgFlags(mailbox, uid, QStringList() << QLatin1String("\\Seen"));
+        m_cache->setMsgPart(mailbox, uid, QLatin1String("1"), partData('x', 100));
+    }
+    QCOMPARE(m_cache->statistics().residentBytes, qint64(400));
+    QCOMPARE(m_cache->statistics().evictions, quint64(0));
+    QVERIFY(evictedSpy.isEmpty());
+
+    // Lowering the limit drops the oldest parts right away
+    m_cache->setCacheBudget(250, 0);
+    QCOMPARE(m_cache->statistics().residentBytes, qint64(200));
+    QCOMPARE(m_cache->statistics().evictions, quint64(2));
+    QCOMPARE(evictedSpy.size(), 1);
+    QCOMPARE(evictedSpy.takeFirst()[0].toLongLong(), qint64(200));
+    QCOMPARE(m_cache->messagePart(mailbox, 1, QLatin1String("1")), QByteArray());
+    QCOMPARE(m_cache->messagePart(mailbox, 2, QLatin1String("1")), QByteArray());
+    QCOMPARE(m_cache->messagePart(mailbox, 3, QLatin1String("1")).size(), 100);
+    QCOMPARE(m_cache->messagePart(mailbox, 4, QLatin1String("1")).size(), 100);
+
+    // The metadata and flags are never evicted
+    for (uint uid = 1; uid <= 4; ++uid) {
+        QCOMPARE(m_cache->messageMetadata(mailbox, uid).envelope.subject, QString::number(uid));
+        QCOMPARE(m_cache->msgFlags(mailbox, uid), QStringList() << QLatin1String("\\Seen"));
+    }
+
+    // A part which cannot ever fit is refused without pushing the other ones out
+    m_cache->setMsgPart(mailbox, 5, QLatin1String("1"), partData('y', 300));
+    QCOMPARE(m_cache->statistics().residentBytes, qint64(200));
+    QCOMPARE(m_cache->statistics().evictions, quint64(3));
+    QVERIFY(evictedSpy.isEmpty());
+    QCOMPARE(m_cache->messagePart(mailbox, 5, QLatin1String("1")), QByteArray());
+    QCOMPARE(m_cache->messagePart(mailbox, 3, QLatin1String("1")).size(), 100);
+
+    // A part which fits but overflows the limit makes room for itself
+    m_cache->setMsgPart(mailbox, 5, QLatin1String("1"), partData('z', 150));
+    QCOMPARE(m_cache->statistics().residentBytes, qint64(250));
+    QCOMPARE(m_cache->statistics().evictions, quint64(4));
+    QCOMPARE(evictedSpy.size(), 1);
+    QCOMPARE(evictedSpy.takeFirst()[0].toLongLong(), qint64(100));
+    QCOMPARE(m_cache->messagePart(mailbox, 4, QLatin1String("1")), QByteArray());
+    QCOMPARE(m_cache->messagePart(mailbox, 3, QLatin1String("1")).size(), 100);
+    QCOMPARE(m_cache->messagePart(mailbox, 5, QLatin1String("1")).size(), 150);
+
+    // Zero removes the limit again
+    m_cache->setCacheBudget(0, 0);
+    m_cache->setMsgPart(mailbox, 6, QLatin1String("1"), partData('w', 1000));
+    QCOMPARE(m_cache->statistics().residentBytes, qint64(1250));
+    QCOMPARE(m_cache->statistics().evictions, quint64(4));
+}
+
+/** @short The hits, misses and resident bytes shall follow the lookups and the removals */
+void ImapMemoryCacheTest::testStatistics()
+{
+    const QString mailbox = QLatin1String("a");
+    const QString otherMailbox = QLatin1String("b");
+
+    MemoryCache::Statistics stats = m_cache->statistics();
+    QCOMPARE(stats.hits, quint64(0));
+    QCOMPARE(stats.misses, quint64(0));
+    QCOMPARE(stats.evictions, quint64(0));
+    QCOMPARE(stats.residentBytes, qint64(0));
+
+    // Lookups in a mailbox which was never seen are misses, too
+    QCOMPARE(m_cache->messageMetadata(otherMailbox, 1).uid, 0u);
+    QCOMPARE(m_cache->messagePart(otherMailbox, 1, QLatin1String("1")), QByteArray());
+    QCOMPARE(m_cache->statistics().misses, quint64(2));
+
+    m_cache->setMessageMetadata(mailbox, 1, message(1, QLatin1String("one")));
+    m_cache->setMsgPart(mailbox, 1, QLatin1String("1"), partData('a', 10));
+    m_cache->setMsgPart(mailbox, 1, QLatin1String("2"), partData('b', 20));
+    m_cache->setMsgPart(mailbox, 2, QLatin1String("1"), partData('c', 30));
+    QCOMPARE(m_cache->statistics().residentBytes, qint64(60));
+    // Writes do not count as lookups
+    QCOMPARE(m_cache->statistics().hits, quint64(0));
+
+    QCOMPARE(m_cache->messageMetadata(mailbox, 1).envelope.subject, QString::fromUtf8("one"));
+    QCOMPARE(m_cache->messageMetadata(mailbox, 2).uid, 0u);
+    QCOMPARE(m_cache->messagePart(mailbox, 1, QLatin1String("2")), partData('b', 20));
+    QCOMPARE(m_cache->messagePart(mailbox, 1, QLatin1String("3")), QByteArray());
+    QCOMPARE(m_cache->messagePart(mailbox, 3, QLatin1String("1")), QByteArray());
+    stats = m_cache->statistics();
+    QCOMPARE(stats.hits, quint64(2));
+    QCOMPARE(stats.misses, quint64(5));
+
+    // The bulk lookup used for sorting does not skew the counters
+    QCOMPARE(m_cache->metadataOfMessages(mailbox, QList<uint>() << 1 << 2).size(), 1);
+    QCOMPARE(m_cache->statistics().hits, quint64(2));
+    QCOMPARE(m_cache->statistics().misses, quint64(5));
+
+    // Replacing a part accounts for the size difference only
+    m_cache->setMsgPart(mailbox, 1, QLatin1String("2"), partData('B', 5));
+    QCOMPARE(m_cache->statistics().residentBytes, qint64(45));
+
+    m_cache->clearMessage(mailbox, 1);
+    QCOMPARE(m_cache->statistics().residentBytes, qint64(30));
+    m_cache->clearAllMessages(mailbox);
+    stats = m_cache->statistics();
+    QCOMPARE(stats.residentBytes, qint64(0));
+    // Explicit removals are not evictions
+    QCOMPARE(stats.evictions, quint64(0));
+}
+
+TROJITA_HEADLESS_TEST(ImapMemoryCacheTest)
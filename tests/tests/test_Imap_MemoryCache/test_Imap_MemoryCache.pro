@@ -0,0 +1,2 @@
+TARGET = test_Imap_MemoryCache
+include(../tests.pri)
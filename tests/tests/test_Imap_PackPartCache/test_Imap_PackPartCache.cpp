@@ -0,0 +1,233 @@
+/* Copyright (C) 2006 - 2013 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <QDir>
+#include <QSignalSpy>
+#include <QTest>
+#include "test_Imap_PackPartCache.h"
+#include "../headless_test.h"
+#include "Utils/CacheHelpers.h"
+#include "Imap/Model/PackPartCache.h"
+
+using namespace Imap::Mailbox;
+using namespace TestUtils;
+
+namespace {
+
+/** @short Return data which do not compress at all, so that they are stored verbatim */
+QByteArray noise(const int size, const uint seed)
+{
+    qsrand(seed);
+    QByteArray res;
+    res.reserve(size);
+    for (int i = 0; i < size; ++i)
+        res.append(static_cast<char>(qrand() & 0xff));
+    return res;
+}
+
+/** @short Return data which compress very well */
+QByteArray text(const int size, const char c)
+{
+    return QByteArray(size, c);
+}
+
+/** @short Store a part the way the DiskPartCache used to do it */
+void writeLegacyPart(const QString &cacheDir, const QString &mailbox, const uint uid, const QString &partId, const QByteArray &data)
+{
+    const QString dir = cacheDir + QLatin1Char('/') + QString::fromUtf8(mailbox.toUtf8().toBase64());
+    QVERIFY(QDir().mkpath(dir));
+    QFile file(QString::fromUtf8("%1/%2_%3.cache").arg(dir, QString::number(uid), partId));
+    QVERIFY(file.open(QIODevice::WriteOnly));
+    QVERIFY(file.write(qCompress(data)) > 0);
+}
+
+}
+
+void ImapPackPartCacheTest::init()
+{
+    m_dir = QDir::tempPath() + QString::fromUtf8("/trojita-test-packpartcache-%1").arg(QCoreApplication::applicationPid());
+    removeRecursively(m_dir);
+    QVERIFY(QDir().mkpath(m_dir));
+}
+
+void ImapPackPartCacheTest::cleanup()
+{
+    removeRecursively(m_dir);
+}
+
+QString ImapPackPartCacheTest::packFile(const int pack) const
+{
+    return m_dir + QString::fromUtf8("/packs/%1.pack").arg(QString::number(pack));
+}
+
+/** @short The same data stored under several parts occupy the space just once */
+void ImapPackPartCacheTest::testDeduplication()
+{
+    PackPartCache cache(0, QLatin1String("test-dedup"), m_dir);
+    QSignalSpy errors(&cache, SIGNAL(error(QString)));
+    QVERIFY(cache.open());
+
+    const QByteArray attachment = noise(5000, 1);
+    cache.setMsgPart(QLatin1String("a"), 1, QLatin1String("2"), attachment);
+    // A copy of the message in another mailbox, and a forward of the attachment
+    cache.setMsgPart(QLatin1String("b"), 10, QLatin1String("2"), attachment);
+    cache.setMsgPart(QLatin1String("a"), 2, QLatin1String("3"), attachment);
+    QCOMPARE(cache.storedSize(), qint64(attachment.size()));
+    QCOMPARE(QFileInfo(packFile(1)).size(), qint64(attachment.size()));
+    QVERIFY(cache.contains(QLatin1String("a"), 1, QLatin1String("2")));
+    QVERIFY(cache.contains(QLatin1String("b"), 10, QLatin1String("2")));
+    QVERIFY(cache.contains(QLatin1String("a"), 2, QLatin1String("3")));
+    QCOMPARE(cache.messagePart(QLatin1String("b"), 10, QLatin1String("2")), attachment);
+
+    // Removing a message which shares all its data frees nothing
+    QCOMPARE(cache.messageSize(QLatin1String("a"), 1), qint64(0));
+    cache.clearMessage(QLatin1String("a"), 1);
+    cache.clearAllMessages(QLatin1String("b"));
+    QVERIFY(!cache.contains(QLatin1String("a"), 1, QLatin1String("2")));
+    QVERIFY(!cache.contains(QLatin1String("b"), 10, QLatin1String("2")));
+    QCOMPARE(cache.messagePart(QLatin1String("a"), 1, QLatin1String("2")), QByteArray());
+    QCOMPARE(cache.messageSize(QLatin1String("a"), 2), qint64(attachment.size()));
+    QCOMPARE(cache.messagePart(QLatin1String("a"), 2, QLatin1String("3")), attachment);
+
+    // Different data are not merged
+    cache.setMsgPart(QLatin1String("a"), 3, QLatin1String("2"), noise(1000, 2));
+    QCOMPARE(cache.storedSize(), qint64(attachment.size() + 1000));
+    QVERIFY(errors.isEmpty());
+}
+
+/** @short Both the compressed and the verbatim blobs read back unchanged, even after reopening the cache */
+void ImapPackPartCacheTest::testRoundTrip()
+{
+    const QByteArray compressible = text(100000, 'x');
+    const QByteArray incompressible = noise(100000, 3);
+    {
+        PackPartCache cache(0, QLatin1String("test-roundtrip"), m_dir);
+        QSignalSpy errors(&cache, SIGNAL(error(QString)));
+        QVERIFY(cache.open());
+        cache.setMsgPart(QLatin1String("a"), 1, QLatin1String("1"), compressible);
+        // Compression is used when it pays off
+        QVERIFY(cache.storedSize() < compressible.size() / 10);
+        const qint64 compressedSize = cache.storedSize();
+        cache.setMsgPart(QLatin1String("a"), 1, QLatin1String("2"), incompressible);
+        // ...and not when it doesn't
+        QCOMPARE(cache.storedSize(), compressedSize + incompressible.size());
+        QCOMPARE(cache.messagePart(QLatin1String("a"), 1, QLatin1String("1")), compressible);
+        QCOMPARE(cache.messagePart(QLatin1String("a"), 1, QLatin1String("2")), incompressible);
+        QCOMPARE(cache.messagePart(QLatin1String("a"), 1, QLatin1String("3")), QByteArray());
+        QVERIFY(errors.isEmpty());
+    }
+
+    PackPartCache cache(0, QLatin1String("test-roundtrip"), m_dir);
+    QSignalSpy errors(&cache, SIGNAL(error(QString)));
+    QVERIFY(cache.open());
+    QVERIFY(cache.contains(QLatin1String("a"), 1, QLatin1String("1")));
+    QVERIFY(cache.contains(QLatin1String("a"), 1, QLatin1String("2")));
+    QCOMPARE(cache.messagePart(QLatin1String("a"), 1, QLatin1String("1")), compressible);
+    QCOMPARE(cache.messagePart(QLatin1String("a"), 1, QLatin1String("2")), incompressible);
+    QVERIFY(errors.isEmpty());
+}
+
+/** @short The compaction removes a mostly unused pack and keeps the live blobs readable */
+void ImapPackPartCacheTest::testCompaction()
+{
+    const QByteArray dead = noise(3000, 4);
+    const QByteArray live = noise(1000, 5);
+    {
+        PackPartCache cache(0, QLatin1String("test-compaction"), m_dir);
+        QVERIFY(cache.open());
+        cache.setMsgPart(QLatin1String("a"), 1, QLatin1String("1"), dead);
+        cache.setMsgPart(QLatin1String("a"), 2, QLatin1String("1"), live);
+    }
+    QVERIFY(QFile::exists(packFile(1)));
+
+    // Pack #1 is not written to anymore after reopening
+    PackPartCache cache(0, QLatin1String("test-compaction"), m_dir);
+    QSignalSpy errors(&cache, SIGNAL(error(QString)));
+    QVERIFY(cache.open());
+
+    // Nothing is wasted yet
+    cache.compact();
+    QVERIFY(QFile::exists(packFile(1)));
+    QVERIFY(!QFile::exists(packFile(2)));
+
+    cache.clearMessage(QLatin1String("a"), 1);
+    QCOMPARE(cache.storedSize(), qint64(live.size()));
+    QCOMPARE(QFileInfo(packFile(1)).size(), qint64(dead.size() + live.size()));
+    cache.compact();
+    QVERIFY(!QFile::exists(packFile(1)));
+    QCOMPARE(QFileInfo(packFile(2)).size(), qint64(live.size()));
+    QCOMPARE(cache.storedSize(), qint64(live.size()));
+    QCOMPARE(cache.messagePart(QLatin1String("a"), 2, QLatin1String("1")), live);
+    QCOMPARE(cache.messagePart(QLatin1String("a"), 1, QLatin1String("1")), QByteArray());
+
+    // Storing the removed data again creates a new blob instead of referring to the one which is gone
+    cache.setMsgPart(QLatin1String("a"), 3, QLatin1String("1"), dead);
+    QCOMPARE(cache.messagePart(QLatin1String("a"), 3, QLatin1String("1")), dead);
+    QCOMPARE(cache.storedSize(), qint64(dead.size() + live.size()));
+    QVERIFY(errors.isEmpty());
+}
+
+/** @short The files of the old one-file-per-part layout are moved into the packs, including the nested directories */
+void ImapPackPartCacheTest::testLegacyImport()
+{
+    const QByteArray inboxPart = text(10000, 'i');
+    // The base64 of this one is "YT8/Pw==", so the old cache has put it into a subdirectory
+    const QString nestedMailbox = QString::fromUtf8("a???");
+    const QByteArray nestedPart = noise(2000, 6);
+    // ...while this one's is "YT8/", which got stored in the "YT8" directory, and there's no way to tell what it was
+    const QString lostMailbox = QString::fromUtf8("a??");
+    QCOMPARE(nestedMailbox.toUtf8().toBase64(), QByteArray("YT8/Pw=="));
+    QCOMPARE(lostMailbox.toUtf8().toBase64(), QByteArray("YT8/"));
+
+    writeLegacyPart(m_dir, QLatin1String("INBOX"), 1, QLatin1String("1"), inboxPart);
+    writeLegacyPart(m_dir, QLatin1String("INBOX"), 2, QLatin1String("1.2"), inboxPart);
+    writeLegacyPart(m_dir, nestedMailbox, 7, QLatin1String("2"), nestedPart);
+    writeLegacyPart(m_dir, lostMailbox, 8, QLatin1String("1"), nestedPart);
+    QVERIFY(QFile::exists(m_dir + QLatin1String("/YT8/Pw==/7_2.cache")));
+    QVERIFY(QFile::exists(m_dir + QLatin1String("/YT8/8_1.cache")));
+
+    {
+        PackPartCache cache(0, QLatin1String("test-legacy"), m_dir);
+        QSignalSpy errors(&cache, SIGNAL(error(QString)));
+        QVERIFY(cache.open());
+        QVERIFY(cache.contains(QLatin1String("INBOX"), 1, QLatin1String("1")));
+        QVERIFY(cache.contains(QLatin1String("INBOX"), 2, QLatin1String("1.2")));
+        QVERIFY(cache.contains(nestedMailbox, 7, QLatin1String("2")));
+        QVERIFY(!cache.contains(lostMailbox, 8, QLatin1String("1")));
+        QCOMPARE(cache.messagePart(QLatin1String("INBOX"), 2, QLatin1String("1.2")), inboxPart);
+        QCOMPARE(cache.messagePart(nestedMailbox, 7, QLatin1String("2")), nestedPart);
+        // The two INBOX parts are the same
+        QCOMPARE(cache.messageSize(QLatin1String("INBOX"), 1), qint64(0));
+        QVERIFY(errors.isEmpty());
+    }
+
+    // All the old files and directories are gone, the packs stay
+    QCOMPARE(QDir(m_dir).entryList(QDir::Dirs | QDir::Files | QDir::NoDotAndDotDot), QStringList() << QLatin1String("packs"));
+
+    // Nothing gets imported twice
+    PackPartCache cache(0, QLatin1String("test-legacy"), m_dir);
+    QVERIFY(cache.open());
+    QCOMPARE(cache.messagePart(nestedMailbox, 7, QLatin1String("2")), nestedPart);
+    QVERIFY(!QFile::exists(packFile(2)));
+}
+
+TROJITA_HEADLESS_TEST(ImapPackPartCacheTest)
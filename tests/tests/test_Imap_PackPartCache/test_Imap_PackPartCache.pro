@@ -0,0 +1,3 @@
+TARGET = test_Imap_PackPartCache
+include(../tests.pri)
+QT += sql
@@ -434,6 +434,21 @@ void ImapParserParseTest::testParseUntagged_data()
         << QByteArray("* ESEARCH (TAG \"B01\") UID REMOVEFROM (0 32768)\r\n")
         << QSharedPointer<AbstractResponse>(new ESearch("B01", ESearch::UIDS, incrementalEsearchData));
 
+    esearchData.clear();
+    esearchData.push_back(qMakePair<QByteArray, QList<uint> >("COUNT", QList<uint>() << 12));
+    ESearch::PartialData_t partialEsearchData;
+    partialEsearchData.push_back(ESearch::PartialResult(1, 5, QList<uint>() << 9 << 3 << 4 << 5 << 1));
+    QTest::newRow("esearch-partial")
+        << QByteArray("* ESEARCH (TAG \"D01\") UID PARTIAL (1:5 9,3:5,1) COUNT 12\r\n")
+        << QSharedPointer<AbstractResponse>(new ESearch("D01", ESearch::UIDS, esearchData, partialEsearchData));
+
+    esearchData.clear();
+    partialEsearchData.clear();
+    partialEsearchData.push_back(ESearch::PartialResult(201, 400, QList<uint>()));
+    QTest::newRow("esearch-partial-nil")
+        << QByteArray("* ESEARCH (TAG \"D02\") UID PARTIAL (201:400 NIL)\r\n")
+        << QSharedPointer<AbstractResponse>(new ESearch("D02", ESearch::UIDS, esearchData, partialEsearchData));
+
     Status::stateDataType states;
     states[Status::MESSAGES] = 231;
     states[Status::UIDNEXT] = 44292;
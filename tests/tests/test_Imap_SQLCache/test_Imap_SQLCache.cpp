@@ -0,0 +1,303 @@
+/* Copyright (C) 2006 - 2013 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <QDir>
+#include <QSignalSpy>
+#include <QSqlDatabase>
+#include <QSqlQuery>
+#include <QTest>
+#include "test_Imap_SQLCache.h"
+#include "../headless_test.h"
+#include "Utils/CacheHelpers.h"
+#include "Imap/Model/SQLCache.h"
+
+using namespace Imap::Mailbox;
+using namespace TestUtils;
+using Imap::Responses::ThreadingNode;
+
+namespace {
+
+ThreadingNode node(const uint num, const QVector<ThreadingNode> &children = QVector<ThreadingNode>())
+{
+    return ThreadingNode(num, children);
+}
+
+QVector<ThreadingNode> nodes(const ThreadingNode &a)
+{
+    return QVector<ThreadingNode>() << a;
+}
+
+QVector<ThreadingNode> nodes(const ThreadingNode &a, const ThreadingNode &b)
+{
+    return QVector<ThreadingNode>() << a << b;
+}
+
+/** @short (0 (1)(2))(3 (0 (0 (4)))) -- an empty thread root, and a chain of empty nodes deeper in the thread */
+QVector<ThreadingNode> threadingWithPlaceholders()
+{
+    return nodes(node(0, nodes(node(1), node(2))),
+                 node(3, nodes(node(0, nodes(node(0, nodes(node(4))))))));
+}
+
+/** @short Number of rows which were modified through the given connection since it was opened */
+int totalChanges(const QString &connectionName)
+{
+    QSqlQuery q(QLatin1String("SELECT total_changes()"), QSqlDatabase::database(connectionName));
+    return q.first() ? q.value(0).toInt() : -1;
+}
+
+}
+
+void ImapSQLCacheTest::init()
+{
+    m_dir = QDir::tempPath() + QString::fromUtf8("/trojita-test-sqlcache-%1").arg(QCoreApplication::applicationPid());
+    removeRecursively(m_dir);
+    QVERIFY(QDir().mkpath(m_dir));
+    m_fileName = m_dir + QLatin1String("/imap.cache.sqlite");
+}
+
+void ImapSQLCacheTest::cleanup()
+{
+    removeRecursively(m_dir);
+}
+
+/** @short The empty nodes get stored under IDs derived from their first real descendant, and they survive a round trip */
+void ImapSQLCacheTest::testThreadingPlaceholders()
+{
+    QObject parent;
+    {
+        SQLCache cache(&parent);
+        QSignalSpy errors(&cache, SIGNAL(error(QString)));
+        QVERIFY(cache.open(QLatin1String("test-placeholders-write"), m_fileName));
+        cache.setMessageThreading(QLatin1String("a"), threadingWithPlaceholders());
+        QCOMPARE(cache.messageThreading(QLatin1String("a")), threadingWithPlaceholders());
+        QCOMPARE(errors.size(), 0);
+    }
+
+    {
+        QSqlDatabase db = QSqlDatabase::addDatabase(QLatin1String("QSQLITE"), QLatin1String("test-placeholders-inspect"));
+        db.setDatabaseName(m_fileName);
+        QVERIFY(db.open());
+        QSqlQuery q(QLatin1String("SELECT node, parent FROM msg_thread_nodes"), db);
+        QMap<quint64, quint64> parents;
+        while (q.next())
+            parents[q.value(0).toULongLong()] = q.value(1).toULongLong();
+        const quint64 emptyRoot = (Q_UINT64_C(1) << 32) | 1;
+        const quint64 outerEmpty = (Q_UINT64_C(2) << 32) | 4;
+        const quint64 innerEmpty = (Q_UINT64_C(1) << 32) | 4;
+        QMap<quint64, quint64> expected;
+        expected[emptyRoot] = 0;
+        expected[1] = emptyRoot;
+        expected[2] = emptyRoot;
+        expected[3] = 0;
+        expected[outerEmpty] = 3;
+        expected[innerEmpty] = outerEmpty;
+        expected[4] = innerEmpty;
+        QCOMPARE(parents, expected);
+        q.finish();
+        db.close();
+    }
+    QSqlDatabase::removeDatabase(QLatin1String("test-placeholders-inspect"));
+
+    // A fresh instance has nothing in memory and has to rebuild the tree from the rows
+    SQLCache cache(&parent);
+    QVERIFY(cache.open(QLatin1String("test-placeholders-read"), m_fileName));
+    QCOMPARE(cache.messageThreading(QLatin1String("a")), threadingWithPlaceholders());
+}
+
+/** @short Updating the threading only touches the nodes which have changed */
+void ImapSQLCacheTest::testThreadingWritesChangedNodes()
+{
+    QObject parent;
+    const QString connection = QLatin1String("test-changed-nodes");
+    // (1 (2 (4)(5)))(3)
+    const QVector<ThreadingNode> withNewArrival = nodes(node(1, nodes(node(2, nodes(node(4), node(5))))), node(3));
+    {
+        SQLCache cache(&parent);
+        QSignalSpy errors(&cache, SIGNAL(error(QString)));
+        QVERIFY(cache.open(connection, m_fileName));
+
+        // (1 (2 (4)))(3)
+        cache.setMessageThreading(QLatin1String("a"), nodes(node(1, nodes(node(2, nodes(node(4))))), node(3)));
+        int changes = totalChanges(connection);
+
+        // A new arrival is a single new row; none of its siblings has moved
+        cache.setMessageThreading(QLatin1String("a"), withNewArrival);
+        QCOMPARE(totalChanges(connection) - changes, 1);
+        changes = totalChanges(connection);
+
+        // Storing the same tree once again is free
+        cache.setMessageThreading(QLatin1String("a"), withNewArrival);
+        QCOMPARE(totalChanges(connection) - changes, 0);
+
+        // A message which is gone costs a single deletion
+        cache.setMessageThreading(QLatin1String("a"), nodes(node(1, nodes(node(2, nodes(node(4), node(5)))))));
+        QCOMPARE(totalChanges(connection) - changes, 1);
+        cache.setMessageThreading(QLatin1String("a"), withNewArrival);
+        QCOMPARE(errors.size(), 0);
+    }
+
+    SQLCache cache(&parent);
+    QVERIFY(cache.open(QLatin1String("test-changed-nodes-read"), m_fileName));
+    QCOMPARE(cache.messageThreading(QLatin1String("a")), withNewArrival);
+}
+
+/** @short The threading blobs of the v11 schema are converted into the per-node rows */
+void ImapSQLCacheTest::testThreadingMigrationFromV11()
+{
+    QObject parent;
+    {
+        // The mailbox has to be known to the cache before it gets downgraded
+        SQLCache cache(&parent);
+        QVERIFY(cache.open(QLatin1String("test-migration-create"), m_fileName));
+        cache.setUidMapping(QLatin1String("a"), QList<uint>() << 1 << 2 << 3 << 4);
+    }
+
+    {
+        QSqlDatabase db = QSqlDatabase::addDatabase(QLatin1String("QSQLITE"), QLatin1String("test-migration-downgrade"));
+        db.setDatabaseName(m_fileName);
+        QVERIFY(db.open());
+        QSqlQuery q(db);
+        QVERIFY(q.exec(QLatin1String("SELECT id FROM mailboxes WHERE name = 'a'")));
+        QVERIFY(q.first());
+        const int id = q.value(0).toInt();
+        q.finish();
+
+        QByteArray buf;
+        QDataStream stream(&buf, QIODevice::WriteOnly);
+        stream.setVersion(QDataStream::Qt_4_6);
+        stream << threadingWithPlaceholders();
+
+        QVERIFY(q.exec(QLatin1String("DROP TABLE msg_thread_nodes")));
+        QVERIFY(q.exec(QLatin1String("CREATE TABLE msg_threading (mailbox_id INTEGER NOT NULL PRIMARY KEY, threading BINARY)")));
+        QVERIFY(q.prepare(QLatin1String("INSERT INTO msg_threading (mailbox_id, threading) VALUES (?, ?)")));
+        q.bindValue(0, id);
+        q.bindValue(1, qCompress(buf));
+        QVERIFY(q.exec());
+        QVERIFY(q.exec(QLatin1String("UPDATE trojita SET version = 11")));
+        q.finish();
+        db.close();
+    }
+    QSqlDatabase::removeDatabase(QLatin1String("test-migration-downgrade"));
+
+    SQLCache cache(&parent);
+    QSignalSpy errors(&cache, SIGNAL(error(QString)));
+    QVERIFY(cache.open(QLatin1String("test-migration-open"), m_fileName));
+    QCOMPARE(errors.size(), 0);
+    QVERIFY(!QSqlDatabase::database(QLatin1String("test-migration-open")).tables().contains(QLatin1String("msg_threading")));
+    QCOMPARE(cache.messageThreading(QLatin1String("a")), threadingWithPlaceholders());
+}
+
+/** @short A part which is fetched once again replaces its old text in the full-text index */
+void ImapSQLCacheTest::testFullTextRefetchedPart()
+{
+    QObject parent;
+    SQLCache cache(&parent);
+    QSignalSpy errors(&cache, SIGNAL(error(QString)));
+    QVERIFY(cache.open(QLatin1String("test-fulltext"), m_fileName));
+
+    AbstractCache::MessageDataBundle data;
+    data.uid = 1;
+    data.envelope.subject = QLatin1String("Fruit delivery");
+    cache.setMessageMetadata(QLatin1String("a"), 1, data);
+    data.uid = 2;
+    data.envelope.subject = QLatin1String("Something else");
+    cache.setMessageMetadata(QLatin1String("a"), 2, data);
+    if (cache.fullTextSearch(QLatin1String("a"), QLatin1String("SUBJECT"), QLatin1String("fruit")).isEmpty()) {
+#if QT_VERSION >= 0x050000
+        QSKIP("SQLite was built without the FTS4 support");
+#else
+        QSKIP("SQLite was built without the FTS4 support", SkipSingle);
+#endif
+    }
+
+    const QString utf8 = QLatin1String("utf-8");
+    const QString plain = QLatin1String("text/plain");
+    cache.setMsgPartText(QLatin1String("a"), 1, QLatin1String("1"), QByteArray("Apples and pears"), utf8, plain);
+    cache.setMsgPartText(QLatin1String("a"), 1, QLatin1String("2"), QByteArray("Bananas"), utf8, plain);
+    cache.setMsgPartText(QLatin1String("a"), 2, QLatin1String("1"), QByteArray("More apples"), utf8, plain);
+    QCOMPARE(cache.fullTextSearch(QLatin1String("a"), QLatin1String("BODY"), QLatin1String("apples")), QList<uint>() << 1 << 2);
+    QCOMPARE(cache.fullTextSearch(QLatin1String("a"), QLatin1String("BODY"), QLatin1String("bananas")), QList<uint>() << 1);
+
+    // The first part has changed, e.g. because it was fetched in a different way; its old words shall be forgotten
+    cache.setMsgPartText(QLatin1String("a"), 1, QLatin1String("1"), QByteArray("Cherries"), utf8, plain);
+    QCOMPARE(cache.fullTextSearch(QLatin1String("a"), QLatin1String("BODY"), QLatin1String("apples")), QList<uint>() << 2);
+    QCOMPARE(cache.fullTextSearch(QLatin1String("a"), QLatin1String("BODY"), QLatin1String("pears")), QList<uint>());
+    QCOMPARE(cache.fullTextSearch(QLatin1String("a"), QLatin1String("BODY"), QLatin1String("cherries")), QList<uint>() << 1);
+    // The other part and the envelope are left alone
+    QCOMPARE(cache.fullTextSearch(QLatin1String("a"), QLatin1String("BODY"), QLatin1String("bananas")), QList<uint>() << 1);
+    QCOMPARE(cache.fullTextSearch(QLatin1String("a"), QLatin1String("TEXT"), QLatin1String("fruit cherries")), QList<uint>() << 1);
+
+    // Fetching the same text again does not duplicate anything
+    cache.setMsgPartText(QLatin1String("a"), 1, QLatin1String("2"), QByteArray("Bananas"), utf8, plain);
+    cache.setMsgPartText(QLatin1String("a"), 1, QLatin1String("2"), QByteArray("Bananas"), utf8, plain);
+    QCOMPARE(cache.fullTextSearch(QLatin1String("a"), QLatin1String("BODY"), QLatin1String("cherries bananas")), QList<uint>() << 1);
+
+    // A message which is gone disappears from the index, along with the positions of its parts
+    cache.clearMessage(QLatin1String("a"), 1);
+    QCOMPARE(cache.fullTextSearch(QLatin1String("a"), QLatin1String("BODY"), QLatin1String("bananas")), QList<uint>());
+    cache.setMsgPartText(QLatin1String("a"), 1, QLatin1String("2"), QByteArray("Oranges"), utf8, plain);
+    QCOMPARE(cache.fullTextSearch(QLatin1String("a"), QLatin1String("BODY"), QLatin1String("oranges")), QList<uint>() << 1);
+
+    // The conversion from the charset and the removal of HTML markup are done by the cache
+    cache.setMsgPartText(QLatin1String("a"), 2, QLatin1String("2"), QByteArray("Caf\xe9 au lait"), QLatin1String("iso-8859-1"), plain);
+    cache.setMsgPartText(QLatin1String("a"), 2, QLatin1String("3"), QByteArray("<p class=\"banner\">Kiwis</p>"), utf8,
+                         QLatin1String("text/html"));
+    QCOMPARE(cache.fullTextSearch(QLatin1String("a"), QLatin1String("BODY"), QString::fromUtf8("caf\xc3\xa9")), QList<uint>() << 2);
+    QCOMPARE(cache.fullTextSearch(QLatin1String("a"), QLatin1String("BODY"), QLatin1String("kiwis")), QList<uint>() << 2);
+    QCOMPARE(cache.fullTextSearch(QLatin1String("a"), QLatin1String("BODY"), QLatin1String("banner")), QList<uint>());
+    QCOMPARE(errors.size(), 0);
+}
+
+/** @short The flags of messages which are no longer in the UID map are not counted */
+void ImapSQLCacheTest::testFlagsOutsideOfUidMap()
+{
+    QObject parent;
+    SQLCache cache(&parent);
+    QSignalSpy errors(&cache, SIGNAL(error(QString)));
+    QVERIFY(cache.open(QLatin1String("test-flags"), m_fileName));
+
+    const QString seen = QLatin1String("\\Seen");
+    const QString label = QLatin1String("$Label1");
+    cache.setUidMapping(QLatin1String("a"), QList<uint>() << 1 << 2 << 3);
+    cache.setMsgFlags(QLatin1String("a"), 1, QStringList() << seen << label);
+    cache.setMsgFlags(QLatin1String("a"), 2, QStringList());
+    cache.setMsgFlags(QLatin1String("a"), 3, QStringList() << label);
+    // Left behind by a message which was expunged while nobody was watching
+    cache.setMsgFlags(QLatin1String("a"), 4, QStringList() << seen << label);
+
+    QCOMPARE(cache.countWithFlag(QLatin1String("a"), seen, true), 1u);
+    QCOMPARE(cache.uidsWithFlag(QLatin1String("a"), seen, true), QList<uint>() << 1);
+    QCOMPARE(cache.countWithFlag(QLatin1String("a"), seen, false), 2u);
+    QCOMPARE(cache.countWithFlag(QLatin1String("a"), label, true), 2u);
+    QCOMPARE(cache.uidsWithFlag(QLatin1String("a"), label, false), QList<uint>() << 2);
+
+    // The message #1 is gone as well, but its flags are still in the cache
+    cache.setUidMapping(QLatin1String("a"), QList<uint>() << 2 << 3);
+    QCOMPARE(cache.countWithFlag(QLatin1String("a"), seen, true), 0u);
+    QCOMPARE(cache.countWithFlag(QLatin1String("a"), seen, false), 2u);
+    QCOMPARE(cache.uidsWithFlag(QLatin1String("a"), label, true), QList<uint>() << 3);
+    QCOMPARE(cache.msgFlags(QLatin1String("a"), 1), QStringList() << seen << label);
+    QCOMPARE(errors.size(), 0);
+}
+
+TROJITA_HEADLESS_TEST(ImapSQLCacheTest)
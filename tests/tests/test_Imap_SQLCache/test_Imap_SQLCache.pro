@@ -0,0 +1,3 @@
+TARGET = test_Imap_SQLCache
+include(../tests.pri)
+QT += sql
@@ -24,6 +24,7 @@
 #include "test_Imap_Tasks_ListChildMailboxes.h"
 #include "../headless_test.h"
 #include "Streams/FakeSocket.h"
+#include "Imap/Model/ItemRoles.h"
 #include "Imap/Model/MemoryCache.h"
 #include "Imap/Model/Model.h"
 #include "Imap/Tasks/Fake_ListChildMailboxesTask.h"
@@ -128,4 +129,44 @@ void ImapModelListChildMailboxesTest::testFakeListing()
     QVERIFY( SOCK->writtenStuff().isEmpty() );
 }
 
+/** @short Requests for message counts shall be sent at once and their results remembered in the cache */
+void ImapModelListChildMailboxesTest::testPipelinedStatus()
+{
+    model->rowCount( QModelIndex() );
+    QCoreApplication::processEvents();
+    QCoreApplication::processEvents();
+    QCoreApplication::processEvents();
+    QCOMPARE( SOCK->writtenStuff(), QByteArray("y0 LIST \"\" \"%\"\r\n") );
+    SOCK->fakeReading( "* LIST (\\HasNoChildren) \".\" \"b\"\r\n"
+                       "* LIST (\\HasNoChildren) \".\" \"a\"\r\n"
+                       "y0 OK List done.\r\n");
+    QCoreApplication::processEvents();
+    QCoreApplication::processEvents();
+    QCOMPARE( model->rowCount( QModelIndex() ), 3 );
+    QModelIndex idxA = model->index( 1, 0, QModelIndex() );
+    QModelIndex idxB = model->index( 2, 0, QModelIndex() );
+    QCOMPARE( idxA.data( Imap::Mailbox::RoleTotalMessageCount ), QVariant() );
+    QCOMPARE( idxB.data( Imap::Mailbox::RoleTotalMessageCount ), QVariant() );
+    QCoreApplication::processEvents();
+    QCoreApplication::processEvents();
+    QCoreApplication::processEvents();
+    QCOMPARE( SOCK->writtenStuff(), QByteArray("y1 STATUS a (MESSAGES UNSEEN RECENT)\r\n"
+                                               "y2 STATUS b (MESSAGES UNSEEN RECENT)\r\n") );
+    SOCK->fakeReading( "* STATUS a (MESSAGES 3 UNSEEN 1 RECENT 0)\r\n"
+                       "* STATUS b (MESSAGES 5 UNSEEN 0 RECENT 0)\r\n"
+                       "y1 OK status\r\n"
+                       "y2 OK status\r\n" );
+    QCoreApplication::processEvents();
+    QCoreApplication::processEvents();
+    QCOMPARE( idxA.data( Imap::Mailbox::RoleTotalMessageCount ), QVariant(3) );
+    QCOMPARE( idxA.data( Imap::Mailbox::RoleUnreadMessageCount ), QVariant(1) );
+    QCOMPARE( idxB.data( Imap::Mailbox::RoleTotalMessageCount ), QVariant(5) );
+
+    Imap::Mailbox::SyncState status = model->cache()->mailboxStatus( QLatin1String("a") );
+    QVERIFY( status.isUsableForNumbers() );
+    QCOMPARE( status.exists(), 3u );
+    QCOMPARE( status.unSeenCount(), 1u );
+    QVERIFY( SOCK->writtenStuff().isEmpty() );
+}
+
 TROJITA_HEADLESS_TEST( ImapModelListChildMailboxesTest )
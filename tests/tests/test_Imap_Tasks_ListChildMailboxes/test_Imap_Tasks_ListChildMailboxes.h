@@ -39,6 +39,7 @@ private slots:
 
     void testSimpleListing();
     void testFakeListing();
+    void testPipelinedStatus();
 
 private:
     Imap::Mailbox::Model* model;
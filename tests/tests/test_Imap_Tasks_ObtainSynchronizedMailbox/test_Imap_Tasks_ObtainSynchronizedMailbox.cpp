@@ -449,6 +449,59 @@ void ImapModelObtainSynchronizedMailboxTest::testCacheNoChange()
     justKeepTask();
 }
 
+/** @short Without CONDSTORE, the flags shall be fetched around the interesting messages first and in windows afterwards */
+void ImapModelObtainSynchronizedMailboxTest::testCacheWindowedFlags()
+{
+    model->setProperty("trojita-imap-flags-sync-window", 3);
+    Imap::Mailbox::SyncState sync;
+    sync.setExists(10);
+    sync.setUidValidity(666);
+    sync.setUidNext(21);
+    QList<uint> uidMap;
+    for (uint i = 1; i <= 10; ++i)
+        uidMap << i * 2;
+    model->cache()->setMailboxSyncState("a", sync);
+    model->cache()->setUidMapping("a", uidMap);
+    model->cache()->setMsgFlags("a", 2, QStringList() << "cached");
+    QCOMPARE(model->rowCount(msgListA), 0);
+    cClient(t.mk("SELECT a\r\n"));
+    cServer("* 10 EXISTS\r\n"
+            "* OK [UIDVALIDITY 666] .\r\n"
+            "* OK [UIDNEXT 21] .\r\n");
+    cServer(t.last("OK selected\r\n"));
+    cClient(t.mk("FETCH 8:10 (FLAGS)\r\n"));
+    cServer("* 8 FETCH (FLAGS (f8))\r\n"
+            "* 9 FETCH (FLAGS (f9))\r\n"
+            "* 10 FETCH (FLAGS (f10))\r\n");
+    cServer(t.last("OK fetch\r\n"));
+
+    // The mailbox is usable now, the rest of the flags comes from the cache until it gets refreshed
+    QCOMPARE(model->rowCount(msgListA), 10);
+    QCOMPARE(msgListA.child(0, 0).data(Imap::Mailbox::RoleMessageFlags).toStringList(), QStringList() << "cached");
+    QCOMPARE(model->cache()->msgFlags("a", 20), QStringList() << "f10");
+
+    cClient(t.mk("UID FETCH 10:14 (FLAGS)\r\n"));
+    cServer("* 5 FETCH (UID 10 FLAGS (f5))\r\n"
+            "* 6 FETCH (UID 12 FLAGS (f6))\r\n"
+            "* 7 FETCH (UID 14 FLAGS (f7))\r\n");
+    cServer(t.last("OK fetch\r\n"));
+    cClient(t.mk("UID FETCH 4:8 (FLAGS)\r\n"));
+    cServer("* 2 FETCH (UID 4 FLAGS (f2))\r\n"
+            "* 3 FETCH (UID 6 FLAGS (f3))\r\n"
+            "* 4 FETCH (UID 8 FLAGS (f4))\r\n");
+    cServer(t.last("OK fetch\r\n"));
+    cClient(t.mk("UID FETCH 2 (FLAGS)\r\n"));
+    cServer("* 1 FETCH (UID 2 FLAGS (f1))\r\n");
+    cServer(t.last("OK fetch\r\n"));
+    cEmpty();
+
+    QCOMPARE(msgListA.child(0, 0).data(Imap::Mailbox::RoleMessageFlags).toStringList(), QStringList() << "f1");
+    for (uint i = 1; i <= 10; ++i)
+        QCOMPARE(model->cache()->msgFlags("a", i * 2), QStringList() << QString::fromUtf8("f%1").arg(i));
+    QCOMPARE(model->cache()->mailboxSyncState("a"), sync);
+    justKeepTask();
+}
+
 /** @short Test UIDVALIDITY changes since the last cached state */
 void ImapModelObtainSynchronizedMailboxTest::testCacheUidValidity()
 {
@@ -48,6 +48,7 @@ private slots:
     void testDecreasedUidNext();
     void testReloadReadsFromCache();
     void testCacheNoChange();
+    void testCacheWindowedFlags();
     void testCacheUidValidity();
     void testCacheArrivals();
     void testCacheArrivalRaceDuringUid();
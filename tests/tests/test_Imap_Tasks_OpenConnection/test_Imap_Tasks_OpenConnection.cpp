@@ -685,6 +685,96 @@ void ImapModelOpenConnectionTest::testInitialGarbage_data()
         << QByteArray("+OK InterMail POP3 server ready.\r\n");
 }
 
+/** @short A reconnect after a lost connection reuses the capabilities of the previous session instead of asking again */
+void ImapModelOpenConnectionTest::testResumeReusesCapabilities()
+{
+    model->m_lastAuthenticatedCapabilities = QStringList() << QLatin1String("IMAP4REV1") << QLatin1String("ENABLE")
+                                                           << QLatin1String("QRESYNC");
+    model->m_resumingSession = true;
+    model->m_resumeParser = task->parser;
+
+    QCoreApplication::processEvents();
+    QCoreApplication::processEvents();
+    SOCK->fakeReading("* OK [CAPABILITY IMAP4rev1] foo\r\n");
+    QCoreApplication::processEvents();
+    QCoreApplication::processEvents();
+    QCoreApplication::processEvents();
+    QCoreApplication::processEvents();
+    QCOMPARE(SOCK->writtenStuff(), QByteArray("y0 LOGIN luzr sikrit\r\n"));
+    // The server does not say anything about its capabilities after the login
+    SOCK->fakeReading("y0 OK logged in\r\n");
+    QCoreApplication::processEvents();
+    QCoreApplication::processEvents();
+    QCOMPARE(completedSpy->size(), 1);
+    QVERIFY(failedSpy->isEmpty());
+    QVERIFY(SOCK->writtenStuff().isEmpty());
+    QVERIFY(model->capabilities().contains(QLatin1String("QRESYNC")));
+
+    // Going offline cancels the resume, so whatever connects next will go through a fresh login
+    model->setNetworkOffline();
+    QVERIFY(!model->m_resumingSession);
+    QVERIFY(!model->m_resumeTimer->isActive());
+}
+
+/** @short Connections other than the one which re-opens the mailbox ask for the capabilities even while a resume is running */
+void ImapModelOpenConnectionTest::testOtherConnectionDuringResume()
+{
+    model->m_lastAuthenticatedCapabilities = QStringList() << QLatin1String("IMAP4REV1") << QLatin1String("ENABLE")
+                                                           << QLatin1String("QRESYNC");
+    model->m_resumingSession = true;
+    QVERIFY(!model->m_resumeParser);
+
+    QCoreApplication::processEvents();
+    QCoreApplication::processEvents();
+    SOCK->fakeReading("* OK [CAPABILITY IMAP4rev1] foo\r\n");
+    QCoreApplication::processEvents();
+    QCoreApplication::processEvents();
+    QCoreApplication::processEvents();
+    QCoreApplication::processEvents();
+    QCOMPARE(SOCK->writtenStuff(), QByteArray("y0 LOGIN luzr sikrit\r\n"));
+    SOCK->fakeReading("y0 OK logged in\r\n");
+    QCoreApplication::processEvents();
+    QCoreApplication::processEvents();
+    QCOMPARE(SOCK->writtenStuff(), QByteArray("y1 CAPABILITY\r\n"));
+    QVERIFY(completedSpy->isEmpty());
+    SOCK->fakeReading("* CAPABILITY IMAP4rev1\r\ny1 OK capability completed\r\n");
+    QCoreApplication::processEvents();
+    QCoreApplication::processEvents();
+    QCOMPARE(completedSpy->size(), 1);
+    QVERIFY(failedSpy->isEmpty());
+    QVERIFY(!model->capabilities().contains(QLatin1String("QRESYNC")));
+}
+
+/** @short Without a resume in progress, the cached capabilities of an older session are not trusted */
+void ImapModelOpenConnectionTest::testFreshLoginAsksForCapabilities()
+{
+    model->m_lastAuthenticatedCapabilities = QStringList() << QLatin1String("IMAP4REV1") << QLatin1String("ENABLE")
+                                                           << QLatin1String("QRESYNC");
+    QVERIFY(!model->m_resumingSession);
+
+    QCoreApplication::processEvents();
+    QCoreApplication::processEvents();
+    SOCK->fakeReading("* OK [CAPABILITY IMAP4rev1] foo\r\n");
+    QCoreApplication::processEvents();
+    QCoreApplication::processEvents();
+    QCoreApplication::processEvents();
+    QCoreApplication::processEvents();
+    QCOMPARE(SOCK->writtenStuff(), QByteArray("y0 LOGIN luzr sikrit\r\n"));
+    SOCK->fakeReading("y0 OK logged in\r\n");
+    QCoreApplication::processEvents();
+    QCoreApplication::processEvents();
+    QCOMPARE(SOCK->writtenStuff(), QByteArray("y1 CAPABILITY\r\n"));
+    QVERIFY(completedSpy->isEmpty());
+    SOCK->fakeReading("* CAPABILITY IMAP4rev1\r\ny1 OK capability completed\r\n");
+    QCoreApplication::processEvents();
+    QCoreApplication::processEvents();
+    QCOMPARE(completedSpy->size(), 1);
+    QVERIFY(failedSpy->isEmpty());
+    QVERIFY(!model->capabilities().contains(QLatin1String("QRESYNC")));
+    // The capabilities of this session are the ones to reuse next time
+    QCOMPARE(model->m_lastAuthenticatedCapabilities, QStringList() << QLatin1String("IMAP4REV1"));
+}
+
 // FIXME: verify how LOGINDISABLED even after STARTLS ends up
 
 void ImapModelOpenConnectionTest::provideAuthDetails()
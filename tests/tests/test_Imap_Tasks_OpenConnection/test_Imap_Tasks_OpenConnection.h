@@ -62,6 +62,10 @@ private slots:
 
     void testInitialBye();
 
+    void testResumeReusesCapabilities();
+    void testOtherConnectionDuringResume();
+    void testFreshLoginAsksForCapabilities();
+
     void testInitialGarbage();
     void testInitialGarbage_data();
 
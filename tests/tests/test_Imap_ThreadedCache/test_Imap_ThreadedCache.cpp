@@ -0,0 +1,258 @@
+/* Copyright (C) 2006 - 2013 Jan Kundrát <jkt@flaska.net>
+
+   This file is part of the Trojita Qt IMAP e-mail client,
+   http://trojita.flaska.net/
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of
+   the License or (at your option) version 3 or any later version
+   accepted by the membership of KDE e.V. (or its successor approved
+   by the membership of KDE e.V.), which shall act as a proxy
+   defined in Section 14 of version 3 of the license.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <QDir>
+#include <QSignalSpy>
+#include <QTest>
+#include "test_Imap_ThreadedCache.h"
+#include "../headless_test.h"
+#include "Utils/CacheHelpers.h"
+#include "Imap/Model/ThreadedCache.h"
+
+using namespace Imap::Mailbox;
+using namespace TestUtils;
+
+void ImapThreadedCacheTest::init()
+{
+    m_dir = QDir::tempPath() + QString::fromUtf8("/trojita-test-threadedcache-%1").arg(QCoreApplication::applicationPid());
+    removeRecursively(m_dir);
+    QVERIFY(QDir().mkpath(m_dir));
+}
+
+void ImapThreadedCacheTest::cleanup()
+{
+    removeRecursively(m_dir);
+}
+
+/** @short The reads which have to be answered by the worker see all writes which were issued before them */
+void ImapThreadedCacheTest::testReadAfterWrite()
+{
+    ThreadedCache cache(0, QLatin1String("test-read-after-write"), m_dir);
+    QVERIFY(cache.open());
+
+    QList<uint> uids;
+    for (uint uid = 1; uid <= 500; ++uid)
+        uids << uid;
+    cache.setUidMapping(QLatin1String("a"), uids.mid(0, 3));
+    cache.setUidMapping(QLatin1String("b"), uids);
+
+    // Plenty of unrelated writes, which the reads are allowed to overtake
+    for (uint uid = 1; uid <= 500; ++uid)
+        cache.setMsgFlags(QLatin1String("b"), uid, QStringList() << QLatin1String("\\Seen"));
+
+    cache.setMsgFlags(QLatin1String("a"), 1, QStringList() << QLatin1String("\\Seen"));
+    cache.setMsgFlags(QLatin1String("a"), 2, QStringList());
+    // The counting is not mirrored in memory, so this goes to the worker
+    QCOMPARE(cache.countWithFlag(QLatin1String("a"), QLatin1String("\\Seen"), true), 1u);
+    QCOMPARE(cache.uidsWithFlag(QLatin1String("a"), QLatin1String("\\Seen"), false), QList<uint>() << 2);
+
+    cache.setMsgFlags(QLatin1String("a"), 2, QStringList() << QLatin1String("\\Seen"));
+    QCOMPARE(cache.countWithFlag(QLatin1String("a"), QLatin1String("\\Seen"), true), 2u);
+
+    // The writes within a batch are passed to the worker before the read
+    cache.beginBatch();
+    cache.setMsgFlags(QLatin1String("a"), 3, QStringList() << QLatin1String("\\Seen"));
+    QCOMPARE(cache.countWithFlag(QLatin1String("a"), QLatin1String("\\Seen"), true), 3u);
+    cache.commitBatch();
+
+    QCOMPARE(cache.countWithFlag(QLatin1String("b"), QLatin1String("\\Seen"), true), 500u);
+}
+
+/** @short All writes reach the disk in the order in which they were issued */
+void ImapThreadedCacheTest::testWriteBehindOrdering()
+{
+    {
+        ThreadedCache cache(0, QLatin1String("test-ordering-write"), m_dir);
+        QVERIFY(cache.open());
+        cache.setMsgFlags(QLatin1String("a"), 1, QStringList() << QLatin1String("\\Seen"));
+        cache.setMsgFlags(QLatin1String("a"), 1, QStringList() << QLatin1String("\\Answered"));
+        cache.setMessageMetadata(QLatin1String("a"), 1, message(1, QLatin1String("first")));
+        cache.setMessageMetadata(QLatin1String("a"), 1, message(1, QLatin1String("second")));
+        cache.setMessageMetadata(QLatin1String("a"), 2, message(2, QLatin1String("gone")));
+        cache.clearMessage(QLatin1String("a"), 2);
+        cache.setUidMapping(QLatin1String("a"), QList<uint>() << 1 << 2);
+        cache.setUidMapping(QLatin1String("a"), QList<uint>() << 1);
+        // The destructor waits for all of the writes
+    }
+
+    ThreadedCache cache(0, QLatin1String("test-ordering-read"), m_dir);
+    QVERIFY(cache.open());
+    QCOMPARE(cache.msgFlags(QLatin1String("a"), 1), QStringList() << QLatin1String("\\Answered"));
+    QCOMPARE(cache.messageMetadata(QLatin1String("a"), 1).envelope.subject, QString::fromUtf8("second"));
+    QCOMPARE(cache.messageMetadata(QLatin1String("a"), 2).uid, 0u);
+    QCOMPARE(cache.uidMapping(QLatin1String("a")), QList<uint>() << 1);
+}
+
+/** @short Only a few mailboxes are mirrored in memory; the others are read back from the worker */
+void ImapThreadedCacheTest::testMirrorLimit()
+{
+    ThreadedCache cache(0, QLatin1String("test-mirror-limit"), m_dir);
+    QVERIFY(cache.open());
+
+    const int mailboxes = ThreadedCache::maxMirroredMailboxes + 2;
+    for (int i = 0; i < mailboxes; ++i) {
+        const QString mailbox = QString::fromUtf8("m%1").arg(i);
+        cache.setMessageMetadata(mailbox, 1, message(1, mailbox));
+        cache.setMsgFlags(mailbox, 1, QStringList() << mailbox);
+    }
+
+    // The first mailboxes are no longer in memory, so these reads have to wait for the writes which are still queued
+    for (int i = 0; i < mailboxes; ++i) {
+        const QString mailbox = QString::fromUtf8("m%1").arg(i);
+        QCOMPARE(cache.messageMetadata(mailbox, 1).envelope.subject, mailbox);
+        QCOMPARE(cache.msgFlags(mailbox, 1), QStringList() << mailbox);
+    }
+
+    // A single mailbox cannot take an unlimited amount of memory either, but nothing is lost
+    const uint messages = ThreadedCache::maxMirroredMessages + 10;
+    cache.beginBatch();
+    for (uint uid = 1; uid <= messages; ++uid)
+        cache.setMsgFlags(QLatin1String("big"), uid, QStringList() << QString::number(uid));
+    cache.commitBatch();
+    for (uint uid = 1; uid <= messages; uid += 997)
+        QCOMPARE(cache.msgFlags(QLatin1String("big"), uid), QStringList() << QString::number(uid));
+    QCOMPARE(cache.msgFlags(QLatin1String("big"), messages), QStringList() << QString::number(messages));
+}
+
+/** @short The messages which were used recently stay in the mirror when it overflows */
+void ImapThreadedCacheTest::testMirrorLru()
+{
+    ThreadedCache cache(0, QLatin1String("test-mirror-lru"), m_dir);
+    QVERIFY(cache.open());
+
+    const uint messages = ThreadedCache::maxMirroredMessages;
+    cache.beginBatch();
+    for (uint uid = 1; uid <= messages; ++uid)
+        cache.setMsgFlags(QLatin1String("a"), uid, QStringList());
+    cache.commitBatch();
+    QCOMPARE(cache.m_messages[QLatin1String("a")].messages.size(), ThreadedCache::maxMirroredMessages);
+
+    // Both reading and writing counts as a use
+    QCOMPARE(cache.msgFlags(QLatin1String("a"), 1), QStringList());
+    cache.setMsgFlags(QLatin1String("a"), 2, QStringList() << QLatin1String("\\Seen"));
+
+    cache.setMsgFlags(QLatin1String("a"), messages + 1, QStringList());
+    cache.setMsgFlags(QLatin1String("a"), messages + 2, QStringList());
+    cache.setMsgFlags(QLatin1String("a"), messages + 3, QStringList());
+    const QHash<uint, ThreadedCache::MirroredMessage> &mirror = cache.m_messages[QLatin1String("a")].messages;
+    QCOMPARE(mirror.size(), ThreadedCache::maxMirroredMessages);
+    QVERIFY(mirror.contains(1));
+    QVERIFY(mirror.contains(2));
+    QVERIFY(!mirror.contains(3));
+    QVERIFY(!mirror.contains(4));
+    QVERIFY(!mirror.contains(5));
+    QVERIFY(mirror.contains(6));
+    QVERIFY(mirror.contains(messages + 3));
+
+    // The evicted messages are still available from the disk
+    QCOMPARE(cache.msgFlags(QLatin1String("a"), 3), QStringList());
+    QCOMPARE(cache.msgFlags(QLatin1String("a"), 2), QStringList() << QLatin1String("\\Seen"));
+}
+
+/** @short Removing the messages of a mailbox also forgets its UID map and threading in memory */
+void ImapThreadedCacheTest::testClearAllMessages()
+{
+    ThreadedCache cache(0, QLatin1String("test-clear-all"), m_dir);
+    QVERIFY(cache.open());
+
+    QVector<Imap::Responses::ThreadingNode> threading;
+    threading << Imap::Responses::ThreadingNode(1);
+    cache.setUidMapping(QLatin1String("a"), QList<uint>() << 1);
+    cache.setMessageThreading(QLatin1String("a"), threading);
+    cache.setMessageMetadata(QLatin1String("a"), 1, message(1, QLatin1String("a")));
+    cache.setMsgFlags(QLatin1String("a"), 1, QStringList() << QLatin1String("\\Seen"));
+    cache.setUidMapping(QLatin1String("b"), QList<uint>() << 1);
+
+    cache.clearAllMessages(QLatin1String("a"));
+    QVERIFY(!cache.m_uidMapping.contains(QLatin1String("a")));
+    QVERIFY(!cache.m_threading.contains(QLatin1String("a")));
+    QVERIFY(!cache.m_messages.contains(QLatin1String("a")));
+    QVERIFY(cache.m_uidMapping.contains(QLatin1String("b")));
+
+    // Whatever is left is read back from the disk
+    QCOMPARE(cache.messageMetadata(QLatin1String("a"), 1).uid, 0u);
+    QCOMPARE(cache.msgFlags(QLatin1String("a"), 1), QStringList());
+}
+
+/** @short Loading the metadata in the background does not overwrite the data which were written in the meanwhile */
+void ImapThreadedCacheTest::testLoadMetadata()
+{
+    {
+        ThreadedCache cache(0, QLatin1String("test-load-metadata-write"), m_dir);
+        QVERIFY(cache.open());
+        for (uint uid = 1; uid <= 3; ++uid) {
+            cache.setMessageMetadata(QLatin1String("a"), uid, message(uid, QString::number(uid)));
+            cache.setMsgFlags(QLatin1String("a"), uid, QStringList() << QLatin1String("\\Seen"));
+        }
+    }
+
+    ThreadedCache cache(0, QLatin1String("test-load-metadata-read"), m_dir);
+    QVERIFY(cache.open());
+    QSignalSpy spy(&cache, SIGNAL(messageMetadataLoaded(QString,QList<uint>)));
+    QVERIFY(cache.loadMessageMetadata(QLatin1String("a"), QList<uint>() << 1 << 2 << 4));
+    // This one is already on its way
+    QVERIFY(cache.loadMessageMetadata(QLatin1String("a"), QList<uint>() << 2));
+    cache.setMsgFlags(QLatin1String("a"), 2, QStringList() << QLatin1String("\\Answered"));
+    for (int i = 0; i < 500 && spy.isEmpty(); ++i)
+        QTest::qWait(10);
+    QCOMPARE(spy.size(), 1);
+    QCOMPARE(spy[0][0].toString(), QString::fromUtf8("a"));
+
+    const QHash<uint, ThreadedCache::MirroredMessage> &mirror = cache.m_messages[QLatin1String("a")].messages;
+    QVERIFY(mirror[1].hasMetadata);
+    QVERIFY(mirror[1].hasFlags);
+    QVERIFY(mirror[4].hasMetadata);
+    QVERIFY(mirror[4].hasFlags);
+    QVERIFY(cache.m_loadingMetadata.isEmpty());
+    QVERIFY(cache.m_loads.isEmpty());
+    QVERIFY(!cache.loadMessageMetadata(QLatin1String("a"), QList<uint>() << 1 << 4));
+
+    QCOMPARE(cache.messageMetadata(QLatin1String("a"), 1).envelope.subject, QString::fromUtf8("1"));
+    QCOMPARE(cache.msgFlags(QLatin1String("a"), 1), QStringList() << QLatin1String("\\Seen"));
+    QCOMPARE(cache.msgFlags(QLatin1String("a"), 2), QStringList() << QLatin1String("\\Answered"));
+    QCOMPARE(cache.messageMetadata(QLatin1String("a"), 2).envelope.subject, QString::fromUtf8("2"));
+    QCOMPARE(cache.messageMetadata(QLatin1String("a"), 4).uid, 0u);
+    QCOMPARE(cache.msgFlags(QLatin1String("a"), 4), QStringList());
+}
+
+/** @short The part data are delivered through a signal */
+void ImapThreadedCacheTest::testLoadPart()
+{
+    ThreadedCache cache(0, QLatin1String("test-load-part"), m_dir);
+    QVERIFY(cache.open());
+    cache.setMsgPart(QLatin1String("a"), 1, QLatin1String("1"), QByteArray("foo"));
+
+    QSignalSpy spy(&cache, SIGNAL(messagePartLoaded(QString,uint,QString,QByteArray)));
+    QVERIFY(cache.loadMessagePart(QLatin1String("a"), 1, QLatin1String("1")));
+    QVERIFY(cache.loadMessagePart(QLatin1String("a"), 1, QLatin1String("2")));
+    for (int i = 0; i < 500 && spy.size() < 2; ++i)
+        QTest::qWait(10);
+    QCOMPARE(spy.size(), 2);
+    QCOMPARE(spy[0][0].toString(), QString::fromUtf8("a"));
+    QCOMPARE(spy[0][1].toUInt(), 1u);
+    QCOMPARE(spy[0][2].toString(), QString::fromUtf8("1"));
+    QCOMPARE(spy[0][3].toByteArray(), QByteArray("foo"));
+    QCOMPARE(spy[1][2].toString(), QString::fromUtf8("2"));
+    QVERIFY(spy[1][3].toByteArray().isNull());
+}
+
+TROJITA_HEADLESS_TEST(ImapThreadedCacheTest)
@@ -0,0 +1,3 @@
+TARGET = test_Imap_ThreadedCache
+include(../tests.pri)
+QT += sql
@@ -23,10 +23,12 @@
 #include <QtTest>
 #include "test_Imap_Threading.h"
 #include "../headless_test.h"
+#include "Imap/Model/Cache.h"
 #include "Imap/Model/MsgListModel.h"
 #include "Imap/Model/ThreadingMsgListModel.h"
 #include "Streams/FakeSocket.h"
 #include "test_LibMailboxSync/FakeCapabilitiesInjector.h"
+#include "test_LibMailboxSync/ModelEvents.h"
 
 Q_DECLARE_METATYPE(Mapping);
 
@@ -589,6 +591,50 @@ template<typename T> void ImapModelThreadingTest::reverseContainer(T &container)
         container.swap(i, container.size() - 1 - i);
 }
 
+/** @short Wait until the threads which are being built in the background get applied */
+void ImapModelThreadingTest::waitForThreadLayout()
+{
+    for (int i = 0; i < 2000 && threadingModel->m_threadLayoutInFlight; ++i)
+        QTest::qWait(5);
+    QVERIFY(!threadingModel->m_threadLayoutInFlight);
+}
+
+/** @short Put headers of four messages forming two threads into the cache, the way a previous session would have left them */
+void ImapModelThreadingTest::cacheHeadersForLocalThreading()
+{
+    for (uint uid = 1; uid <= 4; ++uid) {
+        Imap::Mailbox::AbstractCache::MessageDataBundle data;
+        data.uid = uid;
+        const bool isReply = uid % 2 == 0;
+        const QByteArray threadRoot = "<thread" + QByteArray::number((uid + 1) / 2) + "@example.org>";
+        data.envelope.subject = QString::fromUtf8(isReply ? "Re: subject %1" : "subject %1").arg((uid + 1) / 2);
+        if (isReply) {
+            data.envelope.messageId = "<reply" + QByteArray::number(uid) + "@example.org>";
+            data.envelope.inReplyTo << threadRoot;
+        } else {
+            data.envelope.messageId = threadRoot;
+        }
+        model->cache()->setMessageMetadata(QLatin1String("a"), uid, data);
+    }
+}
+
+/** @short Wait until the threads computed locally get applied */
+void ImapModelThreadingTest::waitForLocalThreading(const QByteArray &expected)
+{
+    for (int i = 0; i < 400 && treeToThreading(QModelIndex()) != expected; ++i)
+        QTest::qWait(5);
+    QCOMPARE(treeToThreading(QModelIndex()), expected);
+}
+
+/** @short Format the UIDs as a sequence-set which keeps their order */
+static QByteArray uidsInOrder(const QList<uint> &uids)
+{
+    QStringList res;
+    Q_FOREACH(const uint uid, uids)
+        res << QString::number(uid);
+    return res.join(QLatin1String(",")).toUtf8();
+}
+
 /** @short Test how sorting reacts to dynamic mailbox updates and the initial sync */
 void ImapModelThreadingTest::testDynamicSorting()
 {
@@ -1073,6 +1119,93 @@ void ImapModelThreadingTest::testDynamicSearch()
     expectedUidOrder = uidMap;
     checkUidMapFromThreading(expectedUidOrder);
 
+    // Nothing has changed in the mailbox, so the previous result is reused
+    threadingModel->setUserSearchingSortingPreference(QStringList() << QLatin1String("SUBJECT") << QLatin1String("blah"),
+                                                      threadingModel->currentSortCriterium(), threadingModel->currentSortOrder());
+    cEmpty();
+    expectedUidOrder.clear();
+    expectedUidOrder << 9;
+    checkUidMapFromThreading(expectedUidOrder);
+
+    // A refinement of an empty result is empty as well
+    threadingModel->setUserSearchingSortingPreference(QStringList() << QLatin1String("SUBJECT") << QLatin1String("foobarbaz"),
+                                                      threadingModel->currentSortCriterium(), threadingModel->currentSortOrder());
+    cEmpty();
+    expectedUidOrder.clear();
+    checkUidMapFromThreading(expectedUidOrder);
+
+    // The result of a broader search is shown until the server answers
+    threadingModel->setUserSearchingSortingPreference(QStringList() << QLatin1String("SUBJECT") << QLatin1String("blahx"),
+                                                      threadingModel->currentSortCriterium(), threadingModel->currentSortOrder());
+    expectedUidOrder << 9;
+    checkUidMapFromThreading(expectedUidOrder);
+    cClient(t.mk("UID SEARCH RETURN (ALL) CHARSET utf-8 SUBJECT blahx\r\n"));
+    searchTag = t.last();
+    cServer("* ESEARCH (TAG \"" + searchTag + "\") UID\r\n" + t.last("OK searched\r\n"));
+    expectedUidOrder.clear();
+    checkUidMapFromThreading(expectedUidOrder);
+
+    // A search which gets replaced while in flight shall not overwrite the newer result
+    threadingModel->setUserSearchingSortingPreference(QStringList() << QLatin1String("SUBJECT") << QLatin1String("x"),
+                                                      threadingModel->currentSortCriterium(), threadingModel->currentSortOrder());
+    cClient(t.mk("UID SEARCH RETURN (ALL) CHARSET utf-8 SUBJECT x\r\n"));
+    QByteArray staleResponse = "* ESEARCH (TAG \"" + t.last() + "\") UID ALL 6,9\r\n" + t.last("OK searched\r\n");
+    threadingModel->setUserSearchingSortingPreference(QStringList() << QLatin1String("SUBJECT") << QLatin1String("y"),
+                                                      threadingModel->currentSortCriterium(), threadingModel->currentSortOrder());
+    cClient(t.mk("UID SEARCH RETURN (ALL) CHARSET utf-8 SUBJECT y\r\n"));
+    searchTag = t.last();
+    cServer(staleResponse);
+    checkUidMapFromThreading(expectedUidOrder);
+    cServer("* ESEARCH (TAG \"" + searchTag + "\") UID ALL 10\r\n" + t.last("OK searched\r\n"));
+    expectedUidOrder << 10;
+    checkUidMapFromThreading(expectedUidOrder);
+
+    threadingModel->setUserSearchingSortingPreference(QStringList(), threadingModel->currentSortCriterium(), threadingModel->currentSortOrder());
+    expectedUidOrder = uidMap;
+    checkUidMapFromThreading(expectedUidOrder);
+
+    // A new arrival changes the mailbox, so the same query has to go to the server again
+    cServer("* 4 EXISTS\r\n");
+    cClient(t.mk("UID FETCH 15:* (FLAGS)\r\n"));
+    cServer("* 4 FETCH (UID 15 FLAGS ())\r\n" + t.last("ok fetched\r\n"));
+    cServer("* OK [HIGHESTMODSEQ 34] .\r\n");
+    uidMap << 15;
+    expectedUidOrder = uidMap;
+    checkUidMapFromThreading(expectedUidOrder);
+    threadingModel->setUserSearchingSortingPreference(QStringList() << QLatin1String("SUBJECT") << QLatin1String("blah"),
+                                                      threadingModel->currentSortCriterium(), threadingModel->currentSortOrder());
+    cClient(t.mk("UID SEARCH RETURN (ALL) CHARSET utf-8 SUBJECT blah\r\n"));
+    searchTag = t.last();
+    cServer("* ESEARCH (TAG \"" + searchTag + "\") UID ALL 9,15\r\n" + t.last("OK searched\r\n"));
+    expectedUidOrder.clear();
+    expectedUidOrder << 9 << 15;
+    checkUidMapFromThreading(expectedUidOrder);
+
+    // The refinement of a result which was empty before the arrival cannot be answered locally either
+    threadingModel->setUserSearchingSortingPreference(QStringList() << QLatin1String("SUBJECT") << QLatin1String("foobarbaz"),
+                                                      threadingModel->currentSortCriterium(), threadingModel->currentSortOrder());
+    cClient(t.mk("UID SEARCH RETURN (ALL) CHARSET utf-8 SUBJECT foobarbaz\r\n"));
+    searchTag = t.last();
+    cServer("* ESEARCH (TAG \"" + searchTag + "\") UID ALL 15\r\n" + t.last("OK searched\r\n"));
+    expectedUidOrder.clear();
+    expectedUidOrder << 15;
+    checkUidMapFromThreading(expectedUidOrder);
+
+    // A bumped HIGHESTMODSEQ alone invalidates the cached results, too
+    cServer("* OK [HIGHESTMODSEQ 35] .\r\n");
+    threadingModel->setUserSearchingSortingPreference(QStringList() << QLatin1String("SUBJECT") << QLatin1String("blah"),
+                                                      threadingModel->currentSortCriterium(), threadingModel->currentSortOrder());
+    cClient(t.mk("UID SEARCH RETURN (ALL) CHARSET utf-8 SUBJECT blah\r\n"));
+    searchTag = t.last();
+    cServer("* ESEARCH (TAG \"" + searchTag + "\") UID ALL 9\r\n" + t.last("OK searched\r\n"));
+    expectedUidOrder.clear();
+    expectedUidOrder << 9;
+    checkUidMapFromThreading(expectedUidOrder);
+
+    threadingModel->setUserSearchingSortingPreference(QStringList(), threadingModel->currentSortCriterium(), threadingModel->currentSortOrder());
+    expectedUidOrder = uidMap;
+    checkUidMapFromThreading(expectedUidOrder);
+
     // FIXME: check threading & searching combo
     // FIXME: check sorting & searching combo
     // FIXME: check threading & sorting & searching combo
@@ -1127,6 +1260,7 @@ void ImapModelThreadingTest::testThreadingPerformance()
         QCoreApplication::processEvents();
         QCoreApplication::processEvents();
         QCoreApplication::processEvents();
+        waitForThreadLayout();
         model->cache()->setMessageThreading("a", QVector<Imap::Responses::ThreadingNode>());
         threadingModel->wantThreading();
         QCoreApplication::processEvents();
@@ -1182,6 +1316,144 @@ void ImapModelThreadingTest::testSortingPerformance()
     }
 }
 
+/** @short Measure how long it takes to show a large mailbox in the other direction of a sort order which is known already */
+void ImapModelThreadingTest::testResortPerformance()
+{
+    threadingModel->setUserWantsThreading(false);
+
+    using namespace Imap::Mailbox;
+
+    const int num = 200000;
+    initialMessages(num);
+
+    FakeCapabilitiesInjector injector(model);
+    injector.injectCapability("SORT");
+
+    // Interleave the messages from both halves of the mailbox, so that the result is nowhere near the UID order
+    QStringList sortOrder;
+    QList<uint> expectedUidOrder;
+    // Another result of a similar shape, with the pairs swapped
+    QList<uint> otherUidOrder;
+    for (int i = 0; i < num / 2; ++i) {
+        sortOrder << QString::number(num / 2 + 1 + i) << QString::number(i + 1);
+        expectedUidOrder << num / 2 + 1 + i << i + 1;
+        otherUidOrder << i + 1 << num / 2 + 1 + i;
+    }
+    threadingModel->setUserSearchingSortingPreference(QStringList(), ThreadingMsgListModel::SORT_SUBJECT, Qt::AscendingOrder);
+    cClient(t.mk("UID SORT (SUBJECT) utf-8 ALL\r\n"));
+    cServer(("* SORT " + sortOrder.join(QLatin1String(" ")) + "\r\n").toUtf8() + t.last("OK sorted\r\n"));
+    QCOMPARE(threadingModel->rowCount(), num);
+    QCOMPARE(threadingModel->index(0, 0).data(RoleMessageUid).toUInt(), expectedUidOrder.first());
+    QCOMPARE(threadingModel->index(num - 1, 0).data(RoleMessageUid).toUInt(), expectedUidOrder.last());
+
+    // Each iteration applies a brand new result, the way a fresh SORT response does, so the UIDs have to be looked up again
+    bool flag = false;
+    QBENCHMARK {
+        threadingModel->m_currentSortResult = flag ? expectedUidOrder : otherUidOrder;
+        threadingModel->applySort();
+        flag = !flag;
+    }
+    QCOMPARE(threadingModel->rowCount(), num);
+    QCOMPARE(threadingModel->index(0, 0).data(RoleMessageUid).toUInt(),
+             flag ? otherUidOrder.first() : expectedUidOrder.first());
+    threadingModel->m_currentSortResult = expectedUidOrder;
+    threadingModel->applySort();
+    cEmpty();
+
+    // Flipping the direction does not need any lookups at all
+    QBENCHMARK {
+        threadingModel->setUserSearchingSortingPreference(QStringList(), ThreadingMsgListModel::SORT_SUBJECT,
+                                                          flag ? Qt::AscendingOrder : Qt::DescendingOrder);
+        flag = !flag;
+    }
+    cEmpty();
+
+    // The direction has to match the last request, no matter how many times the benchmark has run
+    threadingModel->setUserSearchingSortingPreference(QStringList(), ThreadingMsgListModel::SORT_SUBJECT, Qt::DescendingOrder);
+    QCOMPARE(threadingModel->index(0, 0).data(RoleMessageUid).toUInt(), expectedUidOrder.last());
+    QCOMPARE(threadingModel->index(num - 1, 0).data(RoleMessageUid).toUInt(), expectedUidOrder.first());
+    cEmpty();
+}
+
+/** @short Measure the speed of walking a huge thread forest through the MVC API, which is what the views do all the time */
+void ImapModelThreadingTest::testIndexPerformance()
+{
+    const uint num = 200000;
+    initialMessages(num);
+    QString response = QLatin1String("* THREAD ");
+    for (uint i = 1; i < num; i += 10) {
+        response += QString::fromUtf8("(%1 (%2 %3 (%4)(%5 %6 %7))(%8 %9 %10))").arg(
+                    QString::number(i), QString::number(i+1), QString::number(i+2), QString::number(i+3),
+                    QString::number(i+4), QString::number(i+5), QString::number(i+6), QString::number(i+7),
+                    QString::number(i+8)).arg(QString::number(i+9));
+    }
+    response += QLatin1String("\r\n");
+    cClient(t.mk("UID THREAD REFS utf-8 ALL\r\n"));
+    cServer(response.toUtf8() + t.last("OK thread\r\n"));
+    waitForThreadLayout();
+    QCOMPARE(threadingModel->rowCount(QModelIndex()), static_cast<int>(num / 10));
+
+    QBENCHMARK {
+        uint seen = 0;
+        QList<QModelIndex> pending;
+        pending << QModelIndex();
+        while (!pending.isEmpty()) {
+            const QModelIndex parent = pending.takeLast();
+            const int rows = threadingModel->rowCount(parent);
+            for (int row = 0; row < rows; ++row) {
+                const QModelIndex index = threadingModel->index(row, 0, parent);
+                if (threadingModel->parent(index) != parent)
+                    QFAIL("Broken parent()");
+                if (index.data(Imap::Mailbox::RoleMessageUid).toUInt())
+                    ++seen;
+                index.data(Imap::Mailbox::RoleMessageIsMarkedRead);
+                if (threadingModel->hasChildren(index))
+                    pending << index;
+            }
+        }
+        QCOMPARE(seen, num);
+    }
+}
+
+/** @short Benchmark the part of the background threading which runs in the GUI thread */
+void ImapModelThreadingTest::testThreadLayoutSwapPerformance()
+{
+    const uint num = 100000;
+    threadingModel->m_backgroundLayoutThreshold = 1;
+    initialMessages(num);
+    QString response = QLatin1String("* THREAD ");
+    for (uint i = 1; i < num; i += 10) {
+        response += QString::fromUtf8("(%1 (%2 %3 (%4)(%5 %6 %7))(%8 %9 %10))").arg(
+                    QString::number(i), QString::number(i+1), QString::number(i+2), QString::number(i+3),
+                    QString::number(i+4), QString::number(i+5), QString::number(i+6), QString::number(i+7),
+                    QString::number(i+8)).arg(QString::number(i+9));
+    }
+    response += QLatin1String("\r\n");
+    cClient(t.mk("UID THREAD REFS utf-8 ALL\r\n"));
+    cServer(response.toUtf8() + t.last("OK thread\r\n"));
+    waitForThreadLayout();
+    QCOMPARE(threadingModel->rowCount(QModelIndex()), static_cast<int>(num / 10));
+
+    // The other tree shows all messages as standalone threads
+    QVector<Imap::Responses::ThreadingNode> flat;
+    flat.reserve(num);
+    for (uint i = 1; i <= num; ++i)
+        flat << Imap::Responses::ThreadingNode(i);
+    Imap::Mailbox::ThreadLayoutRequest request;
+    threadingModel->snapshotThreadLayout(flat, request);
+    Imap::Mailbox::ThreadingMsgListModel::buildThreadLayout(&request);
+
+    // Each swap leaves the replaced tree in the request, so swapping twice gets us back where we started
+    QBENCHMARK {
+        threadingModel->swapInThreadLayout(request);
+        QCOMPARE(threadingModel->rowCount(QModelIndex()), static_cast<int>(num));
+        threadingModel->swapInThreadLayout(request);
+    }
+    QCOMPARE(threadingModel->rowCount(QModelIndex()), static_cast<int>(num / 10));
+    QCOMPARE(findItem("0.0.0.0").data(Imap::Mailbox::RoleMessageUid).toUInt(), 4u);
+    cEmpty();
+}
+
 /** @short Test that the INCTHREAD extension works as advertized */
 void ImapModelThreadingTest::testIncrementalThreading()
 {
@@ -1222,6 +1494,67 @@ void ImapModelThreadingTest::testIncrementalThreading()
     cEmpty();
 }
 
+/** @short Make sure that rebuilding the threads from scratch leads to the same tree as the incremental update did */
+void ImapModelThreadingTest::verifyFullRebuildMatches()
+{
+    const QByteArray incremental = treeToThreading(QModelIndex());
+    threadingModel->m_threadingApplied = false;
+    threadingModel->applyThreading(model->cache()->messageThreading(QLatin1String("a")));
+    QCOMPARE(treeToThreading(QModelIndex()), incremental);
+}
+
+/** @short New arrivals are moved to their place in the threads, the rest of the tree is left alone */
+void ImapModelThreadingTest::testIncrementalArrivals()
+{
+    initialMessages(4);
+    cClient(t.mk("UID THREAD REFS utf-8 ALL\r\n"));
+    cServer(QByteArray("* THREAD (1 2)(3)(4)\r\n") + t.last("OK thread\r\n"));
+    QCOMPARE(treeToThreading(QModelIndex()), QByteArray("(1 2)(3)(4)"));
+    QPersistentModelIndex msg2 = findItem("0.0");
+    QCOMPARE(msg2.data(Imap::Mailbox::RoleMessageUid).toUInt(), 2u);
+
+    qRegisterMetaType<QModelIndex>("QModelIndex");
+    QSignalSpy layoutChanged(threadingModel, SIGNAL(layoutChanged()));
+    QSignalSpy rowsInserted(threadingModel, SIGNAL(rowsInserted(QModelIndex,int,int)));
+    QSignalSpy rowsMoved(threadingModel, SIGNAL(rowsMoved(QModelIndex,int,int,QModelIndex,int)));
+
+    // A reply to the message #2 arrives; at first it shows up as a new thread
+    cServer("* 5 EXISTS\r\n");
+    cClient(t.mk("UID FETCH 5:* (FLAGS)\r\n"));
+    cServer("* 5 FETCH (UID 5 FLAGS ())\r\n" + t.last("OK fetch\r\n"));
+    QCOMPARE(rowsInserted.size(), 1);
+    QCOMPARE(treeToThreading(QModelIndex()), QByteArray("(1 2)(3)(4)(5)"));
+
+    // The THREAD response moves it below its parent
+    cClient(t.mk("UID THREAD REFS utf-8 ALL\r\n"));
+    cServer(QByteArray("* THREAD (1 2 5)(3)(4)\r\n") + t.last("OK thread\r\n"));
+    QCOMPARE(treeToThreading(QModelIndex()), QByteArray("(1 2 5)(3)(4)"));
+    QCOMPARE(rowsMoved.size(), 1);
+    QCOMPARE(rowsMoved[0][0].value<QModelIndex>(), QModelIndex());
+    QCOMPARE(rowsMoved[0][1].toInt(), 3);
+    QCOMPARE(QPersistentModelIndex(rowsMoved[0][3].value<QModelIndex>()), msg2);
+    QCOMPARE(rowsMoved[0][4].toInt(), 0);
+    QCOMPARE(layoutChanged.size(), 0);
+    QCOMPARE(findItem("0.0.0").data(Imap::Mailbox::RoleMessageUid).toUInt(), 5u);
+    rowsInserted.clear();
+    rowsMoved.clear();
+
+    // A message which starts a new thread stays where it is
+    cServer("* 6 EXISTS\r\n");
+    cClient(t.mk("UID FETCH 6:* (FLAGS)\r\n"));
+    cServer("* 6 FETCH (UID 6 FLAGS ())\r\n" + t.last("OK fetch\r\n"));
+    QCOMPARE(rowsInserted.size(), 1);
+    cClient(t.mk("UID THREAD REFS utf-8 ALL\r\n"));
+    cServer(QByteArray("* THREAD (1 2 5)(3)(4)(6)\r\n") + t.last("OK thread\r\n"));
+    QCOMPARE(treeToThreading(QModelIndex()), QByteArray("(1 2 5)(3)(4)(6)"));
+    QCOMPARE(rowsMoved.size(), 0);
+    QCOMPARE(layoutChanged.size(), 0);
+    cEmpty();
+
+    verifyFullRebuildMatches();
+    cEmpty();
+}
+
 /** Test what happens when a thread root ceases to exist while the THREAD response is in flight */
 void ImapModelThreadingTest::testRemovingRootWithThreadingInFlight()
 {
@@ -1269,4 +1602,298 @@ void ImapModelThreadingTest::testRemovingRootWithThreadingInFlight()
     cEmpty();
 }
 
+/** @short Test which messages remain visible when the read ones are hidden */
+void ImapModelThreadingTest::testHideRead()
+{
+    // Only the message #9 is unread
+    initialMessages(10);
+
+    Mapping mapping;
+    QByteArray response;
+    complexMapping(mapping, response);
+    cClient(t.mk("UID THREAD REFS utf-8 ALL\r\n"));
+    cServer(QByteArray("* THREAD ") + response + QByteArray("\r\n") + t.last("OK thread\r\n"));
+    QCOMPARE(treeToThreading(QModelIndex()), QByteArray("(1)(2 3)(4 (5)(6))(7 (8)(9 10))"));
+
+    // The whole thread with an unread message is visible, nothing else is
+    QVERIFY(!threadingModel->isVisibleWhenHidingRead(0, QModelIndex()));
+    QVERIFY(!threadingModel->isVisibleWhenHidingRead(1, QModelIndex()));
+    QVERIFY(!threadingModel->isVisibleWhenHidingRead(0, findItem("1")));
+    QVERIFY(!threadingModel->isVisibleWhenHidingRead(2, QModelIndex()));
+    QVERIFY(threadingModel->isVisibleWhenHidingRead(3, QModelIndex()));
+    QVERIFY(threadingModel->isVisibleWhenHidingRead(0, findItem("3")));
+    QVERIFY(threadingModel->isVisibleWhenHidingRead(1, findItem("3")));
+    QVERIFY(threadingModel->isVisibleWhenHidingRead(0, findItem("3.1")));
+    QVERIFY(findItem("3").data(Imap::Mailbox::RoleThreadRootWithUnreadMessages).toBool());
+
+    // Once the message gets read, it shall not disappear from under the user's hands, and neither shall its replies
+    cServer("* 9 FETCH (FLAGS (\\Seen))\r\n");
+    QVERIFY(!threadingModel->isVisibleWhenHidingRead(3, QModelIndex()));
+    QVERIFY(!threadingModel->isVisibleWhenHidingRead(0, findItem("3")));
+    QVERIFY(threadingModel->isVisibleWhenHidingRead(1, findItem("3")));
+    QVERIFY(threadingModel->isVisibleWhenHidingRead(0, findItem("3.1")));
+    QVERIFY(!findItem("3").data(Imap::Mailbox::RoleThreadRootWithUnreadMessages).toBool());
+
+    // A message which becomes unread brings its whole thread back
+    cServer("* 2 FETCH (FLAGS ())\r\n");
+    QVERIFY(threadingModel->isVisibleWhenHidingRead(1, QModelIndex()));
+    QVERIFY(threadingModel->isVisibleWhenHidingRead(0, findItem("1")));
+    QVERIFY(!threadingModel->isVisibleWhenHidingRead(0, QModelIndex()));
+    QVERIFY(!threadingModel->isVisibleWhenHidingRead(2, QModelIndex()));
+    cEmpty();
+}
+
+/** @short Test that the threads built in the background replace the flat list along with the persistent indexes */
+void ImapModelThreadingTest::testBackgroundThreading()
+{
+    // Pretend that even this tiny mailbox is a huge one
+    threadingModel->m_backgroundLayoutThreshold = 1;
+    initialMessages(10);
+    QCOMPARE(threadingModel->rowCount(QModelIndex()), 10);
+    QPersistentModelIndex lastMessage = threadingModel->index(9, 0);
+    QCOMPARE(lastMessage.data(Imap::Mailbox::RoleMessageUid).toUInt(), 10u);
+
+    Mapping mapping;
+    QByteArray response;
+    complexMapping(mapping, response);
+    cClient(t.mk("UID THREAD REFS utf-8 ALL\r\n"));
+    cServer(QByteArray("* THREAD ") + response + QByteArray("\r\n") + t.last("OK thread\r\n"));
+    waitForThreadLayout();
+    verifyMapping(mapping);
+    verifyIndexMap(buildIndexMap(mapping), mapping);
+    QCOMPARE(treeToThreading(QModelIndex()), QByteArray("(1)(2 3)(4 (5)(6))(7 (8)(9 10))"));
+
+    // The message has moved deep into its thread, and the persistent index has followed it
+    QVERIFY(lastMessage.isValid());
+    QVERIFY(lastMessage.parent().isValid());
+    QCOMPARE(lastMessage.data(Imap::Mailbox::RoleMessageUid).toUInt(), 10u);
+    cEmpty();
+}
+
+/** @short The tree built from a snapshot is not applied when the messages have changed in the meanwhile */
+void ImapModelThreadingTest::testBackgroundThreadingMessagesChanged()
+{
+    using Imap::Responses::ThreadingNode;
+    threadingModel->m_backgroundLayoutThreshold = 1;
+    initialMessages(4);
+    cClient(t.mk("UID THREAD REFS utf-8 ALL\r\n"));
+    cServer(QByteArray("* THREAD (1)(2)(3)(4)\r\n") + t.last("OK thread\r\n"));
+    waitForThreadLayout();
+    QCOMPARE(treeToThreading(QModelIndex()), QByteArray("(1)(2)(3)(4)"));
+
+    // (1 2 3)(4)
+    QVector<ThreadingNode> mapping;
+    mapping << ThreadingNode(1, QVector<ThreadingNode>() << ThreadingNode(2, QVector<ThreadingNode>() << ThreadingNode(3)))
+            << ThreadingNode(4);
+
+    // Take the snapshot by hand, so that the worker cannot finish before the mailbox changes
+    Imap::Mailbox::ThreadLayoutRequest *request = new Imap::Mailbox::ThreadLayoutRequest();
+    threadingModel->snapshotThreadLayout(mapping, *request);
+    Imap::Mailbox::ThreadingMsgListModel::buildThreadLayout(request);
+    threadingModel->m_threadLayoutInFlight = true;
+
+    // The tree which is being built refers to this message
+    cServer("* 4 EXPUNGE\r\n");
+    QCOMPARE(treeToThreading(QModelIndex()), QByteArray("(1)(2)(3)"));
+
+    // The finished tree is thrown away and built once again from the current messages
+    threadingModel->slotThreadLayoutAvailable(request);
+    waitForThreadLayout();
+    QCOMPARE(treeToThreading(QModelIndex()), QByteArray("(1 2 3)"));
+    QCOMPARE(threadingModel->rowCount(QModelIndex()), 1);
+    cEmpty();
+}
+
+/** @short Only the most recent THREAD response is built once the worker is done with the current one */
+void ImapModelThreadingTest::testBackgroundThreadingCoalescing()
+{
+    using Imap::Responses::ThreadingNode;
+    threadingModel->m_backgroundLayoutThreshold = 1;
+    initialMessages(4);
+    cClient(t.mk("UID THREAD REFS utf-8 ALL\r\n"));
+    cServer(QByteArray("* THREAD (1)(2)(3)(4)\r\n") + t.last("OK thread\r\n"));
+    waitForThreadLayout();
+    QCOMPARE(treeToThreading(QModelIndex()), QByteArray("(1)(2)(3)(4)"));
+
+    // (1 2)(3)(4)
+    QVector<ThreadingNode> first;
+    first << ThreadingNode(1, QVector<ThreadingNode>() << ThreadingNode(2)) << ThreadingNode(3) << ThreadingNode(4);
+    // (1)(2)(3 4)
+    QVector<ThreadingNode> second;
+    second << ThreadingNode(1) << ThreadingNode(2) << ThreadingNode(3, QVector<ThreadingNode>() << ThreadingNode(4));
+
+    QSignalSpy layoutChanged(threadingModel, SIGNAL(layoutChanged()));
+
+    // Make sure that the whole tree gets built in the background each time
+    threadingModel->m_threadingApplied = false;
+    threadingModel->applyThreading(first);
+    QVERIFY(threadingModel->m_threadLayoutInFlight);
+    // No events have been processed, so the worker cannot have delivered its result yet
+    threadingModel->applyThreading(second);
+    QVERIFY(threadingModel->m_hasPendingThreadLayout);
+
+    waitForThreadLayout();
+    QVERIFY(!threadingModel->m_hasPendingThreadLayout);
+    QCOMPARE(treeToThreading(QModelIndex()), QByteArray("(1)(2)(3 4)"));
+    // The first tree has never made it to the GUI
+    QCOMPARE(layoutChanged.size(), 1);
+    cEmpty();
+}
+
+/** @short Without the THREAD capability, the threads are computed from the headers known to the cache */
+void ImapModelThreadingTest::testLocalThreadingWithoutServerSupport()
+{
+    FakeCapabilitiesInjector injector(model);
+    injector.removeCapability(QLatin1String("THREAD=REFS"));
+    initialMessages(4);
+    cacheHeadersForLocalThreading();
+    QCOMPARE(threadingModel->rowCount(QModelIndex()), 4);
+
+    // No THREAD command at all
+    waitForLocalThreading("(1 2)(3 4)");
+    cEmpty();
+}
+
+/** @short When the server refuses the THREAD command, the local threading takes over */
+void ImapModelThreadingTest::testLocalThreadingAfterFailure()
+{
+    initialMessages(4);
+    cacheHeadersForLocalThreading();
+    cClient(t.mk("UID THREAD REFS utf-8 ALL\r\n"));
+    cServer(t.last("NO threading is not available right now\r\n"));
+    waitForLocalThreading("(1 2)(3 4)");
+    cEmpty();
+}
+
+/** @short A THREAD command which takes too long is not waited for */
+void ImapModelThreadingTest::testLocalThreadingAfterTimeout()
+{
+    threadingModel->m_threadingTimeout->setInterval(50);
+    initialMessages(4);
+    cacheHeadersForLocalThreading();
+    cClient(t.mk("UID THREAD REFS utf-8 ALL\r\n"));
+    QVERIFY(threadingModel->threadingInFlight);
+
+    // The server is silent, yet the threads show up
+    waitForLocalThreading("(1 2)(3 4)");
+    QVERIFY(threadingModel->threadingInFlight);
+
+    // The response which arrives late still wins
+    cServer(QByteArray("* THREAD (1 (2)(3))(4)\r\n") + t.last("OK thread\r\n"));
+    QVERIFY(!threadingModel->threadingInFlight);
+    QCOMPARE(treeToThreading(QModelIndex()), QByteArray("(1 (2)(3))(4)"));
+    cEmpty();
+}
+
+/** @short Large mailboxes get their SORT result in windows, starting with the first screenful */
+void ImapModelThreadingTest::testSortWindows()
+{
+    threadingModel->setUserWantsThreading(false);
+    const uint num = 300;
+    initialMessages(num);
+    FakeCapabilitiesInjector injector(model);
+    injector.injectCapability("SORT");
+    injector.injectCapability("ESORT");
+    injector.injectCapability("CONTEXT=SORT");
+
+    // Sorted by subject, the messages happen to come in the reversed order of their UIDs
+    QList<uint> expectedUidOrder;
+    for (uint uid = num; uid > 0; --uid)
+        expectedUidOrder << uid;
+
+    threadingModel->setUserSearchingSortingPreference(QStringList(), Imap::Mailbox::ThreadingMsgListModel::SORT_SUBJECT);
+    cClient(t.mk("UID SORT RETURN (PARTIAL 1:200 COUNT UPDATE) (SUBJECT) utf-8 ALL\r\n"));
+    QByteArray sortTag(t.last());
+    cServer("* ESEARCH (TAG \"" + sortTag + "\") UID PARTIAL (1:200 " + uidsInOrder(expectedUidOrder.mid(0, 200)) +
+            ") COUNT 300\r\n" + t.last("OK sorted\r\n"));
+    checkUidMapFromThreading(expectedUidOrder.mid(0, 200));
+    QCOMPARE(threadingModel->m_sortResultTotal, 300);
+    QVERIFY(threadingModel->canFetchMore(QModelIndex()));
+    cEmpty();
+
+    // Changes past the known beginning of the result only affect the total number of results
+    cServer("* 301 EXISTS\r\n* ESEARCH (TAG \"" + sortTag + "\") UID ADDTO (250 301)\r\n");
+    cClient(t.mk("UID FETCH 301:* (FLAGS)\r\n"));
+    cServer("* 301 FETCH (UID 301 FLAGS ())\r\n" + t.last("OK fetched\r\n"));
+    QCOMPARE(threadingModel->m_currentSortResult, expectedUidOrder.mid(0, 200));
+    QCOMPARE(threadingModel->m_sortResultTotal, 301);
+    cServer("* ESEARCH (TAG \"" + sortTag + "\") UID REMOVEFROM (251 301)\r\n* 301 EXPUNGE\r\n");
+    QCOMPARE(threadingModel->m_currentSortResult, expectedUidOrder.mid(0, 200));
+    QCOMPARE(threadingModel->m_sortResultTotal, 300);
+    checkUidMapFromThreading(expectedUidOrder.mid(0, 200));
+    cEmpty();
+
+    // Scrolling to the end asks for the next window
+    threadingModel->fetchMore(QModelIndex());
+    QVERIFY(!threadingModel->canFetchMore(QModelIndex()));
+    cClient(t.mk("UID SORT RETURN (PARTIAL 201:400) (SUBJECT) utf-8 ALL\r\n"));
+    cServer("* ESEARCH (TAG \"" + t.last() + "\") UID PARTIAL (201:400 " + uidsInOrder(expectedUidOrder.mid(200)) + ")\r\n"
+            + t.last("OK sorted\r\n"));
+    checkUidMapFromThreading(expectedUidOrder);
+    QCOMPARE(threadingModel->m_sortResultTotal, 300);
+    QVERIFY(!threadingModel->canFetchMore(QModelIndex()));
+    cEmpty();
+}
+
+/** @short The windows are taken from the beginning, so the descending order is left to the server */
+void ImapModelThreadingTest::testSortWindowsReversed()
+{
+    threadingModel->setUserWantsThreading(false);
+    const uint num = 300;
+    initialMessages(num);
+    FakeCapabilitiesInjector injector(model);
+    injector.injectCapability("SORT");
+    injector.injectCapability("ESORT");
+    injector.injectCapability("CONTEXT=SORT");
+
+    QList<uint> ascending;
+    for (uint uid = num; uid > 0; --uid)
+        ascending << uid;
+    QList<uint> descending = ascending;
+    reverseContainer(descending);
+
+    threadingModel->setUserSearchingSortingPreference(QStringList(), Imap::Mailbox::ThreadingMsgListModel::SORT_SUBJECT,
+                                                      Qt::DescendingOrder);
+    cClient(t.mk("UID SORT RETURN (PARTIAL 1:200 COUNT UPDATE) (REVERSE SUBJECT) utf-8 ALL\r\n"));
+    QByteArray sortTag(t.last());
+    cServer("* ESEARCH (TAG \"" + sortTag + "\") UID PARTIAL (1:200 " + uidsInOrder(descending.mid(0, 200)) +
+            ") COUNT 300\r\n" + t.last("OK sorted\r\n"));
+    // The server has reversed the result already, so it is shown as-is
+    checkUidMapFromThreading(descending.mid(0, 200));
+    cEmpty();
+
+    // Turning the partial result around locally would show the wrong messages, so the server is asked again
+    threadingModel->setUserSearchingSortingPreference(QStringList(), Imap::Mailbox::ThreadingMsgListModel::SORT_SUBJECT,
+                                                      Qt::AscendingOrder);
+    QByteArray cancelReq = t.mk("CANCELUPDATE \"" + sortTag + "\"\r\n");
+    QByteArray cancelResponse = t.last("OK no more updates for you\r\n");
+    cClient(cancelReq + t.mk("UID SORT RETURN (PARTIAL 1:200 COUNT UPDATE) (SUBJECT) utf-8 ALL\r\n"));
+    sortTag = t.last();
+    cServer("* ESEARCH (TAG \"" + sortTag + "\") UID PARTIAL (1:200 " + uidsInOrder(ascending.mid(0, 200)) +
+            ") COUNT 300\r\n" + cancelResponse + t.last("OK sorted\r\n"));
+    checkUidMapFromThreading(ascending.mid(0, 200));
+    cEmpty();
+}
+
+/** @short Without CONTEXT=SORT, there are no windows and the whole result is requested */
+void ImapModelThreadingTest::testSortWindowsWithoutContext()
+{
+    threadingModel->setUserWantsThreading(false);
+    const uint num = 300;
+    initialMessages(num);
+    FakeCapabilitiesInjector injector(model);
+    injector.injectCapability("SORT");
+
+    QList<uint> expectedUidOrder;
+    for (uint uid = num; uid > 0; --uid)
+        expectedUidOrder << uid;
+
+    threadingModel->setUserSearchingSortingPreference(QStringList(), Imap::Mailbox::ThreadingMsgListModel::SORT_SUBJECT);
+    cClient(t.mk("UID SORT (SUBJECT) utf-8 ALL\r\n"));
+    cServer("* SORT " + numListToString(expectedUidOrder) + "\r\n" + t.last("OK sorted\r\n"));
+    checkUidMapFromThreading(expectedUidOrder);
+    QVERIFY(!threadingModel->canFetchMore(QModelIndex()));
+    cEmpty();
+}
+
 TROJITA_HEADLESS_TEST( ImapModelThreadingTest )
@@ -40,11 +40,25 @@ private slots:
     void testThreadDeletionsAdditions_data();
     void testDynamicSorting();
     void testDynamicSortingContext();
+    void testSortWindows();
+    void testSortWindowsReversed();
+    void testSortWindowsWithoutContext();
     void testDynamicSearch();
     void testIncrementalThreading();
+    void testIncrementalArrivals();
     void testRemovingRootWithThreadingInFlight();
+    void testHideRead();
+    void testBackgroundThreading();
+    void testBackgroundThreadingMessagesChanged();
+    void testBackgroundThreadingCoalescing();
+    void testLocalThreadingWithoutServerSupport();
+    void testLocalThreadingAfterFailure();
+    void testLocalThreadingAfterTimeout();
     void testThreadingPerformance();
     void testSortingPerformance();
+    void testResortPerformance();
+    void testIndexPerformance();
+    void testThreadLayoutSwapPerformance();
 protected slots:
     virtual void init();
 private:
@@ -59,6 +73,11 @@ private:
     QByteArray numListToString(const QList<uint> &seq);
 
     template<typename T> void reverseContainer(T &container);
+
+    void waitForThreadLayout();
+    void verifyFullRebuildMatches();
+    void cacheHeadersForLocalThreading();
+    void waitForLocalThreading(const QByteArray &expected);
 };
 
 #endif
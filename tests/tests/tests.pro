@@ -13,6 +13,13 @@ SUBDIRS  = \
     test_Imap_SelectedMailboxUpdates \
     test_Imap_DisappearingMailboxes \
     test_Imap_Threading \
+    test_Imap_LocalThreading \
+    test_Imap_LocalSorting \
+    test_Imap_MemoryCache \
+    test_Imap_ThreadedCache \
+    test_Imap_SQLCache \
+    test_Imap_PackPartCache \
+    test_Imap_BackgroundSync \
     test_Composer_responses \
     test_Html_formatting \
     test_Rfc5322 \